@@ -15,43 +15,109 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <assert.h>
+#include <time.h>
 
 
 
-void icmp_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface){
+void icmp_processPacket(struct sr_instance* sr, pkt_buf_t* pkt, int port){
+	const uint8_t* packet = pkt->data;
+	unsigned int len = pkt->len;
 	icmp_header_t* icmp_hdr = icmp_getHeader(packet);
-	printf("\n\n\tICMP Header: ");
-	printf("\n\t\tType: %d", icmp_hdr->icmp_type);
-	printf("\n\t\tCode: %d", icmp_hdr->icmp_code);
-	printf("\n\t\tChecksum: %04X", icmp_hdr->icmp_sum);
-	printf("\n\n");
+	Debug("\n\n\tICMP Header: ");
+	Debug("\n\t\tType: %d", icmp_hdr->icmp_type);
+	Debug("\n\t\tCode: %d", icmp_hdr->icmp_code);
+	Debug("\n\t\tChecksum: %04X", icmp_hdr->icmp_sum);
+	Debug("\n\n");
 	
 	if (icmp_hdr->icmp_type == ICMP_TYPE_ECHO_REQUEST){
-		printf("\n\t\tICMP Type: Echo Request, sending reply ...");
-		icmp_sendPacket(sr, packet, len, ICMP_TYPE_ECHO_REPLY, ICMP_CODE_ECHO);
+		Debug("\n\t\tICMP Type: Echo Request, sending reply ...");
+		icmp_echoReply(sr, pkt, port);
 	}
 	if (icmp_hdr->icmp_type == ICMP_TYPE_ECHO_REPLY){
-		printf("\n\t\tICMP Type: Echo Reply, processing reply ...");
+		Debug("\n\t\tICMP Type: Echo Reply, processing reply ...");
 		icmp_processEchoReply(sr, packet, len);
 	}
 }
 
 
+/**
+ * answer an echo request with the frame it came in: addresses swapped, type
+ * flipped, the checksums patched for the words that change, and back out of
+ * the ingress port to the host or router that handed it to us. No lookup,
+ * allocation or copy.
+ * Threadsafe, the caller keeps its reference to pkt
+ *
+ * @returns 0 on success, 1 if the request was dropped
+ */
+int icmp_echoReply(struct sr_instance* sr, pkt_buf_t* pkt, int port){
+	router_t* router = sr_get_subsystem(sr);
+	eth_header_t* eth = (eth_header_t*) pkt->data;
+	ip_header_t* ip_hdr = ip_getHeader(pkt->data);
+	icmp_header_t* icmp_hdr = icmp_getHeader(pkt->data);
+	
+	/*
+	 * the echo header (type, code, checksum, id, sequence) must be there
+	 */
+	unsigned int ip_len = ntohs(ip_hdr->ip_len);
+	if (ip_len < sizeof(ip_header_t) + sizeof(icmp_header_t) + 4 || ETH_HDR_LEN + ip_len > pkt->len) {
+		return 1;
+	}
+	
+	if (!icmp_limitAllow(router->icmp_limit, ICMP_LIMIT_ECHO_REPLY, ip_hdr->ip_src.s_addr)) {
+		return 1;
+	}
+	
+	/*
+	 * type shares its word with the code
+	 */
+	uint16_t old_word = htons((icmp_hdr->icmp_type << 8) | icmp_hdr->icmp_code);
+	icmp_hdr->icmp_type = ICMP_TYPE_ECHO_REPLY;
+	uint16_t new_word = htons((icmp_hdr->icmp_type << 8) | icmp_hdr->icmp_code);
+	icmp_hdr->icmp_sum = ip_checksumAdjust(icmp_hdr->icmp_sum, old_word, new_word);
+	
+	/*
+	 * swapping the addresses leaves the sum alone, the ttl of the request
+	 * says nothing about the way back
+	 */
+	struct in_addr addr = ip_hdr->ip_src;
+	ip_hdr->ip_src = ip_hdr->ip_dst;
+	ip_hdr->ip_dst = addr;
+	ip_setTtl(ip_hdr, IP_DEFAULT_TTL);
+	
+	memcpy(eth->d_addr, eth->s_addr, ETH_ADDR_LEN);
+	memcpy(eth->s_addr, router->if_list[port].addr, ETH_ADDR_LEN);
+	
+	/*
+	 * trailing padding of the request is not ours to echo
+	 */
+	pkt->len = ETH_HDR_LEN + ip_len;
+	
+	return router_sendPacket(sr, pkt, port) < 0;
+}
+
 icmp_header_t* icmp_getHeader(const uint8_t* packet){
 	icmp_header_t* icmp_hdr = (icmp_header_t*) &packet[sizeof(ip_header_t) + sizeof(eth_header_t)];
 	return icmp_hdr;
 }
 
 /**
- * This method is NOT thread safe, accesses rtable (which currently is locking itself),
- * ARP cache, and potentially ARP queue
+ * Threadsafe, the route and ARP lookups are lock free; the ARP queue is
+ * locked on the way if the next hop is unresolved
  *
  * @returns 0 on success, 1 on failure
  */
 int icmp_sendPacket(struct sr_instance* sr, const uint8_t* src_packet, unsigned int len, uint8_t icmp_type, uint8_t icmp_code){
-	printf("\n sending ICMP packet type = %d, code = %d, len = %d\n", icmp_type, icmp_code, len);
 	router_t* router = sr_get_subsystem(sr);
 	
+	/*
+	 * over the limit of its type/code: drop before doing any work
+	 */
+	if (!icmp_limitAllow(router->icmp_limit, icmp_limitClass(icmp_type, icmp_code), ip_getHeader(src_packet)->ip_src.s_addr)) {
+		return 1;
+	}
+	Debug("\n sending ICMP packet type = %d, code = %d, len = %d\n", icmp_type, icmp_code, len);
+	
 	int new_packet_len;
 	int icmp_payload_len;
 	
@@ -63,33 +129,38 @@ int icmp_sendPacket(struct sr_instance* sr, const uint8_t* src_packet, unsigned
 		icmp_payload_len = 4 + sizeof(ip_header_t) + 8;
 	}
 	
-	uint8_t* new_packet = (uint8_t*)malloc(new_packet_len);
-	
-	bzero(new_packet, new_packet_len);
-	
-	eth_header_t* new_eth = (eth_header_t*) new_packet;
 	ip_header_t* ip_hdr = ip_getHeader(src_packet);
-	ip_header_t* new_ip = ip_getHeader(new_packet);
-	icmp_header_t* new_icmp = icmp_getHeader(new_packet);
 	
 	struct in_addr next_hop;
 	int next_hop_ifIndex = 0;
 	
 	/* 
-	 * Check that we have a next hop, and if so get the next hop IP, and outgoing interface name 
+	 * Check that we have a next hop, and if so get the next hop IP, and outgoing port 
 	 */
 	if (rtable_nextHop(router, &ip_hdr->ip_src, &next_hop, &next_hop_ifIndex)){
 		printf("\nFailure getting next hop address");
 		return 1;
 	}
 	
+	pkt_buf_t* pkt = pkt_alloc(new_packet_len);
+	uint8_t* new_packet = pkt->data;
+	
+	bzero(new_packet, new_packet_len);
+	
+	eth_header_t* new_eth = (eth_header_t*) new_packet;
+	ip_header_t* new_ip = ip_getHeader(new_packet);
+	icmp_header_t* new_icmp = icmp_getHeader(new_packet);
+	
 	if (icmp_type == ICMP_TYPE_ECHO_REPLY){
-		icmp_create(new_icmp, icmp_type, icmp_code, ((uint8_t*) icmp_getHeader(src_packet)) + sizeof(icmp_header_t*), icmp_payload_len);
+		icmp_create(new_icmp, icmp_type, icmp_code, ((uint8_t*) icmp_getHeader(src_packet)) + sizeof(icmp_header_t), icmp_payload_len);
 	} else {
-		uint8_t *new_payload = calloc(icmp_payload_len, sizeof(uint8_t));
-		bcopy(ip_hdr, new_payload + 4, icmp_payload_len - 4);
-		icmp_create(new_icmp, icmp_type, icmp_code, new_payload, icmp_payload_len);
-		free(new_payload);
+		/*
+		 * unused word, then the offending ip header and 8 bytes of its data,
+		 * copied straight into the zeroed buffer
+		 */
+		new_icmp->icmp_type = icmp_type;
+		new_icmp->icmp_code = icmp_code;
+		bcopy(ip_hdr, ((uint8_t*) new_icmp) + sizeof(icmp_header_t) + 4, icmp_payload_len - 4);
 	}
 	
 	new_icmp->icmp_sum = htons(icmp_checksum(new_icmp, icmp_payload_len));
@@ -122,7 +193,172 @@ int icmp_sendPacket(struct sr_instance* sr, const uint8_t* src_packet, unsigned
 	/*
 	 * ship the packet to lower layer for sending 
 	 */
-	return router_ip2mac(sr, new_packet, new_packet_len, &next_hop, router->if_list[next_hop_ifIndex].name);
+	int retval = router_ip2mac(sr, pkt, &next_hop, next_hop_ifIndex);
+	pkt_unref(pkt);
+	
+	return retval;
+}
+
+/*
+ * rate limits: default rate and burst of each class, global then per source
+ * prefix. Echo replies get more room than errors, TTL exceeded enough for a
+ * few traceroutes at once
+ */
+static const struct {
+	const char* name;
+	icmp_rate_t global;
+	icmp_rate_t source;
+} icmp_limitDefaults[ICMP_LIMIT_CLASSES] = {
+	{ "echo reply",		{ 1000, 250 },	{ 100, 25 } },
+	{ "net unreachable",	{ 200, 50 },	{ 20, 5 } },
+	{ "host unreachable",	{ 200, 50 },	{ 20, 5 } },
+	{ "proto unreachable",	{ 200, 50 },	{ 20, 5 } },
+	{ "port unreachable",	{ 200, 50 },	{ 20, 5 } },
+	{ "net unknown",	{ 200, 50 },	{ 20, 5 } },
+	{ "ttl exceeded",	{ 500, 100 },	{ 50, 15 } },
+	{ "other",		{ 100, 25 },	{ 10, 5 } },
+};
+
+static uint64_t icmp_nowNs(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+icmp_limiter_t* icmp_createLimiter(void){
+	icmp_limiter_t* limiter = (icmp_limiter_t*) calloc(1, sizeof(icmp_limiter_t));
+	int cls = 0;
+	
+	assert(limiter);
+	icmp_setLimitPrefix(limiter, ICMP_LIMIT_PREFIX_LEN);
+	for (cls = 0; cls < ICMP_LIMIT_CLASSES; cls++){
+		icmp_setLimit(limiter, cls, &icmp_limitDefaults[cls].global, &icmp_limitDefaults[cls].source);
+	}
+	
+	return limiter;
+}
+
+/**
+ * a bucket of burst messages refilled at rate per second, as the ns per
+ * token and how far ahead of now the next token may be
+ */
+static void icmp_rateToGcra(const icmp_rate_t* r, uint64_t* interval, uint64_t* tolerance){
+	if (r->rate == 0) {
+		*interval = 0;
+		*tolerance = 0;
+		return;
+	}
+	*interval = 1000000000ULL / r->rate;
+	*tolerance = (r->burst > 1 ? r->burst - 1 : 0) * *interval;
+}
+
+/**
+ * set the rates of class cls, a NULL rate is left as it is. Meant for setup,
+ * messages checked meanwhile may see half of the change
+ */
+void icmp_setLimit(icmp_limiter_t* limiter, int cls, const icmp_rate_t* global, const icmp_rate_t* source){
+	icmp_limit_class_t* c = &limiter->cls[cls];
+	
+	if (global) {
+		c->global = *global;
+		icmp_rateToGcra(global, &c->interval, &c->tolerance);
+	}
+	if (source) {
+		c->source = *source;
+		icmp_rateToGcra(source, &c->source_interval, &c->source_tolerance);
+	}
+}
+
+/**
+ * sources sharing their first prefix_len bits share a bucket
+ */
+void icmp_setLimitPrefix(icmp_limiter_t* limiter, int prefix_len){
+	limiter->prefix_mask = prefix_len <= 0 ? 0 : 0xFFFFFFFFU << (32 - (prefix_len > 32 ? 32 : prefix_len));
+}
+
+int icmp_limitClass(uint8_t icmp_type, uint8_t icmp_code){
+	switch (icmp_type) {
+		case ICMP_TYPE_ECHO_REPLY:
+			return ICMP_LIMIT_ECHO_REPLY;
+		case ICMP_TYPE_TIME_EXCEEDED:
+			return ICMP_LIMIT_TTL_EXCEEDED;
+		case ICMP_TYPE_DESTINATION_UNREACHABLE:
+			switch (icmp_code) {
+				case ICMP_CODE_NET_UNREACHABLE:
+					return ICMP_LIMIT_NET_UNREACHABLE;
+				case ICMP_CODE_HOST_UNREACHABLE:
+					return ICMP_LIMIT_HOST_UNREACHABLE;
+				case ICMP_CODE_PROTOCOL_UNREACHABLE:
+					return ICMP_LIMIT_PROTO_UNREACHABLE;
+				case ICMP_CODE_PORT_UNREACHABLE:
+					return ICMP_LIMIT_PORT_UNREACHABLE;
+				case ICMP_CODE_NET_UNKNOWN:
+					return ICMP_LIMIT_NET_UNKNOWN;
+			}
+			break;
+	}
+	return ICMP_LIMIT_OTHER;
+}
+
+const char* icmp_limitName(int cls){
+	return icmp_limitDefaults[cls].name;
+}
+
+/**
+ * take a token from the bucket whose next token comes in at *tat
+ * Threadsafe, lock free
+ * @return 1 if there was one
+ */
+static int icmp_takeToken(uint64_t* tat, uint64_t now, uint64_t interval, uint64_t tolerance){
+	uint64_t old = __atomic_load_n(tat, __ATOMIC_RELAXED);
+	uint64_t next;
+	
+	do {
+		uint64_t base = old > now ? old : now;
+		if (base - now > tolerance) {
+			return 0;
+		}
+		next = base + interval;
+	} while (!__atomic_compare_exchange_n(tat, &old, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	
+	return 1;
+}
+
+/**
+ * may the router send a message of class cls to src (net byte order)? The
+ * source bucket is asked first, so a single flooding source does not eat the
+ * tokens of the class.
+ * Threadsafe, lock free
+ * @return 1 if the message may be sent
+ */
+int icmp_limitAllow(icmp_limiter_t* limiter, int cls, uint32_t src){
+	icmp_limit_class_t* c = &limiter->cls[cls];
+	uint64_t now = icmp_nowNs();
+	
+	if (c->source_interval) {
+		uint32_t prefix = ntohl(src) & limiter->prefix_mask;
+		uint32_t i = (prefix * 2654435761U) >> (32 - ICMP_LIMIT_SOURCE_BITS);
+		if (!icmp_takeToken(&c->source_tat[i], now, c->source_interval, c->source_tolerance)) {
+			__atomic_add_fetch(&c->stats.drop_source, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+	
+	if (c->interval && !icmp_takeToken(&c->tat, now, c->interval, c->tolerance)) {
+		__atomic_add_fetch(&c->stats.drop_global, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	
+	__atomic_add_fetch(&c->stats.sent, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+void icmp_getLimitStats(icmp_limiter_t* limiter, int cls, icmp_limit_stats_t* stats){
+	icmp_limit_class_t* c = &limiter->cls[cls];
+	
+	stats->sent = __atomic_load_n(&c->stats.sent, __ATOMIC_RELAXED);
+	stats->drop_source = __atomic_load_n(&c->stats.drop_source, __ATOMIC_RELAXED);
+	stats->drop_global = __atomic_load_n(&c->stats.drop_global, __ATOMIC_RELAXED);
 }
 
 /** 
@@ -168,7 +404,7 @@ uint16_t icmp_checksum(icmp_header_t* icmp, int payload_len){
 
 
 void icmp_processEchoReply(struct sr_instance* sr, const uint8_t* packet, unsigned int len){
-	printf("\n **in icmp_processEchoReply");
+	Debug("\n **in icmp_processEchoReply");
 	/*
 	 * NOTE: no ping support currently
 	 */
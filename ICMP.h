@@ -34,6 +34,58 @@ typedef struct ICMP_Header{
 	uint16_t icmp_sum;
 } __attribute__ ((packed)) icmp_header_t ;
 
+/*
+ * rate limiting of the ICMP messages the router generates. Each type/code
+ * (class) has a global token bucket and a table of per source prefix ones.
+ * A bucket is a single word, the time its next token comes in (GCRA), taken
+ * with one compare and swap; the check runs before any lookup or allocation.
+ * Sources hashing to the same bucket share it, which only limits them more.
+ */
+#define ICMP_LIMIT_ECHO_REPLY		0
+#define ICMP_LIMIT_NET_UNREACHABLE	1
+#define ICMP_LIMIT_HOST_UNREACHABLE	2
+#define ICMP_LIMIT_PROTO_UNREACHABLE	3
+#define ICMP_LIMIT_PORT_UNREACHABLE	4
+#define ICMP_LIMIT_NET_UNKNOWN		5
+#define ICMP_LIMIT_TTL_EXCEEDED		6
+#define ICMP_LIMIT_OTHER		7
+#define ICMP_LIMIT_CLASSES		8
+
+///per source buckets of each class
+#define ICMP_LIMIT_SOURCE_BITS		10
+#define ICMP_LIMIT_SOURCES		(1 << ICMP_LIMIT_SOURCE_BITS)
+
+///sources are grouped by this prefix unless configured otherwise
+#define ICMP_LIMIT_PREFIX_LEN		24
+
+typedef struct ICMP_Limit_Rate {
+	unsigned int rate;			/* messages per second, 0: unlimited */
+	unsigned int burst;			/* messages sent back to back */
+} icmp_rate_t;
+
+typedef struct ICMP_Limit_Stats {
+	unsigned long sent;			/* messages let through */
+	unsigned long drop_source;		/* over the bucket of their source */
+	unsigned long drop_global;		/* over the bucket of the class */
+} icmp_limit_stats_t;
+
+typedef struct ICMP_Limit_Class {
+	icmp_rate_t global;
+	icmp_rate_t source;
+	uint64_t interval;			/* ns per token, 0: unlimited */
+	uint64_t tolerance;			/* ns a bucket may run ahead of now */
+	uint64_t source_interval;
+	uint64_t source_tolerance;
+	uint64_t tat;				/* ns, next token of the global bucket */
+	uint64_t source_tat[ICMP_LIMIT_SOURCES];
+	icmp_limit_stats_t stats;
+} icmp_limit_class_t;
+
+typedef struct ICMP_Limiter {
+	uint32_t prefix_mask;			/* host order */
+	icmp_limit_class_t cls[ICMP_LIMIT_CLASSES];
+} icmp_limiter_t;
+
 
 
 icmp_header_t* icmp_getHeader(const uint8_t* packet);
@@ -42,11 +94,27 @@ void icmp_create(icmp_header_t* icmp, uint8_t icmp_type, uint8_t icmp_code, uint
 
 uint16_t icmp_checksum(icmp_header_t* icmp, int payload_len);
 
-void icmp_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface);
+void icmp_processPacket(struct sr_instance* sr, pkt_buf_t* pkt, int port);
+
+int icmp_echoReply(struct sr_instance* sr, pkt_buf_t* pkt, int port);
 
 int icmp_sendPacket(struct sr_instance* sr, const uint8_t* src_packet, unsigned int len, uint8_t icmp_type, uint8_t icmp_code);
 
 void icmp_processEchoReply(struct sr_instance* sr, const uint8_t* packet, unsigned int len);
 
+icmp_limiter_t* icmp_createLimiter(void);
+
+void icmp_setLimit(icmp_limiter_t* limiter, int cls, const icmp_rate_t* global, const icmp_rate_t* source);
+
+void icmp_setLimitPrefix(icmp_limiter_t* limiter, int prefix_len);
+
+int icmp_limitClass(uint8_t icmp_type, uint8_t icmp_code);
+
+const char* icmp_limitName(int cls);
+
+int icmp_limitAllow(icmp_limiter_t* limiter, int cls, uint32_t src);
+
+void icmp_getLimitStats(icmp_limiter_t* limiter, int cls, icmp_limit_stats_t* stats);
+
 #endif
 
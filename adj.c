@@ -0,0 +1,147 @@
+/**
+ * @file adj.c
+ * @author Mohammad Reza Hosseini
+ *
+ * Adjacencies are handed out when a FIB snapshot is built and given back when
+ * it is destroyed, after rcu_synchronize, so a slot is only reused once no
+ * reader can reach it through an old snapshot.  All functions here but
+ * adj_rewrite are NOT Threadsafe, caller holds lock_arp_cache for write.
+ */
+
+#include "adj.h"
+#include "arp.h"
+#include "seqlock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+adj_table_t* adj_create(void){
+	adj_table_t* table = (adj_table_t*) calloc(1, sizeof(adj_table_t));
+	assert(table);
+	return table;
+}
+
+/**
+ * take a reference to the adjacency of next_hop on port, creating it from the
+ * ARP cache and the interface if there is none yet
+ * @return index in the table, ADJ_NONE if it is full
+ */
+int adj_get(router_t* router, struct in_addr* next_hop, int port){
+	adj_table_t* table = router->adj;
+	int free_slot = ADJ_NONE;
+	int i = 0;
+
+	for (i = 0; i < table->used; i++){
+		adj_t* adj = &table->adj[i];
+		if (adj->refs == 0) {
+			if (free_slot == ADJ_NONE) {
+				free_slot = i;
+			}
+		} else if (adj->next_hop.s_addr == next_hop->s_addr && adj->port == port) {
+			adj->refs++;
+			return i;
+		}
+	}
+
+	if (free_slot == ADJ_NONE) {
+		if (table->used == ADJ_MAX) {
+			return ADJ_NONE;
+		}
+		free_slot = table->used++;
+	}
+
+	adj_t* adj = &table->adj[free_slot];
+	seqlock_writeBegin(&adj->seq);
+	memset(adj->rewrite, 0, sizeof(adj->rewrite));
+	adj->next_hop = *next_hop;
+	adj->port = port;
+	adj->refs = 1;
+	memcpy(adj->rewrite + ETH_ADDR_LEN, router->if_list[port].addr, ETH_ADDR_LEN);
+	adj->valid = arp_searchCache(router, next_hop, adj->rewrite);
+	seqlock_writeEnd(&adj->seq);
+
+	return free_slot;
+}
+
+void adj_put(router_t* router, int index){
+	if (index == ADJ_NONE) {
+		return;
+	}
+	assert(router->adj->adj[index].refs > 0);
+	router->adj->adj[index].refs--;
+}
+
+/**
+ * copy the rewrite of adj over the ethernet addresses of frame. Lock free,
+ * the caller stays in the rcu read side section it found adj in
+ * @return 1 if adj is resolved and frame was rewritten, 0 otherwise
+ */
+int adj_rewrite(adj_t* adj, uint8_t* frame){
+	uint32_t seq;
+	int valid;
+
+	do {
+		seq = seqlock_readBegin(&adj->seq);
+		valid = adj->valid;
+		if (valid) {
+			memcpy(frame, adj->rewrite, sizeof(adj->rewrite));
+		}
+	} while (seqlock_readRetry(&adj->seq, seq));
+
+	return valid;
+}
+
+/**
+ * ip is now at mac: every adjacency through it becomes usable
+ */
+void adj_resolve(router_t* router, struct in_addr* ip, const uint8_t* mac){
+	adj_table_t* table = router->adj;
+	int i = 0;
+
+	for (i = 0; i < table->used; i++){
+		adj_t* adj = &table->adj[i];
+		if (adj->refs && adj->next_hop.s_addr == ip->s_addr) {
+			seqlock_writeBegin(&adj->seq);
+			memcpy(adj->rewrite, mac, ETH_ADDR_LEN);
+			adj->valid = 1;
+			seqlock_writeEnd(&adj->seq);
+		}
+	}
+}
+
+/**
+ * the ARP entry of ip is gone, packets through it go back to the ARP queue
+ */
+void adj_unresolve(router_t* router, struct in_addr* ip){
+	adj_table_t* table = router->adj;
+	int i = 0;
+
+	for (i = 0; i < table->used; i++){
+		adj_t* adj = &table->adj[i];
+		if (adj->next_hop.s_addr == ip->s_addr) {
+			seqlock_writeBegin(&adj->seq);
+			adj->valid = 0;
+			seqlock_writeEnd(&adj->seq);
+		}
+	}
+}
+
+/**
+ * pick up a new hardware address of port
+ */
+void adj_updatePort(router_t* router, int port){
+	adj_table_t* table = router->adj;
+	int i = 0;
+
+	for (i = 0; i < table->used; i++){
+		adj_t* adj = &table->adj[i];
+		if (adj->port == port) {
+			seqlock_writeBegin(&adj->seq);
+			memcpy(adj->rewrite + ETH_ADDR_LEN, router->if_list[port].addr, ETH_ADDR_LEN);
+			seqlock_writeEnd(&adj->seq);
+		}
+	}
+}
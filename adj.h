@@ -0,0 +1,53 @@
+/**
+ * @file adj.h
+ * @author Mohammad Reza Hosseini
+ *
+ * adjacency table: one pre-resolved ethernet rewrite per (gateway, port) the
+ * FIB routes through.  Next hop rows of the FIB point at their adjacency, so
+ * forwarding through a resolved gateway is a FIB lookup and a 12 byte copy.
+ * Records follow the ARP cache and the interfaces; every writer holds
+ * lock_arp_cache, the forwarding path copies the rewrite out under the
+ * record's sequence counter without any lock.
+ */
+#ifndef ADJ_H_
+#define ADJ_H_
+
+#include "router.h"
+#include "ethernet.h"
+
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#define ADJ_MAX		256
+///no adjacency: directly connected route (the next hop is the destination), or table full
+#define ADJ_NONE	-1
+
+typedef struct Adjacency {
+	uint32_t seq;				/* see seqlock.h, covers rewrite and valid */
+	uint8_t rewrite[2 * ETH_ADDR_LEN];	/* destination then source MAC, as they sit in the header */
+	int port;
+	struct in_addr next_hop;
+	int valid;				/* destination MAC is known */
+	int refs;				/* FIB next hop rows pointing here, 0: slot free */
+} adj_t;
+
+typedef struct Adj_Table {
+	adj_t adj[ADJ_MAX];
+	int used;				/* slots ever handed out */
+} adj_table_t;
+
+adj_table_t* adj_create(void);
+
+int adj_get(router_t* router, struct in_addr* next_hop, int port);
+
+void adj_put(router_t* router, int index);
+
+int adj_rewrite(adj_t* adj, uint8_t* frame);
+
+void adj_resolve(router_t* router, struct in_addr* ip, const uint8_t* mac);
+
+void adj_unresolve(router_t* router, struct in_addr* ip);
+
+void adj_updatePort(router_t* router, int port);
+
+#endif
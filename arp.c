@@ -10,6 +10,9 @@
 #include "netfpga.h"
 #include "ip.h"
 #include "ICMP.h"
+#include "adj.h"
+#include "rcu.h"
+#include "seqlock.h"
 
 
 #include <stdio.h>
@@ -20,17 +23,26 @@
 #include <time.h>
 #include <arpa/inet.h>
 
+
+/*
+ * how many times the calling thread holds lock_arp_queue, see arp_lockQueue
+ */
+static __thread int arp_queue_depth = 0;
+
+static void arp_qTimer(void* arg, uintptr_t data);
+
 arp_header_t* arp_getHeader(const uint8_t* packet){
  	return ((arp_header_t*)&packet[ETH_HDR_LEN]);
 }
 
-void arp_processPacket(struct sr_instance *sr, const uint8_t *packet, unsigned int len, const char *interface){
+void arp_processPacket(struct sr_instance *sr, const uint8_t *packet, unsigned int len, int port){
 	
 	assert(sr);
 	assert(packet);
-	assert(interface);
+	assert(port >= 0);
 	
 	arp_header_t* arp_hdr = arp_getHeader(packet);
+#ifdef _DEBUG_
 	printf("\n\n\tARP Header: ");
 	printf("\n\t\tHW Format: %d", arp_hdr->arp_hrd);
 	printf("\n\t\tPro Format: %d", arp_hdr->arp_pro);
@@ -56,6 +68,7 @@ void arp_processPacket(struct sr_instance *sr, const uint8_t *packet, unsigned i
 	inet_ntop(AF_INET, &arp_hdr->arp_tip, ip_string, INET_ADDRSTRLEN);
 	printf("\n\t\tTarget IP: %s",ip_string);
 	printf("\n\n");
+#endif
 	
 	/*
 	 * arp_op is in network byte order
@@ -63,13 +76,13 @@ void arp_processPacket(struct sr_instance *sr, const uint8_t *packet, unsigned i
  	switch (ntohs(arp_hdr->arp_op)) { 
 		
 		case ARP_OP_REQUEST:
-			printf("\n ARP Request Operation ...");
-			arp_processRequest(sr, packet, len, interface);
+			Debug("\n ARP Request Operation ...");
+			arp_processRequest(sr, packet, len, port);
 			break;
 			
 		case ARP_OP_REPLY:
-			printf("\n ARP Reply Operation ...");
-			arp_processReply(sr, packet, len, interface);
+			Debug("\n ARP Reply Operation ...");
+			arp_processReply(sr, packet, len, port);
 			break;
 			
 		default: return;
@@ -77,11 +90,11 @@ void arp_processPacket(struct sr_instance *sr, const uint8_t *packet, unsigned i
 }
 
 
-void arp_processRequest(struct sr_instance *sr, const uint8_t *packet, unsigned int len, const char *interface){
+void arp_processRequest(struct sr_instance *sr, const uint8_t *packet, unsigned int len, int port){
 	
 	assert(sr);
 	assert(packet);
-	assert(interface);
+	assert(port >= 0);
 	
 	arp_header_t* arp_hdr = arp_getHeader(packet);
 	
@@ -93,7 +106,7 @@ void arp_processRequest(struct sr_instance *sr, const uint8_t *packet, unsigned
 	int i = 0;
 	for (i = 0; i < NUM_INTERFACES; i++){
 		if (router->if_list[i].ip == arp_hdr->arp_tip.s_addr){
-			printf("\n Interface %s has the IP address, sending reply ...", router->if_list[i].name);
+			Debug("\n Interface %s has the IP address, sending reply ...", router->if_list[i].name);
 			arp_sendReply(sr, packet, len, i);
 			break;
 		}
@@ -101,11 +114,11 @@ void arp_processRequest(struct sr_instance *sr, const uint8_t *packet, unsigned
 }
 
 
-void arp_processReply(struct sr_instance *sr, const uint8_t *packet, unsigned int len, const char *interface){
+void arp_processReply(struct sr_instance *sr, const uint8_t *packet, unsigned int len, int port){
 	
 	assert(sr);
 	assert(packet);
-	assert(interface);
+	assert(port >= 0);
 	
 	router_t* router = sr_get_subsystem(sr);
 	
@@ -119,11 +132,9 @@ void arp_processReply(struct sr_instance *sr, const uint8_t *packet, unsigned in
 	/*
 	 * process arp_queue for possible resolve
 	 */
-	router_lockRead(&router->lock_arp_cache);
-	router_lockWrite(&router->lock_arp_queue);
+	arp_lockQueue(router);
 	arp_checkQueue(sr, &(arp_hdr->arp_sip), arp_hdr->arp_sha);
-	router_unlock(&router->lock_arp_queue);
-	router_unlock(&router->lock_arp_cache);
+	arp_unlockQueue(router);
 }
 
 void arp_sendReply(struct sr_instance *sr, const uint8_t *packet, unsigned int len, int interface_index){
@@ -132,7 +143,8 @@ void arp_sendReply(struct sr_instance *sr, const uint8_t *packet, unsigned int l
 	
 	
 	router_t* router = (router_t*) sr_get_subsystem(sr);
-	uint8_t* new_packet = (uint8_t*) malloc(sizeof(eth_header_t) + sizeof(arp_header_t));
+	pkt_buf_t* pkt = pkt_alloc(sizeof(eth_header_t) + sizeof(arp_header_t));
+	uint8_t* new_packet = pkt->data;
 	
 	/*
 	 * Setup the ETHERNET header 
@@ -149,11 +161,11 @@ void arp_sendReply(struct sr_instance *sr, const uint8_t *packet, unsigned int l
 	/*
 	 * Send the reply 
 	 */
-	if (router_sendPacket(sr, new_packet, sizeof(eth_header_t) + sizeof(arp_header_t), router->if_list[interface_index].name) <= 0) {
+	if (router_sendPacket(sr, pkt, interface_index) <= 0) {
 		printf("Error sending ARP reply\n");
 	}
 	
-	free(new_packet);
+	pkt_unref(pkt);
 }
 
 
@@ -173,63 +185,183 @@ void arp_createHeader(arp_header_t* arp_header, uint8_t* arp_tha, uint32_t arp_t
 }
 
 
+/**
+ * allocate an empty ARP cache of size slots (a power of two)
+ */
+arp_cache_t* arp_createCache(uint32_t size){
+	assert(size && !(size & (size - 1)));
+	arp_cache_t* cache = (arp_cache_t*) calloc(1, sizeof(arp_cache_t) + size * sizeof(arp_slot_t));
+	assert(cache);
+	cache->mask = size - 1;
+	return cache;
+}
+
+static uint32_t arp_hash(uint32_t ip){
+	uint32_t h = ip * 0x9E3779B1u;
+	return h ^ (h >> 16);
+}
+
+/**
+ * slot holding ip, or the slot it should go to if it is not there (the first
+ * tombstone on its probe chain, or the empty slot ending it).
+ * NOT Threadsafe, caller holds lock_arp_cache for write
+ */
+static arp_slot_t* arp_findSlot(arp_cache_t* cache, uint32_t ip){
+	arp_slot_t* free_slot = NULL;
+	uint32_t i = arp_hash(ip) & cache->mask;
+	
+	while (1) {
+		arp_slot_t* slot = &cache->slot[i];
+		if (slot->state == ARP_SLOT_EMPTY) {
+			return free_slot ? free_slot : slot;
+		}
+		if (slot->state == ARP_SLOT_USED && slot->item.ip.s_addr == ip) {
+			return slot;
+		}
+		if (slot->state == ARP_SLOT_DELETED && !free_slot) {
+			free_slot = slot;
+		}
+		i = (i + 1) & cache->mask;
+	}
+}
+
+/**
+ * make room for one more entry: once live entries and tombstones fill three
+ * quarters of the table, copy the live ones into a fresh table (twice as big
+ * if they alone fill half of it) and swap it in.
+ * NOT Threadsafe, caller holds lock_arp_cache for write and is not inside an
+ * rcu read side section
+ */
+static void arp_reserve(router_t* router){
+	arp_cache_t* cache = router->arp_cache;
+	uint32_t size = cache->mask + 1;
+	uint32_t i = 0;
+	
+	if ((cache->filled + 1) * 4 <= size * 3) {
+		return;
+	}
+	
+	arp_cache_t* new_cache = arp_createCache((cache->used + 1) * 2 > size ? size * 2 : size);
+	for (i = 0; i < size; i++){
+		arp_slot_t* slot = &cache->slot[i];
+		if (slot->state == ARP_SLOT_USED) {
+			arp_slot_t* new_slot = arp_findSlot(new_cache, slot->item.ip.s_addr);
+			new_slot->item = slot->item;
+			new_slot->state = ARP_SLOT_USED;
+			
+			/*
+			 * the expiry moves along, one already firing finds the
+			 * entry by IP
+			 */
+			timer_init(&new_slot->timer, slot->timer.fn, slot->timer.arg, slot->timer.data);
+			if (timer_cancel(router->timers, &slot->timer)) {
+				timer_scheduleAt(router->timers, &new_slot->timer, slot->timer.expires);
+			}
+		}
+	}
+	new_cache->used = new_cache->filled = cache->used;
+	
+	arp_cache_t* old_cache = rcu_assignPointer(router->arp_cache, new_cache);
+	rcu_synchronize();
+	free(old_cache);
+}
+
+/**
+ * expiry of the entry of IP data, ARP_TIMEOUT after its last reply
+ */
+static void arp_cacheTimer(void* arg, uintptr_t data){
+	struct sr_instance* sr = (struct sr_instance*) arg;
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	
+	router_lockWrite(&router->lock_arp_cache);
+	
+	arp_slot_t* slot = arp_findSlot(router->arp_cache, (uint32_t) data);
+	
+	/*
+	 * gone, made static or refreshed since the timer was picked
+	 */
+	if (slot->state != ARP_SLOT_USED || slot->item.is_static == 1 ||
+	    timer_isPending(router->timers, &slot->timer)) {
+		router_unlock(&router->lock_arp_cache);
+		return;
+	}
+	
+	adj_unresolve(router, &slot->item.ip);
+	
+	seqlock_writeBegin(&slot->seq);
+	slot->state = ARP_SLOT_DELETED;
+	seqlock_writeEnd(&slot->seq);
+	router->arp_cache->used--;
+	
+	arp_updateHw(router);
+	
+	router_unlock(&router->lock_arp_cache);
+}
+
 void arp_updateCache(struct sr_instance* sr, struct in_addr* remote_ip, uint8_t* remote_mac, int is_static){
 	assert(sr);
 	assert(remote_ip);
 	assert(remote_mac);
 	
 	router_t* router = (router_t*) sr_get_subsystem(sr);
-	arp_item_t* arp_item = 0;
+	int changed = 1;
 	
 	
 	/*
-	 * lock arp_cache for write
+	 * lock arp_cache for write, lookups go on without it
 	 */
 	router_lockWrite(&router->lock_arp_cache);
 	
-	arp_item = arp_searchCache(router, remote_ip);
-	if (arp_item) {
-		
+	arp_reserve(router);
+	arp_cache_t* cache = router->arp_cache;
+	arp_slot_t* slot = arp_findSlot(cache, remote_ip->s_addr);
+	
+	if (slot->state == ARP_SLOT_USED) {
 		/* 
-		 * if this remote ip is in the cache, update its data 
+		 * if this remote ip is in the cache, update its data; a refresh
+		 * of the same address leaves the hardware table alone
 		 */
-		memcpy(arp_item->arp_ha, remote_mac, ETH_ADDR_LEN);
-		if (is_static == 1) {
-			arp_item->ttl = 0;
-		} else {
-			time(&arp_item->ttl);
-		}
-		arp_item->is_static = is_static;
-	}
-	else {
+		changed = memcmp(slot->item.arp_ha, remote_mac, ETH_ADDR_LEN) || slot->item.is_static != is_static;
+	} else {
 		/* 
-		 * if this interface is not in the cache, create a new entry 
+		 * if this ip is not in the cache, create a new entry 
 		 */
-		node_t* n = node_create();
-		arp_item = calloc(1, sizeof(arp_item_t));
-		
-		arp_item->ip.s_addr = remote_ip->s_addr;
-		memcpy(arp_item->arp_ha, remote_mac, ETH_ADDR_LEN);
-		if (is_static == 1) {
-			arp_item->ttl = 0;
-		} else {
-			time(&arp_item->ttl);
-		}
-		arp_item->is_static = is_static;
-		
-		n->data = (void *)arp_item;
-		if (router->arp_cache == NULL) {
-			router->arp_cache = n;
-		} else {
-			node_push_back(router->arp_cache, n);
+		if (slot->state == ARP_SLOT_EMPTY) {
+			cache->filled++;
 		}
+		cache->used++;
+		timer_init(&slot->timer, arp_cacheTimer, sr, remote_ip->s_addr);
+	}
+	
+	seqlock_writeBegin(&slot->seq);
+	slot->item.ip.s_addr = remote_ip->s_addr;
+	memcpy(slot->item.arp_ha, remote_mac, ETH_ADDR_LEN);
+	if (is_static == 1) {
+		slot->item.ttl = 0;
+	} else {
+		time(&slot->item.ttl);
+	}
+	slot->item.is_static = is_static;
+	slot->state = ARP_SLOT_USED;
+	seqlock_writeEnd(&slot->seq);
+	
+	/*
+	 * every reply pushes the expiry back
+	 */
+	if (is_static == 1) {
+		timer_cancel(router->timers, &slot->timer);
+	} else {
+		timer_schedule(router->timers, &slot->timer, ARP_TIMEOUT * 1000);
 	}
 	
 	/* 
 	 * update the hw arp cache copy 
 	 * cache is locked, no need to lock again
 	 */
-	arp_updateHw(router);
+	if (changed) {
+		arp_updateHw(router);
+		adj_resolve(router, remote_ip, remote_mac);
+	}
 	
 
 	/*
@@ -240,25 +372,61 @@ void arp_updateCache(struct sr_instance* sr, struct in_addr* remote_ip, uint8_t*
 	return;
 }
 
-arp_item_t* arp_searchCache(router_t* router, struct in_addr* ip_addr) {
-	node_t* arp_walker = 0;
-	arp_item_t* arp_item = 0;
-	
-	arp_walker = router->arp_cache;
-	while (arp_walker){
-		arp_item = (arp_item_t*) arp_walker->data;
+/**
+ * look ip up in the ARP cache. Lock free, never waits for a writer
+ * @param [out] arp_ha hardware address of ip if found, may be NULL
+ * @return 1 if ip is resolved, 0 otherwise
+ */
+int arp_searchCache(router_t* router, struct in_addr* ip_addr, uint8_t* arp_ha) {
+	int found = 0;
+	
+	rcu_readLock();
+	arp_cache_t* cache = rcu_dereference(router->arp_cache);
+	uint32_t i = arp_hash(ip_addr->s_addr) & cache->mask;
+	uint32_t probes = 0;
+	
+	for (probes = 0; probes <= cache->mask; probes++){
+		arp_slot_t* slot = &cache->slot[i];
+		uint32_t state;
+		uint32_t ip;
+		uint8_t ha[ETH_ADDR_LEN];
+		uint32_t seq;
+		
+		do {
+			seq = seqlock_readBegin(&slot->seq);
+			state = slot->state;
+			ip = slot->item.ip.s_addr;
+			memcpy(ha, slot->item.arp_ha, ETH_ADDR_LEN);
+		} while (seqlock_readRetry(&slot->seq, seq));
 		
-		if (ip_addr->s_addr == arp_item->ip.s_addr) {
+		if (state == ARP_SLOT_EMPTY) {
 			break;
 		}
-		
-		arp_item = 0;
-		arp_walker = arp_walker->next;
-	}	
-	return arp_item;
+		if (state == ARP_SLOT_USED && ip == ip_addr->s_addr) {
+			if (arp_ha) {
+				memcpy(arp_ha, ha, ETH_ADDR_LEN);
+			}
+			found = 1;
+			break;
+		}
+		i = (i + 1) & cache->mask;
+	}
+	rcu_readUnlock();
+	
+	return found;
 }
 
+/**
+ * NOT Threadsafe, caller holds lock_arp_cache for write
+ */
 void arp_updateHw(router_t* router){
+	arp_cache_t* cache = router->arp_cache;
+	uint32_t size = cache->mask + 1;
+	uint32_t slot = 0;
+	
+	if (router->netfpga.fd < 0) {
+		return;
+	}
 	
 	/* 
 	 * iterate sequentially through the 16 slots in hw updating all entries 
@@ -268,176 +436,247 @@ void arp_updateHw(router_t* router){
 	/* 
 	 * first write all the static entries 
 	 */
-	node_t* cur = router->arp_cache;
-	while((cur != NULL) && (i < ROUTER_OP_LUT_ARP_TABLE_DEPTH)) {
-		arp_item_t* arp_item = (arp_item_t*) cur->data;
+	for (slot = 0; slot < size && i < ROUTER_OP_LUT_ARP_TABLE_DEPTH; slot++){
+		arp_slot_t* cur = &cache->slot[slot];
 		
-		if (arp_item->is_static) {
-			netfpga_writeArpCacheItem(&router->netfpga, arp_item, i);
+		if (cur->state == ARP_SLOT_USED && cur->item.is_static) {
+			netfpga_writeArpCacheItem(&router->netfpga, &cur->item, i);
 			i++;
 		}
-		
-		cur = cur->next;
 	}
 	
 	/*
 	 * second write all the non-static entries and zero out remaining entries in hw
 	 */
-	cur = router->arp_cache;
-	while(i < ROUTER_OP_LUT_ARP_TABLE_DEPTH) {
+	for (slot = 0; slot < size && i < ROUTER_OP_LUT_ARP_TABLE_DEPTH; slot++){
+		arp_slot_t* cur = &cache->slot[slot];
 		
-		if (cur) {
-			arp_item_t* arp_item = (arp_item_t*)cur->data;
-			if(arp_item->is_static == 0) {
-				netfpga_writeArpCacheItem(&router->netfpga, arp_item, i);
-				i++;
-			}
-			cur = cur->next;
-			
-		} else {
-			/*
-			 * zero out the rest of the rows 
-			 */
-			netfpga_writeArpCacheItem(&router->netfpga, NULL, i);
+		if (cur->state == ARP_SLOT_USED && !cur->item.is_static) {
+			netfpga_writeArpCacheItem(&router->netfpga, &cur->item, i);
 			i++;
 		}
 	}
+	
+	/*
+	 * zero out the rest of the rows 
+	 */
+	for (; i < ROUTER_OP_LUT_ARP_TABLE_DEPTH; i++){
+		netfpga_writeArpCacheItem(&router->netfpga, NULL, i);
+	}
+}
+
+arp_queue_t* arp_createQueue(void){
+	arp_queue_t* queue = (arp_queue_t*) calloc(1, sizeof(arp_queue_t));
+	int i = 0;
+	
+	assert(queue);
+	for (i = 0; i < ARP_QUEUE_BUCKETS; i++){
+		queue->bucket[i] = ARP_QUEUE_NONE;
+	}
+	for (i = 0; i < ARP_QUEUE_ENTRIES; i++){
+		queue->item[i].hash_next = i + 1 < ARP_QUEUE_ENTRIES ? i + 1 : ARP_QUEUE_NONE;
+	}
+	queue->free = 0;
+	
+	return queue;
+}
+
+static int* arp_qBucket(arp_queue_t* queue, uint32_t ip){
+	return &queue->bucket[arp_hash(ip) & (ARP_QUEUE_BUCKETS - 1)];
+}
+
+/**
+ * move the packets parked on aqi to pkts, oldest first, and give the entry
+ * back to the pool. The caller owns the references now
+ * @return number of packets moved
+ */
+static int arp_qRelease(router_t* router, arp_qi_t* aqi, pkt_buf_t** pkts){
+	arp_queue_t* queue = router->arp_queue;
+	int index = aqi - queue->item;
+	int count = aqi->count;
+	int i = 0;
+	
+	for (i = 0; i < count; i++){
+		pkts[i] = aqi->pkts[(aqi->first + i) & (ARP_QUEUE_MAX_LEN - 1)];
+	}
+	
+	int* link = arp_qBucket(queue, aqi->next_hop.s_addr);
+	while (*link != index) {
+		link = &queue->item[*link].hash_next;
+	}
+	*link = aqi->hash_next;
+	timer_cancel(router->timers, &aqi->timer);
+	
+	aqi->count = 0;
+	aqi->hash_next = queue->free;
+	queue->free = index;
+	queue->stats.entries--;
+	queue->stats.packets -= count;
+	
+	return count;
 }
 
+/**
+ * NOT Threadsafe, caller holds lock_arp_queue
+ */
 void arp_checkQueue(struct sr_instance* sr, struct in_addr* dest_ip, unsigned char* dest_mac) {
 	router_t* router = (router_t*) sr_get_subsystem(sr);
-	node_t* n = router->arp_queue;
-	node_t* next = NULL;
+	pkt_buf_t* pkts[ARP_QUEUE_MAX_LEN];
+	int i = 0;
 	
-	while (n) {
-		next = n->next;
-		
-		arp_qi_t* aqi = (arp_qi_t*)n->data;
-		
+	/*
+	 * match the arp reply sip to our entry next hop ip
+	 */
+	arp_qi_t* aqi = arp_qSearch(router, dest_ip);
+	if (!aqi) {
+		return;
+	}
+	
+	/*
+	 * free the entry before resending, a packet that still does not
+	 * resolve parks on a new one
+	 */
+	struct in_addr next_hop = aqi->next_hop;
+	int out_port = aqi->out_port;
+	int count = arp_qRelease(router, aqi, pkts);
+	router->arp_queue->stats.resolved += count;
+	
+	for (i = 0; i < count; i++){
 		/*
-		 * match the arp reply sip to our entry next hop ip
+		 * rerun the ip2mac process to see if the packet can be sent
 		 */
-		if (dest_ip->s_addr == aqi->next_hop.s_addr) {
-			node_t* cur_packet_node = aqi->head;
-			node_t* next_packet_node = NULL;
-			
-			while (cur_packet_node) {
-				next_packet_node = cur_packet_node->next;
-				
-				/*
-				 * rerun the ip2mac process to see if the packet can be sent
-				 */
-				arp_qp_t* aqp = (arp_qp_t*) cur_packet_node->data;
-				
-				router_ip2mac(sr, aqp->packet, aqp->len, &(aqi->next_hop), aqi->out_iface_name);
-				
-				node_remove(&(aqi->head), cur_packet_node);
-				
-				cur_packet_node = next_packet_node;
-			}
-			
-			/*
-			 * free the arp queue entry for this destination ip, and patch the list 
-			 */
-			node_remove(&router->arp_queue, n);
-		}
-		
-		n = next;
+		router_ip2mac(sr, pkts[i], &next_hop, out_port);
+		pkt_unref(pkts[i]);
 	}
 }
 
-void arp_qAdd(struct sr_instance* sr, uint8_t* packet, unsigned int len, const char* out_iface_name, struct in_addr *next_hop){
+/**
+ * park a packet until next_hop is resolved, the buffer is not copied, only
+ * referenced. The first packet toward a next hop sends a request. 
+ * NOT Threadsafe, caller holds lock_arp_queue
+ */
+void arp_qAdd(struct sr_instance* sr, pkt_buf_t* pkt, int out_port, struct in_addr *next_hop){
 	assert(sr);
-	assert(packet);
-	assert(out_iface_name);
+	assert(pkt);
+	assert(out_port >= 0);
 	assert(next_hop);
 	
 	router_t* router = (router_t*) sr_get_subsystem(sr);
+	arp_queue_t* queue = router->arp_queue;
 	
 	/*
 	 * Is there an existing queue entry for this IP? 
 	 */
 	arp_qi_t* aqi = arp_qSearch(router, next_hop);
 	if (!aqi) {
+		if (queue->free == ARP_QUEUE_NONE) {
+			queue->stats.drop_entries++;
+			return;
+		}
+		
 		/*
 		 * create a new queue entry 
 		 */
-		aqi = (arp_qi_t*) malloc(sizeof(arp_qi_t));
-		bzero(aqi, sizeof(arp_qi_t));
-		memcpy(aqi->out_iface_name, out_iface_name, IF_LEN);
+		int index = queue->free;
+		aqi = &queue->item[index];
+		queue->free = aqi->hash_next;
+		
+		int* bucket = arp_qBucket(queue, next_hop->s_addr);
+		aqi->hash_next = *bucket;
+		*bucket = index;
+		
+		aqi->out_port = out_port;
 		aqi->next_hop = *next_hop;
+		aqi->first = 0;
+		aqi->count = 0;
+		queue->stats.entries++;
 		
 		/*
-		 * send a request 
+		 * send a request, the next one is due an interval later
 		 */
-		time(&(aqi->last_req_time));
 		aqi->requests = 1;
-		arp_sendRequest(sr, next_hop->s_addr, out_iface_name);
-		arp_qAddPacket(aqi, packet, len);
-		
-		/*
-		 * create a node, add this entry to the node, and push it into our linked list 
-		 */
-		node_t* n = node_create();
-		n->data = aqi;
-		
-		if (router->arp_queue == NULL) {
-			router->arp_queue = n;
-		} else {
-			node_push_back(router->arp_queue, n);
+		aqi->deadline = timer_now() + ARP_REQUEST_INTERVAL * 1000;
+		timer_init(&aqi->timer, arp_qTimer, sr, index);
+		timer_scheduleAt(router->timers, &aqi->timer, aqi->deadline);
+		queue->stats.requests++;
+		arp_sendRequest(sr, next_hop->s_addr, out_port);
+	} else if (aqi->count >= sr->arp_queue_len) {
+		if (!sr->arp_drop_oldest) {
+			queue->stats.drop_newest++;
+			return;
 		}
-	} else {
-		/*
-		 * entry exists, just add the packet 
-		 */
-		arp_qAddPacket(aqi, packet, len);
+		
+		pkt_unref(aqi->pkts[aqi->first]);
+		aqi->first = (aqi->first + 1) & (ARP_QUEUE_MAX_LEN - 1);
+		aqi->count--;
+		queue->stats.packets--;
+		queue->stats.drop_oldest++;
 	}
+	
+	/*
+	 * the frame may sit in a receive ring that is reused after this batch
+	 * while another worker drains the queue, park a copy of our own then
+	 */
+	aqi->pkts[(aqi->first + aqi->count) & (ARP_QUEUE_MAX_LEN - 1)] = pkt_keep(pkt);
+	aqi->count++;
+	queue->stats.packets++;
+	queue->stats.queued++;
 }
 
+/**
+ * NOT Threadsafe, caller holds lock_arp_queue
+ */
 arp_qi_t* arp_qSearch(router_t* router, struct in_addr* ip){
-	node_t* n = router->arp_queue;
+	arp_queue_t* queue = router->arp_queue;
+	int i = *arp_qBucket(queue, ip->s_addr);
 	
-	while (n) {
-		arp_qi_t* aqi = (arp_qi_t*) n->data;
-		if (aqi->next_hop.s_addr == ip->s_addr) {
-			return aqi;
+	while (i != ARP_QUEUE_NONE) {
+		if (queue->item[i].next_hop.s_addr == ip->s_addr) {
+			return &queue->item[i];
 		}
-		n = n->next;
+		i = queue->item[i].hash_next;
 	}
 	
 	return NULL;
 }
 
-void arp_qAddPacket(arp_qi_t* aqi, uint8_t* packet, unsigned int len){
-	node_t* n = node_create();
-	arp_qp_t* aqp = (arp_qp_t*)malloc(sizeof(arp_qp_t));
-	
-	aqp->packet = packet;
-	aqp->len = len;
-	
-	/*
-	 * set the new nodes data to point to the packet entry 
-	 */
-	n->data = aqp;
+/**
+ * tell the sender of a packet we gave up on that its destination is unreachable
+ */
+static void arp_qUnreachable(struct sr_instance* sr, pkt_buf_t* pkt){
+	router_t* router = (router_t*) sr_get_subsystem(sr);
 	
-	/*
-	 * add the new node to the arp queue entry 
+	/* only send an icmp error if the packet is not icmp, or if it is, its an echo request or reply
+	 * also ensure we don't send an icmp error back to one of our interfaces
 	 */
-	if (aqi->head == NULL) {
-		aqi->head = n;
-	} else {
-		node_push_back(aqi->head, n);
+	ip_header_t* ip_hdr = ip_getHeader(pkt->data);
+	icmp_header_t* icmp_hdr = icmp_getHeader(pkt->data);
+	if ( ip_hdr->ip_p != IP_PROTO_ICMP || icmp_hdr->icmp_type == ICMP_TYPE_ECHO_REPLY || icmp_hdr->icmp_type == ICMP_TYPE_ECHO_REQUEST){
+		
+		/*
+		 * also ensure we don't send an icmp error back to one of our interfaces 
+		 */
+		if (router_getInterfaceByIp(router, ip_hdr->ip_src.s_addr) >= 0){
+			/* Total hack here to increment the TTL since we already decremented it earlier in the pipeline
+			 * and the ICMP error should return the original packet. 
+			 */
+
+			if (ip_hdr->ip_ttl < 255) {
+				/* also patches the checksum */
+				ip_incrementTtl(ip_hdr);
+			}
+			icmp_sendPacket(sr, pkt->data, pkt->len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_HOST_UNREACHABLE);
+		}
 	}
 }
 
-
-void arp_sendRequest(struct sr_instance* sr, uint32_t tip /* Net byte order */, const char* interface){
+void arp_sendRequest(struct sr_instance* sr, uint32_t tip /* Net byte order */, int port){
 	
 	assert(sr);
-	assert(interface);
+	assert(port >= 0);
 	router_t* router = (router_t*) sr_get_subsystem(sr);
 
-	int interface_index = router_getInterfaceIndex(router, interface);
+	pkt_buf_t* pkt = 0;
 	uint8_t *request_packet = 0;
 	eth_header_t *eth_request = 0;
 	arp_header_t *arp_request = 0;
@@ -448,174 +687,105 @@ void arp_sendRequest(struct sr_instance* sr, uint32_t tip /* Net byte order */,
 	 * construct the ARP request 
 	 */
 	len = sizeof(eth_header_t) + sizeof(arp_header_t);
-	request_packet = calloc(len, sizeof(uint8_t));
+	pkt = pkt_alloc(len);
+	request_packet = pkt->data;
+	bzero(request_packet, len);
 	eth_request = (eth_header_t*) request_packet;
 	arp_request = (arp_header_t*) (request_packet + sizeof(eth_header_t));
 	
-	eth_createHeader(eth_request, default_addr, router->if_list[interface_index].addr, ETH_TYPE_ARP);
-	arp_createHeader(arp_request, NULL, tip, router->if_list[interface_index].addr, router->if_list[interface_index].ip, ARP_OP_REQUEST);
+	eth_createHeader(eth_request, default_addr, router->if_list[port].addr, ETH_TYPE_ARP);
+	arp_createHeader(arp_request, NULL, tip, router->if_list[port].addr, router->if_list[port].ip, ARP_OP_REQUEST);
 	
 	
 	/* 
 	 * send the ARP request 
 	 */
-	if (router_sendPacket(sr, request_packet, len, interface) != 0) {
+	if (router_sendPacket(sr, pkt, port) < 0) {
 		printf("Failure sending arp request\n");
 	}
 	
 	/*
 	 * recover allocated memory 
 	 */
-	free(request_packet);
+	pkt_unref(pkt);
 }
 
-void arp_processQueue(struct sr_instance* sr) {
+/**
+ * retry of entry data: send another request, or give up on its next hop
+ * after ARP_MAX_REQUESTS
+ */
+static void arp_qTimer(void* arg, uintptr_t data){
+	struct sr_instance* sr = (struct sr_instance*) arg;
 	router_t* router = (router_t*) sr_get_subsystem(sr);
-	node_t* n = router->arp_queue;
-	node_t* next = NULL;
-	time_t now;
-	double diff;
-	
-	while (n) {
-		next = n->next;
-		arp_qi_t* aqi = (arp_qi_t*) n->data;
-		
-		/*
-		 * has it been over a second since the last arp request was sent? 
-		 */
-		time(&now);
-		diff = difftime(now, aqi->last_req_time);
-		if (diff > ARP_REQUEST_INTERVAL) {
-			/*
-			 * have we sent less than 5 arp requests? 
-			 */
-			if (aqi->requests < ARP_MAX_REQUESTS) {
-				/*
-				 * send another arp request
-				 */
-				time(&(aqi->last_req_time));
-				++(aqi->requests);
-				arp_sendRequest(sr, aqi->next_hop.s_addr, aqi->out_iface_name);
-			} else {
-				/*
-				 * we have exceeded the max arp requests, return packets to sender 
-				 */
-				node_t* cur_packet_node = aqi->head;
-				node_t* next_packet_node = NULL;
-				
-				while (cur_packet_node) {
-					/*
-					 * send icmp for the packet, free it, and its encasing entry 
-					 */
-					arp_qp_t* aqp = (arp_qp_t*) cur_packet_node->data;
-					
-					/* only send an icmp error if the packet is not icmp, or if it is, its an echo request or reply
-					 * also ensure we don't send an icmp error back to one of our interfaces
-					 */
-					ip_header_t* ip_hdr = ip_getHeader(aqp->packet);
-					icmp_header_t* icmp_hdr = icmp_getHeader(aqp->packet);
-					if ( ip_hdr->ip_p != IP_PROTO_ICMP || icmp_hdr->icmp_type == ICMP_TYPE_ECHO_REPLY || icmp_hdr->icmp_type == ICMP_TYPE_ECHO_REQUEST){
-						
-						/*
-						 * also ensure we don't send an icmp error back to one of our interfaces 
-						 */
-						if (router_getInterfaceByIp(router, ip_hdr->ip_src.s_addr) >= 0){
-							/* Total hack here to increment the TTL since we already decremented it earlier in the pipeline
-							 * and the ICMP error should return the original packet. 
-							 */
-
-							if (ip_hdr->ip_ttl < 255) {
-								ip_hdr->ip_ttl++;
-								
-								/* recalculate checksum */
-								bzero(&ip_hdr->ip_sum, sizeof(uint16_t));
-								uint16_t checksum = htons(ip_checksum(ip_hdr));
-								ip_hdr->ip_sum = checksum;
-							}
-							icmp_sendPacket(sr, aqp->packet, aqp->len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_HOST_UNREACHABLE);
-						}
-					}
-						
-					free(aqp->packet);
-					next_packet_node = cur_packet_node->next;
-					//free(cur_packet_node);   /* IS THIS CORRECT TO FREE IT ? */
-					node_remove(&(aqi->head), cur_packet_node);
-					cur_packet_node = next_packet_node;
-				}
-				
-				/*
-				 * free the arp queue entry for this destination ip, and patch the list 
-				 */
-				node_remove(&router->arp_queue, n);
-			}
-		}
-		n = next;
-	}
+	arp_queue_t* queue = router->arp_queue;
+	arp_qi_t* aqi = &queue->item[data];
+	pkt_buf_t* pkts[ARP_QUEUE_MAX_LEN];
+	int i = 0;
 	
-}
-
-void* arp_thread(void *param) {
-	assert(param);
-	struct sr_instance *sr = (struct sr_instance *)param;
-	router_t* router = (router_t*) sr_get_subsystem(sr);
+	arp_lockQueue(router);
 	
-	while (1) {
-		router_lockWrite(&router->lock_arp_cache);
-		arp_expireCache(sr);
-		router_unlock(&router->lock_arp_cache);		
-		
-		
-		router_lockRead(&router->lock_arp_cache);
-		router_lockWrite(&router->lock_arp_queue);
-		router_lockRead(&router->lock_rtable); /* because we may send an icmp packet back, requiring get next hop */
-		
-		arp_processQueue(sr);
-		
-		router_unlock(&router->lock_rtable);
-		router_unlock(&router->lock_arp_queue);
-		router_unlock(&router->lock_arp_cache);
-		
-		sleep(1);
+	/*
+	 * resolved since the timer was picked, maybe reused for another next
+	 * hop that is not due yet
+	 */
+	if (aqi->count == 0 || aqi->deadline > timer_now()) {
+		arp_unlockQueue(router);
+		return;
 	}
-}
-
-void arp_expireCache(struct sr_instance* sr){
-	assert(sr);
-	router_t* router = (router_t*) sr_get_subsystem(sr);
-	node_t* arp_walker = 0;
-	arp_item_t* arp_item = 0;
-	time_t now;
-	double diff;
-	int timedout_entry = 0;
-	
 	
 	/*
-	 * iterate through arp_cache to find expired entries
+	 * have we sent less than 5 arp requests? 
 	 */
-	arp_walker = router->arp_cache;
-	while(arp_walker) {
-		arp_item = (arp_item_t *)arp_walker->data;
-		node_t* tmp = arp_walker;
-		arp_walker = arp_walker->next;
-		
+	if (aqi->requests < ARP_MAX_REQUESTS) {
 		/*
-		 * if not static, check that TTL is within reason 
+		 * send another arp request
 		 */
-		if (arp_item->is_static != 1) {
-			time(&now);
-			diff = difftime(now, arp_item->ttl);
-			
-			if (diff > ARP_TIMEOUT) {
-				node_remove(&router->arp_cache, tmp);
-				timedout_entry = 1;
-			}
+		++(aqi->requests);
+		aqi->deadline = timer_now() + ARP_REQUEST_INTERVAL * 1000;
+		timer_scheduleAt(router->timers, &aqi->timer, aqi->deadline);
+		queue->stats.requests++;
+		arp_sendRequest(sr, aqi->next_hop.s_addr, aqi->out_port);
+	} else {
+		/*
+		 * we have exceeded the max arp requests, return packets to sender 
+		 */
+		int count = arp_qRelease(router, aqi, pkts);
+		queue->stats.unreachable += count;
+		
+		for (i = 0; i < count; i++){
+			arp_qUnreachable(sr, pkts[i]);
+			pkt_unref(pkts[i]);
 		}
 	}
 	
-	/* 
-	 * update hw
-	 */
-	if (timedout_entry == 1) {
-		arp_updateHw(router);
+	arp_unlockQueue(router);
+}
+
+/**
+ * copy out the counters of the ARP queue
+ */
+void arp_getQueueStats(router_t* router, arp_queue_stats_t* stats){
+	arp_lockQueue(router);
+	*stats = router->arp_queue->stats;
+	arp_unlockQueue(router);
+}
+
+/**
+ * take lock_arp_queue for write unless the calling thread already holds it.
+ * The forwarding path only needs the queue when a next hop is unresolved, and
+ * it gets there both from receive workers (which do not hold the lock) and
+ * from the queue walkers that resend parked packets (which do).
+ * Never take lock_arp_cache while holding it.
+ */
+void arp_lockQueue(router_t* router){
+	if (arp_queue_depth++ == 0) {
+		router_lockWrite(&router->lock_arp_queue);
+	}
+}
+
+void arp_unlockQueue(router_t* router){
+	assert(arp_queue_depth > 0);
+	if (--arp_queue_depth == 0) {
+		router_unlock(&router->lock_arp_queue);
 	}
 }
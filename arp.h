@@ -11,6 +11,7 @@
 #include "router.h"
 #include "ethernet.h"
 #include "ll.h"
+#include "timer.h"
 
 
 #define ARP_HRD_ETHERNET 	0x0001
@@ -21,7 +22,7 @@
 
 #define ARP_REQUEST_INTERVAL	1 //seconds
 #define ARP_MAX_REQUESTS	5
-#define ARP_TIMEOUT		300 //seconds
+#define ARP_TIMEOUT		300 //seconds, since the last reply
 
 typedef struct Arp_Header{
 	unsigned short  arp_hrd;             /* format of hardware address   */
@@ -45,35 +46,93 @@ typedef struct Arp_Item{
 } __attribute__ ((packed)) arp_item_t;
 
 
+/*
+ * the ARP cache is an open addressing (linear probing) hash table keyed by
+ * IP. Lookups are lock free: the table is reached through rcu, so it can be
+ * grown by copying, and every slot is read under its own sequence counter, so
+ * a reply updating it in place is never seen half written. Writers hold
+ * lock_arp_cache. A removed entry leaves a tombstone behind to keep probe
+ * chains intact, the next rebuild drops them. Each learned entry has a timer
+ * that removes it ARP_TIMEOUT after the last reply, keyed by IP rather than
+ * by slot since a rebuild moves the entries.
+ */
+#define ARP_CACHE_MIN_SIZE	64	/* slots, a power of two */
+
+#define ARP_SLOT_EMPTY		0	/* ends a probe chain */
+#define ARP_SLOT_USED		1
+#define ARP_SLOT_DELETED	2	/* tombstone */
+
+typedef struct Arp_Slot {
+	uint32_t seq;				/* see seqlock.h */
+	uint32_t state;
+	arp_item_t item;
+	timer_entry_t timer;			/* expiry, not armed for static entries */
+} arp_slot_t;
+
+typedef struct Arp_Cache {
+	uint32_t mask;				/* slots - 1 */
+	uint32_t used;				/* live entries */
+	uint32_t filled;			/* live entries and tombstones */
+	arp_slot_t slot[];
+} arp_cache_t;
+
+
 
 #define IF_LEN 32
 
+/*
+ * packets waiting for their next hop to resolve. Entries come from a fixed
+ * pool and are found through a hash of the next hop, each parks at most
+ * sr->arp_queue_len packets in a ring, so a scan or flood toward hosts that
+ * never answer costs bounded memory instead of a list per packet. Every
+ * entry has a timer for its next request, nothing walks the table to find
+ * the due ones. All of it is under lock_arp_queue.
+ */
+#define ARP_QUEUE_ENTRIES	1024	/* neighbors being resolved at once */
+#define ARP_QUEUE_BUCKETS	1024	/* a power of two */
+#define ARP_QUEUE_MAX_LEN	SR_MAX_ARP_QUEUE_LEN	/* a power of two */
+#define ARP_QUEUE_NONE		-1	/* end of a chain or list */
+
 typedef struct Arp_QueueItem{
-	char out_iface_name[IF_LEN];
 	struct in_addr next_hop;
-	int requests;
-	time_t last_req_time;
-	node_t* head;
-	int is_static;
-} __attribute__ ((packed)) arp_queue_item_t;
+	int out_port;				/* if_list index the packets leave on */
+	int requests;				/* sent so far */
+	uint64_t deadline;			/* ms, next request or give up */
+	timer_entry_t timer;			/* fires at deadline */
+	int hash_next;				/* bucket chain, or free list */
+	int first;				/* oldest parked packet in pkts */
+	int count;
+	pkt_buf_t* pkts[ARP_QUEUE_MAX_LEN];	/* parked buffers, the queue holds a reference */
+} arp_queue_item_t;
 
 typedef arp_queue_item_t arp_qi_t;
 
-
-typedef struct ARP_QueuePacket {
-	uint8_t* packet;
-	unsigned int len;
-} arp_queue_packet_t;
-
-typedef arp_queue_packet_t arp_qp_t;
+typedef struct Arp_Queue_Stats {
+	unsigned long queued;			/* packets parked */
+	unsigned long resolved;			/* parked packets sent on a reply */
+	unsigned long unreachable;		/* parked packets given up on */
+	unsigned long drop_oldest;		/* parked packets pushed out by a newer one */
+	unsigned long drop_newest;		/* packets refused, their neighbor was full */
+	unsigned long drop_entries;		/* packets refused, no free entry */
+	unsigned long requests;			/* requests sent for parked packets */
+	unsigned int entries;			/* neighbors pending now */
+	unsigned int packets;			/* packets parked now */
+} arp_queue_stats_t;
+
+typedef struct Arp_Queue {
+	int bucket[ARP_QUEUE_BUCKETS];
+	int free;				/* unused entries, through hash_next */
+	arp_queue_stats_t stats;
+	arp_qi_t item[ARP_QUEUE_ENTRIES];
+} arp_queue_t;
 
 arp_header_t* arp_getHeader(const uint8_t* packet);
 
-void arp_processPacket(struct sr_instance *sr, const uint8_t *packet, unsigned int len, const char *interface);
+void arp_processPacket(struct sr_instance *sr, const uint8_t *packet, unsigned int len, int port);
 
-void arp_processRequest( struct sr_instance *sr, const uint8_t *packet, unsigned int len, const char *interface);
+void arp_processRequest( struct sr_instance *sr, const uint8_t *packet, unsigned int len, int port);
 
-void arp_processReply(struct sr_instance *sr, const uint8_t *packet, unsigned int len, const char *interface);
+void arp_processReply(struct sr_instance *sr, const uint8_t *packet, unsigned int len, int port);
 
 void arp_createHeader(arp_header_t* arp_header, uint8_t* arp_tha, uint32_t arp_tip, uint8_t* arp_sha, uint32_t arp_sip, uint16_t op);
 
@@ -81,25 +140,27 @@ void arp_sendReply(struct sr_instance *sr, const uint8_t *packet, unsigned int l
 
 void arp_updateCache(struct sr_instance* sr, struct in_addr* remote_ip, uint8_t* remote_mac, int is_static);
 
-arp_item_t* arp_searchCache(router_t* router, struct in_addr* ip_addr);
+arp_cache_t* arp_createCache(uint32_t size);
+
+int arp_searchCache(router_t* router, struct in_addr* ip_addr, uint8_t* arp_ha);
 
 void arp_updateHw(router_t* router);
 
-void arp_sendRequest(struct sr_instance* sr, uint32_t tip /* Net byte order */, const char* interface);
+void arp_sendRequest(struct sr_instance* sr, uint32_t tip /* Net byte order */, int port);
 
-void arp_qAddPacket(arp_qi_t* aqi, uint8_t* packet, unsigned int len);
+arp_queue_t* arp_createQueue(void);
 
 arp_qi_t* arp_qSearch(router_t* router, struct in_addr* ip);
 
-void arp_qAdd(struct sr_instance* sr, uint8_t* packet, unsigned int len, const char* out_iface_name, struct in_addr *next_hop);
+void arp_qAdd(struct sr_instance* sr, pkt_buf_t* pkt, int out_port, struct in_addr *next_hop);
 
 void arp_checkQueue(struct sr_instance* sr, struct in_addr* dest_ip, unsigned char* dest_mac);
 
-void arp_processQueue(struct sr_instance* sr);
+void arp_getQueueStats(router_t* router, arp_queue_stats_t* stats);
 
-void arp_expireCache(struct sr_instance* sr);
+void arp_lockQueue(router_t* router);
 
-void* arp_thread(void *param);
+void arp_unlockQueue(router_t* router);
 	
 #endif
 
@@ -0,0 +1,362 @@
+/**
+ * @file arp_bench.c
+ * @author Mohammad Reza Hosseini
+ *
+ * ARP cache benchmark: 64k neighbors on one flat L2 segment.  The cache learns
+ * every neighbor through arp_updateCache, then 1 to NUM_INTERFACES reader
+ * threads look up random neighbors as the forwarding path would, first alone
+ * and then while a writer keeps changing their hardware addresses the way a
+ * storm of ARP replies would.  Each address carries its IP in its low four
+ * bytes, so a reader seeing a half written entry is caught.
+ *
+ * A flood toward neighbors that never answer then parks packets for every
+ * address of the segment, first spread over all of them and then aimed at a
+ * single one, under both drop policies: the pending table has to stay
+ * bounded, keep its counters straight and give every buffer back once the
+ * neighbors resolve.
+ *
+ * usage: arp_bench [lookups per reader]
+ */
+
+#include "router.h"
+#include "arp.h"
+#include "ICMP.h"
+#include "adj.h"
+#include "ethernet.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_LOOKUPS	2000000
+#define NEIGHBORS	65536
+#define SEGMENT		0x0A000000	/* 10.0.0.0/15, we are 10.0.0.1 */
+
+
+/*
+ * the pieces of the base system the router calls into
+ */
+static struct sr_instance bench_sr;
+static router_t* bench_router;
+
+void* sr_get_subsystem(struct sr_instance* sr){
+	return bench_router;
+}
+
+void sr_set_subsystem(struct sr_instance* sr, void* core){
+	bench_router = (router_t*) core;
+}
+
+struct sr_instance* get_sr(){
+	return &bench_sr;
+}
+
+int sr_integ_low_level_outputv(struct sr_instance* sr, const struct iovec* iov, int iovcnt, int port){
+	int len = 0;
+	while (iovcnt--) {
+		len += iov[iovcnt].iov_len;
+	}
+	return len;
+}
+
+int sr_integ_low_level_output_batch(struct sr_instance* sr, pkt_buf_t** pkts, unsigned int* lens, int count, int port){
+	return count;
+}
+
+
+static struct in_addr bench_neighbor(int i){
+	struct in_addr ip;
+	ip.s_addr = htonl(SEGMENT + 2 + i);
+	return ip;
+}
+
+/**
+ * 02:gen:<ip>, generation gen of the address of ip
+ */
+static void bench_mac(struct in_addr ip, uint8_t gen, uint8_t* mac){
+	mac[0] = 0x02;
+	mac[1] = gen;
+	memcpy(mac + 2, &ip.s_addr, 4);
+}
+
+static void bench_createRouter(void){
+	router_t* router = (router_t*) calloc(1, sizeof(router_t));
+	int i = 0;
+
+	sr_set_subsystem(&bench_sr, router);
+	router->adj = adj_create();
+	router->icmp_limit = icmp_createLimiter();
+	router->timers = timer_createWheel();
+	router->arp_cache = arp_createCache(ARP_CACHE_MIN_SIZE);
+	router->arp_queue = arp_createQueue();
+	router->netfpga.fd = -1;
+	bench_sr.arp_queue_len = SR_DEFAULT_ARP_QUEUE_LEN;
+
+	interface_t* iface = &router->if_list[0];
+	strcpy(iface->name, "eth0");
+	iface->ip = htonl(SEGMENT + 1);
+	iface->mask = htonl(0xFFFE0000);
+	iface->hw_port = 0;
+	router->if_list_index = 1;
+
+	pthread_rwlock_init(&router->lock_arp_cache, NULL);
+	pthread_rwlock_init(&router->lock_arp_queue, NULL);
+	for (i = 0; i < NUM_INTERFACES; i++){
+		txq_init(&router->txq[i]);
+	}
+}
+
+static int bench_learn(void){
+	uint8_t mac[ETH_ADDR_LEN];
+	int i = 0;
+
+	double start = bench_now();
+	for (i = 0; i < NEIGHBORS; i++){
+		struct in_addr ip = bench_neighbor(i);
+		bench_mac(ip, 0, mac);
+		arp_updateCache(&bench_sr, &ip, mac, 0);
+	}
+	double elapsed = bench_now() - start;
+
+	/*
+	 * a refresh of a known neighbor, the common case once the cache is warm
+	 */
+	start = bench_now();
+	for (i = 0; i < NEIGHBORS; i++){
+		struct in_addr ip = bench_neighbor(i);
+		bench_mac(ip, 0, mac);
+		arp_updateCache(&bench_sr, &ip, mac, 0);
+	}
+	double refresh = bench_now() - start;
+
+	arp_cache_t* cache = bench_router->arp_cache;
+	fprintf(stderr, "learn: %d neighbors, %.1f ns/insert, %.1f ns/refresh, %u entries in %u slots\n",
+		NEIGHBORS, elapsed * 1e9 / NEIGHBORS, refresh * 1e9 / NEIGHBORS, cache->used, cache->mask + 1);
+
+	return cache->used != NEIGHBORS;
+}
+
+typedef struct Bench_Reader {
+	int lookups;
+	unsigned int seed;
+	pthread_barrier_t* start;
+	int found;
+	int torn;
+	double elapsed;
+} bench_reader_t;
+
+static void* bench_reader(void* arg){
+	bench_reader_t* reader = (bench_reader_t*) arg;
+	struct in_addr* ips = (struct in_addr*) malloc(reader->lookups * sizeof(struct in_addr));
+	uint8_t mac[ETH_ADDR_LEN];
+	int i = 0;
+
+	for (i = 0; i < reader->lookups; i++){
+		ips[i] = bench_neighbor(rand_r(&reader->seed) % NEIGHBORS);
+	}
+
+	pthread_barrier_wait(reader->start);
+
+	double start = bench_now();
+	for (i = 0; i < reader->lookups; i++){
+		if (arp_searchCache(bench_router, &ips[i], mac)) {
+			reader->found++;
+			reader->torn += mac[0] != 0x02 || memcmp(mac + 2, &ips[i].s_addr, 4);
+		}
+	}
+	reader->elapsed = bench_now() - start;
+
+	free(ips);
+	return NULL;
+}
+
+static volatile int bench_writing = 0;
+
+/**
+ * ARP replies for random neighbors with a new address each time
+ */
+static void* bench_writer(void* arg){
+	unsigned long* updates = (unsigned long*) arg;
+	unsigned int seed = 344;
+	uint8_t mac[ETH_ADDR_LEN];
+	uint8_t gen = 1;
+
+	while (bench_writing) {
+		struct in_addr ip = bench_neighbor(rand_r(&seed) % NEIGHBORS);
+		bench_mac(ip, gen++, mac);
+		arp_updateCache(&bench_sr, &ip, mac, 0);
+		(*updates)++;
+	}
+	return NULL;
+}
+
+static int bench_lookup(int readers, int lookups, int with_writer){
+	pthread_t tids[NUM_INTERFACES];
+	bench_reader_t reader[NUM_INTERFACES];
+	pthread_barrier_t start;
+	pthread_t writer;
+	unsigned long updates = 0;
+	int i = 0;
+
+	pthread_barrier_init(&start, NULL, readers + 1);
+	for (i = 0; i < readers; i++){
+		memset(&reader[i], 0, sizeof(bench_reader_t));
+		reader[i].lookups = lookups;
+		reader[i].seed = i + 1;
+		reader[i].start = &start;
+		pthread_create(&tids[i], NULL, bench_reader, &reader[i]);
+	}
+
+	if (with_writer) {
+		bench_writing = 1;
+		pthread_create(&writer, NULL, bench_writer, &updates);
+	}
+	pthread_barrier_wait(&start);
+
+	int found = 0, torn = 0;
+	double elapsed = 0;
+	for (i = 0; i < readers; i++){
+		pthread_join(tids[i], NULL);
+		found += reader[i].found;
+		torn += reader[i].torn;
+		elapsed = reader[i].elapsed > elapsed ? reader[i].elapsed : elapsed;
+	}
+
+	if (with_writer) {
+		bench_writing = 0;
+		pthread_join(writer, NULL);
+	}
+	pthread_barrier_destroy(&start);
+
+	fprintf(stderr, "lookup: %d reader(s)%s, %.1f ns/lookup, %.2f Mlookups/s, %d of %d found, %d torn",
+		readers, with_writer ? " + writer" : "", elapsed * 1e9 / lookups,
+		readers * lookups / elapsed / 1e6, found, readers * lookups, torn);
+	if (with_writer) {
+		fprintf(stderr, ", %lu updates", updates);
+	}
+	fprintf(stderr, "\n");
+
+	return found != readers * lookups || torn;
+}
+
+static int bench_miss(int lookups){
+	int found = 0;
+	int i = 0;
+
+	double start = bench_now();
+	for (i = 0; i < lookups; i++){
+		struct in_addr ip = bench_neighbor(NEIGHBORS + i % NEIGHBORS);
+		found += arp_searchCache(bench_router, &ip, NULL);
+	}
+	double elapsed = bench_now() - start;
+
+	fprintf(stderr, "miss: %.1f ns/lookup, %d found\n", elapsed * 1e9 / lookups, found);
+
+	return found != 0;
+}
+
+/**
+ * park packets toward count neighbors that do not answer, round robin
+ * starting at first, then resolve them all
+ */
+static int bench_flood(const char* name, int first, int count, int packets, int drop_oldest){
+	router_t* router = bench_router;
+	uint8_t mac[ETH_ADDR_LEN];
+	arp_queue_stats_t before, after;
+	pkt_stats_t pkts;
+	int i = 0;
+
+	bench_sr.arp_drop_oldest = drop_oldest;
+	arp_getQueueStats(router, &before);
+
+	double start = bench_now();
+	arp_lockQueue(router);
+	for (i = 0; i < packets; i++){
+		struct in_addr ip = bench_neighbor(first + i % count);
+		pkt_buf_t* pkt = pkt_alloc(64);
+		arp_qAdd(&bench_sr, pkt, 0, &ip);
+		pkt_unref(pkt);
+	}
+	arp_unlockQueue(router);
+	double elapsed = bench_now() - start;
+
+	/*
+	 * nothing is due yet, the retry pass must not walk the table
+	 */
+	start = bench_now();
+	timer_run(router->timers, timer_now());
+	double retry = bench_now() - start;
+
+	arp_getQueueStats(router, &after);
+	pkt_getStats(&pkts);
+	unsigned int entries = after.entries, parked = after.packets;
+	unsigned long in_use = pkts.in_use;
+
+	for (i = 0; i < count && i < ARP_QUEUE_ENTRIES; i++){
+		struct in_addr ip = bench_neighbor(first + i);
+		bench_mac(ip, 0, mac);
+		arp_updateCache(&bench_sr, &ip, mac, 0);
+		arp_lockQueue(router);
+		arp_checkQueue(&bench_sr, &ip, mac);
+		arp_unlockQueue(router);
+	}
+	arp_getQueueStats(router, &after);
+	pkt_getStats(&pkts);
+
+	fprintf(stderr, "flood %s: %d packets to %d neighbors, %.1f ns/packet, retry pass %.1f us, "
+		"%u pending with %u packets (%lu buffers), %lu requests, %lu resolved, "
+		"dropped %lu oldest %lu newest %lu no entry, %lu buffers left\n",
+		name, packets, count, elapsed * 1e9 / packets, retry * 1e6,
+		entries, parked, in_use, after.requests - before.requests,
+		after.resolved - before.resolved, after.drop_oldest - before.drop_oldest,
+		after.drop_newest - before.drop_newest, after.drop_entries - before.drop_entries, pkts.in_use);
+
+	unsigned long queued = after.queued - before.queued;
+	unsigned long pushed_out = after.drop_oldest - before.drop_oldest;
+	unsigned long refused = (after.drop_newest - before.drop_newest) + (after.drop_entries - before.drop_entries);
+
+	return entries > ARP_QUEUE_ENTRIES || parked > entries * SR_DEFAULT_ARP_QUEUE_LEN || in_use != parked ||
+		queued + refused != packets || queued - pushed_out != parked ||
+		after.resolved - before.resolved != parked || pkts.in_use != 0 || after.entries != 0;
+}
+
+int main(int argc, char** argv){
+	int lookups = DEFAULT_LOOKUPS;
+	if (argc > 1) {
+		lookups = atoi(argv[1]);
+	}
+
+	/*
+	 * the router traces on stdout
+	 */
+	if (!freopen("/dev/null", "w", stdout)) {
+		perror("freopen");
+		return 1;
+	}
+
+	bench_createRouter();
+
+	int errors = 0;
+	int readers = 0;
+	errors += bench_learn();
+	for (readers = 1; readers <= NUM_INTERFACES; readers++){
+		errors += bench_lookup(readers, lookups, 0);
+	}
+	for (readers = 1; readers <= NUM_INTERFACES; readers++){
+		errors += bench_lookup(readers, lookups, 1);
+	}
+	errors += bench_miss(lookups);
+
+	/*
+	 * the neighbors learned above are resolved, flood the other half of the segment
+	 */
+	errors += bench_flood("scan", NEIGHBORS, NEIGHBORS - 2, 4 * NEIGHBORS, 1);
+	errors += bench_flood("one oldest", NEIGHBORS + 1, 1, 1000, 1);
+	errors += bench_flood("one newest", NEIGHBORS + 2, 1, 1000, 0);
+
+	return errors ? 1 : 0;
+}
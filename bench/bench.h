@@ -0,0 +1,100 @@
+/**
+ * @file bench.h
+ * @author Mohammad Reza Hosseini
+ *
+ * helpers shared by the micro-benchmarks: clocks, random numbers, a sort
+ * comparator for latency samples and the reader of the cpuhw interface file.
+ * Everything is static inline, a bench only pays for what it uses.
+ */
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define BENCH_HW_NAMELEN	32
+
+/*
+ * one "name ip mask mac" line of a cpuhw file
+ */
+typedef struct Bench_Hw {
+	char name[BENCH_HW_NAMELEN];
+	uint32_t ip;			/* network order */
+	uint32_t mask;
+	uint8_t mac[6];
+} bench_hw_t;
+
+/**
+ * @return seconds on the monotonic clock
+ */
+static inline double bench_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @return nanoseconds on the monotonic clock
+ */
+static inline uint64_t bench_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @return 32 random bits, rand() alone only gives 31
+ */
+static inline uint32_t bench_random(void){
+	return ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+}
+
+/**
+ * qsort comparator of uint64_t samples
+ */
+static inline int bench_cmp(const void* a, const void* b){
+	uint64_t x = *(const uint64_t*) a;
+	uint64_t y = *(const uint64_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * read up to max interfaces from "name ip mask mac" lines, the format of the
+ * cpuhw file
+ * @return number of interfaces read, -1 if the file can't be read or a line
+ * is bad
+ */
+static inline int bench_readHw(const char* file, bench_hw_t* hw, int max){
+	FILE* fp = fopen(file, "r");
+	char name[BENCH_HW_NAMELEN], ip[32], mask[32], mac[32];
+	unsigned int m[6];
+	int count = 0;
+	int i = 0;
+
+	if (!fp) {
+		perror(file);
+		return -1;
+	}
+	while (count < max && fscanf(fp, "%31s %31s %31s %31s", name, ip, mask, mac) == 4) {
+		bench_hw_t* h = &hw[count];
+		if (sscanf(mac, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6 ||
+				inet_pton(AF_INET, ip, &h->ip) != 1 || inet_pton(AF_INET, mask, &h->mask) != 1) {
+			fprintf(stderr, "%s: bad line for %s\n", file, name);
+			fclose(fp);
+			return -1;
+		}
+		memcpy(h->name, name, sizeof(name));
+		for (i = 0; i < 6; i++){
+			h->mac[i] = m[i];
+		}
+		count++;
+	}
+	fclose(fp);
+	return count;
+}
+
+#endif
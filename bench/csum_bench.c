@@ -0,0 +1,121 @@
+/**
+ * @file csum_bench.c
+ * @author Mohammad Reza Hosseini
+ *
+ * compares the incremental checksum helpers with a full ip_checksum: first
+ * checks they agree on random headers for ttl decrement, ttl increment and
+ * arbitrary 16 bit field rewrites, then times a ttl decrement both ways.
+ *
+ * usage: csum_bench [iterations]
+ */
+
+#include "ip.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_ITERATIONS	100000000
+#define CHECK_HEADERS		1000000
+#define HEADER_POOL		1024
+
+static void bench_randomHeader(ip_header_t* ip){
+	ip_createHeader(ip, bench_random() % 1480, bench_random() & 0xFF, bench_random(), bench_random());
+	ip->ip_tos = bench_random() & 0xFF;
+	ip->ip_id = bench_random() & 0xFFFF;
+	ip->ip_ttl = 1 + bench_random() % 254;
+	ip->ip_sum = htons(ip_checksum(ip));
+}
+
+/**
+ * @return 1 if the checksum stored in the header matches a full recompute
+ */
+static int bench_matches(ip_header_t* ip){
+	ip_header_t copy = *ip;
+	return ip->ip_sum == htons(ip_checksum(&copy));
+}
+
+static int bench_check(void){
+	int errors = 0;
+	int i = 0;
+
+	for (i = 0; i < CHECK_HEADERS; i++){
+		ip_header_t ip;
+		bench_randomHeader(&ip);
+
+		ip_decrementTtl(&ip);
+		errors += !bench_matches(&ip);
+
+		ip_incrementTtl(&ip);
+		errors += !bench_matches(&ip);
+
+		/*
+		 * rewrite a random 16 bit word other than the checksum itself and the
+		 * first one, which holds the header length
+		 */
+		uint8_t* word = (uint8_t*) &ip + 2 * (1 + bench_random() % 9);
+		if (word == (uint8_t*) &ip.ip_sum) {
+			word -= 2;
+		}
+		uint16_t old_val, new_val = bench_random() & 0xFFFF;
+		memcpy(&old_val, word, sizeof(uint16_t));
+		memcpy(word, &new_val, sizeof(uint16_t));
+		ip.ip_sum = ip_checksumAdjust(ip.ip_sum, old_val, new_val);
+		errors += !bench_matches(&ip);
+	}
+
+	printf("equivalence: %d headers x 3 updates, %d mismatches against ip_checksum\n", CHECK_HEADERS, errors);
+	return errors;
+}
+
+static void bench_time(long iterations){
+	ip_header_t* headers = (ip_header_t*) malloc(HEADER_POOL * sizeof(ip_header_t));
+	long i = 0;
+	unsigned long acc = 0;
+
+	for (i = 0; i < HEADER_POOL; i++){
+		bench_randomHeader(&headers[i]);
+		headers[i].ip_ttl = 255;
+	}
+
+	double start = bench_now();
+	for (i = 0; i < iterations; i++){
+		ip_header_t* ip = &headers[i & (HEADER_POOL - 1)];
+		ip->ip_ttl--;
+		ip->ip_sum = htons(ip_checksum(ip));
+		ip->ip_ttl++;
+		acc += ip->ip_sum;
+	}
+	double full = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < iterations; i++){
+		ip_header_t* ip = &headers[i & (HEADER_POOL - 1)];
+		ip_decrementTtl(ip);
+		ip->ip_ttl++;
+		acc += ip->ip_sum;
+	}
+	double incremental = bench_now() - start;
+
+	printf("full ip_checksum:    %6.2f ns per ttl decrement\n", full * 1e9 / iterations);
+	printf("ip_decrementTtl:     %6.2f ns per ttl decrement (%lu)\n", incremental * 1e9 / iterations, acc & 1);
+
+	free(headers);
+}
+
+int main(int argc, char** argv){
+	long iterations = DEFAULT_ITERATIONS;
+	if (argc > 1) {
+		iterations = atol(argv[1]);
+	}
+
+	srand(344);
+
+	int errors = bench_check();
+	bench_time(iterations);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+/**
+ * @file fib_bench.c
+ * @author Mohammad Reza Hosseini
+ *
+ * lookup micro-benchmark for the FIB with 1k, 100k and 1M random prefixes.
+ * The 1k table is also checked against a naive longest prefix match.
+ *
+ * usage: fib_bench [lookups]
+ */
+
+#include "fib.h"
+#include "rtable.h"
+#include "ll.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_LOOKUPS	10000000
+
+/**
+ * prefix lengths roughly follow a backbone table: mostly /24, some shorter,
+ * very few longer than /24
+ */
+static int bench_prefixLen(void){
+	int r = rand() % 100;
+	if (r < 55) {
+		return 24;
+	} else if (r < 97) {
+		return 8 + rand() % 16;
+	}
+	return 25 + rand() % 8;
+}
+
+static node_t* bench_buildRtable(int count){
+	node_t* head = NULL;
+	node_t* tail = NULL;
+	int i = 0;
+
+	for (i = 0; i < count; i++){
+		rtable_row_t* row = (rtable_row_t*) calloc(1, sizeof(rtable_row_t));
+		int len = bench_prefixLen();
+		uint32_t mask = len ? ~((1u << (32 - len)) - 1) : 0;
+
+		row->mask.s_addr = htonl(mask);
+		row->ip.s_addr = htonl(bench_random() & mask);
+		row->gw.s_addr = htonl(bench_random() | 1);
+		row->ifIndex = rand() % NUM_INTERFACES;
+		row->is_active = 1;
+		row->is_static = 1;
+
+		node_t* n = node_create();
+		n->data = row;
+		if (!head) {
+			head = n;
+		} else {
+			tail->next = n;
+			n->prev = tail;
+		}
+		tail = n;
+	}
+	return head;
+}
+
+static void bench_freeRtable(node_t* head){
+	while (head) {
+		node_t* next = head->next;
+		free(head->data);
+		free(head);
+		head = next;
+	}
+}
+
+/**
+ * reference lookup: the linear scan rtable_nextHop used to do
+ */
+static int bench_naiveLookup(node_t* rtable, struct in_addr* dest, struct in_addr* next_hop){
+	rtable_row_t* lpm = NULL;
+	int most_bits_matched = -1;
+
+	while (rtable) {
+		rtable_row_t* row = (rtable_row_t*) rtable->data;
+		uint32_t mask = ntohl(row->mask.s_addr);
+		if ((ntohl(row->ip.s_addr) & mask) == (ntohl(dest->s_addr) & mask)) {
+			int bits = __builtin_popcount(mask);
+			if (bits > most_bits_matched) {
+				lpm = row;
+				most_bits_matched = bits;
+			}
+		}
+		rtable = rtable->next;
+	}
+
+	if (!lpm) {
+		return 1;
+	}
+	next_hop->s_addr = lpm->gw.s_addr;
+	return 0;
+}
+
+static int bench_run(int prefixes, int lookups){
+	node_t* rtable = bench_buildRtable(prefixes);
+
+	double start = bench_now();
+	fib_t* fib = fib_create(rtable);
+	double build = bench_now() - start;
+
+	/*
+	 * pre-generate the addresses so rand() is not measured
+	 */
+	int n_addrs = 1 << 20;
+	struct in_addr* addrs = (struct in_addr*) malloc(n_addrs * sizeof(struct in_addr));
+	int i = 0;
+	for (i = 0; i < n_addrs; i++){
+		addrs[i].s_addr = htonl(bench_random());
+	}
+
+	struct in_addr next_hop;
+	int ifIndex = 0;
+	unsigned long hits = 0;
+
+	start = bench_now();
+	for (i = 0; i < lookups; i++){
+		if (fib_lookup(fib, &addrs[i & (n_addrs - 1)], &next_hop, &ifIndex) == 0) {
+			hits += next_hop.s_addr & 1;
+		}
+	}
+	double elapsed = bench_now() - start;
+
+	printf("%8d prefixes: build %8.2f ms, %5u groups (%6lu KB), lookup %6.2f ns, %7.2f Mlookups/s (%lu)\n",
+	       prefixes, build * 1e3, fib->groups,
+	       (unsigned long)((FIB_TBL16_SIZE + fib->groups * FIB_GROUP_SIZE) * sizeof(uint32_t) / 1024),
+	       elapsed * 1e9 / lookups, lookups / elapsed / 1e6, hits);
+
+	int errors = 0;
+	if (prefixes <= 1000) {
+		for (i = 0; i < 100000; i++){
+			struct in_addr expected;
+			int r1 = fib_lookup(fib, &addrs[i], &next_hop, &ifIndex);
+			int r2 = bench_naiveLookup(rtable, &addrs[i], &expected);
+			if (r1 != r2 || (!r1 && next_hop.s_addr != expected.s_addr)) {
+				errors++;
+			}
+		}
+		printf("%8d prefixes: %d mismatches against linear lookup\n", prefixes, errors);
+	}
+
+	free(addrs);
+	fib_destroy(fib);
+	bench_freeRtable(rtable);
+	return errors;
+}
+
+int main(int argc, char** argv){
+	int lookups = DEFAULT_LOOKUPS;
+	if (argc > 1) {
+		lookups = atoi(argv[1]);
+	}
+
+	srand(344);
+
+	int errors = 0;
+	errors += bench_run(1000, lookups);
+	errors += bench_run(100000, lookups);
+	errors += bench_run(1000000, lookups);
+
+	return errors ? 1 : 0;
+}
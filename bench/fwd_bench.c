@@ -0,0 +1,830 @@
+/**
+ * @file fwd_bench.c
+ * @author Mohammad Reza Hosseini
+ *
+ * forwarding path benchmark: pushes a transit frame through router_processPacket
+ * with a resolved next hop and counts every malloc on the way.  The transmit
+ * hook checks that the frame leaves from the same buffer it arrived in.  A
+ * second run parks frames on the ARP queue and checks they are sent from the
+ * original buffer once the next hop resolves, and that a frame lent from a
+ * receive ring is parked as a copy.  Short frames lent from a
+ * receive ring must leave from the ring with their padding gathered behind
+ * them.  Batched runs check that the transmit queue sends each receive batch
+ * as a single vector.  The worker runs
+ * forward batches from 1 to NUM_INTERFACES threads at once, each as the
+ * receive worker of its own port forwarding to the next one.  Pings of the
+ * router must be answered out of the request's own buffer.  Last, a storm of
+ * TTL 1 frames, first from one source then from a whole subnet, must be
+ * answered within the ICMP rate limits and the dropped ones must not
+ * allocate.  The buffer pool is then driven on its own, by threads taking
+ * and releasing bursts of buffers and by a pair handing buffers from one
+ * thread to the other; once warm neither may malloc.
+ *
+ * usage: fwd_bench [packets]
+ */
+
+#include "router.h"
+#include "rtable.h"
+#include "arp.h"
+#include "adj.h"
+#include "ip.h"
+#include "ICMP.h"
+#include "ethernet.h"
+#include "packet.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PACKETS	1000000
+#define FRAME_LEN	98
+#define BENCH_BATCH	32
+
+
+/*
+ * count every allocation made by the code under test
+ */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long bench_mallocs = 0;
+
+void* malloc(size_t size){
+	__atomic_add_fetch(&bench_mallocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size){
+	__atomic_add_fetch(&bench_mallocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size){
+	__atomic_add_fetch(&bench_mallocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+
+/*
+ * the pieces of the base system the router calls into
+ */
+static struct sr_instance bench_sr;
+static router_t* bench_router;
+
+/*
+ * per thread, every worker transmits the batches it received itself
+ */
+static __thread const uint8_t* bench_rx_data[BENCH_BATCH];
+static __thread int bench_rx_count = 0;
+static __thread unsigned long bench_sent_inplace = 0;
+static __thread unsigned long bench_sent_other = 0;
+static __thread unsigned long bench_sent_gathered = 0;
+
+void* sr_get_subsystem(struct sr_instance* sr){
+	return bench_router;
+}
+
+void sr_set_subsystem(struct sr_instance* sr, void* core){
+	bench_router = (router_t*) core;
+}
+
+struct sr_instance* get_sr(){
+	return &bench_sr;
+}
+
+/*
+ * a gathered frame counts if its first piece is a received frame and the
+ * rest is zero padding up to the minimum length
+ */
+int sr_integ_low_level_outputv(struct sr_instance* sr, const struct iovec* iov, int iovcnt, int port){
+	unsigned int len = iov[0].iov_len;
+	int padded = 1;
+	int i = 0, j = 0;
+
+	for (i = 1; i < iovcnt; i++){
+		for (j = 0; j < (int) iov[i].iov_len; j++){
+			padded &= ((const uint8_t*) iov[i].iov_base)[j] == 0;
+		}
+		len += iov[i].iov_len;
+	}
+	for (j = 0; j < bench_rx_count && iov[0].iov_base != bench_rx_data[j]; j++);
+	if (j < bench_rx_count && padded && len == PKT_MIN_LEN) {
+		bench_sent_gathered++;
+	} else {
+		bench_sent_other++;
+	}
+	return len;
+}
+
+int sr_integ_low_level_output_batch(struct sr_instance* sr, pkt_buf_t** pkts, unsigned int* lens, int count, int port){
+	int i = 0, j = 0;
+	for (i = 0; i < count; i++){
+		for (j = 0; j < bench_rx_count && pkts[i]->data != bench_rx_data[j]; j++);
+		if (j < bench_rx_count) {
+			bench_sent_inplace++;
+		} else {
+			bench_sent_other++;
+		}
+	}
+	return count;
+}
+
+
+static void bench_addRoute(router_t* router, const char* ip, const char* mask, const char* gw, int port){
+	rtable_row_t* row = (rtable_row_t*) calloc(1, sizeof(rtable_row_t));
+	inet_pton(AF_INET, ip, &row->ip);
+	inet_pton(AF_INET, mask, &row->mask);
+	inet_pton(AF_INET, gw, &row->gw);
+	row->ifIndex = port;
+	row->is_active = 1;
+	row->is_static = 1;
+
+	node_t* n = node_create();
+	n->data = row;
+	if (!router->rtable) {
+		router->rtable = n;
+	} else {
+		node_push_back(router->rtable, n);
+	}
+}
+
+/**
+ * a static ARP entry, resolves the adjacencies through ip (there is no NetFPGA
+ * table to program)
+ */
+static void bench_addNeighbor(router_t* router, const char* ip, uint8_t last_byte){
+	struct in_addr addr;
+	inet_pton(AF_INET, ip, &addr);
+	uint8_t mac[ETH_ADDR_LEN] = { 0x00, 0x11, 0x22, 0x33, 0x44, last_byte };
+	arp_updateCache(&bench_sr, &addr, mac, 1);
+}
+
+static router_t* bench_createRouter(void){
+	router_t* router = (router_t*) calloc(1, sizeof(router_t));
+	int i = 0;
+
+	sr_set_subsystem(&bench_sr, router);
+	router->adj = adj_create();
+	router->icmp_limit = icmp_createLimiter();
+	router->timers = timer_createWheel();
+	router->arp_cache = arp_createCache(ARP_CACHE_MIN_SIZE);
+	router->arp_queue = arp_createQueue();
+	bench_sr.arp_queue_len = SR_DEFAULT_ARP_QUEUE_LEN;
+	bench_sr.arp_drop_oldest = 1;
+
+	for (i = 0; i < NUM_INTERFACES; i++){
+		interface_t* iface = &router->if_list[i];
+		char ip[INET_ADDRSTRLEN];
+		sprintf(iface->name, "eth%d", i);
+		sprintf(ip, "192.168.%d.1", i);
+		inet_pton(AF_INET, ip, &iface->ip);
+		iface->mask = htonl(0xFFFFFF00);
+		uint8_t mac[ETH_ADDR_LEN] = { 0xaa, 0xba, 0xd0, 0xca, 0xfe, i };
+		memcpy(iface->addr, mac, ETH_ADDR_LEN);
+		iface->hw_port = i;
+	}
+	router->if_list_index = NUM_INTERFACES;
+
+	pthread_rwlock_init(&router->lock_arp_cache, NULL);
+	pthread_rwlock_init(&router->lock_arp_queue, NULL);
+	pthread_rwlock_init(&router->lock_rtable, NULL);
+	for (i = 0; i < NUM_INTERFACES; i++){
+		txq_init(&router->txq[i]);
+	}
+	router->netfpga.fd = -1;
+
+	bench_addRoute(router, "192.168.0.0", "255.255.255.0", "0.0.0.0", 0);
+	bench_addRoute(router, "192.168.1.0", "255.255.255.0", "0.0.0.0", 1);
+	bench_addRoute(router, "10.0.0.0", "255.0.0.0", "192.168.1.2", 1);
+	bench_addRoute(router, "172.16.0.0", "255.240.0.0", "192.168.2.2", 2);
+
+	bench_addNeighbor(router, "192.168.1.2", 0x02);
+
+	/*
+	 * 10.10p.0.0/16 leaves through port p, for the workers
+	 */
+	for (i = 0; i < NUM_INTERFACES; i++){
+		char net[INET_ADDRSTRLEN], gw[INET_ADDRSTRLEN];
+		sprintf(net, "10.%d.0.0", 100 + i);
+		sprintf(gw, "192.168.%d.3", i);
+		bench_addRoute(router, net, "255.255.0.0", gw, i);
+		bench_addNeighbor(router, gw, 0x10 + i);
+	}
+	rtable_buildFib(router);
+
+	return router;
+}
+
+/**
+ * a UDP frame from a host on eth0 to dest
+ */
+static void bench_buildFrame(uint8_t* frame, const char* dest){
+	memset(frame, 0, FRAME_LEN);
+
+	eth_header_t* eth = (eth_header_t*) frame;
+	uint8_t src_mac[ETH_ADDR_LEN] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x64 };
+	eth_createHeader(eth, bench_router->if_list[0].addr, src_mac, ETH_TYPE_IP);
+
+	ip_header_t* ip = ip_getHeader(frame);
+	struct in_addr src, dst;
+	inet_pton(AF_INET, "192.168.0.100", &src);
+	inet_pton(AF_INET, dest, &dst);
+	ip_createHeader(ip, FRAME_LEN - ETH_HDR_LEN - sizeof(ip_header_t), IP_PROTO_UDP, src.s_addr, dst.s_addr);
+	ip->ip_sum = htons(ip_checksum(ip));
+}
+
+/**
+ * the receive loop: a pooled buffer filled by the "NIC" and lent to the router.
+ * Buffers received since the last bench_rx_count reset count as in place
+ */
+static pkt_buf_t* bench_receive(const uint8_t* frame){
+	pkt_buf_t* pkt = pkt_alloc(FRAME_LEN);
+	memcpy(pkt->data, frame, FRAME_LEN);
+	bench_rx_data[bench_rx_count++] = pkt->data;
+	return pkt;
+}
+
+static int bench_forward(int packets){
+	uint8_t frame[FRAME_LEN];
+	bench_buildFrame(frame, "10.1.2.3");
+
+	/*
+	 * the gateway is resolved, both addresses come from its adjacency
+	 */
+	uint8_t rewrite[2 * ETH_ADDR_LEN] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x02 };
+	memcpy(rewrite + ETH_ADDR_LEN, bench_router->if_list[1].addr, ETH_ADDR_LEN);
+	int rewrite_ok = 1;
+
+	int i = 0;
+	for (i = 0; i < 1000; i++){
+		bench_rx_count = 0;
+		pkt_buf_t* pkt = bench_receive(frame);
+		router_processPacket(&bench_sr, pkt, 0);
+		rewrite_ok &= !memcmp(pkt->data, rewrite, sizeof(rewrite));
+		pkt_unref(pkt);
+	}
+
+	bench_sent_inplace = 0;
+	bench_sent_other = 0;
+	unsigned long mallocs = bench_mallocs;
+	pkt_stats_t before;
+	pkt_getStats(&before);
+
+	double start = bench_now();
+	for (i = 0; i < packets; i++){
+		bench_rx_count = 0;
+		pkt_buf_t* pkt = bench_receive(frame);
+		router_processPacket(&bench_sr, pkt, 0);
+		pkt_unref(pkt);
+	}
+	double elapsed = bench_now() - start;
+
+	mallocs = bench_mallocs - mallocs;
+	pkt_stats_t after;
+	pkt_getStats(&after);
+
+	fprintf(stderr, "forward: %d packets, %.1f ns/packet, %lu sent in place, %lu other frames\n",
+		packets, elapsed * 1e9 / packets, bench_sent_inplace, bench_sent_other);
+	fprintf(stderr, "forward: %lu mallocs (%.3f per packet), %lu buffer pool misses, ethernet rewrite %s\n",
+		mallocs, (double) mallocs / packets, after.mallocs - before.mallocs, rewrite_ok ? "ok" : "WRONG");
+
+	return (bench_sent_inplace != packets) || mallocs || !rewrite_ok;
+}
+
+/**
+ * one receive batch of count copies of frame arriving on port
+ */
+static void bench_receiveBatch(const uint8_t* frame, int count, int port){
+	pkt_buf_t* pkts[BENCH_BATCH];
+	int ports[BENCH_BATCH];
+	int j = 0;
+
+	bench_rx_count = 0;
+	for (j = 0; j < count; j++){
+		pkts[j] = bench_receive(frame);
+		ports[j] = port;
+	}
+	router_processBatch(&bench_sr, pkts, ports, count);
+	for (j = 0; j < count; j++){
+		pkt_unref(pkts[j]);
+	}
+}
+
+/**
+ * receive batches through router_processBatch, every batch should leave as
+ * one vector on the egress port
+ */
+static int bench_batch(int packets){
+	uint8_t frame[FRAME_LEN];
+	bench_buildFrame(frame, "10.1.2.3");
+
+	int batches = packets / BENCH_BATCH;
+	int i = 0;
+
+	/*
+	 * a batch keeps BENCH_BATCH buffers alive, fill the pool first
+	 */
+	bench_receiveBatch(frame, BENCH_BATCH, 0);
+
+	txq_stats_t before;
+	txq_getStats(&bench_router->txq[1], &before);
+	bench_sent_inplace = 0;
+	bench_sent_other = 0;
+	unsigned long mallocs = bench_mallocs;
+
+	double start = bench_now();
+	for (i = 0; i < batches; i++){
+		bench_receiveBatch(frame, BENCH_BATCH, 0);
+	}
+	double elapsed = bench_now() - start;
+
+	mallocs = bench_mallocs - mallocs;
+	txq_stats_t after;
+	txq_getStats(&bench_router->txq[1], &after);
+	unsigned long flushes = after.flushes - before.flushes;
+	unsigned long full = after.hist[5] - before.hist[5];
+
+	fprintf(stderr, "batch: %d x %d packets, %.1f ns/packet, %lu sent in place, %lu other frames\n",
+		batches, BENCH_BATCH, elapsed * 1e9 / (batches * BENCH_BATCH), bench_sent_inplace, bench_sent_other);
+	fprintf(stderr, "batch: %lu flushes on eth1, %lu of %d frames, %lu overruns, %lu mallocs\n",
+		flushes, full, BENCH_BATCH, after.overruns - before.overruns, mallocs);
+
+	return bench_sent_inplace != batches * BENCH_BATCH || flushes != batches || full != batches || mallocs;
+}
+
+typedef struct Bench_Worker {
+	int port;
+	int batches;
+	pthread_barrier_t* start;
+	unsigned long sent_inplace;
+} bench_worker_t;
+
+/**
+ * receive worker of one port, run to completion on frames for the next port
+ */
+static void* bench_worker(void* arg){
+	bench_worker_t* worker = (bench_worker_t*) arg;
+	uint8_t frame[FRAME_LEN];
+	char dest[INET_ADDRSTRLEN];
+	int i = 0;
+
+	sprintf(dest, "10.%d.1.1", 100 + (worker->port + 1) % NUM_INTERFACES);
+	bench_buildFrame(frame, dest);
+
+	bench_receiveBatch(frame, BENCH_BATCH, worker->port);
+	bench_sent_inplace = 0;
+	pthread_barrier_wait(worker->start);
+
+	for (i = 0; i < worker->batches; i++){
+		bench_receiveBatch(frame, BENCH_BATCH, worker->port);
+	}
+
+	worker->sent_inplace = bench_sent_inplace;
+	return NULL;
+}
+
+/**
+ * 1 .. NUM_INTERFACES workers forwarding at once, each the same number of
+ * packets, aggregate throughput should grow with the cores available
+ */
+static int bench_workers(int packets){
+	bench_worker_t workers[NUM_INTERFACES];
+	pthread_t threads[NUM_INTERFACES];
+	pthread_barrier_t start;
+	int batches = packets / NUM_INTERFACES / BENCH_BATCH;
+	int errors = 0;
+	int n = 0, i = 0;
+
+	/*
+	 * every worker keeps a batch of buffers alive, fill the pool for all of them
+	 */
+	pkt_buf_t* warm[NUM_INTERFACES * BENCH_BATCH];
+	for (i = 0; i < NUM_INTERFACES * BENCH_BATCH; i++){
+		warm[i] = pkt_alloc(FRAME_LEN);
+	}
+	for (i = 0; i < NUM_INTERFACES * BENCH_BATCH; i++){
+		pkt_unref(warm[i]);
+	}
+
+	for (n = 1; n <= NUM_INTERFACES; n++){
+		pthread_barrier_init(&start, NULL, n + 1);
+		for (i = 0; i < n; i++){
+			workers[i].port = i;
+			workers[i].batches = batches;
+			workers[i].start = &start;
+			pthread_create(&threads[i], NULL, bench_worker, &workers[i]);
+		}
+
+		pthread_barrier_wait(&start);
+		unsigned long mallocs = bench_mallocs;
+		double begin = bench_now();
+		for (i = 0; i < n; i++){
+			pthread_join(threads[i], NULL);
+		}
+		double elapsed = bench_now() - begin;
+		mallocs = bench_mallocs - mallocs;
+		pthread_barrier_destroy(&start);
+
+		unsigned long inplace = 0;
+		for (i = 0; i < n; i++){
+			inplace += workers[i].sent_inplace;
+		}
+		unsigned long total = (unsigned long) n * batches * BENCH_BATCH;
+
+		fprintf(stderr, "workers: %d, %lu packets, %.3f Mpps, %lu sent in place, %lu mallocs\n",
+			n, total, total / elapsed / 1e6, inplace, mallocs);
+		errors += inplace != total || mallocs;
+	}
+
+	return errors;
+}
+
+static int bench_park(void){
+	uint8_t frame[FRAME_LEN];
+	uint8_t ring[FRAME_LEN];
+	bench_buildFrame(frame, "172.16.5.5");
+
+	bench_rx_count = 0;
+	pkt_buf_t* pkt = bench_receive(frame);
+	router_processPacket(&bench_sr, pkt, 0);
+
+	/*
+	 * the queue should hold our buffer, not a copy
+	 */
+	struct in_addr next_hop;
+	inet_pton(AF_INET, "192.168.2.2", &next_hop);
+	arp_qi_t* aqi = arp_qSearch(bench_router, &next_hop);
+	int parked = aqi && aqi->count == 1 && aqi->pkts[aqi->first] == pkt && pkt->refcnt == 2;
+	bench_rx_data[0] = pkt->data;
+	bench_rx_count = 1;
+	pkt_unref(pkt);
+
+	/*
+	 * a frame lent from a ring is parked as a copy, the ring is reused as
+	 * soon as the batch is done
+	 */
+	memcpy(ring, frame, FRAME_LEN);
+	pkt = pkt_wrap(ring, FRAME_LEN);
+	router_processPacket(&bench_sr, pkt, 0);
+	pkt_buf_t* copy = aqi ? aqi->pkts[(aqi->first + 1) & (ARP_QUEUE_MAX_LEN - 1)] : NULL;
+	int copied = aqi && aqi->count == 2 && copy != pkt && !copy->external && pkt->refcnt == 1;
+	pkt_unref(pkt);
+	memset(ring, 0, FRAME_LEN);
+	copied = copied && ip_getHeader(copy->data)->ip_dst.s_addr == ip_getHeader(frame)->ip_dst.s_addr;
+
+	/*
+	 * resolve the next hop, the parked frame goes out of the original buffer
+	 */
+	bench_sent_inplace = 0;
+	bench_sent_other = 0;
+	bench_addNeighbor(bench_router, "192.168.2.2", 0x03);
+	arp_checkQueue(&bench_sr, &next_hop, NULL);
+
+	pkt_stats_t stats;
+	pkt_getStats(&stats);
+
+	fprintf(stderr, "park: queued without copy %s, ring frame copied %s, sent in place after resolve %s, "
+		"%lu buffers in use\n",
+		parked ? "yes" : "NO", copied ? "yes" : "NO", bench_sent_inplace == 1 && bench_sent_other == 1 ? "yes" : "NO",
+		stats.in_use);
+
+	return !parked || !copied || bench_sent_inplace != 1 || bench_sent_other != 1 || stats.in_use != 0;
+}
+
+/**
+ * short frames lent from a receive ring have no room to be padded in, they
+ * must leave from the ring with the padding gathered behind them
+ */
+#define SHORT_LEN	(ETH_HDR_LEN + sizeof(ip_header_t) + 8)
+
+static int bench_short(int packets){
+	uint8_t frame[FRAME_LEN];
+	uint8_t ring[SHORT_LEN];
+	int i = 0;
+
+	bench_buildFrame(frame, "10.1.2.3");
+	ip_header_t* ip = ip_getHeader(frame);
+	ip->ip_len = htons(SHORT_LEN - ETH_HDR_LEN);
+	ip->ip_sum = htons(ip_checksum(ip));
+
+	bench_sent_gathered = 0;
+	bench_sent_other = 0;
+	unsigned long mallocs = bench_mallocs;
+
+	double start = bench_now();
+	for (i = 0; i < packets; i++){
+		memcpy(ring, frame, SHORT_LEN);
+		pkt_buf_t* pkt = pkt_wrap(ring, SHORT_LEN);
+		bench_rx_data[0] = ring;
+		bench_rx_count = 1;
+		router_processPacket(&bench_sr, pkt, 0);
+		pkt_unref(pkt);
+	}
+	double elapsed = bench_now() - start;
+	mallocs = bench_mallocs - mallocs;
+
+	fprintf(stderr, "short: %d frames of %d bytes from a ring, %.1f ns/packet, %lu padded without copy, "
+		"%lu other frames, %lu mallocs\n",
+		packets, (int) SHORT_LEN, elapsed * 1e9 / packets, bench_sent_gathered, bench_sent_other, mallocs);
+
+	return bench_sent_gathered != (unsigned long) packets || bench_sent_other || mallocs;
+}
+
+/**
+ * pings of eth0's address, the reply must leave from the request's buffer
+ * with the addresses swapped and valid checksums
+ */
+static int bench_ping(int packets){
+	icmp_rate_t unlimited = { 0, 0 };
+	uint8_t frame[FRAME_LEN];
+	int payload_len = FRAME_LEN - ETH_HDR_LEN - sizeof(ip_header_t) - sizeof(icmp_header_t);
+	int i = 0;
+
+	icmp_setLimit(bench_router->icmp_limit, ICMP_LIMIT_ECHO_REPLY, &unlimited, &unlimited);
+
+	bench_buildFrame(frame, "192.168.0.1");
+	ip_header_t* ip = ip_getHeader(frame);
+	ip->ip_p = IP_PROTO_ICMP;
+	ip->ip_sum = htons(ip_checksum(ip));
+	icmp_header_t* icmp = icmp_getHeader(frame);
+	uint8_t* payload = (uint8_t*) (icmp + 1);
+	for (i = 0; i < payload_len; i++){
+		payload[i] = i;
+	}
+	icmp->icmp_type = ICMP_TYPE_ECHO_REQUEST;
+	icmp->icmp_code = ICMP_CODE_ECHO;
+	icmp->icmp_sum = htons(icmp_checksum(icmp, payload_len));
+
+	/*
+	 * look at one reply
+	 */
+	bench_rx_count = 0;
+	bench_sent_inplace = 0;
+	pkt_buf_t* pkt = bench_receive(frame);
+	router_processPacket(&bench_sr, pkt, 0);
+
+	eth_header_t* eth = (eth_header_t*) pkt->data;
+	ip_header_t* rip = ip_getHeader(pkt->data);
+	icmp_header_t* ricmp = icmp_getHeader(pkt->data);
+	uint16_t sum = ricmp->icmp_sum;
+	int reply_ok = bench_sent_inplace == 1 &&
+		!memcmp(eth->d_addr, ((eth_header_t*) frame)->s_addr, ETH_ADDR_LEN) &&
+		!memcmp(eth->s_addr, bench_router->if_list[0].addr, ETH_ADDR_LEN) &&
+		rip->ip_src.s_addr == ip->ip_dst.s_addr && rip->ip_dst.s_addr == ip->ip_src.s_addr &&
+		!ip_verifyChecksum((uint8_t*) rip, sizeof(ip_header_t)) &&
+		ricmp->icmp_type == ICMP_TYPE_ECHO_REPLY && htons(icmp_checksum(ricmp, payload_len)) == sum &&
+		!memcmp(ricmp + 1, payload, payload_len);
+	pkt_unref(pkt);
+
+	bench_sent_inplace = 0;
+	bench_sent_other = 0;
+	unsigned long mallocs = bench_mallocs;
+
+	double start = bench_now();
+	for (i = 0; i < packets; i++){
+		bench_rx_count = 0;
+		pkt = bench_receive(frame);
+		router_processPacket(&bench_sr, pkt, 0);
+		pkt_unref(pkt);
+	}
+	double elapsed = bench_now() - start;
+	mallocs = bench_mallocs - mallocs;
+
+	fprintf(stderr, "ping: %d echo requests, %.1f ns/packet, %lu replied in place, %lu other frames, %lu mallocs, reply %s\n",
+		packets, elapsed * 1e9 / packets, bench_sent_inplace, bench_sent_other, mallocs, reply_ok ? "ok" : "WRONG");
+
+	return !reply_ok || bench_sent_inplace != packets || bench_sent_other || mallocs;
+}
+
+/**
+ * time exceeded for packets TTL 1 frames, from count hosts of 192.168.0.0/24
+ * (ours is .1)
+ * @return errors
+ */
+static int bench_icmpStorm(const char* name, int packets, int count){
+	icmp_limiter_t* limiter = bench_router->icmp_limit;
+	icmp_limit_class_t* c = &limiter->cls[ICMP_LIMIT_TTL_EXCEEDED];
+	icmp_limit_stats_t before, after;
+	uint8_t frame[FRAME_LEN];
+	int i = 0;
+
+	bench_buildFrame(frame, "10.1.2.3");
+	ip_header_t* ip = ip_getHeader(frame);
+	ip->ip_ttl = 1;
+
+	icmp_getLimitStats(limiter, ICMP_LIMIT_TTL_EXCEEDED, &before);
+	bench_sent_other = 0;
+	unsigned long mallocs = bench_mallocs;
+
+	double start = bench_now();
+	for (i = 0; i < packets; i++){
+		ip->ip_src.s_addr = htonl(0xC0A80002 + i % count);
+		ip->ip_sum = htons(ip_checksum(ip));
+		bench_rx_count = 0;
+		pkt_buf_t* pkt = bench_receive(frame);
+		router_processPacket(&bench_sr, pkt, 0);
+		pkt_unref(pkt);
+	}
+	double elapsed = bench_now() - start;
+
+	mallocs = bench_mallocs - mallocs;
+	icmp_getLimitStats(limiter, ICMP_LIMIT_TTL_EXCEEDED, &after);
+	unsigned long sent = after.sent - before.sent;
+	unsigned long dropped = (after.drop_source - before.drop_source) + (after.drop_global - before.drop_global);
+
+	/*
+	 * one bucket is the tighter: the source's for one source, the global
+	 * one for many
+	 */
+	const icmp_rate_t* r = count == 1 ? &c->source : &c->global;
+	unsigned long allowed = r->burst + (unsigned long) (r->rate * elapsed) + 1;
+
+	fprintf(stderr, "icmp %s: %d packets from %d source(s), %.1f ns/packet, %lu time exceeded sent (at most %lu), "
+		"%lu dropped, %lu mallocs\n", name, packets, count, elapsed * 1e9 / packets, sent, allowed, dropped, mallocs);
+
+	/*
+	 * only the messages let through may allocate, a couple each
+	 */
+	return sent > allowed || bench_sent_other != sent || sent + dropped != packets || mallocs > 2 * sent;
+}
+
+static int bench_icmp(int packets){
+	char ip[INET_ADDRSTRLEN];
+	int errors = 0;
+	int i = 0;
+
+	/*
+	 * the sources are resolved, replies go straight out
+	 */
+	for (i = 2; i < 255; i++){
+		sprintf(ip, "192.168.0.%d", i);
+		bench_addNeighbor(bench_router, ip, i);
+	}
+
+	errors += bench_icmpStorm("source", packets, 1);
+
+	icmp_setLimitPrefix(bench_router->icmp_limit, 32);
+	errors += bench_icmpStorm("scan", packets, 253);
+	icmp_setLimitPrefix(bench_router->icmp_limit, ICMP_LIMIT_PREFIX_LEN);
+
+	return errors;
+}
+
+/*
+ * buffer pool: bursts on each thread, then buffers taken on one thread and
+ * released on another
+ */
+#define POOL_RING	1024
+
+typedef struct Bench_Pool {
+	int packets;
+	pkt_buf_t* ring[POOL_RING];
+	volatile unsigned int head;		/* written by the producer */
+	volatile unsigned int tail;		/* written by the consumer */
+} bench_pool_t;
+
+static void* bench_poolBursts(void* arg){
+	bench_pool_t* p = (bench_pool_t*) arg;
+	pkt_buf_t* burst[BENCH_BATCH];
+	int i = 0, j = 0;
+
+	for (i = 0; i < p->packets; i += BENCH_BATCH){
+		for (j = 0; j < BENCH_BATCH; j++){
+			burst[j] = pkt_alloc(FRAME_LEN);
+		}
+		for (j = 0; j < BENCH_BATCH; j++){
+			pkt_unref(burst[j]);
+		}
+	}
+	return NULL;
+}
+
+static void* bench_poolProduce(void* arg){
+	bench_pool_t* p = (bench_pool_t*) arg;
+	int i = 0;
+
+	for (i = 0; i < p->packets; i++){
+		while (p->head - __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE) == POOL_RING) {
+			sched_yield();
+		}
+		p->ring[p->head % POOL_RING] = pkt_alloc(FRAME_LEN);
+		__atomic_store_n(&p->head, p->head + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void* bench_poolConsume(void* arg){
+	bench_pool_t* p = (bench_pool_t*) arg;
+	int i = 0;
+
+	for (i = 0; i < p->packets; i++){
+		while (__atomic_load_n(&p->head, __ATOMIC_ACQUIRE) == p->tail) {
+			sched_yield();
+		}
+		pkt_unref(p->ring[p->tail % POOL_RING]);
+		__atomic_store_n(&p->tail, p->tail + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/**
+ * run threads, fn of each on its own bench_pool_t or, if shared, all on the
+ * first one
+ * @return seconds taken
+ */
+static double bench_poolRun(int threads, void* (*fn[])(void*), bench_pool_t* pools, int shared, int packets){
+	pthread_t tids[NUM_INTERFACES];
+	int i = 0;
+
+	double start = bench_now();
+	for (i = 0; i < threads; i++){
+		bench_pool_t* p = &pools[shared ? 0 : i];
+		p->packets = packets;
+		p->head = p->tail = 0;
+		if (pthread_create(&tids[i], NULL, fn[i], p) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < threads; i++){
+		pthread_join(tids[i], NULL);
+	}
+	return bench_now() - start;
+}
+
+static int bench_pool(int packets){
+	static bench_pool_t pools[NUM_INTERFACES];
+	void* (*bursts[NUM_INTERFACES])(void*);
+	void* (*pair[2])(void*) = { bench_poolProduce, bench_poolConsume };
+	pkt_stats_t before, after;
+	int errors = 0;
+	int i = 0;
+
+	for (i = 0; i < NUM_INTERFACES; i++){
+		bursts[i] = bench_poolBursts;
+	}
+
+	/*
+	 * warm the slabs, then count
+	 */
+	bench_poolRun(NUM_INTERFACES, bursts, pools, 0, BENCH_BATCH);
+	pkt_getStats(&before);
+	double run = bench_poolRun(NUM_INTERFACES, bursts, pools, 0, packets);
+	pkt_getStats(&after);
+	fprintf(stderr, "pool bursts: %d threads, %.1f ns/buffer on each, %.1f%% from the own list, %lu mallocs, %lu in use\n",
+		NUM_INTERFACES, run * 1e9 / packets, 100.0 * (after.cache_hits - before.cache_hits) / (after.allocs - before.allocs),
+		after.mallocs - before.mallocs, after.in_use);
+	errors += after.mallocs != before.mallocs || after.in_use != 0;
+
+	/*
+	 * the producer's list runs dry and the consumer's overflows, both go
+	 * through the shared list in batches
+	 */
+	bench_poolRun(2, pair, pools, 1, POOL_RING * 2);
+	pkt_getStats(&before);
+	run = bench_poolRun(2, pair, pools, 1, packets);
+	pkt_getStats(&after);
+	fprintf(stderr, "pool handoff: %.1f ns/buffer, %.1f%% from the own list, %lu mallocs, %lu in use, "
+		"%lu of %lu buffers in %lu slabs, %lu free shared\n",
+		run * 1e9 / packets, 100.0 * (after.cache_hits - before.cache_hits) / (after.allocs - before.allocs),
+		after.mallocs - before.mallocs, after.in_use, after.capacity - after.pooled - after.cached,
+		after.capacity, after.slabs, after.pooled);
+	errors += after.mallocs != before.mallocs || after.in_use != 0 || after.capacity > PKT_POOL_MAX;
+
+	return errors;
+}
+
+int main(int argc, char** argv){
+	int packets = DEFAULT_PACKETS;
+	if (argc > 1) {
+		packets = atoi(argv[1]);
+	}
+
+	/*
+	 * the router traces every packet on stdout
+	 */
+	if (!freopen("/dev/null", "w", stdout)) {
+		perror("freopen");
+		return 1;
+	}
+
+	bench_createRouter();
+
+	int errors = 0;
+	errors += bench_forward(packets);
+	errors += bench_batch(packets);
+	errors += bench_workers(packets);
+	errors += bench_park();
+	errors += bench_short(packets);
+	errors += bench_ping(packets);
+	errors += bench_icmp(packets);
+	errors += bench_pool(packets);
+
+	return errors ? 1 : 0;
+}
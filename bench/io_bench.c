@@ -0,0 +1,151 @@
+/**
+ * @file io_bench.c
+ * @author Mohammad Reza Hosseini
+ *
+ * cpu mode packet i/o backends on a veth pair, no NetFPGA needed.  For each
+ * backend a burst of minimum size frames is sent through tx on one end and
+ * then drained through rx/rxDone on the other, checking every frame arrives
+ * in order and counting how many were handed out without a copy.
+ *
+ *   ip link add vethA type veth peer name vethB
+ *   ip link set vethA up; ip link set vethB up
+ *   bench/io_bench vethA vethB
+ *
+ * usage: io_bench <rx iface> <tx iface> [frames] [batch] [backend]
+ */
+
+#include "router.h"
+#include "cpu_io.h"
+#include "packet.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_FRAMES	20000
+#define FRAME_LEN	60
+#define BENCH_ETHERTYPE	0x88B5	/* local experimental, ignored by the stack */
+
+static void bench_send(const cpu_io_t* io, router_t* router, int count, int batch){
+	uint8_t frames[batch][FRAME_LEN];
+	uint8_t* bufs[batch];
+	unsigned int lens[batch];
+	int seq = 0;
+	int i = 0;
+
+	memset(frames, 0, sizeof(frames));
+	for (i = 0; i < batch; i++){
+		memset(frames[i], 0xff, 6);
+		frames[i][6] = 0x02;
+		frames[i][12] = BENCH_ETHERTYPE >> 8;
+		frames[i][13] = BENCH_ETHERTYPE & 0xff;
+		lens[i] = FRAME_LEN;
+	}
+
+	double start = bench_now();
+	while (seq < count) {
+		int n = count - seq < batch ? count - seq : batch;
+		for (i = 0; i < n; i++){
+			uint32_t s = htonl(seq + i);
+			memcpy(frames[i] + 14, &s, sizeof(s));
+			bufs[i] = frames[i];
+		}
+
+		/* -- a full ring takes a moment to drain, try again -- */
+		int sent = io->tx(router, 1, bufs, lens, n);
+		if (sent > 0) {
+			seq += sent;
+		}
+	}
+	double elapsed = bench_now() - start;
+
+	printf("%-7s tx: %8d frames, %6.3f Mpps\n", io->name, count, count / elapsed / 1e6);
+}
+
+static void bench_receive(const cpu_io_t* io, router_t* router, int count, int batch){
+	pkt_buf_t* pkts[batch];
+	pkt_buf_t* kept = NULL;
+	uint8_t kept_copy[FRAME_LEN];
+	int frames = 0, in_order = 0, zero_copy = 0;
+	uint32_t expect = 0;
+	int i = 0;
+
+	double start = bench_now();
+	double idle_since = start;
+	double last = start;
+	while (frames < count && bench_now() - idle_since < 0.1) {
+		int n = io->rx(router, 0, pkts, batch);
+		if (n <= 0) {
+			continue;
+		}
+		idle_since = last = bench_now();
+
+		for (i = 0; i < n; i++){
+			uint8_t* data = pkts[i]->data;
+			if (data[12] != (BENCH_ETHERTYPE >> 8) || data[13] != (BENCH_ETHERTYPE & 0xff)) {
+				continue;
+			}
+			uint32_t s;
+			memcpy(&s, data + 14, sizeof(s));
+			in_order += ntohl(s) == expect;
+			expect = ntohl(s) + 1;
+			zero_copy += pkts[i]->external;
+			frames++;
+		}
+
+		/*
+		 * hold on to one frame past rxDone, as the ARP queue would: it has
+		 * to come out of the ring intact
+		 */
+		if (!kept && pkts[0]->len == FRAME_LEN) {
+			kept = pkt_ref(pkts[0]);
+			memcpy(kept_copy, kept->data, FRAME_LEN);
+		}
+		io->rxDone(router, 0, pkts, n);
+	}
+
+	int kept_ok = kept && !kept->external && !memcmp(kept->data, kept_copy, FRAME_LEN);
+	pkt_unref(kept);
+
+	printf("%-7s rx: %8d frames, %6.3f Mpps, %d in order, %d without copy, kept frame %s\n",
+		io->name, frames, frames / (last - start) / 1e6, in_order, zero_copy, kept_ok ? "intact" : "BROKEN");
+}
+
+int main(int argc, char** argv){
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <rx iface> <tx iface> [frames] [batch] [backend]\n", argv[0]);
+		return 1;
+	}
+
+	int count = argc > 3 ? atoi(argv[3]) : DEFAULT_FRAMES;
+	int batch = argc > 4 ? atoi(argv[4]) : SR_DEFAULT_RX_BATCH;
+	const char* names[] = { "socket", "mmap", "xdp", NULL };
+	int i = 0;
+
+	for (i = 0; names[i]; i++){
+		if (argc > 5 && strcmp(argv[5], names[i])) {
+			continue;
+		}
+
+		const cpu_io_t* io = cpu_io_find(names[i]);
+		router_t* router = (router_t*) calloc(1, sizeof(router_t));
+		router->sockfd[0] = io->open(router, 0, argv[1], batch);
+		router->sockfd[1] = io->open(router, 1, argv[2], batch);
+
+		/*
+		 * the whole burst has to fit in the receive queue (the mmap ring
+		 * is sized for it)
+		 */
+		int rcvbuf = 1 << 30;
+		setsockopt(router->sockfd[0], SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf));
+
+		bench_send(io, router, count, batch);
+		bench_receive(io, router, count, batch);
+	}
+
+	return 0;
+}
@@ -0,0 +1,256 @@
+/**
+ * @file reactor_bench.c
+ * @author Mohammad Reza Hosseini
+ *
+ * reactor benchmark: four datagram socket pairs stand in for the ports of a
+ * worker. A feeder thread floods them while the reactor reads them, which
+ * gives the cost per frame of epoll dispatch next to a select(..) loop over
+ * the same sockets. Meanwhile another thread arms a burst of short timers on
+ * a wheel run by the reactor and posts numbered calls to it; every timer
+ * must fire with little lateness and the calls must run in posting order.
+ *
+ * usage: reactor_bench [frames]
+ */
+
+#include "reactor.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#define DEFAULT_FRAMES	400000
+#define PORTS		4
+#define FRAME_LEN	64
+#define TIMERS		1000
+#define TIMER_SPREAD	200		/* ms */
+#define CALLS		10000
+
+static int bench_fds[PORTS][2];		/* [0] read by the loop, [1] fed */
+static int bench_frames;
+
+/*
+ * feeder: round robin over the ports, backing off when a socket is full
+ */
+static void* bench_feed(void* arg){
+	char frame[FRAME_LEN];
+	int sent = 0;
+
+	memset(frame, 0xab, sizeof(frame));
+	while (sent < bench_frames) {
+		if (send(bench_fds[sent % PORTS][1], frame, sizeof(frame), MSG_DONTWAIT) < 0) {
+			if (errno == EAGAIN) {
+				sched_yield();
+				continue;
+			}
+			perror("send");
+			exit(1);
+		}
+		sent++;
+	}
+
+	return NULL;
+}
+
+/**
+ * drain one port the way a worker takes a batch
+ * @return frames read
+ */
+static int bench_drain(int fd){
+	char frame[FRAME_LEN];
+	int n = 0;
+
+	while (n < 32 && recv(fd, frame, sizeof(frame), MSG_DONTWAIT) > 0) {
+		n++;
+	}
+	return n;
+}
+
+/*
+ * timers armed from another thread, run on the reactor
+ */
+static pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t bench_maxLate;
+static uint64_t bench_totalLate;
+static int bench_timersFired;
+
+static void bench_fire(void* arg, uintptr_t data){
+	uint64_t late = timer_now() - (uint64_t) data;
+
+	pthread_mutex_lock(&bench_lock);
+	if (late > bench_maxLate) {
+		bench_maxLate = late;
+	}
+	bench_totalLate += late;
+	bench_timersFired++;
+	pthread_mutex_unlock(&bench_lock);
+}
+
+/*
+ * numbered calls, posted from another thread
+ */
+static int bench_callsRun;
+static int bench_callsOutOfOrder;
+
+static void bench_call(void* arg){
+	if ((intptr_t) arg != bench_callsRun) {
+		bench_callsOutOfOrder++;
+	}
+	bench_callsRun++;
+}
+
+typedef struct Bench_Arm {
+	reactor_t* r;
+	timer_wheel_t* w;
+	timer_entry_t* timers;
+} bench_arm_t;
+
+static void* bench_arm(void* arg){
+	bench_arm_t* a = (bench_arm_t*) arg;
+	uint64_t base = timer_now();
+	int i = 0;
+
+	for (i = 0; i < TIMERS; i++){
+		uint64_t expires = base + 1 + rand() % TIMER_SPREAD;
+		timer_init(&a->timers[i], bench_fire, NULL, expires);
+		timer_scheduleAt(a->w, &a->timers[i], expires);
+	}
+	for (i = 0; i < CALLS; i++){
+		reactor_post(a->r, bench_call, (void*) (intptr_t) i);
+	}
+
+	return NULL;
+}
+
+/*
+ * reactor side
+ */
+static int bench_received;
+
+static void bench_ready(reactor_t* r, reactor_handler_t* h, uint32_t events){
+	bench_received += bench_drain(h->fd);
+}
+
+static int bench_reactor(void){
+	reactor_t* r = reactor_create(0);
+	timer_wheel_t* w = timer_createWheel();
+	timer_entry_t* timers = (timer_entry_t*) calloc(TIMERS, sizeof(timer_entry_t));
+	bench_arm_t arm = { r, w, timers };
+	reactor_stats_t stats;
+	pthread_t feeder, armer;
+	int i = 0;
+
+	for (i = 0; i < PORTS; i++){
+		reactor_add(r, bench_fds[i][0], EPOLLIN, bench_ready, NULL);
+	}
+	reactor_setWheel(r, w);
+
+	double start = bench_now();
+	if (pthread_create(&feeder, NULL, bench_feed, NULL) != 0 ||
+			pthread_create(&armer, NULL, bench_arm, &arm) != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	while (bench_received < bench_frames) {
+		reactor_runOnce(r, 100);
+	}
+	double run = bench_now() - start;
+	pthread_join(feeder, NULL);
+	pthread_join(armer, NULL);
+
+	/*
+	 * let the rest of the timers and calls come in
+	 */
+	uint64_t deadline = timer_now() + TIMER_SPREAD + 5000;
+	while ((bench_timersFired < TIMERS || bench_callsRun < CALLS) && timer_now() < deadline) {
+		reactor_runOnce(r, 100);
+	}
+	stats = r->stats;
+
+	fprintf(stderr, "reactor: %d frames on %d ports, %.1f ns/frame, %.1f frames/wait, "
+		"%d/%d timers, %.2f ms mean lateness, %llu ms max, %d/%d calls, %d out of order, %lu wakeups\n",
+		bench_received, PORTS, run * 1e9 / bench_received, (double) bench_received / stats.waits,
+		bench_timersFired, TIMERS, bench_timersFired ? (double) bench_totalLate / bench_timersFired : 0.0,
+		(unsigned long long) bench_maxLate, bench_callsRun, CALLS, bench_callsOutOfOrder, stats.wakeups);
+
+	/*
+	 * a callback before its tick would show as a huge lateness
+	 */
+	return bench_timersFired != TIMERS || bench_maxLate > TIMER_SPREAD + 5000 ||
+		bench_callsRun != CALLS || bench_callsOutOfOrder != 0;
+}
+
+/*
+ * the loop it replaces
+ */
+static int bench_select(void){
+	pthread_t feeder;
+	fd_set read_set;
+	int received = 0;
+	int waits = 0;
+	int i = 0;
+
+	double start = bench_now();
+	if (pthread_create(&feeder, NULL, bench_feed, NULL) != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	FD_ZERO(&read_set);
+	while (received < bench_frames) {
+		int nfd = 0;
+		for (i = 0; i < PORTS; i++){
+			FD_SET(bench_fds[i][0], &read_set);
+			if (bench_fds[i][0] >= nfd) {
+				nfd = bench_fds[i][0] + 1;
+			}
+		}
+		if (select(nfd, &read_set, NULL, NULL, NULL) < 0) {
+			perror("select");
+			return 1;
+		}
+		waits++;
+		for (i = 0; i < PORTS; i++){
+			if (FD_ISSET(bench_fds[i][0], &read_set)) {
+				received += bench_drain(bench_fds[i][0]);
+			}
+		}
+	}
+	double run = bench_now() - start;
+	pthread_join(feeder, NULL);
+
+	fprintf(stderr, "select: %d frames on %d ports, %.1f ns/frame, %.1f frames/wait\n",
+		received, PORTS, run * 1e9 / received, (double) received / waits);
+
+	return received != bench_frames;
+}
+
+int main(int argc, char** argv){
+	int i = 0;
+
+	bench_frames = DEFAULT_FRAMES;
+	if (argc > 1) {
+		bench_frames = atoi(argv[1]);
+	}
+
+	for (i = 0; i < PORTS; i++){
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, bench_fds[i]) < 0) {
+			perror("socketpair");
+			return 1;
+		}
+	}
+
+	int errors = 0;
+	errors += bench_select();
+	errors += bench_reactor();
+
+	return errors ? 1 : 0;
+}
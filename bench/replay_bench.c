@@ -0,0 +1,571 @@
+/**
+ * @file replay_bench.c
+ * @author Mohammad Reza Hosseini
+ *
+ * pcap replay benchmark: the whole router behind sr_integ_input, without
+ * sockets. The interfaces come from a cpuhw style file and the routes from
+ * an rtable file, through the same sr_integ_add_interface and rtable_init
+ * the router starts with. The frames of a classic pcap are copied into
+ * packet buffers and fed to sr_integ_input (or sr_integ_input_batch with -b)
+ * in a tight loop, each on the port a mapping file picks for it, addressed
+ * to that port's MAC unless -k keeps the captured one.
+ *
+ * Output is caught below sr_integ_low_level_output, at the cpu mode
+ * sr_cpu_output* calls, and counted per port. ARP requests are answered by
+ * feeding replies back in during a warm-up pass, so the measured passes
+ * find their next hops resolved. Every frame sent is hashed into a
+ * fingerprint that two builds of the router can be compared by.
+ *
+ * A first run times each call and reports ns/packet percentiles, a second
+ * one runs untimed for Mpps and mallocs per packet. Router logging goes to
+ * stdout, which is worth sending to /dev/null; results go to stderr.
+ *
+ * The mapping file has one rule per line, the first match wins:
+ *
+ *   12-40 eth1                 packets 12 to 40, 1 based as in a capture viewer
+ *   00:11:22:33:44:55 eth2     frames from this source MAC
+ *   * eth0                     everything else (the default is the first port)
+ *
+ * usage: replay_bench [-H hw file] [-r rtable] [-m mapping file] [-n packets]
+ *                     [-b batch] [-k] file.pcap
+ */
+
+#include "router.h"
+#include "arp.h"
+#include "ethernet.h"
+#include "rtable.h"
+#include "packet.h"
+#include "sr_integration.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PACKETS	1000000
+#define MAX_BATCH	256
+#define MAX_RULES	256
+#define MAX_FRAME	(PKT_BUF_SIZE - PKT_HEADROOM)
+#define ETH_HLEN	14
+#define WARMUP_PASSES	3
+
+
+/*
+ * count every allocation made by the code under test
+ */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long bench_mallocs = 0;
+
+void* malloc(size_t size){
+	__atomic_add_fetch(&bench_mallocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size){
+	__atomic_add_fetch(&bench_mallocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size){
+	__atomic_add_fetch(&bench_mallocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+
+/*
+ * the pieces of sr_base.c the integration layer and the router call into
+ */
+static struct sr_instance bench_sr;
+
+void* sr_get_subsystem(struct sr_instance* sr){
+	return sr->interface_subsystem;
+}
+
+void sr_set_subsystem(struct sr_instance* sr, void* core){
+	sr->interface_subsystem = core;
+}
+
+struct sr_instance* sr_get_global_instance(struct sr_instance* sr){
+	return &bench_sr;
+}
+
+
+/*
+ * output, one level below sr_integ_low_level_output
+ */
+typedef struct Bench_Port {
+	unsigned long frames;
+	unsigned long bytes;
+} bench_port_t;
+
+static bench_port_t bench_out[NUM_INTERFACES];
+static uint64_t bench_fingerprint = 14695981039346656037ULL;
+
+/*
+ * next hops the router asked for, answered between warm-up passes
+ */
+static struct {
+	uint32_t ip;
+	int port;
+} bench_arpAsked[1024];
+static int bench_arpCount;
+
+static void bench_hash(const uint8_t* p, unsigned int len){
+	unsigned int i = 0;
+
+	for (i = 0; i < len; i++){
+		bench_fingerprint = (bench_fingerprint ^ p[i]) * 1099511628211ULL;
+	}
+}
+
+/**
+ * note an ARP request for a next hop, once
+ */
+static void bench_noteArp(const uint8_t* frame, unsigned int len, int port){
+	uint32_t tip;
+	int i = 0;
+
+	if (len < ETH_HLEN + 28 || frame[12] != 0x08 || frame[13] != 0x06 || frame[ETH_HLEN + 7] != ARP_OP_REQUEST) {
+		return;
+	}
+	memcpy(&tip, frame + ETH_HLEN + 24, 4);
+	for (i = 0; i < bench_arpCount; i++){
+		if (bench_arpAsked[i].ip == tip) {
+			return;
+		}
+	}
+	if (bench_arpCount < (int) (sizeof(bench_arpAsked) / sizeof(bench_arpAsked[0]))) {
+		bench_arpAsked[bench_arpCount].ip = tip;
+		bench_arpAsked[bench_arpCount].port = port;
+		bench_arpCount++;
+	}
+}
+
+static void bench_sent(const uint8_t* frame, unsigned int len, int port){
+	bench_out[port].frames++;
+	bench_out[port].bytes += len;
+	bench_hash(frame, len);
+	bench_noteArp(frame, len, port);
+}
+
+int sr_cpu_output(struct sr_instance* sr, uint8_t* buf, unsigned int len, int port){
+	bench_sent(buf, len, port);
+	return len;
+}
+
+int sr_cpu_output_batch(struct sr_instance* sr, uint8_t** bufs, unsigned int* lens, int count, int port){
+	int i = 0;
+
+	for (i = 0; i < count; i++){
+		bench_sent(bufs[i], lens[i], port);
+	}
+	return count;
+}
+
+int sr_cpu_outputv(struct sr_instance* sr, const struct iovec* iov, int iovcnt, int port){
+	uint8_t frame[PKT_BUF_SIZE];
+	unsigned int len = 0;
+	int i = 0;
+
+	for (i = 0; i < iovcnt && len + iov[i].iov_len <= sizeof(frame); i++){
+		memcpy(frame + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	bench_sent(frame, len, port);
+	return len;
+}
+
+
+/*
+ * input: the capture and the port of each of its frames
+ */
+typedef struct Bench_Frame {
+	uint8_t* data;
+	unsigned int len;
+	int port;
+} bench_frame_t;
+
+typedef struct Bench_Rule {
+	unsigned long first, last;	/* packet numbers, 0: match by mac */
+	uint8_t mac[ETH_ADDR_LEN];
+	int any;
+	int port;
+} bench_rule_t;
+
+static bench_rule_t bench_rules[MAX_RULES];
+static int bench_nrules;
+
+/**
+ * add the interfaces of the cpuhw file to the router
+ */
+static int bench_addInterfaces(const char* file){
+	bench_hw_t hw[NUM_INTERFACES];
+	struct sr_vns_if vns_if;
+	int count = bench_readHw(file, hw, NUM_INTERFACES);
+	int i = 0;
+
+	if (count < 0) {
+		return -1;
+	}
+	if (count == 0) {
+		fprintf(stderr, "%s: no interfaces\n", file);
+		return -1;
+	}
+	for (i = 0; i < count; i++){
+		memset(&vns_if, 0, sizeof(vns_if));
+		memcpy(vns_if.name, hw[i].name, SR_NAMELEN);
+		vns_if.ip = hw[i].ip;
+		vns_if.mask = hw[i].mask;
+		memcpy(vns_if.addr, hw[i].mac, ETH_ADDR_LEN);
+		vns_if.speed = 1000;
+		sr_integ_add_interface(&bench_sr, &vns_if);
+	}
+	return 0;
+}
+
+static int bench_readMap(const char* file){
+	FILE* fp = fopen(file, "r");
+	char line[256], key[64], name[SR_NAMELEN];
+	unsigned int m[ETH_ADDR_LEN];
+	int i = 0;
+
+	if (!fp) {
+		perror(file);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%63s %31s", key, name) != 2 || key[0] == '#') {
+			continue;
+		}
+		if (bench_nrules == MAX_RULES) {
+			fprintf(stderr, "%s: more than %d rules\n", file, MAX_RULES);
+			break;
+		}
+
+		bench_rule_t* rule = &bench_rules[bench_nrules];
+		memset(rule, 0, sizeof(*rule));
+		rule->port = sr_integ_getPort(&bench_sr, name);
+		if (rule->port < 0) {
+			fprintf(stderr, "%s: no interface %s\n", file, name);
+			fclose(fp);
+			return -1;
+		}
+
+		if (strcmp(key, "*") == 0) {
+			rule->any = 1;
+		} else if (sscanf(key, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) == 6) {
+			for (i = 0; i < ETH_ADDR_LEN; i++){
+				rule->mac[i] = m[i];
+			}
+		} else if (sscanf(key, "%lu-%lu", &rule->first, &rule->last) == 2 ||
+				sscanf(key, "%lu", &rule->first) == 1) {
+			if (rule->last < rule->first) {
+				rule->last = rule->first;
+			}
+		} else {
+			fprintf(stderr, "%s: bad rule %s\n", file, key);
+			fclose(fp);
+			return -1;
+		}
+		bench_nrules++;
+	}
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * port of packet number n (1 based) by the first rule that matches
+ */
+static int bench_mapPort(unsigned long n, const uint8_t* frame){
+	int i = 0;
+
+	for (i = 0; i < bench_nrules; i++){
+		bench_rule_t* rule = &bench_rules[i];
+		if (rule->any ||
+				(rule->first && n >= rule->first && n <= rule->last) ||
+				(!rule->first && memcmp(frame + ETH_ADDR_LEN, rule->mac, ETH_ADDR_LEN) == 0)) {
+			return rule->port;
+		}
+	}
+	return 0;
+}
+
+/**
+ * classic pcap, either byte order, micro or nanosecond stamps
+ * @return frames read, -1 on error
+ */
+static int bench_readPcap(const char* file, bench_frame_t** frames, int keep_mac){
+	router_t* router = (router_t*) sr_get_subsystem(&bench_sr);
+	FILE* fp = fopen(file, "rb");
+	uint32_t gh[6];
+	uint32_t rh[4];
+	unsigned long n = 0;
+	int swap = 0;
+	int count = 0;
+	int cap = 0;
+
+	if (!fp) {
+		perror(file);
+		return -1;
+	}
+	if (fread(gh, sizeof(gh), 1, fp) != 1) {
+		fprintf(stderr, "%s: short header\n", file);
+		fclose(fp);
+		return -1;
+	}
+	if (gh[0] == 0xa1b2c3d4 || gh[0] == 0xa1b23c4d) {
+		swap = 0;
+	} else if (gh[0] == 0xd4c3b2a1 || gh[0] == 0x4d3cb2a1) {
+		swap = 1;
+	} else {
+		fprintf(stderr, "%s: not a pcap file\n", file);
+		fclose(fp);
+		return -1;
+	}
+	if ((swap ? __builtin_bswap32(gh[5]) : gh[5]) != 1) {
+		fprintf(stderr, "%s: not an ethernet capture\n", file);
+		fclose(fp);
+		return -1;
+	}
+
+	*frames = NULL;
+	while (fread(rh, sizeof(rh), 1, fp) == 1) {
+		uint32_t caplen = swap ? __builtin_bswap32(rh[2]) : rh[2];
+		if (caplen > 65535) {
+			fprintf(stderr, "%s: bogus record\n", file);
+			fclose(fp);
+			return -1;
+		}
+		uint8_t* data = (uint8_t*) __libc_malloc(caplen ? caplen : 1);
+		if (fread(data, 1, caplen, fp) != caplen) {
+			free(data);
+			break;
+		}
+		n++;
+		if (caplen < ETH_HLEN || caplen > MAX_FRAME) {
+			free(data);
+			continue;
+		}
+
+		if (count == cap) {
+			cap = cap ? cap * 2 : 1024;
+			*frames = (bench_frame_t*) __libc_realloc(*frames, cap * sizeof(bench_frame_t));
+		}
+		bench_frame_t* f = &(*frames)[count++];
+		f->data = data;
+		f->len = caplen;
+		f->port = bench_mapPort(n, data);
+		if (!keep_mac) {
+			memcpy(data, router->if_list[f->port].addr, ETH_ADDR_LEN);
+		}
+	}
+	fclose(fp);
+
+	return count;
+}
+
+
+/*
+ * the receive loop
+ */
+
+static pkt_buf_t* bench_receive(const bench_frame_t* f){
+	pkt_buf_t* pkt = pkt_alloc(f->len);
+	memcpy(pkt->data, f->data, f->len);
+	return pkt;
+}
+
+/**
+ * feed packets frames, from frame first on, batch at a time
+ * @param ns	if set, the ns each packet took (a batch is spread evenly)
+ */
+static void bench_run(bench_frame_t* frames, int nframes, unsigned long packets, int batch, uint64_t* ns){
+	pkt_buf_t* pkts[MAX_BATCH];
+	int ports[MAX_BATCH];
+	unsigned long done = 0;
+	int next = 0;
+	int i = 0;
+
+	while (done < packets) {
+		int count = packets - done < (unsigned long) batch ? (int) (packets - done) : batch;
+
+		for (i = 0; i < count; i++){
+			pkts[i] = bench_receive(&frames[next]);
+			ports[i] = frames[next].port;
+			next = next + 1 == nframes ? 0 : next + 1;
+		}
+
+		uint64_t start = ns ? bench_ns() : 0;
+		if (batch == 1) {
+			sr_integ_input(&bench_sr, pkts[0], ports[0]);
+		} else {
+			sr_integ_input_batch(&bench_sr, pkts, ports, count);
+		}
+		if (ns) {
+			uint64_t each = (bench_ns() - start) / count;
+			for (i = 0; i < count; i++){
+				ns[done + i] = each;
+			}
+		}
+
+		for (i = 0; i < count; i++){
+			pkt_unref(pkts[i]);
+		}
+		done += count;
+	}
+}
+
+/**
+ * answer the ARP requests seen so far, as the next hops would
+ */
+static void bench_answerArps(void){
+	router_t* router = (router_t*) sr_get_subsystem(&bench_sr);
+	static int answered = 0;
+
+	for (; answered < bench_arpCount; answered++){
+		interface_t* iface = &router->if_list[bench_arpAsked[answered].port];
+		pkt_buf_t* pkt = pkt_alloc(PKT_MIN_LEN);
+		uint8_t* f = pkt->data;
+		uint8_t mac[ETH_ADDR_LEN] = { 0x02, 0x00 };
+
+		memcpy(mac + 2, &bench_arpAsked[answered].ip, 4);
+		memset(f, 0, PKT_MIN_LEN);
+		memcpy(f, iface->addr, ETH_ADDR_LEN);
+		memcpy(f + ETH_ADDR_LEN, mac, ETH_ADDR_LEN);
+		f[12] = 0x08;
+		f[13] = 0x06;
+
+		uint8_t* a = f + ETH_HLEN;
+		a[1] = 1;			/* ethernet */
+		a[2] = 0x08;			/* IPv4 */
+		a[4] = ETH_ADDR_LEN;
+		a[5] = 4;
+		a[7] = ARP_OP_REPLY;
+		memcpy(a + 8, mac, ETH_ADDR_LEN);
+		memcpy(a + 14, &bench_arpAsked[answered].ip, 4);
+		memcpy(a + 18, iface->addr, ETH_ADDR_LEN);
+		memcpy(a + 24, &iface->ip, 4);
+
+		sr_integ_input(&bench_sr, pkt, bench_arpAsked[answered].port);
+		pkt_unref(pkt);
+	}
+}
+
+static void usage(const char* argv0){
+	fprintf(stderr, "usage: %s [-H hw file] [-r rtable] [-m mapping file] [-n packets]\n"
+		"       [-b batch (1: sr_integ_input)] [-k (keep captured MACs)] file.pcap\n", argv0);
+}
+
+int main(int argc, char** argv){
+	const char* hw_file = "cpuhw";
+	const char* rtable = "rtable";
+	const char* map_file = NULL;
+	unsigned long packets = DEFAULT_PACKETS;
+	bench_frame_t* frames = NULL;
+	int batch = 1;
+	int keep_mac = 0;
+	int c = 0;
+	int i = 0;
+
+	while ((c = getopt(argc, argv, "hH:r:m:n:b:k")) != EOF) {
+		switch (c) {
+			case 'H': hw_file = optarg; break;
+			case 'r': rtable = optarg; break;
+			case 'm': map_file = optarg; break;
+			case 'n': packets = strtoul(optarg, NULL, 10); break;
+			case 'b': batch = atoi(optarg); break;
+			case 'k': keep_mac = 1; break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1 || batch < 1 || batch > MAX_BATCH || packets == 0 || strlen(rtable) >= SR_NAMELEN) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/*
+	 * the router as sr_init_instance and the hardware setup build it,
+	 * minus the ports and the timer thread
+	 */
+	bench_sr.sockfd = -1;
+	bench_sr.rx_batch = batch;
+	bench_sr.arp_queue_len = SR_DEFAULT_ARP_QUEUE_LEN;
+	bench_sr.arp_drop_oldest = 1;
+	bench_sr.icmp_rate = -1;
+	bench_sr.icmp_source_rate = -1;
+	bench_sr.icmp_prefix_len = SR_DEFAULT_ICMP_PREFIX_LEN;
+	strncpy(bench_sr.rtable, rtable, SR_NAMELEN - 1);
+	sr_integ_init(&bench_sr);
+	if (bench_addInterfaces(hw_file) < 0) {
+		return 1;
+	}
+	rtable_init(&bench_sr);
+	if (map_file && bench_readMap(map_file) < 0) {
+		return 1;
+	}
+
+	int nframes = bench_readPcap(argv[optind], &frames, keep_mac);
+	if (nframes <= 0) {
+		fprintf(stderr, "%s: no frames to replay\n", argv[optind]);
+		return 1;
+	}
+
+	/*
+	 * resolve the next hops: every pass answers what the one before asked
+	 */
+	for (i = 0; i < WARMUP_PASSES; i++){
+		bench_run(frames, nframes, nframes, batch, NULL);
+		bench_answerArps();
+	}
+
+	uint64_t* ns = (uint64_t*) __libc_malloc(packets * sizeof(uint64_t));
+	if (!ns) {
+		perror("malloc");
+		return 1;
+	}
+	bench_run(frames, nframes, packets, batch, ns);
+	qsort(ns, packets, sizeof(uint64_t), bench_cmp);
+
+	memset(bench_out, 0, sizeof(bench_out));
+	bench_fingerprint = 14695981039346656037ULL;
+	unsigned long mallocs = bench_mallocs;
+	double start = bench_now();
+	bench_run(frames, nframes, packets, batch, NULL);
+	double run = bench_now() - start;
+	mallocs = bench_mallocs - mallocs;
+
+	router_t* router = (router_t*) sr_get_subsystem(&bench_sr);
+	unsigned long sent = 0;
+	for (i = 0; i < router->if_list_index; i++){
+		sent += bench_out[i].frames;
+	}
+
+	fprintf(stderr, "%s: %d frames replayed to %lu packets through %s (batch %d), %.2f Mpps, "
+		"%.1f ns/packet, %.3f mallocs/packet\n",
+		argv[optind], nframes, packets, batch == 1 ? "sr_integ_input" : "sr_integ_input_batch", batch,
+		packets / run / 1e6, run * 1e9 / packets, (double) mallocs / packets);
+	fprintf(stderr, "ns/packet: p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+		(unsigned long long) ns[packets / 2], (unsigned long long) ns[packets * 9 / 10],
+		(unsigned long long) ns[packets * 99 / 100], (unsigned long long) ns[packets * 999 / 1000],
+		(unsigned long long) ns[packets - 1]);
+	fprintf(stderr, "sent %lu frames (%.3f per packet), fingerprint %016llx, %d next hops resolved\n",
+		sent, (double) sent / packets, (unsigned long long) bench_fingerprint, bench_arpCount);
+	for (i = 0; i < router->if_list_index; i++){
+		fprintf(stderr, "  %s: %lu frames, %lu bytes out\n", router->if_list[i].name,
+			bench_out[i].frames, bench_out[i].bytes);
+	}
+
+	/*
+	 * a capture none of which gets through points at the setup, not the router
+	 */
+	return sent == 0;
+}
@@ -0,0 +1,219 @@
+/**
+ * @file rx_bench.c
+ * @author Mohammad Reza Hosseini
+ *
+ * receive rate of a raw PF_PACKET socket with the two cpu mode receive loops:
+ * select() + read() per frame, and recvmmsg() batches (blocking in select or
+ * busy polling).  A burst of minimum size frames is queued through the peer
+ * of a veth pair, so no NetFPGA is needed:
+ *
+ *   ip link add vethA type veth peer name vethB
+ *   ip link set vethA up; ip link set vethB up
+ *   bench/rx_bench vethA vethB
+ *
+ * usage: rx_bench <rx iface> <tx iface> [frames] [batch]
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#define DEFAULT_FRAMES	200000
+#define FRAME_LEN	60
+#define TX_BATCH	64
+#define BUF_SIZE	2048
+#define BENCH_ETHERTYPE	0x88B5	/* local experimental, ignored by the stack */
+
+/**
+ * open a raw socket bound to an interface, the way router_init does
+ */
+static int bench_open(const char* name){
+	int s = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (s < 0) {
+		perror("socket");
+		exit(1);
+	}
+
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+		perror("ioctl SIOCGIFINDEX");
+		exit(1);
+	}
+
+	struct sockaddr_ll saddr;
+	memset(&saddr, 0, sizeof(saddr));
+	saddr.sll_family = AF_PACKET;
+	saddr.sll_protocol = htons(ETH_P_ALL);
+	saddr.sll_ifindex = ifr.ifr_ifindex;
+	if (bind(s, (struct sockaddr*) &saddr, sizeof(saddr)) < 0) {
+		perror("bind");
+		exit(1);
+	}
+	return s;
+}
+
+/**
+ * queue count frames on the receiving socket before the clock starts, so
+ * only the receive side is measured (the sender would otherwise share the
+ * cpu with the receiver)
+ */
+static void bench_fill(int s, int count){
+	uint8_t frame[FRAME_LEN];
+	struct iovec iov[TX_BATCH];
+	struct mmsghdr msgs[TX_BATCH];
+	int i = 0;
+
+	memset(frame, 0, sizeof(frame));
+	memset(frame, 0xff, 6);
+	frame[6] = 0x02;
+	frame[12] = BENCH_ETHERTYPE >> 8;
+	frame[13] = BENCH_ETHERTYPE & 0xff;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < TX_BATCH; i++){
+		iov[i].iov_base = frame;
+		iov[i].iov_len = FRAME_LEN;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (count > 0) {
+		int n = sendmmsg(s, msgs, count < TX_BATCH ? count : TX_BATCH, 0);
+		if (n < 0) {
+			perror("sendmmsg");
+			exit(1);
+		}
+		count -= n;
+	}
+}
+
+/**
+ * drain whatever is queued so every run starts from an empty socket
+ */
+static void bench_drain(int s){
+	uint8_t buf[BUF_SIZE];
+	while (recv(s, buf, sizeof(buf), MSG_DONTWAIT) > 0);
+}
+
+/**
+ * @return 1 if the socket became readable within 100ms
+ */
+static int bench_wait(int s){
+	fd_set read_set;
+	FD_ZERO(&read_set);
+	FD_SET(s, &read_set);
+	struct timeval t = { 0, 100000 };
+	return select(s + 1, &read_set, NULL, NULL, &t) > 0;
+}
+
+static int bench_read(int s, int count){
+	uint8_t buf[BUF_SIZE];
+	int frames = 0;
+
+	while (frames < count && bench_wait(s)) {
+		if (read(s, buf, sizeof(buf)) > 0) {
+			frames++;
+		}
+	}
+	return frames;
+}
+
+static int bench_recvmmsg(int s, int count, int batch, int busy_poll){
+	uint8_t* bufs = (uint8_t*) malloc(batch * BUF_SIZE);
+	struct iovec* iov = (struct iovec*) calloc(batch, sizeof(struct iovec));
+	struct mmsghdr* msgs = (struct mmsghdr*) calloc(batch, sizeof(struct mmsghdr));
+	int frames = 0;
+	int i = 0;
+
+	for (i = 0; i < batch; i++){
+		iov[i].iov_base = bufs + i * BUF_SIZE;
+		iov[i].iov_len = BUF_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	double idle_since = bench_now();
+	while (frames < count) {
+		if (!busy_poll && !bench_wait(s)) {
+			break;
+		}
+		int n = recvmmsg(s, msgs, batch, MSG_DONTWAIT, NULL);
+		if (n > 0) {
+			frames += n;
+			idle_since = bench_now();
+		} else if (busy_poll && bench_now() - idle_since > 0.1) {
+			break;
+		}
+	}
+
+	free(msgs);
+	free(iov);
+	free(bufs);
+	return frames;
+}
+
+/**
+ * @param batch 0 for select + read, otherwise the recvmmsg batch size
+ */
+static void bench_run(int rx, int tx, int count, int batch, int busy_poll, double* base){
+	bench_drain(rx);
+	bench_fill(tx, count);
+
+	double start = bench_now();
+	int frames = batch ? bench_recvmmsg(rx, count, batch, busy_poll) : bench_read(rx, count);
+	double pps = frames / (bench_now() - start);
+
+	if (!batch) {
+		*base = pps;
+		printf("select + read:              %10.0f pps (%d frames)\n", pps, frames);
+	} else {
+		printf("%-11s recvmmsg(%4d): %10.0f pps (%d frames, x%.2f)\n",
+		       busy_poll ? "busy poll" : "select +", batch, pps, frames, pps / *base);
+	}
+}
+
+int main(int argc, char** argv){
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <rx iface> <tx iface> [frames] [batch]\n", argv[0]);
+		return 1;
+	}
+
+	int count = argc > 3 ? atoi(argv[3]) : DEFAULT_FRAMES;
+	int batch = argc > 4 ? atoi(argv[4]) : 32;
+
+	int rx = bench_open(argv[1]);
+	int tx = bench_open(argv[2]);
+
+	/*
+	 * the whole burst has to fit in the receive queue
+	 */
+	int rcvbuf = 1 << 30;
+	if (setsockopt(rx, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0) {
+		perror("SO_RCVBUFFORCE, burst may be truncated");
+	}
+
+	double base = 0;
+	bench_run(rx, tx, count, 0, 0, &base);
+	bench_run(rx, tx, count, batch, 0, &base);
+	bench_run(rx, tx, count, batch, 1, &base);
+
+	close(rx);
+	close(tx);
+
+	return 0;
+}
@@ -0,0 +1,194 @@
+/**
+ * @file timer_bench.c
+ * @author Mohammad Reza Hosseini
+ *
+ * timer wheel benchmark: arms one timer per neighbor of a large segment with
+ * delays from 1 ms to 10 minutes (all four levels), then re-arms them the way
+ * a storm of ARP replies pushes expiries back and cancels half of them. The
+ * wheel is driven on a virtual clock, jumping from one tick with work to the
+ * next, so every callback can be checked to fire on its exact tick and the
+ * cancelled ones not at all. Last, the timer thread runs a burst of short
+ * timers on the real clock and the lateness of their callbacks is measured.
+ *
+ * usage: timer_bench [timers]
+ */
+
+#include "timer.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define DEFAULT_TIMERS	65536
+#define MAX_DELAY	600000		/* ms */
+#define REARMS		4
+#define THREAD_TIMERS	1000
+#define THREAD_SPREAD	200		/* ms */
+
+typedef struct Bench_Timer {
+	timer_entry_t timer;
+	uint64_t expires;		/* tick it must fire on */
+	int cancelled;
+	int fired;
+} bench_timer_t;
+
+static uint64_t bench_clock;		/* virtual tick being run */
+static unsigned long bench_late;	/* callbacks off their tick */
+static unsigned long bench_fired;
+
+static void bench_fire(void* arg, uintptr_t data){
+	bench_timer_t* bt = (bench_timer_t*) arg;
+
+	bt->fired++;
+	bench_fired++;
+	if (bench_clock != bt->expires) {
+		bench_late++;
+	}
+}
+
+static int bench_virtual(int count){
+	timer_wheel_t* w = timer_createWheel();
+	bench_timer_t* timers = (bench_timer_t*) calloc(count, sizeof(bench_timer_t));
+	timer_stats_t stats;
+	uint64_t base = w->clock;
+	int i = 0;
+	int r = 0;
+
+	srand(1);
+	double start = bench_now();
+	for (i = 0; i < count; i++){
+		timers[i].expires = base + 1 + rand() % MAX_DELAY;
+		timer_init(&timers[i].timer, bench_fire, &timers[i], 0);
+		timer_scheduleAt(w, &timers[i].timer, timers[i].expires);
+	}
+	double arm = bench_now() - start;
+
+	/*
+	 * every reply moves the expiry of its neighbor
+	 */
+	start = bench_now();
+	for (r = 0; r < REARMS; r++){
+		for (i = 0; i < count; i++){
+			timers[i].expires = base + 1 + rand() % MAX_DELAY;
+			timer_scheduleAt(w, &timers[i].timer, timers[i].expires);
+		}
+	}
+	double rearm = bench_now() - start;
+
+	start = bench_now();
+	for (i = 0; i < count; i += 2){
+		timers[i].cancelled = timer_cancel(w, &timers[i].timer);
+	}
+	double cancel = bench_now() - start;
+
+	/*
+	 * run the wheel from one tick with work to the next
+	 */
+	unsigned long wakeups = 0;
+	start = bench_now();
+	bench_clock = base;
+	while (1) {
+		uint64_t next = timer_run(w, bench_clock);
+		if (next == TIMER_NEVER) {
+			break;
+		}
+		bench_clock = next;
+		wakeups++;
+	}
+	double run = bench_now() - start;
+	timer_getStats(w, &stats);
+
+	unsigned long wrong = 0;
+	for (i = 0; i < count; i++){
+		wrong += timers[i].fired != (i % 2 != 0) || timers[i].cancelled != (i % 2 == 0);
+	}
+
+	fprintf(stderr, "virtual: %d timers over %d s, %.1f ns/arm, %.1f ns/re-arm, %.1f ns/cancel, "
+		"%.1f ns/fire, %lu wakeups, %lu cascades, %lu fired, %lu late, %lu wrong, %u pending\n",
+		count, MAX_DELAY / 1000, arm * 1e9 / count, rearm * 1e9 / (count * REARMS),
+		cancel * 1e9 / ((count + 1) / 2), run * 1e9 / bench_fired, wakeups, stats.cascaded,
+		bench_fired, bench_late, wrong, stats.pending);
+
+	free(timers);
+	return bench_late != 0 || wrong != 0 || stats.pending != 0 || bench_fired != (unsigned long) count / 2;
+}
+
+/*
+ * lateness of the callbacks run by the timer thread
+ */
+static pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t bench_maxLate;
+static uint64_t bench_totalLate;
+static int bench_done;
+
+static void bench_fireReal(void* arg, uintptr_t data){
+	uint64_t now = timer_now();
+	uint64_t late = now - (uint64_t) data;
+
+	pthread_mutex_lock(&bench_lock);
+	if (late > bench_maxLate) {
+		bench_maxLate = late;
+	}
+	bench_totalLate += late;
+	bench_done++;
+	pthread_mutex_unlock(&bench_lock);
+}
+
+static int bench_thread(void){
+	timer_wheel_t* w = timer_createWheel();
+	timer_entry_t* timers = (timer_entry_t*) calloc(THREAD_TIMERS, sizeof(timer_entry_t));
+	pthread_t tid;
+	int early = 0;
+	int i = 0;
+
+	if (pthread_create(&tid, NULL, timer_thread, w) != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	uint64_t base = timer_now();
+	for (i = 0; i < THREAD_TIMERS; i++){
+		uint64_t expires = base + 1 + rand() % THREAD_SPREAD;
+		timer_init(&timers[i], bench_fireReal, NULL, expires);
+		timer_scheduleAt(w, &timers[i], expires);
+	}
+
+	while (1) {
+		struct timespec ts = { 0, 10000000 };
+		nanosleep(&ts, NULL);
+
+		pthread_mutex_lock(&bench_lock);
+		int done = bench_done;
+		pthread_mutex_unlock(&bench_lock);
+		if (done == THREAD_TIMERS || timer_now() > base + THREAD_SPREAD + 5000) {
+			break;
+		}
+	}
+
+	/*
+	 * a callback before its tick would have wrapped around
+	 */
+	early = bench_maxLate > THREAD_SPREAD + 5000;
+
+	fprintf(stderr, "thread: %d timers over %d ms, %d fired, %.2f ms mean lateness, %llu ms max\n",
+		THREAD_TIMERS, THREAD_SPREAD, bench_done, bench_done ? (double) bench_totalLate / bench_done : 0.0,
+		(unsigned long long) bench_maxLate);
+
+	return bench_done != THREAD_TIMERS || early;
+}
+
+int main(int argc, char** argv){
+	int count = DEFAULT_TIMERS;
+	if (argc > 1) {
+		count = atoi(argv[1]);
+	}
+
+	int errors = 0;
+	errors += bench_virtual(count);
+	errors += bench_thread();
+
+	return errors ? 1 : 0;
+}
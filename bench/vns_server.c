@@ -0,0 +1,915 @@
+/**
+ * @file vns_server.c
+ * @author Mohammad Reza Hosseini
+ *
+ * VNS server stand-in: lets sr run in VNS mode against the loopback instead
+ * of a live VNS. It listens on 127.0.0.1, takes one router through the
+ * VNS_AUTH_REQUEST / VNS_AUTH_REPLY / VNS_AUTH_STATUS exchange (the salted
+ * sha1 of the auth key, as sr_handle_auth_request computes it), answers
+ * VNSOPEN with the VNSHWINFO of a cpuhw style file and then speaks VNSPACKET
+ * framing only.
+ *
+ * Meanwhile it stands in for every host on every link: ARP requests of the
+ * router are answered, and frames are injected on one interface, either
+ * synthetic UDP flows to the hosts behind the other interfaces or frames
+ * replayed from a classic pcap file. Each injected IPv4 frame carries its
+ * sequence number in the IP id, which the router leaves alone, so a frame
+ * coming back on any interface is matched to its send time. At the end the
+ * offered and forwarded rates, the loss and the latency percentiles are
+ * printed and the router is sent a VNSCLOSE.
+ *
+ * With sr built with MODE = $(MODE_VNS), from the top directory:
+ *
+ *   bench/vns_server -H cpuhw -n 200000 &
+ *   ./sr -s 127.0.0.1 -p 3250 -u bench -v vrhost -r rtable
+ *
+ * usage: vns_server [-p port] [-a auth key file] [-H hw file] [-I interface]
+ *                   [-n frames] [-l frame length] [-F flows] [-r pps]
+ *                   [-w window] [-f pcap file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "vnscommand.h"
+#include "sha1.h"
+#include "bench.h"
+
+#define DEFAULT_PORT	3250
+#define DEFAULT_FRAMES	100000
+#define DEFAULT_LEN	64
+#define DEFAULT_FLOWS	64
+#define DEFAULT_WINDOW	64
+#define MAX_IFACES	16
+#define MAX_FRAME	1514
+#define CMD_MAX		10000
+#define SALT_LEN	20
+#define AUTH_KEY_LEN	64
+#define SHA1_LEN	20
+#define WARMUP_MS	200
+#define DRAIN_MS	500
+#define STALL_MS	50		/* no frame back this long: the window is written off */
+
+#define ETH_HLEN	14
+#define ETH_IP		0x0800
+#define ETH_ARP		0x0806
+#define IP_HLEN		20
+#define UDP_HLEN	8
+
+typedef struct Bench_Iface {
+	char name[16];
+	uint32_t ip;			/* network order */
+	uint32_t mask;
+	uint8_t mac[6];
+	unsigned long out;		/* frames the router sent on it */
+} bench_iface_t;
+
+typedef struct Bench_Frame {
+	uint8_t* data;
+	unsigned int len;
+} bench_frame_t;
+
+static bench_iface_t bench_ifaces[MAX_IFACES];
+static int bench_nifaces;
+static int bench_in;			/* interface frames are injected on */
+
+static int bench_fd = -1;
+static pthread_mutex_t bench_sendLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * sequence state, shared by the sender and the receive loop
+ */
+static pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bench_cond;		/* on CLOCK_MONOTONIC, signalled per frame back */
+static uint64_t bench_sentAt[65536];	/* ns by IP id, 0: nothing outstanding */
+static unsigned long bench_sent;
+static unsigned long bench_forwarded;
+static unsigned long bench_writtenOff;	/* outstanding frames given up on */
+static unsigned long bench_other;	/* frames from the router not matched */
+static unsigned long bench_arps;
+static uint64_t* bench_latency;		/* ns of every matched frame */
+static unsigned long bench_samples;
+static int bench_done;
+
+static void bench_sleepMs(int ms){
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+static uint16_t bench_csum(const uint8_t* p, int len){
+	uint32_t sum = 0;
+	int i = 0;
+
+	for (i = 0; i + 1 < len; i += 2){
+		sum += (p[i] << 8) | p[i + 1];
+	}
+	if (len & 1) {
+		sum += p[len - 1] << 8;
+	}
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return htons(~sum);
+}
+
+/*
+ * socket helpers
+ */
+static int bench_writeAll(const void* buf, size_t len){
+	const uint8_t* p = (const uint8_t*) buf;
+
+	while (len > 0) {
+		ssize_t n = write(bench_fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("write");
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int bench_readAll(void* buf, size_t len){
+	uint8_t* p = (uint8_t*) buf;
+
+	while (len > 0) {
+		ssize_t n = read(bench_fd, p, len);
+		if (n == 0) {
+			return -1;
+		}
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("read");
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * read one command into buf
+ * @return its type, -1 once the router is gone
+ */
+static int bench_readCmd(uint8_t* buf, uint32_t* len){
+	c_base* base = (c_base*) buf;
+
+	if (bench_readAll(buf, sizeof(c_base)) < 0) {
+		return -1;
+	}
+	*len = ntohl(base->mLen);
+	if (*len < sizeof(c_base) || *len > CMD_MAX) {
+		fprintf(stderr, "bogus command length %u\n", *len);
+		return -1;
+	}
+	if (bench_readAll(buf + sizeof(c_base), *len - sizeof(c_base)) < 0) {
+		return -1;
+	}
+	return ntohl(base->mType);
+}
+
+/**
+ * send frame to the router as received on iface
+ */
+static int bench_sendFrame(int iface, const uint8_t* frame, unsigned int len){
+	c_packet_header hdr;
+	struct iovec iov[2];
+	int ret = 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.mLen = htonl(sizeof(hdr) + len);
+	hdr.mType = htonl(VNSPACKET);
+	memcpy(hdr.mInterfaceName, bench_ifaces[iface].name, sizeof(hdr.mInterfaceName));
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void*) frame;
+	iov[1].iov_len = len;
+
+	pthread_mutex_lock(&bench_sendLock);
+	ssize_t n = writev(bench_fd, iov, 2);
+	if (n >= 0 && (size_t) n < sizeof(hdr) + len) {
+		/* -- finish a short write the slow way -- */
+		size_t done = n;
+		if (done < sizeof(hdr)) {
+			ret = bench_writeAll((uint8_t*) &hdr + done, sizeof(hdr) - done);
+			done = sizeof(hdr);
+		}
+		if (ret == 0) {
+			ret = bench_writeAll(frame + done - sizeof(hdr), len - (done - sizeof(hdr)));
+		}
+	} else if (n < 0) {
+		perror("writev");
+		ret = -1;
+	}
+	pthread_mutex_unlock(&bench_sendLock);
+
+	return ret;
+}
+
+static void bench_closeSession(const char* reason){
+	c_close cl;
+
+	memset(&cl, 0, sizeof(cl));
+	cl.mLen = htonl(sizeof(cl));
+	cl.mType = htonl(VNSCLOSE);
+	strncpy(cl.mErrorMessage, reason, sizeof(cl.mErrorMessage) - 1);
+
+	pthread_mutex_lock(&bench_sendLock);
+	bench_writeAll(&cl, sizeof(cl));
+	pthread_mutex_unlock(&bench_sendLock);
+}
+
+/*
+ * set up: hardware file, auth exchange, hwinfo
+ */
+
+static int bench_loadIfaces(const char* file){
+	bench_hw_t hw[MAX_IFACES];
+	int count = bench_readHw(file, hw, MAX_IFACES);
+	int i = 0;
+
+	if (count < 0) {
+		return -1;
+	}
+	for (i = 0; i < count; i++){
+		bench_iface_t* ifc = &bench_ifaces[i];
+		if (strlen(hw[i].name) >= sizeof(ifc->name)) {
+			fprintf(stderr, "%s: bad line for %s\n", file, hw[i].name);
+			return -1;
+		}
+		memcpy(ifc->name, hw[i].name, strlen(hw[i].name) + 1);
+		ifc->ip = hw[i].ip;
+		ifc->mask = hw[i].mask;
+		memcpy(ifc->mac, hw[i].mac, 6);
+	}
+	bench_nifaces = count;
+
+	if (bench_nifaces < 2) {
+		fprintf(stderr, "%s: need at least two interfaces\n", file);
+		return -1;
+	}
+	return 0;
+}
+
+static int bench_findIface(const char* name){
+	int i = 0;
+
+	for (i = 0; i < bench_nifaces; i++){
+		if (strncmp(bench_ifaces[i].name, name, sizeof(bench_ifaces[i].name)) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * the key is hashed as a 64 byte block, the way the router reads it
+ */
+static int bench_readKey(const char* file, char* key){
+	FILE* fp = fopen(file, "r");
+
+	memset(key, 0, AUTH_KEY_LEN + 1);
+	if (!fp) {
+		perror(file);
+		return -1;
+	}
+	if (!fgets(key, AUTH_KEY_LEN + 1, fp)) {
+		fprintf(stderr, "%s: empty auth key\n", file);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	return 0;
+}
+
+static int bench_auth(const char* key){
+	uint8_t buf[CMD_MAX];
+	uint8_t salt[SALT_LEN];
+	uint32_t digest[5];
+	uint32_t len = 0;
+	SHA1Context sha1;
+	int i = 0;
+
+	/*
+	 * the server speaks first
+	 */
+	c_auth_request* req = (c_auth_request*) buf;
+	for (i = 0; i < SALT_LEN; i++){
+		salt[i] = rand();
+	}
+	req->mLen = htonl(sizeof(*req) + SALT_LEN);
+	req->mType = htonl(VNS_AUTH_REQUEST);
+	memcpy(req->salt, salt, SALT_LEN);
+	if (bench_writeAll(buf, sizeof(*req) + SALT_LEN) < 0) {
+		return -1;
+	}
+
+	if (bench_readCmd(buf, &len) != VNS_AUTH_REPLY) {
+		fprintf(stderr, "expected an auth reply\n");
+		return -1;
+	}
+	c_auth_reply* ar = (c_auth_reply*) buf;
+	uint32_t user_len = ntohl(ar->usernameLen);
+	if (sizeof(*ar) + user_len + SHA1_LEN != len) {
+		fprintf(stderr, "bogus auth reply\n");
+		return -1;
+	}
+
+	SHA1Reset(&sha1);
+	SHA1Input(&sha1, salt, SALT_LEN);
+	SHA1Input(&sha1, (const unsigned char*) key, AUTH_KEY_LEN);
+	if (!SHA1Result(&sha1)) {
+		fprintf(stderr, "SHA1 result could not be computed\n");
+		return -1;
+	}
+	for (i = 0; i < 5; i++){
+		digest[i] = htonl(sha1.Message_Digest[i]);
+	}
+	int ok = memcmp(ar->username + user_len, digest, SHA1_LEN) == 0;
+
+	char msg[64];
+	snprintf(msg, sizeof(msg), ok ? "welcome %.*s" : "bad key for %.*s", (int) user_len, ar->username);
+	c_auth_status* st = (c_auth_status*) buf;
+	st->mLen = htonl(sizeof(*st) + strlen(msg) + 1);
+	st->mType = htonl(VNS_AUTH_STATUS);
+	st->auth_ok = ok;
+	strcpy(st->msg, msg);
+	if (bench_writeAll(buf, sizeof(*st) + strlen(msg) + 1) < 0) {
+		return -1;
+	}
+	fprintf(stderr, "auth: %s\n", msg);
+
+	return ok ? 0 : -1;
+}
+
+static void bench_hwEntry(c_hwinfo* hw, int* n, uint32_t key, const void* value, int len){
+	hw->mHWInfo[*n].mKey = htonl(key);
+	memset(hw->mHWInfo[*n].value, 0, sizeof(hw->mHWInfo[*n].value));
+	memcpy(hw->mHWInfo[*n].value, value, len);
+	(*n)++;
+}
+
+static int bench_open(void){
+	static c_hwinfo hw;
+	uint8_t buf[CMD_MAX];
+	uint32_t len = 0;
+	uint32_t speed = htonl(100);
+	int n = 0;
+	int i = 0;
+
+	int type = bench_readCmd(buf, &len);
+	if (type == VNS_OPEN_TEMPLATE) {
+		bench_closeSession("templates are not supported");
+		return -1;
+	}
+	if (type != VNSOPEN) {
+		fprintf(stderr, "expected an open\n");
+		return -1;
+	}
+	c_open* op = (c_open*) buf;
+	fprintf(stderr, "open: topology %u, host %.32s, user %.32s\n",
+		ntohs(op->topoID), op->mVirtualHostID, op->mUID);
+
+	for (i = 0; i < bench_nifaces; i++){
+		bench_iface_t* ifc = &bench_ifaces[i];
+		uint32_t subnet = ifc->ip & ifc->mask;
+		bench_hwEntry(&hw, &n, HWINTERFACE, ifc->name, strlen(ifc->name));
+		bench_hwEntry(&hw, &n, HWSPEED, &speed, sizeof(speed));
+		bench_hwEntry(&hw, &n, HWSUBNET, &subnet, sizeof(subnet));
+		bench_hwEntry(&hw, &n, HWMASK, &ifc->mask, sizeof(ifc->mask));
+		bench_hwEntry(&hw, &n, HWETHIP, &ifc->ip, sizeof(ifc->ip));
+		bench_hwEntry(&hw, &n, HWETHER, ifc->mac, sizeof(ifc->mac));
+	}
+	len = 2 * sizeof(uint32_t) + n * sizeof(c_hw_entry);
+	hw.mLen = htonl(len);
+	hw.mType = htonl(VNSHWINFO);
+
+	return bench_writeAll(&hw, len);
+}
+
+/*
+ * traffic: synthetic flows or a pcap
+ */
+
+/**
+ * mac of the host at ip, made up from the address
+ */
+static void bench_hostMac(uint32_t ip, uint8_t* mac){
+	mac[0] = 0x02;
+	mac[1] = 0x00;
+	memcpy(mac + 2, &ip, 4);
+}
+
+/**
+ * UDP from the host behind the injecting interface to host i of the other
+ * interfaces' subnets
+ */
+static void bench_buildFlow(bench_frame_t* f, int flow, unsigned int len){
+	bench_iface_t* in = &bench_ifaces[bench_in];
+	int out = flow % (bench_nifaces - 1);
+	if (out >= bench_in) {
+		out++;
+	}
+	bench_iface_t* dst_if = &bench_ifaces[out];
+	uint32_t src = (in->ip & in->mask) | htonl(2);
+	uint32_t dst = (dst_if->ip & dst_if->mask) | htonl(10 + flow / (bench_nifaces - 1) % 200);
+
+	f->len = len;
+	f->data = (uint8_t*) calloc(1, len);
+	uint8_t* p = f->data;
+
+	memcpy(p, in->mac, 6);
+	bench_hostMac(src, p + 6);
+	p[12] = ETH_IP >> 8;
+	p[13] = ETH_IP & 0xff;
+
+	uint8_t* ip = p + ETH_HLEN;
+	ip[0] = 0x45;
+	*(uint16_t*) (ip + 2) = htons(len - ETH_HLEN);
+	ip[8] = 64;
+	ip[9] = IPPROTO_UDP;
+	memcpy(ip + 12, &src, 4);
+	memcpy(ip + 16, &dst, 4);
+
+	uint8_t* udp = ip + IP_HLEN;
+	*(uint16_t*) udp = htons(10000 + flow);
+	*(uint16_t*) (udp + 2) = htons(9);
+	*(uint16_t*) (udp + 4) = htons(len - ETH_HLEN - IP_HLEN);
+}
+
+/**
+ * classic pcap, either byte order, micro or nanosecond stamps
+ * @return frames read, -1 on error
+ */
+static int bench_readPcap(const char* file, bench_frame_t** frames){
+	FILE* fp = fopen(file, "rb");
+	uint32_t gh[6];
+	uint32_t rh[4];
+	int swap = 0;
+	int count = 0;
+	int cap = 0;
+
+	if (!fp) {
+		perror(file);
+		return -1;
+	}
+	if (fread(gh, sizeof(gh), 1, fp) != 1) {
+		fprintf(stderr, "%s: short header\n", file);
+		fclose(fp);
+		return -1;
+	}
+	if (gh[0] == 0xa1b2c3d4 || gh[0] == 0xa1b23c4d) {
+		swap = 0;
+	} else if (gh[0] == 0xd4c3b2a1 || gh[0] == 0x4d3cb2a1) {
+		swap = 1;
+	} else {
+		fprintf(stderr, "%s: not a pcap file\n", file);
+		fclose(fp);
+		return -1;
+	}
+	uint32_t link = swap ? __builtin_bswap32(gh[5]) : gh[5];
+	if (link != 1) {
+		fprintf(stderr, "%s: link type %u is not ethernet\n", file, link);
+		fclose(fp);
+		return -1;
+	}
+
+	*frames = NULL;
+	while (fread(rh, sizeof(rh), 1, fp) == 1) {
+		uint32_t caplen = swap ? __builtin_bswap32(rh[2]) : rh[2];
+		if (caplen > 65535) {
+			fprintf(stderr, "%s: bogus record\n", file);
+			fclose(fp);
+			return -1;
+		}
+		uint8_t* data = (uint8_t*) malloc(caplen ? caplen : 1);
+		if (fread(data, 1, caplen, fp) != caplen) {
+			free(data);
+			break;
+		}
+		if (caplen < ETH_HLEN || caplen > MAX_FRAME) {
+			free(data);
+			continue;
+		}
+		if (count == cap) {
+			cap = cap ? cap * 2 : 1024;
+			*frames = (bench_frame_t*) realloc(*frames, cap * sizeof(bench_frame_t));
+		}
+		(*frames)[count].data = data;
+		(*frames)[count].len = caplen;
+		count++;
+	}
+	fclose(fp);
+
+	return count;
+}
+
+/**
+ * address a frame to the router and stamp its IP id with seq
+ * @return 1 if the frame can be matched when it comes back
+ */
+static int bench_stamp(uint8_t* frame, unsigned int len, uint16_t seq){
+	memcpy(frame, bench_ifaces[bench_in].mac, 6);
+	if (len < ETH_HLEN + IP_HLEN || ((frame[12] << 8) | frame[13]) != ETH_IP || (frame[ETH_HLEN] >> 4) != 4) {
+		return 0;
+	}
+
+	uint8_t* ip = frame + ETH_HLEN;
+	int hlen = (ip[0] & 0x0f) * 4;
+	if (hlen < IP_HLEN || ETH_HLEN + hlen > (int) len) {
+		return 0;
+	}
+	*(uint16_t*) (ip + 4) = htons(seq);
+	*(uint16_t*) (ip + 10) = 0;
+	*(uint16_t*) (ip + 10) = bench_csum(ip, hlen);
+	return 1;
+}
+
+typedef struct Bench_Traffic {
+	bench_frame_t* frames;
+	int nframes;
+	unsigned long count;		/* frames to send */
+	unsigned long rate;		/* pps, 0: as fast as the window allows */
+	unsigned long window;		/* frames in flight */
+} bench_traffic_t;
+
+/**
+ * wait until fewer than window frames are in flight. If nothing comes back
+ * for STALL_MS the frames in flight are given up on, they count as lost
+ * unless they still show up.
+ * NOT Threadsafe, caller holds bench_lock
+ */
+static void bench_waitWindow(unsigned long window){
+	while (bench_sent - bench_forwarded - bench_writtenOff >= window) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_nsec += STALL_MS * 1000000L;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+
+		unsigned long before = bench_forwarded;
+		if (pthread_cond_timedwait(&bench_cond, &bench_lock, &ts) == ETIMEDOUT && bench_forwarded == before) {
+			bench_writtenOff = bench_sent - bench_forwarded;
+		}
+	}
+}
+
+static int bench_inject(bench_traffic_t* t, unsigned long count, int measured){
+	uint8_t frame[MAX_FRAME];
+	uint64_t start = bench_ns();
+	unsigned long i = 0;
+
+	for (i = 0; i < count; i++){
+		bench_frame_t* f = &t->frames[i % t->nframes];
+
+		if (t->rate) {
+			uint64_t due = start + i * 1000000000ULL / t->rate;
+			while (bench_ns() < due) {
+				sched_yield();
+			}
+		}
+
+		memcpy(frame, f->data, f->len);
+		pthread_mutex_lock(&bench_lock);
+		bench_waitWindow(t->window);
+		uint16_t seq = bench_sent;
+		int tracked = bench_stamp(frame, f->len, seq);
+		bench_sentAt[seq] = tracked && measured ? bench_ns() : 0;
+		if (tracked) {
+			bench_sent++;
+		}
+		pthread_mutex_unlock(&bench_lock);
+
+		if (bench_sendFrame(bench_in, frame, f->len) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * what comes back from the router
+ */
+
+static void bench_answerArp(int iface, const uint8_t* frame, unsigned int len){
+	uint8_t reply[60];
+	uint32_t target;
+
+	if (len < ETH_HLEN + 28) {
+		return;
+	}
+	const uint8_t* arp = frame + ETH_HLEN;
+	if (((arp[6] << 8) | arp[7]) != 1) {
+		return;			/* not a request */
+	}
+	memcpy(&target, arp + 24, 4);
+	if (target == bench_ifaces[iface].ip) {
+		return;
+	}
+
+	memset(reply, 0, sizeof(reply));
+	memcpy(reply, frame + 6, 6);
+	bench_hostMac(target, reply + 6);
+	reply[12] = ETH_ARP >> 8;
+	reply[13] = ETH_ARP & 0xff;
+	uint8_t* r = reply + ETH_HLEN;
+	memcpy(r, arp, 6);		/* hardware and protocol type and sizes */
+	r[6] = 0;
+	r[7] = 2;
+	bench_hostMac(target, r + 8);
+	memcpy(r + 14, &target, 4);
+	memcpy(r + 18, arp + 8, 10);	/* the requester */
+
+	bench_sendFrame(iface, reply, sizeof(reply));
+	bench_arps++;
+}
+
+/**
+ * frames the router sends from its own addresses (ICMP errors, OSPF) are
+ * not forwarded ones
+ */
+static int bench_isRouter(const uint8_t* src){
+	int i = 0;
+
+	for (i = 0; i < bench_nifaces; i++){
+		if (memcmp(src, &bench_ifaces[i].ip, 4) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void bench_fromRouter(int iface, const uint8_t* frame, unsigned int len){
+	uint64_t now = bench_ns();
+	int type = (frame[12] << 8) | frame[13];
+
+	if (type == ETH_ARP) {
+		bench_answerArp(iface, frame, len);
+		return;
+	}
+
+	pthread_mutex_lock(&bench_lock);
+	bench_ifaces[iface].out++;
+	if (type == ETH_IP && len >= ETH_HLEN + IP_HLEN && !bench_isRouter(frame + ETH_HLEN + 12)) {
+		uint16_t seq = ntohs(*(uint16_t*) (frame + ETH_HLEN + 4));
+		if (bench_sentAt[seq]) {
+			bench_latency[bench_samples++] = now - bench_sentAt[seq];
+			bench_sentAt[seq] = 0;
+		}
+		bench_forwarded++;
+		pthread_cond_signal(&bench_cond);
+	} else {
+		bench_other++;
+	}
+	pthread_mutex_unlock(&bench_lock);
+}
+
+static void* bench_receive(void* arg){
+	static uint8_t buf[CMD_MAX];
+	uint32_t len = 0;
+	int type = 0;
+
+	while ((type = bench_readCmd(buf, &len)) >= 0) {
+		if (type != VNSPACKET) {
+			fprintf(stderr, "ignoring command %d from the router\n", type);
+			continue;
+		}
+		c_packet_header* hdr = (c_packet_header*) buf;
+		char name[17];
+		memcpy(name, hdr->mInterfaceName, 16);
+		name[16] = '\0';
+
+		int iface = bench_findIface(name);
+		if (iface < 0 || len < sizeof(*hdr) + ETH_HLEN) {
+			fprintf(stderr, "frame on unknown interface %s\n", name);
+			continue;
+		}
+		bench_fromRouter(iface, buf + sizeof(*hdr), len - sizeof(*hdr));
+	}
+
+	pthread_mutex_lock(&bench_lock);
+	if (!bench_done) {
+		fprintf(stderr, "router closed the connection\n");
+	}
+	bench_done = 1;
+	pthread_cond_broadcast(&bench_cond);
+	pthread_mutex_unlock(&bench_lock);
+
+	return NULL;
+}
+
+static double bench_percentile(double p){
+	if (bench_samples == 0) {
+		return 0;
+	}
+	unsigned long i = (unsigned long) (p * (bench_samples - 1));
+	return bench_latency[i] / 1000.0;
+}
+
+static int bench_listen(uint16_t port){
+	struct sockaddr_in addr;
+	int one = 1;
+
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s < 0) {
+		perror("socket");
+		return -1;
+	}
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(s, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(s, 1) < 0) {
+		perror("bind");
+		close(s);
+		return -1;
+	}
+	fprintf(stderr, "waiting for the router on 127.0.0.1:%u\n", port);
+
+	int fd = accept(s, NULL, NULL);
+	close(s);
+	if (fd < 0) {
+		perror("accept");
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+static void usage(const char* argv0){
+	fprintf(stderr, "usage: %s [-p port] [-a auth key file] [-H hw file] [-I interface]\n"
+		"       [-n frames] [-l frame length] [-F flows] [-r pps (0: window bound)]\n"
+		"       [-w frames in flight] [-f pcap file (replayed instead of flows)]\n", argv0);
+}
+
+int main(int argc, char** argv){
+	const char* key_file = "auth_key";
+	const char* hw_file = "cpuhw";
+	const char* in_name = NULL;
+	const char* pcap_file = NULL;
+	uint16_t port = DEFAULT_PORT;
+	unsigned int frame_len = DEFAULT_LEN;
+	int flows = DEFAULT_FLOWS;
+	bench_traffic_t t;
+	char key[AUTH_KEY_LEN + 1];
+	pthread_t rx;
+	int c = 0;
+	int i = 0;
+
+	memset(&t, 0, sizeof(t));
+	t.count = DEFAULT_FRAMES;
+	t.window = DEFAULT_WINDOW;
+
+	while ((c = getopt(argc, argv, "hp:a:H:I:n:l:F:r:w:f:")) != EOF) {
+		switch (c) {
+			case 'p': port = atoi(optarg); break;
+			case 'a': key_file = optarg; break;
+			case 'H': hw_file = optarg; break;
+			case 'I': in_name = optarg; break;
+			case 'n': t.count = strtoul(optarg, NULL, 10); break;
+			case 'l': frame_len = atoi(optarg); break;
+			case 'F': flows = atoi(optarg); break;
+			case 'r': t.rate = strtoul(optarg, NULL, 10); break;
+			case 'w': t.window = strtoul(optarg, NULL, 10); break;
+			case 'f': pcap_file = optarg; break;
+			default:
+				usage(argv[0]);
+				return c == 'h' ? 0 : 1;
+		}
+	}
+	if (frame_len < ETH_HLEN + IP_HLEN + UDP_HLEN || frame_len > MAX_FRAME || flows < 1 ||
+			t.window < 1 || t.window > 32768) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (bench_loadIfaces(hw_file) < 0 || bench_readKey(key_file, key) < 0) {
+		return 1;
+	}
+	if (in_name && (bench_in = bench_findIface(in_name)) < 0) {
+		fprintf(stderr, "no interface %s in %s\n", in_name, hw_file);
+		return 1;
+	}
+
+	if (pcap_file) {
+		t.nframes = bench_readPcap(pcap_file, &t.frames);
+		if (t.nframes <= 0) {
+			fprintf(stderr, "%s: no frames to replay\n", pcap_file);
+			return 1;
+		}
+	} else {
+		t.nframes = flows;
+		t.frames = (bench_frame_t*) calloc(flows, sizeof(bench_frame_t));
+		for (i = 0; i < flows; i++){
+			bench_buildFlow(&t.frames[i], i, frame_len);
+		}
+	}
+	bench_latency = (uint64_t*) malloc((t.count + 1) * sizeof(uint64_t));
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&bench_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	srand(time(NULL));
+	bench_fd = bench_listen(port);
+	if (bench_fd < 0 || bench_auth(key) < 0 || bench_open() < 0) {
+		return 1;
+	}
+	if (pthread_create(&rx, NULL, bench_receive, NULL) != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	/*
+	 * one pass over the frames lets the router resolve its next hops
+	 */
+	if (bench_inject(&t, t.nframes, 0) < 0) {
+		return 1;
+	}
+	bench_sleepMs(WARMUP_MS);
+
+	pthread_mutex_lock(&bench_lock);
+	unsigned long arps = bench_arps;
+	bench_sent = bench_forwarded = bench_writtenOff = bench_other = bench_samples = 0;
+	memset(bench_sentAt, 0, sizeof(bench_sentAt));
+	for (i = 0; i < bench_nifaces; i++){
+		bench_ifaces[i].out = 0;
+	}
+	pthread_mutex_unlock(&bench_lock);
+
+	uint64_t start = bench_ns();
+	if (bench_inject(&t, t.count, 1) < 0) {
+		return 1;
+	}
+	uint64_t offered = bench_ns() - start;
+
+	/*
+	 * let the frames in flight come back
+	 */
+	pthread_mutex_lock(&bench_lock);
+	uint64_t deadline = bench_ns() + DRAIN_MS * 1000000ULL;
+	while (bench_forwarded < bench_sent && !bench_done && bench_ns() < deadline) {
+		pthread_mutex_unlock(&bench_lock);
+		bench_sleepMs(1);
+		pthread_mutex_lock(&bench_lock);
+	}
+	uint64_t elapsed = bench_ns() - start;
+	unsigned long sent = bench_sent;
+	unsigned long forwarded = bench_forwarded;
+	unsigned long other = bench_other;
+	unsigned long samples = bench_samples;
+	int gone = bench_done;
+	bench_done = 1;
+	qsort(bench_latency, samples, sizeof(uint64_t), bench_cmp);
+	pthread_mutex_unlock(&bench_lock);
+
+	bench_closeSession("benchmark done");
+	shutdown(bench_fd, SHUT_WR);
+
+	/*
+	 * with frames lost the drain timed out, the rate is over the offer
+	 */
+	unsigned long lost = sent > forwarded ? sent - forwarded : 0;
+	if (lost) {
+		elapsed = offered;
+	}
+	fprintf(stderr, "%s: %lu frames injected on %s in %.3f s (%.0f pps offered), %lu forwarded (%.0f pps), "
+		"%lu lost (%.3f%%), %lu other frames, %lu ARP replies\n",
+		pcap_file ? pcap_file : "flows", sent, bench_ifaces[bench_in].name, offered / 1e9,
+		sent / (offered / 1e9), forwarded, forwarded / (elapsed / 1e9),
+		lost, sent ? 100.0 * lost / sent : 0.0, other, arps);
+	fprintf(stderr, "latency (us) over %lu frames: p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+		samples, bench_percentile(0.5), bench_percentile(0.9), bench_percentile(0.99),
+		bench_percentile(0.999), bench_percentile(1.0));
+	for (i = 0; i < bench_nifaces; i++){
+		fprintf(stderr, "  %s: %lu frames out\n", bench_ifaces[i].name, bench_ifaces[i].out);
+	}
+
+	close(bench_fd);
+	return gone ? 1 : 0;
+}
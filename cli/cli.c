@@ -59,6 +59,11 @@ struct sr_instance* my_get_sr() {
 #   define SR my_get_sr()
 #else
 #   include "../sr_integration.h" /* sr_get() */
+#   include "../router.h"         /* router_t, txq_getStats(), pkt_getStats() */
+#   include "../arp.h"            /* arp_getQueueStats() */
+#   include "../ICMP.h"           /* icmp_getLimitStats() */
+#   include "../sr_vns.h"         /* sr_vns_get_tx_stats() */
+#   include "../sr_dumper.h"      /* sr_log_get_stats() */
 #   define SR get_sr()
 #endif
 
@@ -213,16 +218,118 @@ void cli_show_hw_route() {
 void cli_show_ip() {
     cli_send_str( "IP State:\n" );
     cli_show_ip_arp();
+    cli_show_ip_icmp();
     cli_show_ip_intf();
     cli_show_ip_route();
 }
 
 void cli_show_ip_arp() {
+#ifdef _STANDALONE_CLI_
     cli_send_str( "not yet implemented: show ARP cache of SR\n" );
+#else
+    router_t* router = (router_t*)sr_get_subsystem( SR );
+    arp_queue_stats_t q;
+    char line[256];
+
+    /* -- the cache itself is not listed yet, only what waits on it -- */
+    arp_getQueueStats( router, &q );
+    snprintf( line, sizeof(line),
+              "Pending: %u next hops, %u packets parked (at most %d each, full drops %s)\n",
+              q.entries, q.packets, SR->arp_queue_len, SR->arp_drop_oldest ? "oldest" : "newest" );
+    cli_send_str( line );
+    snprintf( line, sizeof(line),
+              "  %lu parked, %lu sent on resolve, %lu unreachable, %lu requests\n",
+              q.queued, q.resolved, q.unreachable, q.requests );
+    cli_send_str( line );
+    snprintf( line, sizeof(line),
+              "  dropped: %lu oldest, %lu newest, %lu no free entry\n",
+              q.drop_oldest, q.drop_newest, q.drop_entries );
+    cli_send_str( line );
+#endif
+}
+
+void cli_show_ip_icmp() {
+#ifdef _STANDALONE_CLI_
+    cli_send_str( "not yet implemented: show ICMP rate limits of SR\n" );
+#else
+    router_t* router = (router_t*)sr_get_subsystem( SR );
+    icmp_limiter_t* limiter = router->icmp_limit;
+    icmp_limit_stats_t st;
+    char line[256];
+    int cls;
+
+    snprintf( line, sizeof(line), "ICMP rate limits (per source: /%d prefixes, 0/s: unlimited):\n",
+              SR->icmp_prefix_len );
+    cli_send_str( line );
+    for( cls=0; cls<ICMP_LIMIT_CLASSES; cls++ ) {
+        icmp_limit_class_t* c = &limiter->cls[cls];
+
+        icmp_getLimitStats( limiter, cls, &st );
+        snprintf( line, sizeof(line),
+                  "  %-17s %u/s burst %u, per source %u/s burst %u: %lu sent, %lu dropped (%lu source, %lu global)\n",
+                  icmp_limitName( cls ), c->global.rate, c->global.burst, c->source.rate, c->source.burst,
+                  st.sent, st.drop_source + st.drop_global, st.drop_source, st.drop_global );
+        cli_send_str( line );
+    }
+#endif
 }
 
 void cli_show_ip_intf() {
+#ifdef _STANDALONE_CLI_
     cli_send_str( "not yet implemented: show interfaces on SR\n" );
+#else
+    router_t* router = (router_t*)sr_get_subsystem( SR );
+    char ip[STRLEN_IP];
+    char mask[STRLEN_IP];
+    char mac[STRLEN_MAC];
+    char line[256];
+    txq_stats_t tx;
+    pkt_stats_t pool;
+    int i, b, len;
+
+    cli_send_str( "Interfaces:\n" );
+    for( i=0; i<router->if_list_index; i++ ) {
+        interface_t* intf = &router->if_list[i];
+
+        ip_to_string( ip, intf->ip );
+        ip_to_string( mask, intf->mask );
+        mac_to_string( mac, intf->addr );
+        cli_send_strs( 8, "  ", intf->name, ": ", ip, " mask ", mask, " hw ", mac );
+        cli_send_str( "\n" );
+
+        txq_getStats( &router->txq[i], &tx );
+        snprintf( line, sizeof(line),
+                  "    tx: %lu frames in %lu flushes, %lu ring overruns, %lu dropped\n",
+                  tx.frames, tx.flushes, tx.overruns, tx.drops );
+        cli_send_str( line );
+
+        /* -- flushes by number of frames, bucket b holds 2^b .. 2^(b+1)-1 -- */
+        len = snprintf( line, sizeof(line), "    tx flush sizes:" );
+        for( b=0; b<TXQ_HIST_BUCKETS; b++ )
+            len += snprintf( line + len, sizeof(line) - len, " %u+:%lu", 1u << b, tx.hist[b] );
+        cli_send_strs( 2, line, "\n" );
+    }
+
+    /* -- the buffers every interface sends from -- */
+    pkt_getStats( &pool );
+    snprintf( line, sizeof(line),
+              "  packet buffers: %lu in use of %lu in %lu slabs, %lu free shared, %lu free per thread\n"
+              "    %lu allocs, %lu from the thread's own list, %lu mallocs\n",
+              pool.in_use, pool.capacity, pool.slabs, pool.pooled, pool.cached,
+              pool.allocs, pool.cache_hits, pool.mallocs );
+    cli_send_str( line );
+
+    /* -- every frame received and sent goes through the packet log, drops
+     *    mean its writer cannot keep up with the capture ring -- */
+    if( SR->log ) {
+        struct sr_log_stats dump;
+        sr_log_get_stats( SR, &dump );
+        snprintf( line, sizeof(line),
+                  "  packet log: %lu packets, %lu bytes in %lu writes to %lu files, %lu dropped\n",
+                  dump.logged, dump.bytes, dump.writes, dump.files, dump.dropped );
+        cli_send_str( line );
+    }
+#endif
 }
 
 void cli_show_ip_route() {
@@ -274,6 +381,39 @@ void cli_show_vns() {
     cli_show_vns_user();
     cli_send_str( "  Virtual Host: " );
     cli_show_vns_vhost();
+
+    /* -- commands per recv shows how well the receive ring batches -- */
+    char line[128];
+    snprintf( line, sizeof(line), "  Received: %lu commands in %lu reads, %lu partial commands moved\n",
+              SR->vns_rx_cmds, SR->vns_rx_reads, SR->vns_rx_moves );
+    cli_send_str( line );
+
+#ifndef _MANUAL_MODE_
+    /* -- frames per write and how long they waited, to tune -W -- */
+    struct sr_vns_tx_stats tx;
+    char hist[256];
+    int b, len;
+
+    sr_vns_get_tx_stats( SR, &tx );
+    snprintf( line, sizeof(line),
+              "  Sent: %lu frames, %lu bytes in %lu writes (%lu batch ends, %lu full, %lu timer)\n",
+              tx.frames, tx.bytes, tx.flushes, tx.cause[SR_VNS_FLUSH_BATCH],
+              tx.cause[SR_VNS_FLUSH_BYTES], tx.cause[SR_VNS_FLUSH_TIMER] );
+    cli_send_str( line );
+
+    /* -- bucket b holds 2^b .. 2^(b+1)-1 frames -- */
+    len = snprintf( hist, sizeof(hist), "    write sizes:" );
+    for( b=0; b<SR_VNS_TX_HIST; b++ )
+        len += snprintf( hist + len, sizeof(hist) - len, " %u+:%lu", 1u << b, tx.size[b] );
+    cli_send_strs( 2, hist, "\n" );
+
+    /* -- bucket b holds frames held below 2^b us, the last one the rest -- */
+    len = snprintf( hist, sizeof(hist), "    frame latency (us):" );
+    for( b=0; b<SR_VNS_TX_LAT_HIST - 1; b++ )
+        len += snprintf( hist + len, sizeof(hist) - len, " <%u:%lu", 1u << b, tx.latency[b] );
+    len += snprintf( hist + len, sizeof(hist) - len, " %u+:%lu", 1u << (b - 1), tx.latency[b] );
+    cli_send_strs( 2, hist, "\n" );
+#endif
 }
 
 void cli_show_vns_lhost() {
@@ -109,6 +109,7 @@ void cli_show_all();
 
 void cli_show_ip();
 void cli_show_ip_arp();
+void cli_show_ip_icmp();
 void cli_show_ip_intf();
 void cli_show_ip_route();
 
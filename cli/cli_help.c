@@ -76,10 +76,11 @@ show hw route: displays the HW routing table\n" );
 
           case HELP_SHOW_IP:
               return cli_send_multi_help( fd, "\
-show ip [arp, interface (intf), route (rt),]: display information about the\n\
-  router's IP state\n",
-3,
+show ip [arp, icmp, interface (intf), route (rt),]: display information about\n\
+  the router's IP state\n",
+4,
 HELP_SHOW_IP_ARP,
+HELP_SHOW_IP_ICMP,
 HELP_SHOW_IP_INTF,
 HELP_SHOW_IP_ROUTE );
 
@@ -87,9 +88,15 @@ HELP_SHOW_IP_ROUTE );
                 return 0==writenstr( fd, "\
 show ip arp: displays the ARP cache sorted by IP within Active, Pending, and Static types\n" );
 
+           case HELP_SHOW_IP_ICMP:
+                return 0==writenstr( fd, "\
+show ip icmp: displays the rate limits of the ICMP messages the router sends\n\
+  and how many were sent or dropped by each\n" );
+
            case HELP_SHOW_IP_INTF:
                 return 0==writenstr( fd, "\
-show ip interface: displays the router's interfaces\n" );
+show ip interface: displays the router's interfaces, their transmit queues,\n\
+  the packet buffers and the packet log\n" );
 
            case HELP_SHOW_IP_ROUTE:
                 return 0==writenstr( fd, "\
@@ -19,6 +19,7 @@ typedef enum cli_help_t {
        HELP_SHOW_HW_ROUTE,
       HELP_SHOW_IP,
        HELP_SHOW_IP_ARP,
+       HELP_SHOW_IP_ICMP,
        HELP_SHOW_IP_INTF,
        HELP_SHOW_IP_ROUTE,
       HELP_SHOW_OPT,
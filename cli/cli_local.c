@@ -14,17 +14,9 @@ void cli_client_handler_main( void* pclient );
 int cli_is_time_to_shutdown();
 void sys_thread_new(void (* thread)(void *arg), void *arg);
 
-void cli_local_main( void* pport ) {
-    uint16_t port;
+int cli_local_listen( uint16_t port ) {
     struct sockaddr_in addr;
-    struct sockaddr client_addr;
-    unsigned sock_len = sizeof(struct sockaddr);
     int bindfd;
-    int clientfd;
-    cli_client_t* client;
-
-    port = *(uint16_t*)pport;
-    free( pport );
 
     /* create a socket to listen for connections on */
     bindfd = socket( AF_INET, SOCK_STREAM, 0 );
@@ -38,6 +30,7 @@ void cli_local_main( void* pport ) {
         die( "Error: SO_REUSEADDR failed" );
 
     /* bind to the requested port */
+    addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
     addr.sin_addr.s_addr = 0;
     memset(&(addr.sin_zero), 0, sizeof(addr.sin_zero));
@@ -49,24 +42,48 @@ void cli_local_main( void* pport ) {
     /* listen for clients */
     listen( bindfd, 10 );
 
-    while( !cli_is_time_to_shutdown() ) {
-        /* wait for a new client */
-        clientfd = accept(bindfd, &client_addr, &sock_len);
-        if( clientfd == - 1 ) {
-            if( errno == EINTR ) {
-                /* Interrupt received, going back to real accept() */
-                continue;
-            }
+    return bindfd;
+}
+
+cli_client_t* cli_local_accept( int bindfd ) {
+    struct sockaddr client_addr;
+    unsigned sock_len = sizeof(struct sockaddr);
+    int clientfd;
+    cli_client_t* client;
 
+    /* wait for a new client */
+    clientfd = accept(bindfd, &client_addr, &sock_len);
+    if( clientfd == - 1 ) {
+        if( errno != EINTR ) {
             /* some error */
             fprintf( stderr, "Warrning: real accept() returned an error code (%d)", errno );
-            continue;
         }
+        return NULL;
+    }
+
+    /* create a client record */
+    client = malloc_or_die( sizeof(cli_client_t) );
+    client->fd = -clientfd; /* negative means use the real sockets */
+    search_state_init( &client->state, CLI_INIT_BUF, CLI_MAX_BUF );
+
+    return client;
+}
+
+void cli_local_main( void* pport ) {
+    uint16_t port;
+    int bindfd;
+    cli_client_t* client;
+
+    port = *(uint16_t*)pport;
+    free( pport );
+
+    bindfd = cli_local_listen( port );
 
-        /* create a client record */
-        client = malloc_or_die( sizeof(cli_client_t) );
-        client->fd = -clientfd; /* negative means use the real sockets */
-        search_state_init( &client->state, CLI_INIT_BUF, CLI_MAX_BUF );
+    while( !cli_is_time_to_shutdown() ) {
+        /* interrupted or failed, go back to real accept() */
+        client = cli_local_accept( bindfd );
+        if( !client )
+            continue;
 
         /* spawn a new thread to handle the client */
         sys_thread_new( cli_client_handler_main, client );
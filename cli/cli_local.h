@@ -10,4 +10,20 @@
 /* Initializes the thread which will listen for clients on the local IP stack. */
 void cli_local_init( uint16_t port );
 
+/**
+ * Creates a socket on the local IP stack listening on port, for callers which
+ * wait for clients themselves.  Dies on error.
+ *
+ * @return the listening socket
+ */
+int cli_local_listen( uint16_t port );
+
+/**
+ * Accepts a client waiting on bindfd (from cli_local_listen).  The fd of the
+ * client is negated, as for every client on the local IP stack.
+ *
+ * @return the new client, NULL if accept() failed
+ */
+struct cli_client_t* cli_local_accept( int bindfd );
+
 #endif /* CLI_LOCAL */
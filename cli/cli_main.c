@@ -106,6 +106,17 @@ int cli_client_handle_request( cli_client_t* client ) {
     }
 }
 
+/** Sends the welcome message and the first prompt to client. */
+void cli_client_welcome( cli_client_t* client ) {
+    client->verbose = 0;
+
+    pthread_mutex_lock( &parser_lock );
+    cli_focus_set( client->fd, &client->verbose );
+    cli_send_welcome();
+    cli_send_prompt();
+    pthread_mutex_unlock( &parser_lock );
+}
+
 /**
  * Detaches and then handles pclient exclusively.  If pclient sends a shutdown
  * message, then the thread shuts down the whole router.  If pclient quits, then
@@ -115,7 +126,6 @@ THREAD_RETURN_TYPE cli_client_handler_main( void* pclient ) {
     cli_client_t* client;
 
     client = (cli_client_t*)pclient;
-    client->verbose = 0;
     pthread_detach( pthread_self() );
 
     /* ignore the broken pipe signal */
@@ -127,11 +137,7 @@ THREAD_RETURN_TYPE cli_client_handler_main( void* pclient ) {
     client->state.used = client->state.search_offset = client->state.needle_offset = 0;
 
     /* welcome the client */
-    pthread_mutex_lock( &parser_lock );
-    cli_focus_set( client->fd, &client->verbose );
-    cli_send_welcome();
-    cli_send_prompt();
-    pthread_mutex_unlock( &parser_lock );
+    cli_client_welcome( client );
 
     while( 1 ) {
         int res = cli_client_handle_request( client );
@@ -150,6 +156,14 @@ THREAD_RETURN_TYPE cli_client_handler_main( void* pclient ) {
     }
 }
 
+void cli_setup( void ) {
+    pthread_mutex_init( &parser_lock, NULL );
+
+    cli_init();
+    cli_parser_init();
+    cli_scanner_init();
+}
+
 int cli_main( uint16_t port ) {
     struct sockaddr_in addr;
     struct sockaddr client_addr;
@@ -163,11 +177,7 @@ int cli_main( uint16_t port ) {
 #endif
 
     sock_len = sizeof(struct sockaddr);
-    pthread_mutex_init( &parser_lock, NULL );
-
-    cli_init();
-    cli_parser_init();
-    cli_scanner_init();
+    cli_setup();
 
     /* create a socket to listen for connections on */
     bindfd = socket( AF_INET, SOCK_STREAM, 0 );
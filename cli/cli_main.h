@@ -38,4 +38,23 @@ typedef struct cli_client_t {
  */
 int cli_main( uint16_t port );
 
+/**
+ * Initializes the parser without starting any server, for callers which
+ * accept clients and wait for their requests themselves (see cli_local.h).
+ */
+void cli_setup( void );
+
+/** Sends the welcome message and the first prompt to client. */
+void cli_client_welcome( cli_client_t* client );
+
+/**
+ * Reads from client and handles each complete command.
+ *
+ * @return non-zero if client is still alive
+ */
+int cli_client_handle_request( cli_client_t* client );
+
+/** Closes the socket of client and frees its buffer (not client itself). */
+void cli_client_cleanup( cli_client_t* client_to_free );
+
 #endif /* CLI_MAIN_H */
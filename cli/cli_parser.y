@@ -88,7 +88,7 @@ static void run_command();
 /* Terminals with no attribute value */
 %token  T_SHOW T_QUESTION T_NEWLINE T_ALL
 %token  T_VNS T_USER T_VHOST T_LHOST T_TOPOLOGY
-%token  T_IP T_ROUTE T_INTF T_ARP T_OSPF T_HW T_NEIGHBORS
+%token  T_IP T_ROUTE T_INTF T_ARP T_ICMP T_OSPF T_HW T_NEIGHBORS
 %token  T_ADD T_DEL T_UP T_DOWN T_PURGE T_STATIC T_DYNAMIC T_ABOUT
 %token  T_PING T_TRACE T_HELP T_EXIT T_SHUTDOWN T_FLOOD
 %token  T_SET T_UNSET T_OPTION T_VERBOSE T_DATE
@@ -139,6 +139,8 @@ ShowTypeHW : /* empty: show all */                { SETC_FUNC0(cli_show_hw); }
 ShowTypeIP : /* empty: show all */                { SETC_FUNC0(cli_show_ip); }
            | T_ARP                                { SETC_FUNC0(cli_show_ip_arp); }
            | T_ARP TMIorQ                         { HELP(HELP_SHOW_IP_ARP); }
+           | T_ICMP                               { SETC_FUNC0(cli_show_ip_icmp); }
+           | T_ICMP TMIorQ                        { HELP(HELP_SHOW_IP_ICMP); }
            | T_INTF                               { SETC_FUNC0(cli_show_ip_intf); }
            | T_INTF TMIorQ                        { HELP(HELP_SHOW_IP_INTF); }
            | T_ROUTE                              { SETC_FUNC0(cli_show_ip_route); }
@@ -298,6 +300,7 @@ ActionHelp : HelpOrQ                              { HELP(HELP_ACTION_HELP); }
            | HelpOrQ T_SHOW T_HW T_ROUTE          { HELP(HELP_SHOW_HW_ROUTE); }
            | HelpOrQ T_SHOW T_IP                  { HELP(HELP_SHOW_IP); }
            | HelpOrQ T_SHOW T_IP T_ARP            { HELP(HELP_SHOW_IP_ARP); }
+           | HelpOrQ T_SHOW T_IP T_ICMP           { HELP(HELP_SHOW_IP_ICMP); }
            | HelpOrQ T_SHOW T_IP T_INTF           { HELP(HELP_SHOW_IP_INTF); }
            | HelpOrQ T_SHOW T_IP T_ROUTE          { HELP(HELP_SHOW_IP_ROUTE); }
            | HelpOrQ T_SHOW T_OPTION              { HELP(HELP_SHOW_OPT); }
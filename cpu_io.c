@@ -0,0 +1,77 @@
+/**
+ * @file cpu_io.c
+ * @author Mohammad Reza Hosseini
+ *
+ * backend registry and the socket setup they share
+ */
+
+#include "cpu_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+
+static const cpu_io_t* cpu_io_backends[] = {
+	&cpu_io_socket,
+	&cpu_io_mmap,
+	&cpu_io_xdp,
+	NULL
+};
+
+/**
+ * @return the backend called name, NULL if there is none
+ */
+const cpu_io_t* cpu_io_find(const char* name){
+	int i = 0;
+	for (i = 0; cpu_io_backends[i]; i++){
+		if (!strcmp(cpu_io_backends[i]->name, name)) {
+			return cpu_io_backends[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * bind a packet socket to dev, frames of protocol start arriving from here on
+ *
+ * @param protocol ethertype to receive in host order, 0 for a transmit only socket
+ */
+void cpu_io_bindSocket(int s, const char* dev, uint16_t protocol){
+	struct ifreq ifr;
+	bzero(&ifr, sizeof(struct ifreq));
+	strncpy(ifr.ifr_ifrn.ifrn_name, dev, IFNAMSIZ - 1);
+	if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+		perror("ioctl SIOCGIFINDEX");
+		exit(1);
+	}
+
+	struct sockaddr_ll saddr;
+	bzero(&saddr, sizeof(struct sockaddr_ll));
+	saddr.sll_family = AF_PACKET;
+	saddr.sll_protocol = htons(protocol);
+	saddr.sll_ifindex = ifr.ifr_ifru.ifru_ivalue;
+
+	if (bind(s, (struct sockaddr*)(&saddr), sizeof(saddr)) < 0) {
+		perror("bind error");
+		exit(1);
+	}
+}
+
+/**
+ * @return a raw packet socket, not receiving anything until it is bound
+ */
+int cpu_io_createSocket(void){
+	int s = socket(PF_PACKET, SOCK_RAW, 0);
+	if (s < 0) {
+		perror("socket");
+		exit(1);
+	}
+	return s;
+}
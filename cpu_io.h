@@ -0,0 +1,77 @@
+/**
+ * @file cpu_io.h
+ * @author Mohammad Reza Hosseini
+ *
+ * packet i/o backends for cpu mode. sr_cpu_input/sr_cpu_output drive every
+ * port through one of these, picked at startup (-k):
+ *
+ *   socket	PF_PACKET raw sockets, recvmmsg/sendmmsg
+ *   mmap	PACKET_MMAP, TPACKET_V3 receive ring and TPACKET_V2 transmit
+ *		ring; received frames are processed in place in the ring
+ *   xdp	AF_XDP sockets sharing one UMEM, generic XDP in copy mode;
+ *		forwarded frames are sent from where they were received
+ *
+ * Ports are <prefix>0 .. <prefix>3 (-d, "nf2c" by default). The NetFPGA
+ * register interface is only used with the default prefix, so any four
+ * interfaces (e.g. veth pairs) can stand in for the board.
+ */
+#ifndef CPU_IO_H_
+#define CPU_IO_H_
+
+#include "packet.h"
+
+#include <stdint.h>
+
+#define CPU_IO_DEFAULT		"socket"
+#define CPU_IO_NETFPGA_PREFIX	"nf2c"
+
+struct Router;
+struct iovec;
+
+typedef struct Cpu_Io_Backend {
+	const char* name;
+
+	/**
+	 * open port on device dev for bursts of up to batch frames, keeping
+	 * the state in router->io_port[port]
+	 * @return a descriptor that polls readable when frames are waiting
+	 */
+	int (*open)(struct Router* router, int port, const char* dev, int batch);
+
+	/**
+	 * non blocking receive
+	 * @return number of frames stored in pkts, at most max
+	 */
+	int (*rx)(struct Router* router, int port, pkt_buf_t** pkts, int max);
+
+	/**
+	 * give back the frames of the last rx once the router is done with them,
+	 * drops the references rx handed out
+	 */
+	void (*rxDone)(struct Router* router, int port, pkt_buf_t** pkts, int count);
+
+	/**
+	 * non blocking transmit, the frames are not kept
+	 * @return number of frames taken from the front of bufs, -1 on error
+	 */
+	int (*tx)(struct Router* router, int port, uint8_t** bufs, unsigned int* lens, int count);
+
+	/**
+	 * non blocking transmit of one frame gathered from iovcnt pieces, the
+	 * pieces are not kept
+	 * @return 1 if the frame was taken, 0 if there is no room right now, -1 on error
+	 */
+	int (*txv)(struct Router* router, int port, const struct iovec* iov, int iovcnt);
+} cpu_io_t;
+
+extern const cpu_io_t cpu_io_socket;
+extern const cpu_io_t cpu_io_mmap;
+extern const cpu_io_t cpu_io_xdp;
+
+const cpu_io_t* cpu_io_find(const char* name);
+
+int cpu_io_createSocket(void);
+
+void cpu_io_bindSocket(int s, const char* dev, uint16_t protocol);
+
+#endif
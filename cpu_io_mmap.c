@@ -0,0 +1,288 @@
+/**
+ * @file cpu_io_mmap.c
+ * @author Mohammad Reza Hosseini
+ *
+ * PACKET_MMAP backend. Each port gets two sockets sharing rings with the
+ * kernel: a TPACKET_V3 receive ring and a TPACKET_V2 transmit ring.
+ *
+ * Received frames are wrapped (pkt_wrap) and processed where the kernel put
+ * them, rewritten in place on the forwarding path, and only copied when the
+ * stack keeps one past the batch (e.g. on the ARP queue).  A V3 ring is made
+ * of blocks holding many frames; rx hands out frames of one block at a time
+ * and the block goes back to the kernel in rxDone once all of them are done.
+ *
+ * Transmit copies each frame into a ring slot and kicks the kernel once per
+ * burst.
+ */
+
+#include "cpu_io.h"
+#include "router.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#define MMAP_RX_BLOCK_SIZE	(1 << 16)
+#define MMAP_RX_BLOCK_NR	128
+#define MMAP_RX_BLOCK_TOV	1	/* ms before a partly filled block is handed over */
+#define MMAP_FRAME_SIZE		2048
+#define MMAP_TX_BLOCK_SIZE	(1 << 16)
+#define MMAP_TX_BLOCK_NR	16
+#define MMAP_TX_FRAME_NR	(MMAP_TX_BLOCK_SIZE / MMAP_FRAME_SIZE * MMAP_TX_BLOCK_NR)
+
+///where a frame starts in a V2 transmit slot
+#define MMAP_TX_DATA		TPACKET_ALIGN(sizeof(struct tpacket2_hdr))
+
+
+typedef struct Mmap_Port {
+	int rx_fd;
+	uint8_t* rx_ring;
+	unsigned int rx_block;		/* block being read */
+	unsigned int rx_left;		/* frames of it not handed out yet */
+	uint8_t* rx_next;		/* next frame in it, NULL until it is opened */
+
+	int tx_fd;
+	uint8_t* tx_ring;
+	unsigned int tx_head;		/* next slot to fill */
+} mmap_port_t;
+
+
+static uint8_t* mmap_map(int fd, size_t len){
+	uint8_t* ring = (uint8_t*) mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		perror("mmap packet ring");
+		exit(1);
+	}
+	return ring;
+}
+
+static void mmap_setVersion(int fd, int version){
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		perror("setsockopt PACKET_VERSION");
+		exit(1);
+	}
+}
+
+static int mmap_open(router_t* router, int port, const char* dev, int batch){
+	mmap_port_t* p = (mmap_port_t*) calloc(1, sizeof(mmap_port_t));
+	int one = 1;
+	assert(p);
+
+	/*
+	 * receive: the ring has to be in place before the socket is bound, or
+	 * the first frames queue up outside of it
+	 */
+	p->rx_fd = cpu_io_createSocket();
+	mmap_setVersion(p->rx_fd, TPACKET_V3);
+
+	struct tpacket_req3 req3;
+	memset(&req3, 0, sizeof(req3));
+	req3.tp_block_size = MMAP_RX_BLOCK_SIZE;
+	req3.tp_block_nr = MMAP_RX_BLOCK_NR;
+	req3.tp_frame_size = MMAP_FRAME_SIZE;
+	req3.tp_frame_nr = MMAP_RX_BLOCK_SIZE / MMAP_FRAME_SIZE * MMAP_RX_BLOCK_NR;
+	req3.tp_retire_blk_tov = MMAP_RX_BLOCK_TOV;
+	if (setsockopt(p->rx_fd, SOL_PACKET, PACKET_RX_RING, &req3, sizeof(req3)) < 0) {
+		perror("setsockopt PACKET_RX_RING");
+		exit(1);
+	}
+	p->rx_ring = mmap_map(p->rx_fd, MMAP_RX_BLOCK_SIZE * MMAP_RX_BLOCK_NR);
+
+	#ifdef PACKET_IGNORE_OUTGOING
+	/* -- our own transmit socket would otherwise loop every frame back -- */
+	setsockopt(p->rx_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+	#endif
+
+	cpu_io_bindSocket(p->rx_fd, dev, ETH_P_ALL);
+
+	/*
+	 * transmit: bound with protocol 0 so it never receives
+	 */
+	p->tx_fd = cpu_io_createSocket();
+	mmap_setVersion(p->tx_fd, TPACKET_V2);
+
+	struct tpacket_req req;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = MMAP_TX_BLOCK_SIZE;
+	req.tp_block_nr = MMAP_TX_BLOCK_NR;
+	req.tp_frame_size = MMAP_FRAME_SIZE;
+	req.tp_frame_nr = MMAP_TX_FRAME_NR;
+	if (setsockopt(p->tx_fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+		perror("setsockopt PACKET_TX_RING");
+		exit(1);
+	}
+	p->tx_ring = mmap_map(p->tx_fd, MMAP_TX_BLOCK_SIZE * MMAP_TX_BLOCK_NR);
+
+	#ifdef PACKET_QDISC_BYPASS
+	setsockopt(p->tx_fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+	#endif
+
+	cpu_io_bindSocket(p->tx_fd, dev, 0);
+
+	router->io_port[port] = p;
+	return p->rx_fd;
+}
+
+static struct tpacket_block_desc* mmap_block(mmap_port_t* p){
+	return (struct tpacket_block_desc*) (p->rx_ring + p->rx_block * MMAP_RX_BLOCK_SIZE);
+}
+
+/**
+ * hand the current block back to the kernel and move to the next one
+ */
+static void mmap_releaseBlock(mmap_port_t* p){
+	struct tpacket_block_desc* bd = mmap_block(p);
+	__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+	p->rx_block = (p->rx_block + 1) % MMAP_RX_BLOCK_NR;
+	p->rx_next = NULL;
+	p->rx_left = 0;
+}
+
+static int mmap_rx(router_t* router, int port, pkt_buf_t** pkts, int max){
+	mmap_port_t* p = (mmap_port_t*) router->io_port[port];
+	int n = 0;
+
+	while (n == 0) {
+		struct tpacket_block_desc* bd = mmap_block(p);
+
+		if (!p->rx_next) {
+			if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+				return 0;
+			}
+			p->rx_left = bd->hdr.bh1.num_pkts;
+			p->rx_next = (uint8_t*) bd + bd->hdr.bh1.offset_to_first_pkt;
+		}
+
+		while (n < max && p->rx_left > 0) {
+			struct tpacket3_hdr* hdr = (struct tpacket3_hdr*) p->rx_next;
+			struct sockaddr_ll* sll = (struct sockaddr_ll*) ((uint8_t*) hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+			uint8_t* frame = (uint8_t*) hdr + hdr->tp_mac;
+			unsigned int len = hdr->tp_snaplen;
+
+			p->rx_next += hdr->tp_next_offset;
+			p->rx_left--;
+
+			if (sll->sll_pkttype == PACKET_OUTGOING || len > PKT_BUF_SIZE - PKT_HEADROOM) {
+				continue;
+			}
+
+			if (len < PKT_MIN_LEN) {
+				/*
+				 * runts (veth does not pad) get a buffer of their own, the
+				 * transmit path pads them in place
+				 */
+				pkts[n] = pkt_alloc(len);
+				memcpy(pkts[n]->data, frame, len);
+			} else {
+				pkts[n] = pkt_wrap(frame, len);
+			}
+			n++;
+		}
+
+		if (n == 0) {
+			/* -- nothing for us in this block -- */
+			mmap_releaseBlock(p);
+		}
+	}
+
+	return n;
+}
+
+static void mmap_rxDone(router_t* router, int port, pkt_buf_t** pkts, int count){
+	mmap_port_t* p = (mmap_port_t*) router->io_port[port];
+	int i = 0;
+
+	for (i = 0; i < count; i++){
+		pkt_unref(pkts[i]);
+	}
+
+	if (p->rx_next && p->rx_left == 0) {
+		mmap_releaseBlock(p);
+	}
+}
+
+static int mmap_tx(router_t* router, int port, uint8_t** bufs, unsigned int* lens, int count){
+	mmap_port_t* p = (mmap_port_t*) router->io_port[port];
+	int queued = 0;
+
+	for (queued = 0; queued < count; queued++){
+		struct tpacket2_hdr* hdr = (struct tpacket2_hdr*) (p->tx_ring + p->tx_head * MMAP_FRAME_SIZE);
+
+		if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+			/* -- ring full, the kernel has not sent these yet -- */
+			break;
+		}
+		if (lens[queued] > MMAP_FRAME_SIZE - MMAP_TX_DATA) {
+			break;
+		}
+
+		memcpy((uint8_t*) hdr + MMAP_TX_DATA, bufs[queued], lens[queued]);
+		hdr->tp_len = lens[queued];
+		__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+		p->tx_head = (p->tx_head + 1) % MMAP_TX_FRAME_NR;
+	}
+
+	if (queued > 0) {
+		/*
+		 * one kick sends every slot marked so far; if the device is busy
+		 * they stay marked and go out with the next kick
+		 */
+		if (send(p->tx_fd, NULL, 0, MSG_DONTWAIT) < 0 &&
+		    errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+			perror("send packet ring");
+		}
+	}
+
+	return queued;
+}
+
+/**
+ * the pieces are gathered straight into the next transmit slot, which is the
+ * one copy a frame sent through the ring takes anyway
+ */
+static int mmap_txv(router_t* router, int port, const struct iovec* iov, int iovcnt){
+	mmap_port_t* p = (mmap_port_t*) router->io_port[port];
+	struct tpacket2_hdr* hdr = (struct tpacket2_hdr*) (p->tx_ring + p->tx_head * MMAP_FRAME_SIZE);
+	uint8_t* data = (uint8_t*) hdr + MMAP_TX_DATA;
+	unsigned int len = 0;
+	int i = 0;
+
+	if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+		return 0;
+	}
+
+	for (i = 0; i < iovcnt; i++){
+		if (len + iov[i].iov_len > MMAP_FRAME_SIZE - MMAP_TX_DATA) {
+			return -1;
+		}
+		memcpy(data + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+	hdr->tp_len = len;
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+	p->tx_head = (p->tx_head + 1) % MMAP_TX_FRAME_NR;
+
+	if (send(p->tx_fd, NULL, 0, MSG_DONTWAIT) < 0 &&
+	    errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+		perror("send packet ring");
+	}
+
+	return 1;
+}
+
+const cpu_io_t cpu_io_mmap = {
+	"mmap",
+	mmap_open,
+	mmap_rx,
+	mmap_rxDone,
+	mmap_tx,
+	mmap_txv
+};
@@ -0,0 +1,154 @@
+/**
+ * @file cpu_io_socket.c
+ * @author Mohammad Reza Hosseini
+ *
+ * the plain PF_PACKET backend: frames are received into pooled packet
+ * buffers with recvmmsg and sent with sendmmsg, one socket per port.
+ */
+
+#include "cpu_io.h"
+#include "router.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_ether.h>
+
+
+typedef struct Socket_Port {
+	int fd;
+	int batch;
+	struct mmsghdr* msgs;
+	struct iovec* iovs;
+	pkt_buf_t** slots;	/* receive buffers, refilled after they are handed out */
+} socket_port_t;
+
+
+static int socket_open(router_t* router, int port, const char* dev, int batch){
+	socket_port_t* p = (socket_port_t*) calloc(1, sizeof(socket_port_t));
+	assert(p);
+
+	p->fd = cpu_io_createSocket();
+	cpu_io_bindSocket(p->fd, dev, ETH_P_ALL);
+
+	p->batch = batch;
+	p->msgs = (struct mmsghdr*) calloc(batch, sizeof(struct mmsghdr));
+	p->iovs = (struct iovec*) calloc(batch, sizeof(struct iovec));
+	p->slots = (pkt_buf_t**) calloc(batch, sizeof(pkt_buf_t*));
+	assert(p->msgs && p->iovs && p->slots);
+
+	router->io_port[port] = p;
+	return p->fd;
+}
+
+static int socket_rx(router_t* router, int port, pkt_buf_t** pkts, int max){
+	socket_port_t* p = (socket_port_t*) router->io_port[port];
+	int i = 0;
+
+	if (max > p->batch) {
+		max = p->batch;
+	}
+
+	/*
+	 * buffers handed to the router last time are replaced
+	 */
+	for (i = 0; i < max; i++){
+		if (!p->slots[i]) {
+			p->slots[i] = pkt_alloc(PKT_BUF_SIZE - PKT_HEADROOM);
+		}
+		p->iovs[i].iov_base = p->slots[i]->data;
+		p->iovs[i].iov_len = PKT_BUF_SIZE - PKT_HEADROOM;
+		p->msgs[i].msg_hdr.msg_iov = &p->iovs[i];
+		p->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int n = recvmmsg(p->fd, p->msgs, max, MSG_DONTWAIT, NULL);
+	if (n <= 0) {
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			perror("recvmmsg");
+			exit(1);
+		}
+		return 0;
+	}
+
+	for (i = 0; i < n; i++){
+		pkts[i] = p->slots[i];
+		pkts[i]->len = p->msgs[i].msg_len;
+		p->slots[i] = NULL;
+	}
+	return n;
+}
+
+static void socket_rxDone(router_t* router, int port, pkt_buf_t** pkts, int count){
+	int i = 0;
+	for (i = 0; i < count; i++){
+		pkt_unref(pkts[i]);
+	}
+}
+
+static int socket_tx(router_t* router, int port, uint8_t** bufs, unsigned int* lens, int count){
+	socket_port_t* p = (socket_port_t*) router->io_port[port];
+	struct mmsghdr msgs[count];
+	struct iovec iovs[count];
+	int sent = 0;
+	int i = 0;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < count; i++){
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = lens[i];
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < count) {
+		int n = sendmmsg(p->fd, &msgs[sent], count - sent, MSG_DONTWAIT);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+				perror("sendmmsg");
+			}
+			break;
+		}
+		sent += n;
+	}
+
+	return sent;
+}
+
+static int socket_txv(router_t* router, int port, const struct iovec* iov, int iovcnt){
+	socket_port_t* p = (socket_port_t*) router->io_port[port];
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = (struct iovec*) iov;
+	msg.msg_iovlen = iovcnt;
+
+	while (sendmsg(p->fd, &msg, MSG_DONTWAIT) < 0) {
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+			perror("sendmsg");
+			return -1;
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+const cpu_io_t cpu_io_socket = {
+	"socket",
+	socket_open,
+	socket_rx,
+	socket_rxDone,
+	socket_tx,
+	socket_txv
+};
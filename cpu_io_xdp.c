@@ -0,0 +1,551 @@
+/**
+ * @file cpu_io_xdp.c
+ * @author Mohammad Reza Hosseini
+ *
+ * AF_XDP backend. Every port gets one XDP socket on queue 0 of its device, all
+ * of them sharing a single UMEM (the frame memory the kernel receives into and
+ * transmits from).  A frame received on one port and forwarded out another is
+ * put on the transmit ring where it was received, it never leaves the UMEM.
+ * Frames from anywhere else (pool buffers built by ARP, ICMP, PWOSPF) are
+ * copied into a free UMEM frame.
+ *
+ * UMEM frames are counted: the receive side holds one reference from rx to
+ * rxDone and every transmit holds one until the kernel completes it.  The last
+ * one puts the frame on the free list, fill rings are refilled from there.
+ *
+ * No libbpf: the XDP program that steers the frames into the sockets is six
+ * instructions, loaded with bpf(2) and attached in generic (skb) mode through
+ * a bpf link, so it goes away with the process.  Sockets are bound in copy
+ * mode, which works on any device including veth.  Only queue 0 is served,
+ * frames on other queues go on to the kernel (set the NIC to one queue).
+ */
+
+#include "cpu_io.h"
+#include "router.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#ifndef AF_XDP
+#define AF_XDP			44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP			283
+#endif
+
+#define XDP_FRAME_SIZE		2048
+#define XDP_RING_SIZE		1024
+///enough to keep every fill and transmit ring full
+#define XDP_NUM_FRAMES		(NUM_INTERFACES * 2 * XDP_RING_SIZE)
+#define XDP_QUEUE		0
+#define XDP_MAX_QUEUES		64
+
+///frame a UMEM address (or an offset into a frame) belongs to
+#define XDP_FRAME(addr)		((addr) / XDP_FRAME_SIZE)
+
+
+typedef struct Xdp_Ring {
+	uint32_t* producer;
+	uint32_t* consumer;
+	uint32_t* flags;
+	void* desc;
+	void* map;
+	size_t map_len;
+} xdp_ring_t;
+
+typedef struct Xdp_Port {
+	int fd;
+	xdp_ring_t rx;
+	xdp_ring_t fill;
+	xdp_ring_t tx;
+	xdp_ring_t comp;
+	pthread_mutex_t lock_tx;	/* tx and completion ring */
+	int map_fd;
+	int link_fd;
+} xdp_port_t;
+
+typedef struct Xdp_Umem {
+	uint8_t* area;
+	int fd;				/* socket the UMEM is registered on, -1 before the first port */
+	pthread_mutex_t lock;		/* refs and free list */
+	uint16_t refs[XDP_NUM_FRAMES];
+	uint64_t free[XDP_NUM_FRAMES];
+	unsigned int free_count;
+} xdp_umem_t;
+
+
+static xdp_umem_t xdp_umem = { NULL, -1, PTHREAD_MUTEX_INITIALIZER };
+
+
+static int xdp_bpf(int cmd, union bpf_attr* attr){
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * load the program redirecting every frame into the XSKMAP slot of the queue
+ * it arrived on, frames on a queue without a socket are passed to the kernel:
+ *
+ *	r2 = ctx->rx_queue_index
+ *	r1 = map
+ *	r3 = XDP_PASS
+ *	return bpf_redirect_map(r1, r2, r3)
+ */
+static int xdp_loadProgram(int map_fd){
+	struct bpf_insn insns[] = {
+		{ BPF_LDX | BPF_W | BPF_MEM, 2, 1, offsetof(struct xdp_md, rx_queue_index), 0 },
+		{ BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd },
+		{ 0, 0, 0, 0, 0 },
+		{ BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS },
+		{ BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },
+		{ BPF_JMP | BPF_EXIT, 0, 0, 0, 0 }
+	};
+	char log[4096] = "";
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uint64_t) (unsigned long) insns;
+	attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+	attr.license = (uint64_t) (unsigned long) "GPL";
+	attr.log_buf = (uint64_t) (unsigned long) log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+
+	int fd = xdp_bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0) {
+		perror("bpf BPF_PROG_LOAD");
+		fprintf(stderr, "%s", log);
+		exit(1);
+	}
+	return fd;
+}
+
+/**
+ * steer the frames of dev into the socket: an XSKMAP holding it, the program
+ * and a generic mode link to dev
+ */
+static void xdp_attach(xdp_port_t* p, const char* dev){
+	union bpf_attr attr;
+	unsigned int ifindex = if_nametoindex(dev);
+	if (!ifindex) {
+		perror("if_nametoindex");
+		exit(1);
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = XDP_MAX_QUEUES;
+	p->map_fd = xdp_bpf(BPF_MAP_CREATE, &attr);
+	if (p->map_fd < 0) {
+		perror("bpf BPF_MAP_CREATE");
+		exit(1);
+	}
+
+	uint32_t key = XDP_QUEUE;
+	uint32_t value = p->fd;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = p->map_fd;
+	attr.key = (uint64_t) (unsigned long) &key;
+	attr.value = (uint64_t) (unsigned long) &value;
+	if (xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+		perror("bpf BPF_MAP_UPDATE_ELEM");
+		exit(1);
+	}
+
+	int prog_fd = xdp_loadProgram(p->map_fd);
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = prog_fd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+	p->link_fd = xdp_bpf(BPF_LINK_CREATE, &attr);
+	if (p->link_fd < 0) {
+		perror("bpf BPF_LINK_CREATE (another XDP program on the device?)");
+		exit(1);
+	}
+	close(prog_fd);
+}
+
+static void xdp_setRing(int fd, int opt, const char* name){
+	int size = XDP_RING_SIZE;
+	if (setsockopt(fd, SOL_XDP, opt, &size, sizeof(size)) < 0) {
+		perror(name);
+		exit(1);
+	}
+}
+
+static void xdp_mapRing(int fd, xdp_ring_t* ring, struct xdp_ring_offset* off, size_t desc_size, off_t pgoff){
+	ring->map_len = off->desc + XDP_RING_SIZE * desc_size;
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (ring->map == MAP_FAILED) {
+		perror("mmap xdp ring");
+		exit(1);
+	}
+	ring->producer = (uint32_t*) ((uint8_t*) ring->map + off->producer);
+	ring->consumer = (uint32_t*) ((uint8_t*) ring->map + off->consumer);
+	ring->flags = (uint32_t*) ((uint8_t*) ring->map + off->flags);
+	ring->desc = (uint8_t*) ring->map + off->desc;
+}
+
+/**
+ * drop one reference to each frame, the last puts it on the free list
+ * @pre xdp_umem.lock is held
+ */
+static void xdp_release(uint64_t* addrs, int count){
+	int i = 0;
+	for (i = 0; i < count; i++){
+		uint64_t frame = XDP_FRAME(addrs[i]);
+		assert(xdp_umem.refs[frame] > 0);
+		if (--xdp_umem.refs[frame] == 0) {
+			xdp_umem.free[xdp_umem.free_count++] = frame * XDP_FRAME_SIZE;
+		}
+	}
+}
+
+/**
+ * hand free frames to the kernel to receive into
+ */
+static void xdp_refill(xdp_port_t* p){
+	uint32_t prod = *p->fill.producer;
+	uint32_t cons = __atomic_load_n(p->fill.consumer, __ATOMIC_ACQUIRE);
+	uint32_t room = XDP_RING_SIZE - (prod - cons);
+	uint64_t* desc = (uint64_t*) p->fill.desc;
+
+	if (room == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&xdp_umem.lock);
+	while (room > 0 && xdp_umem.free_count > 0) {
+		uint64_t addr = xdp_umem.free[--xdp_umem.free_count];
+		xdp_umem.refs[XDP_FRAME(addr)] = 1;
+		desc[prod++ & (XDP_RING_SIZE - 1)] = addr;
+		room--;
+	}
+	pthread_mutex_unlock(&xdp_umem.lock);
+
+	__atomic_store_n(p->fill.producer, prod, __ATOMIC_RELEASE);
+}
+
+/**
+ * take back the frames the kernel has sent
+ * @pre p->lock_tx is held
+ */
+static void xdp_complete(xdp_port_t* p){
+	uint32_t cons = *p->comp.consumer;
+	uint32_t prod = __atomic_load_n(p->comp.producer, __ATOMIC_ACQUIRE);
+	uint64_t* desc = (uint64_t*) p->comp.desc;
+	uint64_t addrs[XDP_RING_SIZE];
+	int n = 0;
+
+	if (cons == prod) {
+		return;
+	}
+
+	for (; cons != prod; cons++){
+		addrs[n++] = desc[cons & (XDP_RING_SIZE - 1)];
+	}
+	__atomic_store_n(p->comp.consumer, cons, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&xdp_umem.lock);
+	xdp_release(addrs, n);
+	pthread_mutex_unlock(&xdp_umem.lock);
+}
+
+/**
+ * register the UMEM on the first port's socket, every frame starts out free
+ */
+static void xdp_registerUmem(int fd){
+	xdp_umem.area = (uint8_t*) mmap(NULL, (size_t) XDP_NUM_FRAMES * XDP_FRAME_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (xdp_umem.area == MAP_FAILED) {
+		perror("mmap umem");
+		exit(1);
+	}
+
+	struct xdp_umem_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uint64_t) (unsigned long) xdp_umem.area;
+	reg.len = (uint64_t) XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+	reg.chunk_size = XDP_FRAME_SIZE;
+	if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+		perror("setsockopt XDP_UMEM_REG");
+		exit(1);
+	}
+
+	int i = 0;
+	for (i = XDP_NUM_FRAMES - 1; i >= 0; i--){
+		xdp_umem.free[xdp_umem.free_count++] = (uint64_t) i * XDP_FRAME_SIZE;
+	}
+	xdp_umem.fd = fd;
+}
+
+static int xdp_open(router_t* router, int port, const char* dev, int batch){
+	xdp_port_t* p = (xdp_port_t*) calloc(1, sizeof(xdp_port_t));
+	assert(p);
+	pthread_mutex_init(&p->lock_tx, NULL);
+
+	p->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (p->fd < 0) {
+		perror("socket AF_XDP");
+		exit(1);
+	}
+
+	if (xdp_umem.fd < 0) {
+		xdp_registerUmem(p->fd);
+	}
+
+	/*
+	 * each socket has fill and completion rings of its own, also when it
+	 * shares the UMEM of another one
+	 */
+	xdp_setRing(p->fd, XDP_UMEM_FILL_RING, "setsockopt XDP_UMEM_FILL_RING");
+	xdp_setRing(p->fd, XDP_UMEM_COMPLETION_RING, "setsockopt XDP_UMEM_COMPLETION_RING");
+	xdp_setRing(p->fd, XDP_RX_RING, "setsockopt XDP_RX_RING");
+	xdp_setRing(p->fd, XDP_TX_RING, "setsockopt XDP_TX_RING");
+
+	struct xdp_mmap_offsets off;
+	socklen_t optlen = sizeof(off);
+	if (getsockopt(p->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+		perror("getsockopt XDP_MMAP_OFFSETS");
+		exit(1);
+	}
+	xdp_mapRing(p->fd, &p->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING);
+	xdp_mapRing(p->fd, &p->tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING);
+	xdp_mapRing(p->fd, &p->fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING);
+	xdp_mapRing(p->fd, &p->comp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING);
+
+	/* -- the fill ring has to have frames before anything arrives -- */
+	xdp_refill(p);
+
+	struct sockaddr_xdp sxdp;
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = if_nametoindex(dev);
+	sxdp.sxdp_queue_id = XDP_QUEUE;
+	if (xdp_umem.fd == p->fd) {
+		sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+	} else {
+		/* -- flags come from the socket owning the UMEM -- */
+		sxdp.sxdp_flags = XDP_SHARED_UMEM;
+		sxdp.sxdp_shared_umem_fd = xdp_umem.fd;
+	}
+	if (bind(p->fd, (struct sockaddr*) &sxdp, sizeof(sxdp)) < 0) {
+		perror("bind AF_XDP");
+		exit(1);
+	}
+
+	xdp_attach(p, dev);
+
+	router->io_port[port] = p;
+	return p->fd;
+}
+
+static int xdp_rx(router_t* router, int port, pkt_buf_t** pkts, int max){
+	xdp_port_t* p = (xdp_port_t*) router->io_port[port];
+	uint32_t cons = *p->rx.consumer;
+	uint32_t prod = __atomic_load_n(p->rx.producer, __ATOMIC_ACQUIRE);
+	struct xdp_desc* desc = (struct xdp_desc*) p->rx.desc;
+	uint64_t runts[max];
+	int n = 0, r = 0;
+
+	if (cons == prod) {
+		/* -- the kernel only fills the ring when asked while it is empty -- */
+		if (__atomic_load_n(p->fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP) {
+			recvfrom(p->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+		}
+		return 0;
+	}
+
+	for (; cons != prod && n < max; cons++){
+		struct xdp_desc* d = &desc[cons & (XDP_RING_SIZE - 1)];
+		uint8_t* frame = xdp_umem.area + d->addr;
+
+		if (d->len < PKT_MIN_LEN) {
+			/*
+			 * runts (veth does not pad) get a buffer of their own, the
+			 * transmit path pads them in place
+			 */
+			pkts[n] = pkt_alloc(d->len);
+			memcpy(pkts[n]->data, frame, d->len);
+			runts[r++] = d->addr;
+		} else {
+			pkts[n] = pkt_wrap(frame, d->len);
+		}
+		n++;
+	}
+	__atomic_store_n(p->rx.consumer, cons, __ATOMIC_RELEASE);
+
+	if (r > 0) {
+		pthread_mutex_lock(&xdp_umem.lock);
+		xdp_release(runts, r);
+		pthread_mutex_unlock(&xdp_umem.lock);
+	}
+
+	return n;
+}
+
+static void xdp_rxDone(router_t* router, int port, pkt_buf_t** pkts, int count){
+	xdp_port_t* p = (xdp_port_t*) router->io_port[port];
+	uint64_t addrs[count];
+	int n = 0;
+	int i = 0;
+
+	for (i = 0; i < count; i++){
+		if (pkts[i]->external) {
+			addrs[n++] = pkts[i]->data - xdp_umem.area;
+		}
+		pkt_unref(pkts[i]);
+	}
+
+	pthread_mutex_lock(&xdp_umem.lock);
+	xdp_release(addrs, n);
+	pthread_mutex_unlock(&xdp_umem.lock);
+
+	/* -- frames we sent may be what the fill ring is waiting for -- */
+	if (!pthread_mutex_trylock(&p->lock_tx)) {
+		xdp_complete(p);
+		pthread_mutex_unlock(&p->lock_tx);
+	}
+	xdp_refill(p);
+}
+
+static int xdp_tx(router_t* router, int port, uint8_t** bufs, unsigned int* lens, int count){
+	xdp_port_t* p = (xdp_port_t*) router->io_port[port];
+	struct xdp_desc* desc = (struct xdp_desc*) p->tx.desc;
+	uint8_t* umem_end = xdp_umem.area + (size_t) XDP_NUM_FRAMES * XDP_FRAME_SIZE;
+	int queued = 0;
+
+	pthread_mutex_lock(&p->lock_tx);
+	xdp_complete(p);
+
+	uint32_t prod = *p->tx.producer;
+	uint32_t cons = __atomic_load_n(p->tx.consumer, __ATOMIC_ACQUIRE);
+	uint32_t room = XDP_RING_SIZE - (prod - cons);
+
+	pthread_mutex_lock(&xdp_umem.lock);
+	for (queued = 0; queued < count && (uint32_t) queued < room; queued++){
+		uint64_t addr;
+
+		if (lens[queued] > XDP_FRAME_SIZE) {
+			break;
+		}
+
+		if (bufs[queued] >= xdp_umem.area && bufs[queued] < umem_end) {
+			/* -- received into the UMEM, send it from where it is -- */
+			addr = bufs[queued] - xdp_umem.area;
+			xdp_umem.refs[XDP_FRAME(addr)]++;
+		} else {
+			if (xdp_umem.free_count == 0) {
+				break;
+			}
+			addr = xdp_umem.free[--xdp_umem.free_count];
+			xdp_umem.refs[XDP_FRAME(addr)] = 1;
+			memcpy(xdp_umem.area + addr, bufs[queued], lens[queued]);
+		}
+
+		desc[prod & (XDP_RING_SIZE - 1)].addr = addr;
+		desc[prod & (XDP_RING_SIZE - 1)].len = lens[queued];
+		desc[prod & (XDP_RING_SIZE - 1)].options = 0;
+		prod++;
+	}
+	pthread_mutex_unlock(&xdp_umem.lock);
+
+	if (queued > 0) {
+		__atomic_store_n(p->tx.producer, prod, __ATOMIC_RELEASE);
+
+		/* -- in copy mode nothing is sent until the kernel is kicked -- */
+		if (sendto(p->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+		    errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS && errno != EBUSY) {
+			perror("sendto xdp");
+		}
+	}
+	pthread_mutex_unlock(&p->lock_tx);
+
+	return queued;
+}
+
+/**
+ * a single piece goes through xdp_tx, which sends it from the UMEM if it was
+ * received there; several are gathered into a free frame
+ */
+static int xdp_txv(router_t* router, int port, const struct iovec* iov, int iovcnt){
+	xdp_port_t* p = (xdp_port_t*) router->io_port[port];
+	struct xdp_desc* desc = (struct xdp_desc*) p->tx.desc;
+	unsigned int len = 0;
+	uint64_t addr;
+	int i = 0;
+
+	if (iovcnt == 1) {
+		uint8_t* buf = (uint8_t*) iov[0].iov_base;
+		unsigned int buf_len = iov[0].iov_len;
+		return xdp_tx(router, port, &buf, &buf_len, 1);
+	}
+
+	for (i = 0; i < iovcnt; i++){
+		len += iov[i].iov_len;
+	}
+	if (len > XDP_FRAME_SIZE) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&p->lock_tx);
+	xdp_complete(p);
+
+	uint32_t prod = *p->tx.producer;
+	uint32_t cons = __atomic_load_n(p->tx.consumer, __ATOMIC_ACQUIRE);
+
+	pthread_mutex_lock(&xdp_umem.lock);
+	if (prod - cons == XDP_RING_SIZE || xdp_umem.free_count == 0) {
+		pthread_mutex_unlock(&xdp_umem.lock);
+		pthread_mutex_unlock(&p->lock_tx);
+		return 0;
+	}
+	addr = xdp_umem.free[--xdp_umem.free_count];
+	xdp_umem.refs[XDP_FRAME(addr)] = 1;
+	pthread_mutex_unlock(&xdp_umem.lock);
+
+	len = 0;
+	for (i = 0; i < iovcnt; i++){
+		memcpy(xdp_umem.area + addr + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+
+	desc[prod & (XDP_RING_SIZE - 1)].addr = addr;
+	desc[prod & (XDP_RING_SIZE - 1)].len = len;
+	desc[prod & (XDP_RING_SIZE - 1)].options = 0;
+	__atomic_store_n(p->tx.producer, prod + 1, __ATOMIC_RELEASE);
+
+	if (sendto(p->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+	    errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS && errno != EBUSY) {
+		perror("sendto xdp");
+	}
+	pthread_mutex_unlock(&p->lock_tx);
+
+	return 1;
+}
+
+const cpu_io_t cpu_io_xdp = {
+	"xdp",
+	xdp_open,
+	xdp_rx,
+	xdp_rxDone,
+	xdp_tx,
+	xdp_txv
+};
@@ -19,109 +19,88 @@
 #include <stdio.h>
 #include <string.h>
 
+/**
+ * rebuild the rtable on the timer thread. Callers usually hold
+ * lock_pwospf_list, which the rebuild takes too; triggers before it runs
+ * are folded into one run.
+ */
 void dijkstra_trigger(router_t* router){
-	/* no lock on this object, worst case it takes an extra second to run */
-	router->dijkstra_dirty = 1;
-	pthread_cond_signal(&router->dijkstra_cond);
+	timer_schedule(router->timers, &router->dijkstra_timer, 0);
 }
 
-void* dijkstra_thread(void* arg){
+void dijkstra_run(void* arg, uintptr_t data){
 	router_t* router = (router_t*) arg;
 	
-	struct timespec wake_up_time;
-	struct timeval now;
-	int result = 0;
+	router_lockWrite(&router->lock_rtable);
+	router_lockMutex(&router->lock_pwospf_list);
 	
+	/* nuke all the non static entries */
+	//printf("---RTABLE BEFORE DIJKSTRA---\n");
+	//char* rtable_printout;
+	//int len;
+	//sprint_rtable(rs, &rtable_printout, &len);
+	//printf("%s\n", rtable_printout);
+	//free(rtable_printout);
 	
-	router_lockMutex(&router->lock_dijkstra);
-	while (1) {
-		/*
-		 * Determine the time when to wake up next 
-		 */
-		gettimeofday(&now, NULL);
-		wake_up_time.tv_sec = now.tv_sec + 1;
-		wake_up_time.tv_nsec = now.tv_usec + 1000;
-		
-		result = pthread_cond_timedwait(&router->dijkstra_cond, &router->lock_dijkstra, &wake_up_time);
-		
-		/*
-		 * if we timed out, and the data is not dirty, go back to sleep 
-		 */
-		if (result == ETIMEDOUT){
-			if (!router->dijkstra_dirty) {
-				continue;
-			}
-		}
-		router->dijkstra_dirty = 0;
-		
-		router_lockWrite(&router->lock_rtable);
-		router_lockMutex(&router->lock_pwospf_list);
-		
-		/* nuke all the non static entries */
-		//printf("---RTABLE BEFORE DIJKSTRA---\n");
-		//char* rtable_printout;
-		//int len;
-		//sprint_rtable(rs, &rtable_printout, &len);
-		//printf("%s\n", rtable_printout);
-		//free(rtable_printout);
-		
-		node_t* cur = router->rtable;
-		node_t* next = NULL;
-		while (cur){
-			next = cur->next;
-			rtable_row_t* row = (rtable_row_t*)cur->data;
-			if (!row->is_static) {
-				node_remove(&(router->rtable), cur);
-			}
-			cur = next;
+	node_t* cur = router->rtable;
+	node_t* next = NULL;
+	while (cur){
+		next = cur->next;
+		rtable_row_t* row = (rtable_row_t*)cur->data;
+		if (!row->is_static) {
+			node_remove(&(router->rtable), cur);
 		}
-		
-		/*
-		 * run dijkstra 
-		 */
-		node_t* dijkstra_rtable = dijkstra_computeRtable(router->router_id, router->pwospf_router_list, router->if_list);
-		
+		cur = next;
+	}
+	
+	/*
+	 * run dijkstra 
+	 */
+	node_t* dijkstra_rtable = dijkstra_computeRtable(router->router_id, router->pwospf_router_list, router->if_list);
+	
+	/*
+	 * patch our list on to the end of the rtable 
+	 */
+	if (!(router->rtable)){
+		router->rtable = dijkstra_rtable;
+	} 
+	else{
+		cur = router->rtable;
 		/*
-		 * patch our list on to the end of the rtable 
+		 * run to the end of the rtable 
 		 */
-		if (!(router->rtable)){
-			router->rtable = dijkstra_rtable;
-		} 
-		else{
-			cur = router->rtable;
-			/*
-			 * run to the end of the rtable 
-			 */
-			while (cur->next){
-				cur = cur->next;
-			}
-			cur->next = dijkstra_rtable;
-			if (dijkstra_rtable){
-				dijkstra_rtable->prev = cur;
-			}
+		while (cur->next){
+			cur = cur->next;
 		}
-		
-		/*
-		 * write new rtable out to hardware 
-		 */
-		rtable_updated(router);
-		
+		cur->next = dijkstra_rtable;
+		if (dijkstra_rtable){
+			dijkstra_rtable->prev = cur;
+		}
+	}
+	
+	/*
+	 * the router list is no longer needed. Drop it before the FIB rebuild,
+	 * which takes lock_arp_cache and waits for rcu readers; only
+	 * lock_rtable, which no reader takes, is held across it
+	 */
+	router_unlockMutex(&router->lock_pwospf_list);
+	
+	/*
+	 * write new rtable out to hardware 
+	 */
+	rtable_updated(router);
+	
 // 		char* rtable_printout;
 // 		int len;
-		printf("---RTABLE AFTER DIJKSTRA---\n");
+	printf("---RTABLE AFTER DIJKSTRA---\n");
 // 		sprint_rtable(rs, &rtable_printout, &len);
 // 		printf("%s\n", rtable_printout);
 // 		free(rtable_printout);
-		
-		/*
-		 * unlock everything 
-		 */
-		router_unlockMutex(&router->lock_pwospf_list);
-		router_unlock(&router->lock_rtable);		
-	}
-	router_unlockMutex(&router->lock_dijkstra);
 	
-	return NULL;
+	/*
+	 * unlock everything 
+	 */
+	router_unlock(&router->lock_rtable);		
 }
 
 node_t* dijkstra_computeRtable(uint32_t our_router_id, node_t* pwospf_router_list, interface_t* if_list){
@@ -207,7 +186,7 @@ node_t* dijkstra_computeRtable(uint32_t our_router_id, node_t* pwospf_router_lis
 		}
 		assert(iface);
 		
-		memcpy(new_entry->iface, iface->name, IF_LEN);
+		new_entry->ifIndex = iface - if_list;
 		
 		if (wrapper->directly_connected) {
 			new_entry->gw.s_addr = 0;
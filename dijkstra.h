@@ -34,6 +34,6 @@ void dijkstra_addRouteWrappers(uint32_t our_rid, node_t** head, pwospf_router_t*
 
 node_t* dijkstra_computeRtable(uint32_t our_router_id, node_t* pwospf_router_list, interface_t* if_list);
 
-void* dijkstra_thread(void* arg);
+void dijkstra_run(void* arg, uintptr_t data);
 
 #endif
@@ -0,0 +1,232 @@
+/**
+ * @file fib.c
+ * @author Mohammad Reza Hosseini
+ *
+ * The routing table list stays the configuration source; every time it
+ * changes a new trie is built from its active rows.  A lookup costs at most
+ * three memory reads (16 bits, then 8, then 8) regardless of table size.
+ */
+
+#include "fib.h"
+#include "adj.h"
+#include "rtable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+typedef struct Fib_Prefix {
+	uint32_t ip;		/* host order, already masked */
+	int len;
+	int order;		/* position in the rtable list */
+	uint32_t nh;		/* index in the next hop table */
+} fib_prefix_t;
+
+
+/**
+ * shorter prefixes first so longer ones overwrite them. Among equal prefixes the
+ * linear scan used to pick the first row of the list, so that one goes in last.
+ */
+static int fib_comparePrefix(const void* a, const void* b){
+	const fib_prefix_t* pa = (const fib_prefix_t*) a;
+	const fib_prefix_t* pb = (const fib_prefix_t*) b;
+
+	if (pa->len != pb->len) {
+		return pa->len - pb->len;
+	}
+	return pb->order - pa->order;
+}
+
+/**
+ * allocate a new group and fill all its entries with the given value
+ * @return index of the group
+ */
+static uint32_t fib_newGroup(fib_t* fib, uint32_t value){
+	if (fib->groups == fib->groups_size) {
+		fib->groups_size = fib->groups_size ? fib->groups_size * 2 : 64;
+		fib->tbl8 = (uint32_t*) realloc(fib->tbl8, fib->groups_size * FIB_GROUP_SIZE * sizeof(uint32_t));
+		assert(fib->tbl8);
+	}
+
+	uint32_t group = fib->groups++;
+	uint32_t* entry = &fib->tbl8[group * FIB_GROUP_SIZE];
+	int i = 0;
+	for (i = 0; i < FIB_GROUP_SIZE; i++){
+		entry[i] = value;
+	}
+
+	/*
+	 * the group index has to fit next to the flag
+	 */
+	assert(group < FIB_EXTENDED);
+	return group;
+}
+
+/**
+ * return the group below the given entry, splitting the entry into a group first
+ * if it is still a leaf
+ */
+static uint32_t fib_expand(fib_t* fib, uint32_t* entry){
+	if (*entry & FIB_EXTENDED) {
+		return *entry & ~FIB_EXTENDED;
+	}
+
+	uint32_t group = fib_newGroup(fib, *entry);
+	*entry = FIB_EXTENDED | group;
+	return group;
+}
+
+static void fib_insert(fib_t* fib, fib_prefix_t* prefix){
+	uint32_t value = prefix->nh + 1;
+	uint32_t i = 0;
+	uint32_t first = 0;
+	uint32_t count = 0;
+
+	if (prefix->len <= 16) {
+		first = prefix->ip >> 16;
+		count = 1 << (16 - prefix->len);
+		for (i = first; i < first + count; i++){
+			fib->tbl16[i] = value;
+		}
+		return;
+	}
+
+	/*
+	 * note: fib_expand may move tbl8, so never keep pointers into it across calls
+	 */
+	uint32_t group = fib_expand(fib, &fib->tbl16[prefix->ip >> 16]);
+
+	if (prefix->len <= 24) {
+		first = (prefix->ip >> 8) & 0xFF;
+		count = 1 << (24 - prefix->len);
+		for (i = first; i < first + count; i++){
+			fib->tbl8[group * FIB_GROUP_SIZE + i] = value;
+		}
+		return;
+	}
+
+	uint32_t leaf = fib->tbl8[group * FIB_GROUP_SIZE + ((prefix->ip >> 8) & 0xFF)];
+	uint32_t sub_group = fib_expand(fib, &leaf);
+	fib->tbl8[group * FIB_GROUP_SIZE + ((prefix->ip >> 8) & 0xFF)] = leaf;
+
+	first = prefix->ip & 0xFF;
+	count = 1 << (32 - prefix->len);
+	for (i = first; i < first + count; i++){
+		fib->tbl8[sub_group * FIB_GROUP_SIZE + i] = value;
+	}
+}
+
+/**
+ * build a new FIB from the active rows of a routing table list. The result is
+ * never modified afterwards, so it can be shared with lock free readers.
+ * NOT Threadsafe, ensure rtable locked for read
+ * @param rtable head of the routing table list
+ * @return the new FIB, release it with fib_destroy
+ */
+fib_t* fib_create(node_t* rtable){
+	fib_t* fib = (fib_t*) calloc(1, sizeof(fib_t));
+	assert(fib);
+
+	fib->tbl16 = (uint32_t*) calloc(FIB_TBL16_SIZE, sizeof(uint32_t));
+	assert(fib->tbl16);
+
+	int rows = node_length(rtable);
+	fib->nh = (fib_nh_t*) calloc(rows ? rows : 1, sizeof(fib_nh_t));
+	fib_prefix_t* prefixes = (fib_prefix_t*) calloc(rows ? rows : 1, sizeof(fib_prefix_t));
+	assert(fib->nh && prefixes);
+
+	/*
+	 * collect the active rows, one next hop per row
+	 */
+	int count = 0;
+	node_t* n = rtable;
+	while (n) {
+		rtable_row_t* row = (rtable_row_t*) n->data;
+
+		if (row->is_active) {
+			uint32_t mask = ntohl(row->mask.s_addr);
+
+			prefixes[count].ip = ntohl(row->ip.s_addr) & mask;
+			prefixes[count].len = __builtin_popcount(mask);
+			prefixes[count].order = count;
+			prefixes[count].nh = count;
+
+			fib->nh[count].gw = row->gw;
+			fib->nh[count].ifIndex = row->ifIndex;
+			fib->nh[count].adj = ADJ_NONE;
+			count++;
+		}
+		n = n->next;
+	}
+	fib->nh_count = count;
+
+	qsort(prefixes, count, sizeof(fib_prefix_t), fib_comparePrefix);
+
+	int i = 0;
+	for (i = 0; i < count; i++){
+		fib_insert(fib, &prefixes[i]);
+	}
+
+	free(prefixes);
+	return fib;
+}
+
+void fib_destroy(fib_t* fib){
+	if (!fib) {
+		return;
+	}
+	free(fib->tbl16);
+	free(fib->tbl8);
+	free(fib->nh);
+	free(fib);
+}
+
+/**
+ * performs a longest prefix match
+ * @param fib FIB to search
+ * @param dest destination address to lookup
+ * @param [out] next_hop result of lpm
+ * @param [out] next_hop_ifIndex index of interface to return the packet
+ * @return: 1 if no match, 0 if there is a match
+ */
+int fib_lookup(fib_t* fib, struct in_addr* dest, struct in_addr* next_hop, int* next_hop_ifIndex){
+	return fib_lookupAdj(fib, dest, next_hop, next_hop_ifIndex, NULL);
+}
+
+/**
+ * fib_lookup that also returns the adjacency of the matching route
+ * @param [out] adj adjacency index or ADJ_NONE, may be NULL
+ */
+int fib_lookupAdj(fib_t* fib, struct in_addr* dest, struct in_addr* next_hop, int* next_hop_ifIndex, int* adj){
+	uint32_t ip = ntohl(dest->s_addr);
+
+	uint32_t entry = fib->tbl16[ip >> 16];
+	if (entry & FIB_EXTENDED) {
+		entry = fib->tbl8[((entry & ~FIB_EXTENDED) * FIB_GROUP_SIZE) + ((ip >> 8) & 0xFF)];
+		if (entry & FIB_EXTENDED) {
+			entry = fib->tbl8[((entry & ~FIB_EXTENDED) * FIB_GROUP_SIZE) + (ip & 0xFF)];
+		}
+	}
+
+	if (!entry) {
+		return 1;
+	}
+
+	fib_nh_t* nh = &fib->nh[entry - 1];
+	if (nh->gw.s_addr == 0) {
+		/*
+		 * Support for next hop 0.0.0.0, meaning it is equivalent to the destination ip
+		 */
+		next_hop->s_addr = dest->s_addr;
+	} else {
+		next_hop->s_addr = nh->gw.s_addr;
+	}
+	(*next_hop_ifIndex) = nh->ifIndex;
+	if (adj) {
+		(*adj) = nh->adj;
+	}
+
+	return 0;
+}
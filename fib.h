@@ -0,0 +1,50 @@
+/**
+ * @file fib.h
+ * @author Mohammad Reza Hosseini
+ *
+ * forwarding information base: a DIR-16-8-8 multibit trie built from the
+ * rows of the routing table and used for every longest prefix match
+ */
+#ifndef FIB_H_
+#define FIB_H_
+
+#include "router.h"
+#include "ll.h"
+
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#define FIB_TBL16_SIZE		(1 << 16)
+#define FIB_GROUP_SIZE		(1 << 8)
+
+/*
+ * a trie entry is either 0 (no route), an index into the next hop table
+ * plus one, or FIB_EXTENDED | index of a 256 entry group one level down
+ */
+#define FIB_EXTENDED		0x80000000
+
+typedef struct Fib_NextHop {
+	struct in_addr gw;	/* 0.0.0.0 means directly connected */
+	int ifIndex;
+	int adj;		/* adjacency of gw on ifIndex, ADJ_NONE until rtable_buildFib attaches it */
+} fib_nh_t;
+
+typedef struct Fib {
+	uint32_t* tbl16;	/* first level, indexed by the top 16 bits */
+	uint32_t* tbl8;		/* second and third level groups */
+	uint32_t groups;	/* number of groups in use */
+	uint32_t groups_size;	/* number of groups allocated */
+	fib_nh_t* nh;		/* next hop table, one row per route */
+	uint32_t nh_count;
+	uint32_t version;	/* incremented on every published snapshot */
+} fib_t;
+
+fib_t* fib_create(node_t* rtable);
+
+void fib_destroy(fib_t* fib);
+
+int fib_lookup(fib_t* fib, struct in_addr* dest, struct in_addr* next_hop, int* next_hop_ifIndex);
+
+int fib_lookupAdj(fib_t* fib, struct in_addr* dest, struct in_addr* next_hop, int* next_hop_ifIndex, int* adj);
+
+#endif
@@ -11,6 +11,8 @@
 #include "pwospf.h"
 #include "ICMP.h"
 #include "rtable.h"
+#include "adj.h"
+#include "rcu.h"
 #include "pwospf.h"
 
 
@@ -22,26 +24,49 @@
 
 
 
-void ip_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface){
-	router_t* router = (router_t*) sr_get_subsystem(sr);
-	
+void ip_processPacket(struct sr_instance* sr, pkt_buf_t* pkt, int port){
 	/*
 	 * Check if the packet is invalid, if so drop it 
 	 */
-	if (!ip_isValid(packet, len)) {
+	if (!ip_isValid(pkt->data, pkt->len)) {
 		return;
 	}
 	
-	router_lockRead(&router->lock_arp_cache);
-	router_lockWrite(&router->lock_arp_queue);
-	router_lockRead(&router->lock_rtable);
-	
+	/*
+	 * packets for the router itself are handled outside the rcu section,
+	 * PWOSPF takes lock_pwospf_list which is held across rtable rebuilds
+	 */
+	if (ip_isLocal(sr, pkt->data)) {
+		ip_processLocal(sr, pkt, port);
+		return;
+	}
 	
 	/*
-	 * Check if the packet is headed to one of our interfaces 
+	 * route, adjacency and ARP cache lookups are all read under rcu, no lock
+	 * needed; the ARP queue is only locked if the next hop turns out
+	 * unresolved
 	 */
+	rcu_readLock();
+	
+	ip_processPacketLocked(sr, pkt, port);
+	
+	rcu_readUnlock();
+}
+
+/**
+ * @return 1 if a valid IP packet is headed to one of our interfaces or to
+ * the PWOSPF hello address, 0 if it has to be forwarded
+ */
+int ip_isLocal(struct sr_instance* sr, const uint8_t* packet){
+	router_t* router = (router_t*) sr_get_subsystem(sr);
 	ip_header_t* ip_hdr = ip_getHeader(packet);
 	
+	return router_getInterfaceByIp(router, ip_hdr->ip_dst.s_addr) >= 0 ||
+		ip_hdr->ip_dst.s_addr == htonl(PWOSPF_HELLO_TIP);
+}
+
+static void ip_printHeader(ip_header_t* ip_hdr){
+#ifdef _DEBUG_
 	printf("\n\n\tIP Header: ");
 	printf("\n\t\tHeader len: %d",ip_hdr->ip_hl);
 	printf("\n\t\tVersion: %d",ip_hdr->ip_v);
@@ -61,6 +86,26 @@ void ip_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned i
 	printf("\n\t\tDestination: %s",ip_string);
 	
 	printf("\n\n");
+#endif
+}
+
+/**
+ * process a valid IP packet headed to the router, see ip_isLocal.
+ * Must be called outside any rcu read side section: the PWOSPF handlers
+ * lock the router list, which rtable rebuilds hold while waiting for readers
+ */
+void ip_processLocal(struct sr_instance* sr, pkt_buf_t* pkt, int port){
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	uint8_t* packet = pkt->data;
+	unsigned int len = pkt->len;
+	
+	
+	/*
+	 * Check if the packet is headed to one of our interfaces 
+	 */
+	ip_header_t* ip_hdr = ip_getHeader(packet);
+	
+	ip_printHeader(ip_hdr);
 	
 	int if_index = router_getInterfaceByIp(router, ip_hdr->ip_dst.s_addr);
 	if (if_index >= 0){
@@ -70,24 +115,24 @@ void ip_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned i
 				 * We don't accept TCP
 				 * If TCP, send ICMP reply port unreachable
 				 */
-				printf("\n\tPacket IP Proto : TCP, sending ICMP Port Unreachable");
+				Debug("\n\tPacket IP Proto : TCP, sending ICMP Port Unreachable");
 				if (icmp_sendPacket(sr, packet, len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_PROTOCOL_UNREACHABLE) != 0){
 					printf("Failure sending icmp reply\n");
 				}
 				break;
 			case IP_PROTO_ICMP:
-				printf("\n\tPacket IP Proto : ICMP, processing ...");
-				icmp_processPacket(sr, packet, len, interface);
+				Debug("\n\tPacket IP Proto : ICMP, processing ...");
+				icmp_processPacket(sr, pkt, port);
 				break;
 			case IP_PROTO_PWOSPF:
-				printf("\n\tPacket IP Proto : PWOSPF, processing ...");
-				pwospf_processPacket(sr, packet, len, interface);
+				Debug("\n\tPacket IP Proto : PWOSPF, processing ...");
+				pwospf_processPacket(sr, packet, len, port);
 				break;
 			case IP_PROTO_UDP:
 				/*
 				 * We don't accept UDP so ICMP reply port unreachable
 				 */
-				printf("\n\tPacket IP Proto : UDP, sending ICMP Port Unreachable");
+				Debug("\n\tPacket IP Proto : UDP, sending ICMP Port Unreachable");
 				if (icmp_sendPacket(sr, packet, len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_PORT_UNREACHABLE) != 0){
 					printf("Failure sending icmp reply\n");
 				}
@@ -96,7 +141,7 @@ void ip_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned i
 				/*
 				 * If other? return ICMP protocol unreachable 
 				 */
-				printf("\n\tUnknown protocol, sending ICMP unreachable");
+				Debug("\n\tUnknown protocol, sending ICMP unreachable");
 				if (icmp_sendPacket(sr, packet, len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_PROTOCOL_UNREACHABLE) != 0){
 					printf("Failure sending icmp reply\n");
 				}
@@ -107,81 +152,87 @@ void ip_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned i
 		/*
 		 * if the packet is destined to the PWOSPF address then process it 
 		 */
-		pwospf_processPacket(sr, packet, len, interface);
+		pwospf_processPacket(sr, packet, len, port);
 	} 
-	else {
+}
+
+/**
+ * forward a valid IP packet that is not headed to the router, see ip_isLocal.
+ * Caller is inside an rcu read side section, so a batch of packets can share
+ * one. Receive workers run this concurrently
+ */
+void ip_processPacketLocked(struct sr_instance* sr, pkt_buf_t* pkt, int port){
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	uint8_t* packet = pkt->data;
+	unsigned int len = pkt->len;
+	ip_header_t* ip_hdr = ip_getHeader(packet);
+	
+	ip_printHeader(ip_hdr);
+	
+	/*
+	 * Need to forward this packet to another host 
+	 */
+	
+	struct in_addr next_hop;
+	int next_hop_ifIndex = 0;
+	int adj_index = ADJ_NONE;
+
+	/*
+	 * is there an entry in our routing table for the destination? 
+	 */
+	if (rtable_nextHopAdj(router, &ip_hdr->ip_dst, &next_hop, &next_hop_ifIndex, &adj_index) != 0){
+		/* 
+		 * send ICMP no route to host 
+		 */
+		icmp_sendPacket(sr, packet, len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_NET_UNKNOWN);
+	} 
+	else if (port == next_hop_ifIndex){
 		/*
-		 * Need to forward this packet to another host 
+		 * never send a packet back out of the interface it came in on,
+		 * send ICMP net unreachable 
 		 */
-		
-		struct in_addr next_hop;
-		int next_hop_ifIndex = 0;
-
+		icmp_sendPacket(sr, packet, len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_NET_UNREACHABLE);
+	}
+	else{
 		/*
-		 * is there an entry in our routing table for the destination? 
+		 * check ttl to see if is ttl < 1? 
 		 */
-		if (rtable_nextHop(router, &ip_hdr->ip_dst, &next_hop, &next_hop_ifIndex) != 0){
-			/* 
-			 * send ICMP no route to host 
-			 */
-			icmp_sendPacket(sr, packet, len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_NET_UNKNOWN);
-		} 
-		else if (strcmp(interface, router->if_list[next_hop_ifIndex].name)){
+		if (ip_hdr->ip_ttl == 1){
 			/*
-			 * send ICMP net unreachable 
+			 * send ICMP time exceeded 
 			 */
-			icmp_sendPacket(sr, packet, len, ICMP_TYPE_DESTINATION_UNREACHABLE, ICMP_CODE_NET_UNREACHABLE);
+			icmp_sendPacket(sr, packet, len, ICMP_TYPE_TIME_EXCEEDED, ICMP_CODE_TTL_EXCEEDED);
+			
 		}
 		else{
+			/* 
+			 * decrement ttl, the checksum is patched incrementally
+			 */
+			ip_decrementTtl(ip_hdr);
+			
 			/*
-			 * check ttl to see if is ttl < 1? 
+			 * resolved gateway: both addresses come from the adjacency
 			 */
-			if (ip_hdr->ip_ttl == 1){
-				/*
-				 * send ICMP time exceeded 
-				 */
-				icmp_sendPacket(sr, packet, len, ICMP_TYPE_TIME_EXCEEDED, ICMP_CODE_TTL_EXCEEDED);
-				
-			}
-			else{
-				/* 
-				 * decrement ttl 
-				 */
-				ip_hdr->ip_ttl--;
-				
-				/*
-				 * recalculate checksum 
-				 */
-				bzero(&ip_hdr->ip_sum, sizeof(uint16_t));
-				uint16_t checksum = htons(ip_checksum(ip_hdr));
-				ip_hdr->ip_sum = checksum;
-				
-				/*
-				 * update the eth header 
-				 */
-				eth_header_t* eth = (eth_header_t*) packet;
-				eth_createHeader(eth, NULL, router->if_list[next_hop_ifIndex].addr, ETH_TYPE_IP);
-				
-				/* 
-				 * duplicate this packet here because the memory will be freed
-				 * by router_ip2mac, and our copy of the packet is only on loan
-				 */
-				
-				uint8_t* packet_copy = (uint8_t*) malloc(len);
-				memcpy(packet_copy, packet, len);
-				
-				/*
-				 * forward packet out the next hop interface 
-				 * (sending to link layer)
-				 */
-				router_ip2mac(sr, packet_copy, len, &(next_hop), router->if_list[next_hop_ifIndex].name);
+			adj_t* adj = adj_index != ADJ_NONE ? &router->adj->adj[adj_index] : NULL;
+			if (adj && adj_rewrite(adj, packet)) {
+				router_sendPacket(sr, pkt, adj->port);
+				return;
 			}
+			
+			/*
+			 * update the eth header 
+			 */
+			eth_header_t* eth = (eth_header_t*) packet;
+			eth_createHeader(eth, NULL, router->if_list[next_hop_ifIndex].addr, ETH_TYPE_IP);
+			
+			/*
+			 * forward the rewritten buffer out the next hop interface 
+			 * (sending to link layer), no copy: if it has to wait for
+			 * ARP the queue takes its own reference
+			 */
+			router_ip2mac(sr, pkt, &(next_hop), next_hop_ifIndex);
 		}
 	}
-	
-	router_unlock(&router->lock_rtable);
-	router_unlock(&router->lock_arp_queue);
-	router_unlock(&router->lock_arp_cache);
 }
 
 
@@ -287,6 +338,53 @@ uint16_t ip_checksum(ip_header_t* iphdr){
 	return s_sum;
 }
 
+/**
+ * Incremental checksum update (RFC 1624, eqn. 3) for a 16 bit word of the summed
+ * data changing from old_val to new_val: HC' = ~(~HC + ~m + m').
+ * The one's complement sum does not depend on byte order, so all values can be
+ * passed as they are stored in the packet (network byte order).
+ *
+ * @return the new checksum, in the same byte order as the arguments
+ */
+uint16_t ip_checksumAdjust(uint16_t sum, uint16_t old_val, uint16_t new_val){
+	uint32_t s = (uint16_t) ~sum;
+	s += (uint16_t) ~old_val;
+	s += new_val;
+	
+	/*
+	 * fold carries, two rounds are enough for three 16 bit terms
+	 */
+	s = (s & 0xFFFF) + (s >> 16);
+	s = (s & 0xFFFF) + (s >> 16);
+	
+	return (uint16_t) ~s;
+}
+
+/**
+ * decrement the ttl and patch the checksum in place. ttl shares its 16 bit word
+ * with the protocol field.
+ */
+void ip_decrementTtl(ip_header_t* iphdr){
+	uint16_t old_word = htons((iphdr->ip_ttl << 8) | iphdr->ip_p);
+	iphdr->ip_ttl--;
+	uint16_t new_word = htons((iphdr->ip_ttl << 8) | iphdr->ip_p);
+	iphdr->ip_sum = ip_checksumAdjust(iphdr->ip_sum, old_word, new_word);
+}
+
+void ip_incrementTtl(ip_header_t* iphdr){
+	uint16_t old_word = htons((iphdr->ip_ttl << 8) | iphdr->ip_p);
+	iphdr->ip_ttl++;
+	uint16_t new_word = htons((iphdr->ip_ttl << 8) | iphdr->ip_p);
+	iphdr->ip_sum = ip_checksumAdjust(iphdr->ip_sum, old_word, new_word);
+}
+
+void ip_setTtl(ip_header_t* iphdr, uint8_t ttl){
+	uint16_t old_word = htons((iphdr->ip_ttl << 8) | iphdr->ip_p);
+	iphdr->ip_ttl = ttl;
+	uint16_t new_word = htons((iphdr->ip_ttl << 8) | iphdr->ip_p);
+	iphdr->ip_sum = ip_checksumAdjust(iphdr->ip_sum, old_word, new_word);
+}
+
 /**
  * Populates an IP header with the usual data.  Note source_ip and dest_ip must be passed into
  * the function in network byte order.
@@ -299,7 +397,7 @@ void ip_createHeader(ip_header_t* ip, uint16_t payload_size, uint8_t protocol, u
 	ip->ip_off = htons(IP_FRAG_DF);
 	
 	ip->ip_len = htons(20 + payload_size);
-	ip->ip_ttl = 0x40;
+	ip->ip_ttl = IP_DEFAULT_TTL;
 	ip->ip_p = protocol;
 	ip->ip_src.s_addr = source_ip;
 	ip->ip_dst.s_addr = dest_ip;
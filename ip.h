@@ -8,6 +8,7 @@
 #define IP_H_
 
 #include "sr_base_internal.h"
+#include "packet.h"
 
 #include <stdint.h>
 #include <arpa/inet.h>
@@ -20,6 +21,7 @@
 #define	IP_FRAG_DF 		0x4000	/* dont fragment flag */
 #define	IP_FRAG_MF 		0x2000	/* more fragments flag */
 #define	IP_FRAG_OFFMASK 	0x1fff	/* mask for fragmenting bits */
+#define IP_DEFAULT_TTL		0x40	/* ttl of the packets we originate */
 
 
 typedef struct Ip_Header{
@@ -42,10 +44,24 @@ int ip_isValid(const uint8_t * packet, unsigned int len);
 
 ip_header_t* ip_getHeader(const uint8_t* packet);
 
-void ip_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface);
+void ip_processPacket(struct sr_instance* sr, pkt_buf_t* pkt, int port);
+
+int ip_isLocal(struct sr_instance* sr, const uint8_t* packet);
+
+void ip_processLocal(struct sr_instance* sr, pkt_buf_t* pkt, int port);
+
+void ip_processPacketLocked(struct sr_instance* sr, pkt_buf_t* pkt, int port);
 
 uint16_t ip_checksum(ip_header_t* iphdr);
 
+uint16_t ip_checksumAdjust(uint16_t sum, uint16_t old_val, uint16_t new_val);
+
+void ip_decrementTtl(ip_header_t* iphdr);
+
+void ip_incrementTtl(ip_header_t* iphdr);
+
+void ip_setTtl(ip_header_t* iphdr, uint8_t ttl);
+
 void ip_createHeader(ip_header_t* ip, uint16_t payload_size, uint8_t protocol, uint32_t source_ip, uint32_t dest_ip);
 
 #endif
@@ -21,6 +21,11 @@
 
 
 int netfpga_init(router_t* router){
+	if (router->netfpga.fd < 0) {
+		/* -- no board: VNS, or cpu mode on plain interfaces -- */
+		return 0;
+	}
+	
 	/* reset the router */
 	writeReg(&router->netfpga, CPCI_REG_CTRL, 0x00010100);
 	usleep(2000);
@@ -33,7 +38,7 @@ int netfpga_init(router_t* router){
 	 */
 // 	write_arp_cache_to_hw(rs);
 	arp_updateHw(router);
-	netfpga_writeRTable(&router->netfpga, router->rtable);
+	netfpga_writeRTable(router, router->rtable);
 	return 0;
 }
 
@@ -54,6 +59,10 @@ int netfpga_getPortNum(const char* name){
 }
 
 int netfpga_initInterfaces(router_t* router, interface_t* interface){
+	if (router->netfpga.fd < 0) {
+		return 0;
+	}
+	
 	
 	/* 
 	 * set this on hardware 
@@ -67,7 +76,7 @@ int netfpga_initInterfaces(router_t* router, interface_t* interface){
 	mac_lo |= ((unsigned int)interface->addr[4]) << 8;
 	mac_lo |= ((unsigned int)interface->addr[5]);
 	
-	int portNum = netfpga_getPortNum(interface->name);
+	int portNum = interface->hw_port;
 	switch (portNum) {
 		case 0:
 			writeReg(&router->netfpga, ROUTER_OP_LUT_MAC_0_HI_REG, mac_hi);
@@ -99,6 +108,10 @@ int netfpga_initInterfaces(router_t* router, interface_t* interface){
 
 
 void netfpga_writeArpCacheItem(struct nf2device* netfpga, arp_item_t* arp_item, int row){
+	if (netfpga->fd < 0) {
+		return;
+	}
+	
 	if(arp_item != NULL) {
 		unsigned int mac_hi = 0;
 		unsigned int mac_lo = 0;
@@ -137,7 +150,12 @@ void netfpga_writeArpCacheItem(struct nf2device* netfpga, arp_item_t* arp_item,
 	writeReg(netfpga, ROUTER_OP_LUT_ARP_TABLE_WR_ADDR_REG, row);
 }
 
-void netfpga_writeRTable(struct nf2device* netfpga, node_t* rtable_head){
+void netfpga_writeRTable(router_t* router, node_t* rtable_head){
+	struct nf2device* netfpga = &router->netfpga;
+	if (netfpga->fd < 0) {
+		return;
+	}
+	
 	printf("\n Writing rtable in hardware\n");
 	/*
 	 * naively iterate through the 32 slots in hardware updating all entries 
@@ -171,7 +189,7 @@ void netfpga_writeRTable(struct nf2device* netfpga, node_t* rtable_head){
 			/*
 			 * port 
 			 */
-			writeReg(netfpga, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_OUTPUT_PORT_REG, netfpga_getPortId(row->iface));
+			writeReg(netfpga, ROUTER_OP_LUT_ROUTE_TABLE_ENTRY_OUTPUT_PORT_REG, netfpga_getPortId(router->if_list[row->ifIndex].hw_port));
 			
 			/*
 			 * row number
@@ -215,26 +233,14 @@ void netfpga_writeRTable(struct nf2device* netfpga, node_t* rtable_head){
 }
 
 
-unsigned int netfpga_getPortId(char* name) {
-	if (strcmp(ETH0, name) == 0) {
-		return 1;
-	} else if (strcmp(ETH1, name) == 0) {
-		return 4;
-	} else if (strcmp(ETH2, name) == 0) {
-		return 16;
-	} else if (strcmp(ETH3, name) == 0) {
-		return 64;
-	} else if (strcmp(CPU0, name) == 0) {
-		return 2;
-	} else if (strcmp(CPU1, name) == 0) {
-		return 8;
-	} else if (strcmp(CPU2, name) == 0) {
-		return 32;
-	} else if (strcmp(CPU3, name) == 0) {
-		return 128;
-	} else {
-		printf("FAILURE MATCHING NAME TO PORT ID\n");
+/**
+ * output port bitmap of board port hw_port (ethN), as the route table wants it
+ */
+unsigned int netfpga_getPortId(int hw_port) {
+	if (hw_port >= 0 && hw_port < NUM_INTERFACES) {
+		return 1 << (2 * hw_port);
 	}
 	
+	printf("FAILURE MATCHING PORT %d TO PORT ID\n", hw_port);
 	return 0;
 }
@@ -37,9 +37,9 @@ int netfpga_getPortNum(const char* name);
 
 void netfpga_writeArpCacheItem(struct nf2device* netfpga, arp_item_t* arp_item, int row);
 
-void netfpga_writeRTable(struct nf2device* netfpga, node_t* rtable_head);
+void netfpga_writeRTable(router_t* router, node_t* rtable_head);
 
-unsigned int netfpga_getPortId(char* name);
+unsigned int netfpga_getPortId(int hw_port);
 
 #endif
 
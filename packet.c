@@ -0,0 +1,367 @@
+/**
+ * @file packet.c
+ * @author Mohammad Reza Hosseini
+ *
+ * Buffers of PKT_BUF_SIZE live in slabs of PKT_SLAB_BUFS that are never
+ * freed. A thread takes and returns them on its own free list; when that runs
+ * dry it takes a batch from the shared list (carving a new slab if that is
+ * empty too), and when it grows past PKT_CACHE_MAX it hands a batch back, so
+ * the shared lock is taken once per PKT_CACHE_BATCH buffers at most. A buffer
+ * may be released on another thread than the one that took it, it simply
+ * moves over. Once the slabs hold PKT_POOL_MAX buffers, and for anything
+ * larger (e.g. big VNS commands), buffers are allocated to size and freed on
+ * release.
+ *
+ * The counters of a thread are only written by that thread and read by
+ * pkt_getStats, a thread that exits hands its buffers and counters back.
+ */
+
+#include "packet.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+
+///bytes of a slab buffer in front of its storage, keeps the storage on a cache line
+#define PKT_HDR_SIZE		((sizeof(pkt_buf_t) + PKT_ALIGN - 1) & ~(PKT_ALIGN - 1))
+
+///distance between two buffers of a slab
+#define PKT_SLAB_STRIDE		(PKT_HDR_SIZE + PKT_BUF_SIZE)
+
+typedef struct Packet_Cache {
+	pkt_buf_t* free;		/* free buffers of this thread */
+	unsigned long count;		/* buffers on free */
+	unsigned long allocs;
+	unsigned long hits;
+	unsigned long frees;
+	unsigned long mallocs;
+	int registered;
+	struct Packet_Cache* next;	/* on pkt_caches */
+} pkt_cache_t;
+
+static __thread pkt_cache_t pkt_cache;
+
+/*
+ * shared pool, guarded by pkt_pool_lock
+ */
+static pthread_mutex_t pkt_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pkt_buf_t* pkt_pool = NULL;
+static unsigned long pkt_pooled = 0;
+static unsigned long pkt_capacity = 0;
+static unsigned long pkt_slabs = 0;
+static pkt_cache_t* pkt_caches = NULL;		/* caches of live threads */
+static pkt_cache_t pkt_retired;			/* counters of threads gone */
+
+static pthread_key_t pkt_cache_key;
+static pthread_once_t pkt_cache_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * bump a counter of the calling thread's cache, readable from any thread
+ */
+static inline void pkt_count(unsigned long* counter, long delta){
+	__atomic_store_n(counter, *counter + delta, __ATOMIC_RELAXED);
+}
+
+/**
+ * give the free buffers and the counters of an exiting thread to the pool
+ */
+static void pkt_retire(void* arg){
+	pkt_cache_t* c = (pkt_cache_t*) arg;
+	pkt_cache_t** walker = &pkt_caches;
+
+	pthread_mutex_lock(&pkt_pool_lock);
+	while (c->free) {
+		pkt_buf_t* pkt = c->free;
+		c->free = pkt->next;
+		pkt->next = pkt_pool;
+		pkt_pool = pkt;
+		pkt_pooled++;
+	}
+	c->count = 0;
+
+	pkt_retired.allocs += c->allocs;
+	pkt_retired.hits += c->hits;
+	pkt_retired.frees += c->frees;
+	pkt_retired.mallocs += c->mallocs;
+	c->allocs = c->hits = c->frees = c->mallocs = 0;
+
+	while (*walker && *walker != c) {
+		walker = &(*walker)->next;
+	}
+	if (*walker) {
+		*walker = c->next;
+	}
+	c->registered = 0;
+	pthread_mutex_unlock(&pkt_pool_lock);
+}
+
+static void pkt_createKey(void){
+	if (pthread_key_create(&pkt_cache_key, pkt_retire) != 0) {
+		perror("pthread_key_create");
+		exit(1);
+	}
+}
+
+/**
+ * first use of the pool by this thread
+ */
+static void pkt_register(pkt_cache_t* c){
+	pthread_once(&pkt_cache_once, pkt_createKey);
+	pthread_setspecific(pkt_cache_key, c);
+
+	pthread_mutex_lock(&pkt_pool_lock);
+	c->next = pkt_caches;
+	pkt_caches = c;
+	c->registered = 1;
+	pthread_mutex_unlock(&pkt_pool_lock);
+}
+
+/**
+ * carve a slab into buffers on the shared list.
+ * NOT Threadsafe, caller holds pkt_pool_lock
+ * @return 0 if the slabs are at PKT_POOL_MAX or memory ran out
+ */
+static int pkt_newSlab(void){
+	void* mem = NULL;
+	int i = 0;
+
+	if (pkt_capacity + PKT_SLAB_BUFS > PKT_POOL_MAX) {
+		return 0;
+	}
+	if (posix_memalign(&mem, PKT_ALIGN, PKT_SLAB_BUFS * PKT_SLAB_STRIDE) != 0) {
+		return 0;
+	}
+
+	for (i = 0; i < PKT_SLAB_BUFS; i++){
+		pkt_buf_t* pkt = (pkt_buf_t*) ((uint8_t*) mem + i * PKT_SLAB_STRIDE);
+		pkt->head = (uint8_t*) pkt + PKT_HDR_SIZE;
+		pkt->size = PKT_BUF_SIZE;
+		pkt->slab = 1;
+		pkt->next = pkt_pool;
+		pkt_pool = pkt;
+	}
+	pkt_pooled += PKT_SLAB_BUFS;
+	pkt_capacity += PKT_SLAB_BUFS;
+	pkt_slabs++;
+
+	return 1;
+}
+
+/**
+ * move up to PKT_CACHE_BATCH buffers from the shared list to the empty list
+ * of the calling thread
+ */
+static void pkt_refill(pkt_cache_t* c){
+	unsigned long moved = 0;
+
+	pthread_mutex_lock(&pkt_pool_lock);
+	if (!pkt_pool && pkt_newSlab()) {
+		pkt_count(&c->mallocs, 1);
+	}
+	while (pkt_pool && moved < PKT_CACHE_BATCH) {
+		pkt_buf_t* pkt = pkt_pool;
+		pkt_pool = pkt->next;
+		pkt->next = c->free;
+		c->free = pkt;
+		moved++;
+	}
+	pkt_pooled -= moved;
+	pthread_mutex_unlock(&pkt_pool_lock);
+
+	pkt_count(&c->count, moved);
+}
+
+/**
+ * hand PKT_CACHE_BATCH buffers of the calling thread back to the shared list
+ */
+static void pkt_spill(pkt_cache_t* c){
+	pkt_buf_t* first = c->free;
+	pkt_buf_t* last = first;
+	unsigned long moved = 1;
+
+	while (moved < PKT_CACHE_BATCH && last->next) {
+		last = last->next;
+		moved++;
+	}
+	c->free = last->next;
+	pkt_count(&c->count, -(long) moved);
+
+	pthread_mutex_lock(&pkt_pool_lock);
+	last->next = pkt_pool;
+	pkt_pool = first;
+	pkt_pooled += moved;
+	pthread_mutex_unlock(&pkt_pool_lock);
+}
+
+/**
+ * @param len frame length the caller needs
+ * @return a buffer with one reference, data placed PKT_HEADROOM bytes into the
+ * storage and len set. Contents are not cleared.
+ */
+pkt_buf_t* pkt_alloc(unsigned int len){
+	pkt_cache_t* c = &pkt_cache;
+	pkt_buf_t* pkt = NULL;
+	unsigned int size = PKT_HEADROOM + (len < PKT_MIN_LEN ? PKT_MIN_LEN : len);
+
+	if (!c->registered) {
+		pkt_register(c);
+	}
+	pkt_count(&c->allocs, 1);
+
+	if (size <= PKT_BUF_SIZE) {
+		if (c->free) {
+			pkt_count(&c->hits, 1);
+		} else {
+			pkt_refill(c);
+		}
+		pkt = c->free;
+		if (pkt) {
+			c->free = pkt->next;
+			pkt_count(&c->count, -1);
+		}
+		size = PKT_BUF_SIZE;
+	}
+
+	if (!pkt) {
+		pkt_count(&c->mallocs, 1);
+		pkt = (pkt_buf_t*) malloc(sizeof(pkt_buf_t) + size);
+		if (!pkt) {
+			perror("Failed to malloc in pkt_alloc().\n");
+			exit(1);
+		}
+		pkt->head = (uint8_t*) (pkt + 1);
+		pkt->size = size;
+		pkt->slab = 0;
+	}
+
+	pkt->data = pkt->head + PKT_HEADROOM;
+	pkt->len = len;
+	pkt->refcnt = 1;
+	pkt->external = 0;
+	pkt->next = NULL;
+
+	return pkt;
+}
+
+pkt_buf_t* pkt_ref(pkt_buf_t* pkt){
+	assert(pkt);
+	__atomic_add_fetch(&pkt->refcnt, 1, __ATOMIC_RELAXED);
+	return pkt;
+}
+
+/**
+ * drop a reference, the last one returns the buffer to the pool
+ */
+void pkt_unref(pkt_buf_t* pkt){
+	if (!pkt) {
+		return;
+	}
+
+	int refcnt = __atomic_sub_fetch(&pkt->refcnt, 1, __ATOMIC_ACQ_REL);
+	assert(refcnt >= 0);
+	if (refcnt) {
+		return;
+	}
+
+	pkt_cache_t* c = &pkt_cache;
+	if (!c->registered) {
+		pkt_register(c);
+	}
+	pkt_count(&c->frees, 1);
+
+	if (!pkt->slab) {
+		free(pkt);
+		return;
+	}
+
+	pkt->next = c->free;
+	c->free = pkt;
+	pkt_count(&c->count, 1);
+	if (c->count > PKT_CACHE_MAX) {
+		pkt_spill(c);
+	}
+}
+
+/**
+ * @return bytes available in front of the frame, none for a wrapped frame
+ */
+unsigned int pkt_headroom(pkt_buf_t* pkt){
+	if (pkt->external) {
+		return 0;
+	}
+	return pkt->data - pkt->head;
+}
+
+/**
+ * @return bytes available after the end of the frame, none for a wrapped frame
+ */
+unsigned int pkt_tailroom(pkt_buf_t* pkt){
+	if (pkt->external) {
+		return 0;
+	}
+	return pkt->size - (pkt->data - pkt->head) - pkt->len;
+}
+
+/**
+ * lend a frame that lives in memory we do not own (a receive ring) to the
+ * stack without copying it. The ring is reused once the receive batch is
+ * done, so nothing may hold the frame past it: keepers take it with
+ * pkt_keep, transmit queues are flushed before the batch returns.
+ *
+ * @param len at most PKT_BUF_SIZE - PKT_HEADROOM
+ */
+pkt_buf_t* pkt_wrap(uint8_t* data, unsigned int len){
+	assert(len <= PKT_BUF_SIZE - PKT_HEADROOM);
+	pkt_buf_t* pkt = pkt_alloc(len);
+	pkt->data = data;
+	pkt->external = 1;
+	return pkt;
+}
+
+/**
+ * take a frame that was lent to keep it past the call, e.g. to park it until
+ * its next hop is resolved: a reference to a frame in our own storage, a
+ * private copy of a wrapped one. The copy is made by the thread the frame
+ * was lent to, before any other thread can see it.
+ */
+pkt_buf_t* pkt_keep(pkt_buf_t* pkt){
+	if (!pkt->external) {
+		return pkt_ref(pkt);
+	}
+
+	pkt_buf_t* copy = pkt_alloc(pkt->len);
+	memcpy(copy->data, pkt->data, pkt->len);
+	return copy;
+}
+
+/**
+ * sum the counters of every thread, a snapshot while other threads run
+ */
+void pkt_getStats(pkt_stats_t* stats){
+	unsigned long frees = 0;
+	pkt_cache_t* c = NULL;
+
+	memset(stats, 0, sizeof(pkt_stats_t));
+
+	pthread_mutex_lock(&pkt_pool_lock);
+	stats->allocs = pkt_retired.allocs;
+	stats->cache_hits = pkt_retired.hits;
+	stats->mallocs = pkt_retired.mallocs;
+	frees = pkt_retired.frees;
+	for (c = pkt_caches; c; c = c->next){
+		stats->allocs += __atomic_load_n(&c->allocs, __ATOMIC_RELAXED);
+		stats->cache_hits += __atomic_load_n(&c->hits, __ATOMIC_RELAXED);
+		stats->mallocs += __atomic_load_n(&c->mallocs, __ATOMIC_RELAXED);
+		stats->cached += __atomic_load_n(&c->count, __ATOMIC_RELAXED);
+		frees += __atomic_load_n(&c->frees, __ATOMIC_RELAXED);
+	}
+	stats->in_use = stats->allocs > frees ? stats->allocs - frees : 0;
+	stats->capacity = pkt_capacity;
+	stats->slabs = pkt_slabs;
+	stats->pooled = pkt_pooled;
+	pthread_mutex_unlock(&pkt_pool_lock);
+}
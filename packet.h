@@ -0,0 +1,85 @@
+/**
+ * @file packet.h
+ * @author Mohammad Reza Hosseini
+ *
+ * reference counted packet buffers. A buffer is filled by the receive loop and
+ * lent down the stack; anybody who keeps it past the call (ARP queue, transmit
+ * path) takes a reference, so a forwarded frame is rewritten and sent in place.
+ * A frame wrapped in place in a receive ring is copied instead when it is
+ * kept past the receive batch, see pkt_keep.
+ *
+ * Buffers of PKT_BUF_SIZE are carved out of cache aligned slabs and kept on a
+ * free list per thread, so the frames a thread builds (ARP, ICMP, PWOSPF) and
+ * the ones it receives are taken and returned without a lock. Every buffer
+ * has PKT_HEADROOM bytes in front of the frame for headers added below the
+ * router (the VNS packet header) and room behind it for padding to
+ * PKT_MIN_LEN, so neither needs a copy.
+ */
+#ifndef PACKET_H_
+#define PACKET_H_
+
+#include <stdint.h>
+
+///storage of a pooled buffer, room for an MTU sized frame plus headroom
+#define PKT_BUF_SIZE		2048
+
+///bytes reserved in front of the frame for headers added by lower layers
+#define PKT_HEADROOM		64
+
+///shortest frame we put on the wire, shorter ones are padded in place
+#define PKT_MIN_LEN		60
+
+///cache line the slabs and the storage of every buffer are aligned to
+#define PKT_ALIGN		64
+
+///buffers carved out of one slab
+#define PKT_SLAB_BUFS		64
+
+///buffers the slabs may hold in total, past this pooled sized buffers are malloced and freed
+#define PKT_POOL_MAX		4096
+
+///free buffers a thread keeps before handing PKT_CACHE_BATCH back to the shared pool
+#define PKT_CACHE_MAX		256
+
+///buffers moved between a thread and the shared pool at once
+#define PKT_CACHE_BATCH		64
+
+typedef struct Packet_Buffer {
+	uint8_t* data;			/* start of the frame */
+	unsigned int len;		/* length of the frame */
+	unsigned int size;		/* bytes of storage after head */
+	int refcnt;
+	uint8_t* head;			/* start of the storage */
+	int external;			/* data lives outside the storage, see pkt_wrap */
+	int slab;			/* storage belongs to a slab, never freed */
+	struct Packet_Buffer* next;	/* free list link */
+} pkt_buf_t;
+
+typedef struct Packet_Stats {
+	unsigned long allocs;		/* calls to pkt_alloc */
+	unsigned long cache_hits;	/* allocs served by the thread's own free list */
+	unsigned long mallocs;		/* allocs that missed the pool */
+	unsigned long in_use;		/* buffers currently referenced */
+	unsigned long capacity;		/* buffers carved out of slabs */
+	unsigned long slabs;		/* slabs allocated */
+	unsigned long pooled;		/* free buffers on the shared list */
+	unsigned long cached;		/* free buffers on the lists of threads */
+} pkt_stats_t;
+
+pkt_buf_t* pkt_alloc(unsigned int len);
+
+pkt_buf_t* pkt_ref(pkt_buf_t* pkt);
+
+void pkt_unref(pkt_buf_t* pkt);
+
+unsigned int pkt_headroom(pkt_buf_t* pkt);
+
+unsigned int pkt_tailroom(pkt_buf_t* pkt);
+
+pkt_buf_t* pkt_wrap(uint8_t* data, unsigned int len);
+
+pkt_buf_t* pkt_keep(pkt_buf_t* pkt);
+
+void pkt_getStats(pkt_stats_t* stats);
+
+#endif
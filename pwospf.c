@@ -16,11 +16,25 @@
 #include <string.h>
 #include <unistd.h>
 
-void pwospf_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface){
+
+static void pwospf_deadTimer(void* arg, uintptr_t data);
+
+static void pwospf_ageTimer(void* arg, uintptr_t data);
+
+/**
+ * arm t seconds from now, an interval of zero (not configured) leaves it off
+ */
+static void pwospf_armTimer(router_t* router, timer_entry_t* t, uint32_t seconds){
+	if (seconds) {
+		timer_schedule(router->timers, t, (uint64_t) seconds * 1000);
+	}
+}
+
+void pwospf_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned int len, int port){
 	
 	assert(sr);
 	assert(packet);
-	assert(interface);
+	assert(port >= 0);
 	
 	router_t* router = sr_get_subsystem(sr);
 	
@@ -34,9 +48,9 @@ void pwospf_processPacket(struct sr_instance* sr, const uint8_t * packet, unsign
 	pwospf_header_t* pwospf_hdr = pwospf_getHeader(packet);
 	
 	if (pwospf_hdr->pwospf_type == PWOSPF_TYPE_HELLO){
-		pwospf_processHello(sr, packet, len, interface);
+		pwospf_processHello(sr, packet, len, port);
 	} else if (pwospf_hdr->pwospf_type == PWOSPF_TYPE_LINK_STATE_UPDATE){
-		pwospf_processLsu(sr, packet, len, interface);
+		pwospf_processLsu(sr, packet, len, port);
 	}
 }
 
@@ -56,6 +70,12 @@ int pwospf_isValid(router_t* router, const uint8_t *packet, unsigned int len){
 	uint16_t pckt_sum = htons(pwospf_hdr->pwospf_sum);
 	uint16_t sum = pwospf_checksum(pwospf_hdr);
 	
+	/*
+	 * pwospf_checksum clears the field, put it back so the packet can be
+	 * forwarded with an incrementally updated checksum
+	 */
+	pwospf_hdr->pwospf_sum = htons(pckt_sum);
+	
 	/*
 	 * Check the checksum 
 	 */
@@ -139,7 +159,7 @@ uint16_t pwospf_checksum(pwospf_header_t* pwospf_hdr){
 	return s_sum;
 }
 
-void pwospf_processHello(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface){
+void pwospf_processHello(struct sr_instance* sr, const uint8_t * packet, unsigned int len, int port){
 	router_t* router = sr_get_subsystem(sr);
 	ip_header_t* iphdr = ip_getHeader(packet);
 	pwospf_header_t* pwospf_hdr = pwospf_getHeader(packet);
@@ -154,14 +174,9 @@ void pwospf_processHello(struct sr_instance* sr, const uint8_t * packet, unsigne
 		return;
 	}
 	
-	/*
-	 * We got a hello packet so we definitely need to unlock and relock interface in write mode 
-	 */
-	router_unlock(&router->lock_rtable);
-	router_lockRead(&router->lock_rtable);
 	router_lockMutex(&router->lock_pwospf_list);
 	
-	int interfaceIndex = router_getInterfaceIndex(router, interface);
+	int interfaceIndex = port;
 	interface_t* iface = &router->if_list[interfaceIndex];
 	
 	
@@ -169,6 +184,7 @@ void pwospf_processHello(struct sr_instance* sr, const uint8_t * packet, unsigne
 	 * Drop the packet if the masks don't match 
 	 */
 	if (router->if_list[interfaceIndex].mask != hello_hdr->pwospf_mask.s_addr) {
+		router_unlockMutex(&router->lock_pwospf_list);
 		return;
 	}
 	
@@ -197,6 +213,9 @@ void pwospf_processHello(struct sr_instance* sr, const uint8_t * packet, unsigne
 		time(&(nbr->last_rcvd_hello));
 		nbr->ip.s_addr = iphdr->ip_src.s_addr;
 		nbr->router_id = pwospf_hdr->pwospf_rid;
+		nbr->port = interfaceIndex;
+		timer_init(&nbr->dead_timer, pwospf_deadTimer, sr, (uintptr_t) nbr);
+		pwospf_armTimer(router, &nbr->dead_timer, 3 * router->pwospf_hello_interval);
 		
 		node_t* n = node_create();
 		n->data = nbr;
@@ -259,9 +278,11 @@ void pwospf_processHello(struct sr_instance* sr, const uint8_t * packet, unsigne
 		 */
 		
 		/*
-		 * this is an update from our neighbor 
+		 * this is an update from our neighbor, it is alive for another
+		 * dead interval
 		 */
 		time(&(match->last_rcvd_hello));
+		pwospf_armTimer(router, &match->dead_timer, 3 * router->pwospf_hello_interval);
 	}
 	
 	
@@ -269,19 +290,18 @@ void pwospf_processHello(struct sr_instance* sr, const uint8_t * packet, unsigne
 	 * Build packets to inform all our neighbors 
 	 */
 	if (update_neighbors == 1) {
-		pwospf_propagate(router, NULL);
+		pwospf_propagate(router, -1);
 	}
 	
 	
 	router_unlockMutex(&router->lock_pwospf_list);
-	/* unlocking of the above will be automatically performed in process ip packet */
 	
 	
 	/*
-	 * Signal thread to send new information to all our neigbors 
+	 * send the new information to all our neigbors from the timers 
 	 */
 	if (update_neighbors == 1) {
-		pthread_cond_signal(&router->pwospf_lsu_bcast_cond);
+		timer_schedule(router->timers, &router->lsu_bcast_timer, 0);
 	}
 	
 }
@@ -300,7 +320,7 @@ pwospf_router_t* pwospf_searchList(uint32_t rid, node_t* pwospf_router_list){
 	return NULL;
 }
 
-void pwospf_propagate(router_t* router, char* exclude_this_interface){
+void pwospf_propagate(router_t* router, int exclude_port){
 	
 	/*
 	 * update the interface entries in every router entry 
@@ -321,7 +341,7 @@ void pwospf_propagate(router_t* router, char* exclude_this_interface){
 	/*
 	 * build a new IP-LSU update packet 
 	 */
-	pwospf_lsuFlood(router, exclude_this_interface);
+	pwospf_lsuFlood(router, exclude_port);
 }
 
 void pwospf_determineActiveIface(router_t*  router, pwospf_router_t* pwospf_router){
@@ -353,7 +373,7 @@ void pwospf_determineActiveIface(router_t*  router, pwospf_router_t* pwospf_rout
 	}
 }
 
-void pwospf_lsuFlood(router_t* router, char* exclude_this_interface){
+void pwospf_lsuFlood(router_t* router, int exclude_port){
 	/*
 	 * If the flag is set to not broadcast, exit 
 	 */
@@ -376,10 +396,11 @@ void pwospf_lsuFlood(router_t* router, char* exclude_this_interface){
 	free(pwospf_packet);
 	
 	/*
-	 * update the last sent flood time 
+	 * update the last sent flood time, the next refresh is an interval later
 	 */
 	pwospf_router_t* our_router = pwospf_searchList(router->router_id, router->pwospf_router_list);
 	time(&(our_router->last_update));
+	pwospf_armTimer(router, &router->lsu_timer, router->pwospf_lsu_interval);
 }
 
 
@@ -517,7 +538,8 @@ void pwospf_lsuBroadcast(router_t* router, pwospf_header_t* pwospf_hdr, struct i
 				if (!src_ip || (src_ip->s_addr != nbr->ip.s_addr)){
 					
 					unsigned int len = sizeof(eth_header_t) + sizeof(ip_header_t) + ntohs(pwospf_hdr->pwospf_len);
-					uint8_t* packet = (uint8_t*) malloc(len * sizeof(uint8_t));
+					pkt_buf_t* pkt = pkt_alloc(len);
+					uint8_t* packet = pkt->data;
 					eth_header_t* eth_packet = (eth_header_t*) packet;
 					ip_header_t* ip_packet = ip_getHeader(packet);
 					pwospf_header_t* pwospf_packet = pwospf_getHeader(packet);
@@ -541,10 +563,9 @@ void pwospf_lsuBroadcast(router_t* router, pwospf_header_t* pwospf_hdr, struct i
 					router_lockMutex(&router->lock_pwospf_queue);
 					
 					pwospf_lsu_item_t* lqi = (pwospf_lsu_item_t*) calloc(1, sizeof(pwospf_lsu_item_t));
-					memcpy(lqi->iface, iface->name, IF_LEN);
+					lqi->port = i;
 					lqi->ip.s_addr = iface->ip;
-					lqi->packet = packet;
-					lqi->len = len;
+					lqi->pkt = pkt;
 					
 					node_t* n = node_create();
 					n->data = (void*) lqi;
@@ -565,7 +586,7 @@ void pwospf_lsuBroadcast(router_t* router, pwospf_header_t* pwospf_hdr, struct i
 	} /* end of for */
 }
 
-void pwospf_processLsu(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface){
+void pwospf_processLsu(struct sr_instance* sr, const uint8_t * packet, unsigned int len, int port){
 	
 	assert(sr);
 	assert(packet);
@@ -587,10 +608,8 @@ void pwospf_processLsu(struct sr_instance* sr, const uint8_t * packet, unsigned
 	
 	
 	/*
-	 * Lock rtable and router_list for writes 
+	 * Lock router_list for writes, the rtable itself is only rebuilt by dijkstra
 	 */
-	router_unlock(&router->lock_rtable);
-	router_lockWrite(&router->lock_rtable);
 	router_lockMutex(&router->lock_pwospf_list);
 	
 	
@@ -607,6 +626,7 @@ void pwospf_processLsu(struct sr_instance* sr, const uint8_t * packet, unsigned
 		if ( (pwospf_router->seq != ntohs(lsu->pwospf_seq)) && ( ntohs(lsu->pwospf_seq) > pwospf_router->seq  ) ){
 			rebroadcast_packet = 1;
 			time(&(pwospf_router->last_update));
+			pwospf_armTimer(router, &pwospf_router->age_timer, 3 * router->pwospf_lsu_interval);
 			pwospf_router->seq = htons(lsu->pwospf_seq);
 			
 			/*
@@ -639,27 +659,25 @@ void pwospf_processLsu(struct sr_instance* sr, const uint8_t * packet, unsigned
 		 * need to forward a copy of this lsu packet to the other neighbors 
 		 */
 		unsigned int bcasted_pwospf_packet_len = ntohs(pwospf->pwospf_len);
-		uint8_t* bcasted_pwospf_packet = calloc(bcasted_pwospf_packet_len, sizeof(uint8_t));
+		pkt_buf_t* bcasted_pkt = pkt_alloc(bcasted_pwospf_packet_len);
+		uint8_t* bcasted_pwospf_packet = bcasted_pkt->data;
 		memcpy(bcasted_pwospf_packet, pwospf, bcasted_pwospf_packet_len);
 		
 		/*
-		 * update ttl 
+		 * update ttl and patch the checksum, the ttl word is part of the sum
 		 */
 		pwospf_lsu_header_t* bcasted_lsu = (pwospf_lsu_header_t*) (bcasted_pwospf_packet + sizeof(pwospf_header_t));
-		bcasted_lsu->pwospf_ttl = htons(ttl);
-		
-		/*
-		 * recompute checksum 
-		 */
 		pwospf_header_t* bcasted_pwospf = (pwospf_header_t*) (bcasted_pwospf_packet);
-		bcasted_pwospf->pwospf_sum = htons(pwospf_checksum(bcasted_pwospf));
+		uint16_t old_ttl = bcasted_lsu->pwospf_ttl;
+		bcasted_lsu->pwospf_ttl = htons(ttl);
+		bcasted_pwospf->pwospf_sum = ip_checksumAdjust(bcasted_pwospf->pwospf_sum, old_ttl, bcasted_lsu->pwospf_ttl);
 		
 		/*
 		 * broadcast the packet to the other neighbors 
 		 */
 		ip_header_t* ip = ip_getHeader(packet);
 		pwospf_lsuBroadcast(router, bcasted_pwospf, &ip->ip_src);
-		free(bcasted_pwospf_packet);
+		pkt_unref(bcasted_pkt);
 		bcast_incoming_lsu_packet = 1;
 	}
 	
@@ -667,7 +685,7 @@ void pwospf_processLsu(struct sr_instance* sr, const uint8_t * packet, unsigned
 	 * lsu packet has changed our known world, build data to inform the other 3 neighbors 
 	 */
 	if (update_neighbors == 1) {
-		pwospf_propagate(router, NULL);
+		pwospf_propagate(router, -1);
 	}
 	
 	
@@ -678,10 +696,10 @@ void pwospf_processLsu(struct sr_instance* sr, const uint8_t * packet, unsigned
 	
 	
 	/*
-	 * updated neighbor, signal to send the constructed lsu flood 
+	 * updated neighbor, send the constructed lsu flood 
 	 */
 	if ( (update_neighbors == 1)  || (bcast_incoming_lsu_packet == 1) ){
-		pthread_cond_signal(&router->pwospf_lsu_bcast_cond);
+		timer_schedule(router->timers, &router->lsu_bcast_timer, 0);
 	}
 }
 
@@ -868,6 +886,8 @@ void pwospf_addNeighbor(router_t* router, const uint8_t* packet, unsigned int le
 	time(&new_router->last_update);
 	new_router->distance = 0;
 	new_router->shortest_path_found = 0;
+	timer_init(&new_router->age_timer, pwospf_ageTimer, router->sr, (uintptr_t) new_router);
+	pwospf_armTimer(router, &new_router->age_timer, 3 * router->pwospf_lsu_interval);
 	
 	
 	/*
@@ -889,233 +909,222 @@ void pwospf_addNeighbor(router_t* router, const uint8_t* packet, unsigned int le
 	}
 }
 
-void* pwospf_helloThread(void* param){
-	assert(param);
-	struct sr_instance* sr = (struct sr_instance*) param;
+/**
+ * start the hellos and the LSU refresh once the interfaces are known
+ */
+void pwospf_startTimers(struct sr_instance* sr){
+	assert(sr);
 	router_t* router = sr_get_subsystem(sr);
+	int i = 0;
 	
-	while(1){
-		pwospf_helloBroadcast(sr);
-		sleep(router->pwospf_hello_interval - 1);
+	for (i = 0; i < router->if_list_index; i++){
+		timer_init(&router->if_list[i].hello_timer, pwospf_helloTimer, sr, i);
+		if (router->pwospf_hello_interval) {
+			timer_schedule(router->timers, &router->if_list[i].hello_timer, 0);
+		}
 	}
+	
+	pwospf_armTimer(router, &router->lsu_timer, router->pwospf_lsu_interval);
 }
 
-
-void* pwospf_lsuThread(void* param){
+/**
+ * hello on port data, every hello interval
+ */
+void pwospf_helloTimer(void* arg, uintptr_t data){
+	struct sr_instance* sr = (struct sr_instance*) arg;
+	router_t* router = sr_get_subsystem(sr);
 	
-	assert(param);
-	struct sr_instance* sr = (struct sr_instance*) param;
+	pwospf_sendHello(sr, (int) data);
+	pwospf_armTimer(router, &router->if_list[data].hello_timer, router->pwospf_hello_interval);
+}
+
+/**
+ * refresh of our LSU, pwospf_lsu_interval after the last flood
+ */
+void pwospf_lsuTimer(void* arg, uintptr_t data){
+	struct sr_instance* sr = (struct sr_instance*) arg;
 	router_t* router = sr_get_subsystem(sr);
+	int flooded = 0;
 	
-	time_t now;
-	int diff;
+	router_lockMutex(&router->lock_pwospf_list);
 	
-	sleep(5);
-	while (1){
-		router_lockMutex(&router->lock_pwospf_list);
-		pwospf_router_t* our_router = pwospf_searchList(router->router_id, router->pwospf_router_list);
-		router_unlockMutex(&router->lock_pwospf_list);
-		
-		time(&now);
-		if (our_router) {
-			diff = (int) difftime(now, our_router->last_update);
-			
-			/*
-			 * send an lsu update if we haven't done so 
-			 */
-			if (diff > (router->pwospf_lsu_interval)) {
-				
-				router_lockMutex(&router->lock_pwospf_list);
-				pwospf_lsuFlood(router, NULL);
-				router_unlockMutex(&router->lock_pwospf_list);
-				
-				/*
-				 * signal the lsu bcast thread to send the packets 
-				 */
-				pthread_cond_signal(&router->pwospf_lsu_bcast_cond);
-			}
+	/*
+	 * a flood since the timer was picked has re-armed it
+	 */
+	if (!timer_isPending(router->timers, &router->lsu_timer)) {
+		if (pwospf_searchList(router->router_id, router->pwospf_router_list)) {
+			pwospf_lsuFlood(router, -1);
+			flooded = 1;
 		}
-		
-		/*
-		 * poll every 1 second 
-		 */
-		sleep(1);
+		pwospf_armTimer(router, &router->lsu_timer, router->pwospf_lsu_interval);
+	}
+	
+	router_unlockMutex(&router->lock_pwospf_list);
+	
+	/*
+	 * send the packets from the timers 
+	 */
+	if (flooded) {
+		timer_schedule(router->timers, &router->lsu_bcast_timer, 0);
 	}
 }
 
+/**
+ * dead interval of neighbor data: no hello for 3 hello intervals
+ */
+static void pwospf_deadTimer(void* arg, uintptr_t data){
+	struct sr_instance* sr = (struct sr_instance*) arg;
+	router_t* router = sr_get_subsystem(sr);
+	nbr_router_t* nbr = (nbr_router_t*) data;
+	interface_t* iface = &router->if_list[nbr->port];
+	
+	/*
+	 * neighbors are only freed here, on the timer thread, so nbr is still
+	 * there; a hello since the timer was picked has re-armed it
+	 */
+	router_lockMutex(&router->lock_pwospf_list);
+	if (timer_isPending(router->timers, &nbr->dead_timer)) {
+		router_unlockMutex(&router->lock_pwospf_list);
+		return;
+	}
+	
+	node_t* n = iface->neighbors;
+	while (n->data != nbr) {
+		n = n->next;
+	}
+	pwospf_removeNeighbor(router, iface, n);
+	
+	/*
+	 * flood with lsu updates 
+	 */
+	pwospf_propagate(router, -1);
+	router_unlockMutex(&router->lock_pwospf_list);
+	
+	/*
+	 * send it to every neighbor 
+	 */
+	timer_schedule(router->timers, &router->lsu_bcast_timer, 0);
+}
 
-void pwospf_helloBroadcast(struct sr_instance* sr){
+
+void pwospf_sendHello(struct sr_instance* sr, int port){
 	
 	assert(sr);
+	assert(port >= 0);
 	
 	router_t* router = sr_get_subsystem(sr);
 	unsigned int len = sizeof(eth_header_t) + sizeof(ip_header_t) + sizeof(pwospf_header_t) + sizeof(pwospf_hello_header_t);
-	uint8_t* packet = malloc(len * sizeof(char));
-// 	iface_entry *ie = 0;
+	uint8_t default_addr[ETH_ADDR_LEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	interface_t* ie = &router->if_list[port];
+	
+	/*
+	 * a fresh buffer per hello, the transmit queue may still hold the
+	 * previous one
+	 */
+	pkt_buf_t* pkt = pkt_alloc(len);
+	uint8_t* packet = pkt->data;
 	eth_header_t* eth = (eth_header_t*) packet;
 	ip_header_t* ip = ip_getHeader(packet);
 	pwospf_header_t* pwospf = pwospf_getHeader(packet);
 	pwospf_hello_header_t* hello = pwospf_getHelloHeader(packet);
-	uint8_t default_addr[ETH_ADDR_LEN] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
-	int interface_has_timedout = 0;
+	bzero(packet, len);
 	
 	/*
-	 * send one hello packet per interface 
+	 * construct the hello packet 
 	 */
-	int i = 0;
-	for (i = 0; i < NUM_INTERFACES; i++){
-// 		ie = (iface_entry *)iface_walker->data;
-		interface_t* ie = &router->if_list[i];
-		bzero(packet, len);
-		
-// 		if (ie->is_active & 0x1){
-		if (1){
-			
-			/*
-			 * construct the hello packet 
-			 */
-			pwospf_createHelloHeader(hello, ie->mask, router->pwospf_hello_interval);
-			
-			pwospf_createHeader(pwospf, PWOSPF_TYPE_HELLO, sizeof(pwospf_header_t) + sizeof(pwospf_hello_header_t), router->router_id, router->area_id);
-			pwospf->pwospf_sum = htons(pwospf_checksum(pwospf));
-			ip_createHeader(ip, sizeof(pwospf_header_t) + sizeof(pwospf_hello_header_t), IP_PROTO_PWOSPF, ie->ip, htonl(PWOSPF_HELLO_TIP));
-			ip->ip_sum = htons(ip_checksum(ip));
-			eth_createHeader(eth, default_addr, ie->addr, ETH_TYPE_IP);
-			
-			/*
-			 * send hello packet and update the time sent 
-			 */
-			router_sendPacket(sr, packet, len, ie->name);
-			time((time_t*) (&ie->last_sent_hello));
-			
-			
-			/*
-			 * disable timed out interface 
-			* have to lock the router list because we update our pwospf router from inside 
-			*/
-			router_lockMutex(&router->lock_pwospf_list);
-			if (pwospf_findTimedoutInterface(router, ie) == 1){ 
-				/*
-				 * the outer loop checks all interfaces, so we need this if statement 
-				 */
-				interface_has_timedout = 1;
-			}
-			router_unlockMutex(&router->lock_pwospf_list);
-		}
-	}
+	pwospf_createHelloHeader(hello, ie->mask, router->pwospf_hello_interval);
 	
+	pwospf_createHeader(pwospf, PWOSPF_TYPE_HELLO, sizeof(pwospf_header_t) + sizeof(pwospf_hello_header_t), router->router_id, router->area_id);
+	pwospf->pwospf_sum = htons(pwospf_checksum(pwospf));
+	ip_createHeader(ip, sizeof(pwospf_header_t) + sizeof(pwospf_hello_header_t), IP_PROTO_PWOSPF, ie->ip, htonl(PWOSPF_HELLO_TIP));
+	ip->ip_sum = htons(ip_checksum(ip));
+	eth_createHeader(eth, default_addr, ie->addr, ETH_TYPE_IP);
 	
 	/*
-	 * One of neighbor interfaces has timed out 
+	 * send hello packet and update the time sent 
 	 */
-	if (interface_has_timedout == 1){
-		
-		/*
-		 * flood with lsu updates 
-		 */
-		router_lockMutex(&router->lock_pwospf_list);
-		pwospf_propagate(router, NULL);
-		router_unlockMutex(&router->lock_pwospf_list);
-		
-		/*
-		 * send it to every neighbor 
-		 */
-		pthread_cond_signal(&router->pwospf_lsu_bcast_cond);
-	}
-	free(packet);
+	router_sendPacket(sr, pkt, port);
+	pkt_unref(pkt);
+	time((time_t*) (&ie->last_sent_hello));
 }
 
 
-int pwospf_findTimedoutInterface(router_t* router, interface_t* iface){
+/**
+ * forget the neighbor of node cur on iface, its dead interval is over.
+ * NOT Threadsafe, caller holds lock_pwospf_list
+ */
+void pwospf_removeNeighbor(router_t* router, interface_t* iface, node_t* cur){
 	
-	int interface_has_timedout = 0;
-	time_t now;
-	int diff;
+	nbr_router_t* nbr = (nbr_router_t*) cur->data;
 	
-	node_t* cur = iface->neighbors;
-	while (cur) {
-		node_t* next = cur->next;
-		nbr_router_t* nbr = (nbr_router_t*) cur->data;
+	/*
+	 * delete this interface from our router entry 
+	 */
+	pwospf_router_t* our_router = pwospf_searchList(router->router_id, router->pwospf_router_list);
+	
+	if (our_router) {
+		node_t* n = our_router->interface_list;
 		
 		/*
-		 * disable timed out interfaces  
+		 * first count how many routers are on this same subnet 
 		 */
-		time(&now);
-		diff = (int) difftime(now, (time_t)nbr->last_rcvd_hello);
-		if (diff > (3 * router->pwospf_hello_interval)){
+		int count = 0;
+		while (n){
+			pwospf_iface_t *pi = (pwospf_iface_t*) n->data;
 			
-			interface_has_timedout = 1;
+			if ( (pi->subnet.s_addr == (iface->ip & iface->mask)) && (pi->mask.s_addr == iface->mask)){
+				++count;
+			}
 			
+			n = n->next;
+		}
+		
+		assert(count > 0);
+		if (count == 1){
 			/*
-			 * delete this interface from our router entry 
+			 * if there is only one then we zero out its neighbor router, else we delete it 
 			 */
-			pwospf_router_t* our_router = pwospf_searchList(router->router_id, router->pwospf_router_list);
-			
-			node_t* n = our_router->interface_list;
 			
 			/*
-			 * first count how many routers are on this same subnet 
+			 * find this interface 
 			 */
-			int count = 0;
-			while (n){
-				pwospf_iface_t *pi = (pwospf_iface_t*) n->data;
+			n = our_router->interface_list;
+			while(n) {
+				pwospf_iface_t* pi = (pwospf_iface_t*) n->data;
 				
-				if ( (pi->subnet.s_addr == (iface->ip & iface->mask)) && (pi->mask.s_addr == iface->mask)){
-					++count;
+				if ((pi->subnet.s_addr == (iface->ip & iface->mask)) && (pi->mask.s_addr == iface->mask)){
+					pi->router_id = 0;
+					break;
 				}
 				
 				n = n->next;
 			}
 			
-			assert(count > 0);
-			if (count == 1){
-				/*
-				 * if there is only one then we zero out its neighbor router, else we delete it 
-				 */
+		} 
+		else{
+			/*
+			 * delete this interface 
+			 */
+			n = our_router->interface_list;
+			while(n) {
+				pwospf_iface_t* pi = (pwospf_iface_t*) n->data;
 				
-				/*
-				 * find this interface 
-				 */
-				n = our_router->interface_list;
-				while(n) {
-					pwospf_iface_t* pi = (pwospf_iface_t*) n->data;
-					
-					if ((pi->subnet.s_addr == (iface->ip & iface->mask)) && (pi->mask.s_addr == iface->mask)){
-						pi->router_id = 0;
-						break;
-					}
-					
-					n = n->next;
+				if( (pi->subnet.s_addr == (iface->ip & iface->mask)) && (pi->mask.s_addr == iface->mask) && (nbr->router_id == pi->router_id)) {
+					node_remove(&our_router->interface_list, n);
+					break;
 				}
 				
-			} 
-			else{
-				/*
-				 * delete this interface 
-				 */
-				n = our_router->interface_list;
-				while(n) {
-					pwospf_iface_t* pi = (pwospf_iface_t*) n->data;
-					
-					if( (pi->subnet.s_addr == (iface->ip & iface->mask)) && (pi->mask.s_addr == iface->mask) && (nbr->router_id == pi->router_id)) {
-						node_remove(&our_router->interface_list, n);
-						break;
-					}
-					
-					n = n->next;
-				}
+				n = n->next;
 			}
-			
-			/*
-			 * delete this neighbor from our physical interface list 
-			 */
-			node_remove(&iface->neighbors, cur);
-			
 		}
-		cur = next;
 	}
 	
-	return interface_has_timedout;
+	/*
+	 * delete this neighbor from our physical interface list, its timer
+	 * goes with it
+	 */
+	timer_cancel(router->timers, &nbr->dead_timer);
+	node_remove(&iface->neighbors, cur);
 }
 
 
@@ -1144,150 +1153,102 @@ pwospf_iface_t* pwospf_hasDefaultRoute(router_t* router){
 }
 
 
-void* pwospf_lsu_timeout_thread(void *param){
-	
-	assert(param);
-	struct sr_instance *sr = (struct sr_instance *)param;
+/**
+ * aging of LSDB entry data: no newer LSU for 3 LSU intervals
+ */
+static void pwospf_ageTimer(void* arg, uintptr_t data){
+	struct sr_instance* sr = (struct sr_instance*) arg;
 	router_t* router = sr_get_subsystem(sr);
-	time_t now;
-	int diff;
-	int timeout_occured = 0;
+	pwospf_router_t* rl_entry = (pwospf_router_t*) data;
 	
-	while(1) {
-		timeout_occured = 0;
-		router_lockMutex(&router->lock_pwospf_list);
-		
-		node_t *rl_cur = router->pwospf_router_list;
-		node_t *rl_next = NULL;
-		
-		/*
-		 * eliminate lsu timedout entries 
-		 */
-		while(rl_cur) {
-			rl_next = rl_cur->next;
-			
-			pwospf_router_t* rl_entry = (pwospf_router_t *)rl_cur->data;
-			
-			/*
-			 * don't time out ourself 
-			 */
-			if (rl_entry->router_id == router->router_id) {
-				rl_cur = rl_next;
-				continue;
-			}
-			
-			time(&now);
-			diff = (int)difftime(now, rl_entry->last_update);
-			
-			/*
-			 * if(diff > 3 * LSUINT) 
-			 */
-			if (diff > (router->pwospf_lsu_interval * 3)) {
-				char addr[16];
-				inet_ntop(AF_INET, &(rl_entry->router_id), addr, 16);
-				//printf("PWOSPF ROUTER LENGTH: %u\n", node_length(rs->pwospf_router_list));
-				//printf("Timing out router with id: %s\n", addr);
-				node_t *il_cur = rl_entry->interface_list;
-				node_t *il_next = NULL;
-				
-				while(il_cur) {
-					il_next = il_cur->next;
-					node_remove(&rl_entry->interface_list, il_cur);
-					il_cur = il_next;
-				}
-				
-				node_remove(&router->pwospf_router_list, rl_cur);
-				timeout_occured = 1;
-			}
-			
-			rl_cur = rl_next;
-		}
-		
-		
-		/*
-		 * build lsu flood information for all our neighbors 
-		 */
-		if(timeout_occured == 1) {
-			//printf("PWOSPF ROUTER LENGTH: %u\n", node_length(rs->pwospf_router_list));
-			pwospf_propagate(router, NULL);
-		}
-		
-		
+	/*
+	 * entries are only freed here, on the timer thread, so rl_entry is
+	 * still there; an update since the timer was picked has re-armed it
+	 */
+	router_lockMutex(&router->lock_pwospf_list);
+	if (timer_isPending(router->timers, &rl_entry->age_timer)) {
 		router_unlockMutex(&router->lock_pwospf_list);
-		
-		
-		/*
-		 * signal thread to send the lsu flood 
-		 */
-		if(timeout_occured == 1) {
-			pthread_cond_signal(&router->pwospf_lsu_bcast_cond);
-		}
-		
-		sleep(1);
+		return;
+	}
+	
+	node_t* rl_cur = router->pwospf_router_list;
+	while (rl_cur->data != rl_entry) {
+		rl_cur = rl_cur->next;
+	}
+	
+	node_t *il_cur = rl_entry->interface_list;
+	node_t *il_next = NULL;
+	
+	while(il_cur) {
+		il_next = il_cur->next;
+		node_remove(&rl_entry->interface_list, il_cur);
+		il_cur = il_next;
 	}
+	
+	node_remove(&router->pwospf_router_list, rl_cur);
+	
+	/*
+	 * build lsu flood information for all our neighbors 
+	 */
+	pwospf_propagate(router, -1);
+	
+	router_unlockMutex(&router->lock_pwospf_list);
+	
+	/*
+	 * send the lsu flood 
+	 */
+	timer_schedule(router->timers, &router->lsu_bcast_timer, 0);
 }
 
-void* pwospf_lsu_bcast_thread(void *param){
+/**
+ * send the queued LSU packets. Armed with no delay whenever packets are
+ * queued; the wheel runs one callback at a time, so sends never interleave
+ */
+void pwospf_lsuBcastTimer(void* arg, uintptr_t data){
 	
-	assert(param);
-	struct sr_instance *sr = (struct sr_instance *)param;
+	assert(arg);
+	struct sr_instance *sr = (struct sr_instance *)arg;
 	router_t* router = sr_get_subsystem(sr);
 	
-	while(1) {
-		router_lockMutex(&router->lock_pwospf_bcast);
+	/*
+	 * get lsu packet queue 
+	 */
+	node_t* lsu_queue = 0;
+	
+	router_lockMutex(&router->lock_pwospf_queue);
+	lsu_queue = router->pwospf_lsu_queue;
+	router->pwospf_lsu_queue = 0;
+	router_unlockMutex(&router->lock_pwospf_queue);
+	
+	/*
+	 * iterate over the queue and send each packet 
+	 */
+	node_t *cur = lsu_queue;
+	node_t *next = 0;
+	while(cur) {
+		next = cur->next;
+		pwospf_lsu_item_t *lqe = (pwospf_lsu_item_t *)cur->data;
 		
-		pthread_cond_wait(&router->pwospf_lsu_bcast_cond, &router->lock_pwospf_bcast);
+		//print_packet(lqe->pkt->data, lqe->pkt->len);
 		
-		/*
-		 * get lsu packet queue 
-		 */
-		node_t* lsu_queue = 0;
+		struct in_addr next_hop;
+		int next_hop_iface = 0;;
 		
-		router_lockMutex(&router->lock_pwospf_queue);
-		lsu_queue = router->pwospf_lsu_queue;
-		router->pwospf_lsu_queue = 0;
-		router_unlockMutex(&router->lock_pwospf_queue);
-		
-		router_lockRead(&router->lock_arp_cache);
-		router_lockWrite(&router->lock_arp_queue);
-		router_lockRead(&router->lock_rtable);
 		
 		/*
-		 * iterate over the queue and send each packet 
+		 * is there an entry in our routing table for the destination? 
 		 */
-		node_t *cur = lsu_queue;
-		node_t *next = 0;
-		while(cur) {
-			next = cur->next;
-			pwospf_lsu_item_t *lqe = (pwospf_lsu_item_t *)cur->data;
-			
-			//print_packet(lqe->packet, lqe->len);
-			
-			struct in_addr next_hop;
-			int next_hop_iface = 0;;
-			
-			
-			/*
-			 * is there an entry in our routing table for the destination? 
-			 */
-			if (!rtable_nextHop(router, &((ip_getHeader(lqe->packet))->ip_dst), &next_hop, &next_hop_iface )) {
-				router_ip2mac(sr, lqe->packet, lqe->len, &next_hop, router->if_list[next_hop_iface].name);
-			} else {
-				char dest[16];
-				inet_ntop(AF_INET, &((ip_getHeader(lqe->packet))->ip_dst), dest, 16);
-				//printf("FAILURE SENDING LSU PACKET Could Not Match: %s\n", dest);
-			}
-			
-			free(lqe);
-			free(cur);
-			cur = next;
+		if (!rtable_nextHop(router, &((ip_getHeader(lqe->pkt->data))->ip_dst), &next_hop, &next_hop_iface )) {
+			router_ip2mac(sr, lqe->pkt, &next_hop, next_hop_iface);
+		} else {
+			char dest[16];
+			inet_ntop(AF_INET, &((ip_getHeader(lqe->pkt->data))->ip_dst), dest, 16);
+			//printf("FAILURE SENDING LSU PACKET Could Not Match: %s\n", dest);
 		}
 		
-		router_unlock(&router->lock_rtable);
-		router_unlock(&router->lock_arp_queue);
-		router_unlock(&router->lock_arp_cache);
-		
-		router_unlockMutex(&router->lock_pwospf_bcast);
+		pkt_unref(lqe->pkt);
+		free(lqe);
+		free(cur);
+		cur = next;
 	}
-	
 }
@@ -46,6 +46,7 @@ typedef struct pwospf_router {
 	// 	uint16_t lsu_int;
 	uint16_t seq;
 	time_t last_update;
+	timer_entry_t age_timer;	/* re-armed by every newer LSU, never for us */
 	uint32_t distance;
 	unsigned int shortest_path_found:1;
 	node_t* interface_list;
@@ -56,9 +57,8 @@ typedef struct pwospf_router {
 
 typedef struct pwospf_lsu_queue_entry {
 	struct in_addr ip;
-	char iface[IF_LEN];
-	uint8_t *packet;
-	unsigned int len;
+	int port;		/* if_list index it was built for */
+	pkt_buf_t* pkt;
 } pwospf_lsu_item_t;
 
 
@@ -96,7 +96,7 @@ typedef struct pwospf_lsu_adv{
 } __attribute__ ((packed)) pwospf_lsu_adv_t;
 
 
-void pwospf_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface);
+void pwospf_processPacket(struct sr_instance* sr, const uint8_t * packet, unsigned int len, int port);
 
 int pwospf_isValid(router_t* router, const uint8_t *packet, unsigned int len);
 
@@ -112,13 +112,13 @@ uint16_t pwospf_checksum(pwospf_header_t* pwospf_hdr);
 
 pwospf_router_t* pwospf_searchList(uint32_t rid, node_t* pwospf_router_list);
 
-void pwospf_propagate(router_t* router, char* exclude_this_interface);
+void pwospf_propagate(router_t* router, int exclude_port);
 
-void pwospf_processHello(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface);
+void pwospf_processHello(struct sr_instance* sr, const uint8_t * packet, unsigned int len, int port);
 
 void pwospf_determineActiveIface(router_t*  router, pwospf_router_t* pwospf_router);
 
-void pwospf_lsuFlood(router_t* router, char* exclude_this_interface);
+void pwospf_lsuFlood(router_t* router, int exclude_port);
 
 void pwospf_lsuConstruct(router_t* rotuer, uint8_t** pwospf_packet, unsigned int* pwospf_packet_len);
 
@@ -132,24 +132,24 @@ void pwospf_createLsuHeader(pwospf_lsu_header_t* lsu, uint16_t seq, uint32_t num
 
 void pwospf_lsuBroadcast(router_t* router, pwospf_header_t* pwospf_hdr, struct in_addr* src_ip);
 
-void pwospf_processLsu(struct sr_instance* sr, const uint8_t * packet, unsigned int len, const char* interface);
+void pwospf_processLsu(struct sr_instance* sr, const uint8_t * packet, unsigned int len, int port);
 
 int pwospf_populateInterfaceList(pwospf_router_t *router, uint8_t *packet, unsigned int len);
 
 void pwospf_addNeighbor(router_t* router, const uint8_t* packet, unsigned int len);
 
-void* pwospf_helloThread(void* param);
+void pwospf_startTimers(struct sr_instance* sr);
 
-void* pwospf_lsuThread(void* param);
+void pwospf_helloTimer(void* arg, uintptr_t data);
 
-void pwospf_helloBroadcast(struct sr_instance* sr);
+void pwospf_lsuTimer(void* arg, uintptr_t data);
 
-int pwospf_findTimedoutInterface(router_t* router, interface_t* iface);
+void pwospf_sendHello(struct sr_instance* sr, int port);
 
-pwospf_iface_t* pwospf_hasDefaultRoute(router_t* router);
+void pwospf_removeNeighbor(router_t* router, interface_t* iface, node_t* cur);
 
-void* pwospf_lsu_bcast_thread(void *param);
+pwospf_iface_t* pwospf_hasDefaultRoute(router_t* router);
 
-void* pwospf_lsu_timeout_thread(void *param);
+void pwospf_lsuBcastTimer(void* arg, uintptr_t data);
 
 #endif
@@ -0,0 +1,130 @@
+/**
+ * @file rcu.c
+ * @author Mohammad Reza Hosseini
+ *
+ * Every reader thread owns a slot holding the epoch it entered its read side
+ * section in, or 0 when it is outside.  rcu_synchronize advances the global
+ * epoch and waits for the slots that are still in an older one.  A thread
+ * takes its slot on its first read side section and gives it back when it
+ * exits, so short lived threads such as CLI clients don't use them up.
+ */
+
+#include "rcu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include <assert.h>
+
+typedef struct Rcu_Reader {
+	uint64_t epoch;
+	char pad[64 - sizeof(uint64_t)];	/* one reader per cache line */
+} rcu_reader_t;
+
+static rcu_reader_t rcu_readers[RCU_MAX_READERS] __attribute__ ((aligned(64)));
+static uint64_t rcu_epoch = 1;
+
+///slots owned by a live thread, one bit per slot
+static uint64_t rcu_used[(RCU_MAX_READERS + 63) / 64];
+static pthread_key_t rcu_key;
+static pthread_once_t rcu_once = PTHREAD_ONCE_INIT;
+
+static __thread int rcu_slot = -1;
+static __thread int rcu_nesting = 0;
+
+/*
+ * thread exit: the slot is outside any section, hand it back
+ */
+static void rcu_putSlot(void* arg){
+	int slot = (int)(intptr_t) arg - 1;
+
+	__atomic_store_n(&rcu_readers[slot].epoch, 0, __ATOMIC_RELEASE);
+	__atomic_fetch_and(&rcu_used[slot / 64], ~(1ULL << (slot % 64)), __ATOMIC_RELEASE);
+}
+
+static void rcu_initKey(void){
+	if (pthread_key_create(&rcu_key, rcu_putSlot) != 0) {
+		perror("Failure creating rcu key");
+		exit(1);
+	}
+}
+
+/**
+ * claim a free slot for the calling thread, it is released by rcu_putSlot
+ * when the thread exits
+ * @return the slot, -1 if all RCU_MAX_READERS are taken
+ */
+static int rcu_getSlot(void){
+	int i = 0;
+
+	pthread_once(&rcu_once, rcu_initKey);
+
+	for (i = 0; i < RCU_MAX_READERS; i++){
+		uint64_t bit = 1ULL << (i % 64);
+		uint64_t used = __atomic_load_n(&rcu_used[i / 64], __ATOMIC_RELAXED);
+
+		if (!(used & bit) &&
+				!(__atomic_fetch_or(&rcu_used[i / 64], bit, __ATOMIC_ACQUIRE) & bit)) {
+			if (pthread_setspecific(rcu_key, (void*)(intptr_t)(i + 1)) != 0) {
+				perror("Failure setting rcu key");
+				exit(1);
+			}
+			return i;
+		}
+	}
+	return -1;
+}
+
+void rcu_readLock(void){
+	if (rcu_nesting++) {
+		return;
+	}
+
+	if (rcu_slot < 0) {
+		rcu_slot = rcu_getSlot();
+		if (rcu_slot < 0) {
+			fprintf(stderr, "rcu: no free reader slot, more than %d live reader threads\n", RCU_MAX_READERS);
+			exit(1);
+		}
+	}
+
+	/*
+	 * announce the epoch before reading any protected pointer, the fence pairs
+	 * with the one in rcu_synchronize
+	 */
+	uint64_t epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&rcu_readers[rcu_slot].epoch, epoch, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void rcu_readUnlock(void){
+	assert(rcu_nesting > 0);
+	if (--rcu_nesting) {
+		return;
+	}
+	__atomic_store_n(&rcu_readers[rcu_slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * wait until every reader that might have seen a pointer replaced before this
+ * call has left its read side section
+ */
+void rcu_synchronize(void){
+	uint64_t epoch = __atomic_add_fetch(&rcu_epoch, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	/*
+	 * free slots read 0, no need to look at the bitmap
+	 */
+	int i = 0;
+	for (i = 0; i < RCU_MAX_READERS; i++){
+		while (1) {
+			uint64_t e = __atomic_load_n(&rcu_readers[i].epoch, __ATOMIC_ACQUIRE);
+			if (!e || e >= epoch) {
+				break;
+			}
+			sched_yield();
+		}
+	}
+}
@@ -0,0 +1,30 @@
+/**
+ * @file rcu.h
+ * @author Mohammad Reza Hosseini
+ *
+ * epoch based read-copy-update for data read on the forwarding path.
+ *
+ * Readers wrap their accesses in rcu_readLock/rcu_readUnlock and never block.
+ * A writer publishes a new copy with an atomic pointer swap, calls
+ * rcu_synchronize to wait until no reader can still see the old copy, and
+ * frees it.  Writers must be serialized by the caller.
+ */
+#ifndef RCU_H_
+#define RCU_H_
+
+#include <stdint.h>
+
+///maximum number of live threads that have entered a read side section
+#define RCU_MAX_READERS	64
+
+void rcu_readLock(void);
+
+void rcu_readUnlock(void);
+
+void rcu_synchronize(void);
+
+#define rcu_dereference(p)	__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+#define rcu_assignPointer(p, v)	__atomic_exchange_n(&(p), (v), __ATOMIC_SEQ_CST)
+
+#endif
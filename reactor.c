@@ -0,0 +1,236 @@
+/**
+ * @file reactor.c
+ * @author Mohammad Reza Hosseini
+ *
+ * The timerfd is armed on the absolute tick the wheel wants to run next, by
+ * the wheel itself under its lock whenever that tick moves, from whichever
+ * thread armed the timer. The loop only reads the expiry and runs the wheel.
+ */
+
+#include "reactor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+
+/**
+ * run the calls posted so far, in order. Calls posted by them wait for the
+ * next wakeup
+ */
+static void reactor_wakeup(reactor_t* r, reactor_handler_t* h, uint32_t events){
+	uint64_t count;
+
+	if (read(r->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		perror("reactor eventfd read");
+	}
+	r->stats.wakeups++;
+
+	pthread_mutex_lock(&r->lock);
+	reactor_call_t* call = r->calls;
+	r->calls = NULL;
+	r->calls_tail = &r->calls;
+	pthread_mutex_unlock(&r->lock);
+
+	while (call) {
+		reactor_call_t* next = call->next;
+		call->fn(call->arg);
+		r->stats.calls++;
+		free(call);
+		call = next;
+	}
+}
+
+static void reactor_timerExpired(reactor_t* r, reactor_handler_t* h, uint32_t events){
+	uint64_t count;
+
+	if (read(r->timerfd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		perror("reactor timerfd read");
+	}
+	r->stats.timer_runs++;
+
+	timer_run(r->wheel, timer_now());
+}
+
+/**
+ * notify hook of the wheel, arms the timerfd on tick wake of timer_now.
+ * Runs under the wheel lock, on any thread
+ */
+static void reactor_armTimer(void* arg, uint64_t wake){
+	reactor_t* r = (reactor_t*) arg;
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (wake != TIMER_NEVER) {
+		its.it_value.tv_sec = wake / 1000;
+		its.it_value.tv_nsec = (wake % 1000) * 1000000;
+	}
+	if (timerfd_settime(r->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		perror("timerfd_settime");
+	}
+}
+
+/**
+ * @param spin	never sleep in epoll_wait, poll the descriptors instead
+ */
+reactor_t* reactor_create(int spin){
+	reactor_t* r = (reactor_t*) calloc(1, sizeof(reactor_t));
+
+	assert(r);
+	if (pthread_mutex_init(&r->lock, NULL) != 0){
+		perror("Lock init error");
+		exit(1);
+	}
+
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->epfd < 0) {
+		perror("epoll_create1");
+		exit(1);
+	}
+
+	r->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (r->eventfd < 0) {
+		perror("eventfd");
+		exit(1);
+	}
+
+	r->timerfd = -1;
+	r->spin = spin;
+	r->calls_tail = &r->calls;
+	reactor_add(r, r->eventfd, EPOLLIN, reactor_wakeup, r);
+
+	return r;
+}
+
+/**
+ * watch fd for events, fn runs on the reactor thread while they are pending
+ */
+reactor_handler_t* reactor_add(reactor_t* r, int fd, uint32_t events, reactor_fn_t fn, void* arg){
+	reactor_handler_t* h = (reactor_handler_t*) calloc(1, sizeof(reactor_handler_t));
+	struct epoll_event ev;
+
+	assert(h);
+	h->fd = fd;
+	h->fn = fn;
+	h->arg = arg;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = h;
+	if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("epoll_ctl add");
+		exit(1);
+	}
+
+	return h;
+}
+
+/**
+ * stop watching the descriptor of h, before it is closed.
+ * NOT Threadsafe, only called on the reactor thread
+ */
+void reactor_remove(reactor_t* r, reactor_handler_t* h){
+	if (h->fd < 0) {
+		return;
+	}
+	if (epoll_ctl(r->epfd, EPOLL_CTL_DEL, h->fd, NULL) < 0) {
+		perror("epoll_ctl del");
+	}
+	h->fd = -1;
+	h->next = r->dead;
+	r->dead = h;
+}
+
+/**
+ * run fn(arg) on the reactor thread, from any thread
+ */
+void reactor_post(reactor_t* r, reactor_call_fn_t fn, void* arg){
+	reactor_call_t* call = (reactor_call_t*) calloc(1, sizeof(reactor_call_t));
+	uint64_t one = 1;
+
+	assert(call);
+	call->fn = fn;
+	call->arg = arg;
+
+	pthread_mutex_lock(&r->lock);
+	int wake = r->calls == NULL;
+	*r->calls_tail = call;
+	r->calls_tail = &call->next;
+	pthread_mutex_unlock(&r->lock);
+
+	/*
+	 * a non empty list already has a wakeup on its way
+	 */
+	if (wake && write(r->eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		perror("reactor eventfd write");
+	}
+}
+
+/**
+ * run the timers of w on this reactor instead of timer_thread
+ */
+void reactor_setWheel(reactor_t* r, timer_wheel_t* w){
+	assert(r->timerfd < 0);
+
+	r->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (r->timerfd < 0) {
+		perror("timerfd_create");
+		exit(1);
+	}
+	r->wheel = w;
+	reactor_add(r, r->timerfd, EPOLLIN, reactor_timerExpired, r);
+
+	timer_setNotify(w, reactor_armTimer, r);
+	timer_run(w, timer_now());
+}
+
+/**
+ * wait up to timeout ms (-1: forever, 0: poll) and dispatch what is ready.
+ * NOT Threadsafe, only called on the reactor thread
+ * @return handlers run
+ */
+int reactor_runOnce(reactor_t* r, int timeout){
+	struct epoll_event ev[REACTOR_EVENTS];
+	int i = 0;
+
+	int n = epoll_wait(r->epfd, ev, REACTOR_EVENTS, timeout);
+	r->stats.waits++;
+	if (n < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		perror("epoll_wait");
+		exit(1);
+	}
+
+	for (i = 0; i < n; i++){
+		reactor_handler_t* h = (reactor_handler_t*) ev[i].data.ptr;
+		if (h->fd < 0) {
+			continue;
+		}
+		h->fn(r, h, ev[i].events);
+		r->stats.events++;
+	}
+
+	while (r->dead) {
+		reactor_handler_t* h = r->dead;
+		r->dead = h->next;
+		free(h);
+	}
+
+	return n;
+}
+
+/**
+ * the loop of the reactor thread, never returns
+ */
+void reactor_run(reactor_t* r){
+	while (1) {
+		reactor_runOnce(r, r->spin ? 0 : -1);
+	}
+}
@@ -0,0 +1,85 @@
+/**
+ * @file reactor.h
+ * @author Mohammad Reza Hosseini
+ *
+ * epoll event loop, one per receive worker in cpu mode. A reactor owns the
+ * packet descriptors of its ports and, on the first worker, the timer wheel
+ * (through a timerfd) and the CLI listening socket, so receive, timers and
+ * CLI requests run to completion on one pinned thread instead of on a
+ * thread each. Other threads reach a reactor by posting calls to it, which
+ * wakes it through an eventfd; calls run on the reactor in the order they
+ * were posted.
+ *
+ * Handlers are level triggered. A handler may remove itself or add new ones,
+ * its storage is freed once the events of the current wait are dispatched.
+ */
+#ifndef REACTOR_H_
+#define REACTOR_H_
+
+#include "timer.h"
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+///events taken from one epoll_wait
+#define REACTOR_EVENTS		64
+
+struct Reactor;
+struct Reactor_Handler;
+
+typedef void (*reactor_fn_t)(struct Reactor* r, struct Reactor_Handler* h, uint32_t events);
+
+typedef void (*reactor_call_fn_t)(void* arg);
+
+typedef struct Reactor_Handler {
+	int fd;					/* -1 once removed */
+	reactor_fn_t fn;
+	void* arg;
+	struct Reactor_Handler* next;		/* on the dead list once removed */
+} reactor_handler_t;
+
+typedef struct Reactor_Call {
+	struct Reactor_Call* next;
+	reactor_call_fn_t fn;
+	void* arg;
+} reactor_call_t;
+
+typedef struct Reactor_Stats {
+	unsigned long waits;			/* epoll_wait calls */
+	unsigned long events;			/* handlers run */
+	unsigned long calls;			/* posted calls run */
+	unsigned long wakeups;			/* eventfd reads */
+	unsigned long timer_runs;		/* timerfd expiries */
+} reactor_stats_t;
+
+typedef struct Reactor {
+	int epfd;
+	int eventfd;				/* wakes the loop for posted calls */
+	int timerfd;				/* -1 unless the reactor runs a wheel */
+	int spin;				/* poll without sleeping */
+	timer_wheel_t* wheel;
+
+	pthread_mutex_t lock;			/* guards calls */
+	reactor_call_t* calls;
+	reactor_call_t** calls_tail;
+
+	reactor_handler_t* dead;		/* removed handlers, freed after dispatch */
+	reactor_stats_t stats;			/* only touched by the loop */
+} reactor_t;
+
+reactor_t* reactor_create(int spin);
+
+reactor_handler_t* reactor_add(reactor_t* r, int fd, uint32_t events, reactor_fn_t fn, void* arg);
+
+void reactor_remove(reactor_t* r, reactor_handler_t* h);
+
+void reactor_post(reactor_t* r, reactor_call_fn_t fn, void* arg);
+
+void reactor_setWheel(reactor_t* r, timer_wheel_t* w);
+
+int reactor_runOnce(reactor_t* r, int timeout);
+
+void reactor_run(reactor_t* r);
+
+#endif
@@ -19,7 +19,10 @@
 #include "ethernet.h"
 #include "arp.h"
 #include "ip.h"
+#include "adj.h"
+#include "rcu.h"
 #include "dijkstra.h"
+#include "ICMP.h"
 
 
 #include <stdlib.h>
@@ -38,6 +41,12 @@
 #include <linux/if_packet.h>
 
 
+/*
+ * ports the calling thread queued frames on since its last router_flushTx
+ */
+static __thread unsigned int router_tx_pending = 0;
+
+
 void router_initInterfaces(router_t* router, interface_t *interface, struct sr_vns_if vns_if){
 	printf(" ** if_init(..) called \n");
 	interface->ip = vns_if.ip;
@@ -45,9 +54,16 @@ void router_initInterfaces(router_t* router, interface_t *interface, struct sr_v
 	interface->speed = vns_if.speed;
 	memcpy((unsigned char*)interface->addr, vns_if.addr, PHY_ADDR_LEN);
 	strcpy(interface->name, vns_if.name);
+	interface->hw_port = netfpga_getPortNum(vns_if.name);
 	interface->neighbors = NULL;
 	interface->last_sent_hello = 0;
-	netfpga_initInterfaces(router, interface);
+	
+	/*
+	 * adjacencies on this port rewrite with its address
+	 */
+	router_lockWrite(&router->lock_arp_cache);
+	adj_updatePort(router, interface - router->if_list);
+	router_unlock(&router->lock_arp_cache);
 	return;
 }
 
@@ -58,59 +74,43 @@ int router_init(struct sr_instance* sr){
 	
 	
 	/*
-	 * init sockets
+	 * ports and the NetFPGA are opened by router_initIo once the options
+	 * are known
 	 */
-	int base = 0;
-	
-	char iface_name[32] = "nf2c";
 	int i;
 	for (i = 0; i < NUM_INTERFACES; ++i) {
-		sprintf(&(iface_name[4]), "%i", base+i);
-		int s = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
-		
-		struct ifreq ifr;
-		bzero(&ifr, sizeof(struct ifreq));
-		strncpy(ifr.ifr_ifrn.ifrn_name, iface_name, IFNAMSIZ);
-		if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
-			perror("ioctl SIOCGIFINDEX");
-			exit(1);
-		}
-		
-		struct sockaddr_ll saddr;
-		bzero(&saddr, sizeof(struct sockaddr_ll));
-		saddr.sll_family = AF_PACKET;
-		saddr.sll_protocol = htons(ETH_P_ALL);
-		saddr.sll_ifindex = ifr.ifr_ifru.ifru_ivalue;
-		
-		if (bind(s, (struct sockaddr*)(&saddr), sizeof(saddr)) < 0) {
-			perror("bind error");
-			exit(1);
-		}
-		
-		router->sockfd[i] = s;
+		router->sockfd[i] = -1;
+		router->io_port[i] = NULL;
 	}
+	router->io = NULL;
+	router->netfpga.fd = -1;
 	
 	/*
 	 * initialize other members
 	 */
 	router->if_list_index = 0;
-	router->arp_cache = NULL;
-	router->arp_queue = NULL;
+	router->arp_cache = arp_createCache(ARP_CACHE_MIN_SIZE);
+	router->arp_queue = arp_createQueue();
+	router->fib = NULL;
+	router->adj = adj_create();
+	router->icmp_limit = icmp_createLimiter();
 	router->router_id = 0;
 	router->area_id = 0;
 	router->lsu_update_needed = 0;
 	router->pwospf_hello_interval = 0;
 	router->pwospf_lsu_interval = 0;
 	router->pwospf_lsu_broadcast = 0;
-	router->dijkstra_dirty = 0;
+	router->timers = timer_createWheel();
+	timer_init(&router->lsu_timer, pwospf_lsuTimer, sr, 0);
+	timer_init(&router->dijkstra_timer, dijkstra_run, router, 0);
+	timer_init(&router->lsu_bcast_timer, pwospf_lsuBcastTimer, sr, 0);
 	
 	
 	/*
 	 * initialize locks
 	 */
-	if (pthread_mutex_init(&router->lock_send, NULL) != 0){
-		perror("Lock init error");
-		exit(1);
+	for (i = 0; i < NUM_INTERFACES; ++i) {
+		txq_init(&router->txq[i]);
 	}
 	
 	if (pthread_rwlock_init(&router->lock_arp_cache, NULL) != 0){
@@ -138,41 +138,85 @@ int router_init(struct sr_instance* sr){
 		exit(1);
 	}
 	
-	if (pthread_mutex_init(&router->lock_dijkstra, NULL) != 0){
-		perror("Lock init error");
-		exit(1);
-	}
 	
-	if (pthread_mutex_init(&router->lock_pwospf_bcast, NULL) != 0){
-		perror("Lock init error");
-		exit(1);
-	}
+	/*
+	 * register with the global instance
+	 */
+	sr_set_subsystem(get_sr(), router);
 	
+	/*
+	 * save a pointer to global instance
+	 */
+	router->sr = sr;
+	
+	return 0;
+}
+
+/**
+ * apply the options that are known by now, then start running the timers:
+ * on timer_thread, or in reactor mode on the reactor of the first rx
+ * worker, which takes the wheel over when it starts
+ */
+void router_start(struct sr_instance* sr){
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	int cls;
 	
 	/*
-	 * initialize conditions
+	 * -L replaces the rates of every ICMP type/code, bursts of 1/4 s
 	 */
-	if (pthread_cond_init(&router->pwospf_lsu_bcast_cond, NULL) != 0){
-		perror("LSU bcast cond init error");
+	if (sr->icmp_rate >= 0) {
+		for (cls = 0; cls < ICMP_LIMIT_CLASSES; ++cls) {
+			icmp_rate_t global = { sr->icmp_rate, sr->icmp_rate / 4 + 1 };
+			icmp_rate_t source = { sr->icmp_source_rate, sr->icmp_source_rate / 4 + 1 };
+			icmp_setLimit(router->icmp_limit, cls, &global, sr->icmp_source_rate >= 0 ? &source : NULL);
+		}
+	}
+	icmp_setLimitPrefix(router->icmp_limit, sr->icmp_prefix_len);
+	
+	if (sr->reactor) {
+		return;
+	}
+	
+	if (pthread_create(&router->timer_thread, NULL, timer_thread, (void *)router->timers) != 0){
+		perror("timer thread create error");
 		exit(1);
 	}
+}
+
+/**
+ * cpu mode: open every port with the packet i/o backend picked at startup,
+ * then the NetFPGA register interface if the ports are the board's. Called
+ * once the interfaces are known, before the routing table is loaded.
+ */
+int router_initIo(struct sr_instance* sr){
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	char dev[SR_NAMELEN + 12]; /* the prefix and any int port number */
+	int i;
 	
-	if (pthread_cond_init(&router->dijkstra_cond, NULL) != 0){
-		perror("Dijkstra cond init error");
+	router->io = cpu_io_find(sr->io_backend);
+	if (!router->io) {
+		fprintf(stderr, "unknown packet i/o backend %s\n", sr->io_backend);
 		exit(1);
 	}
 	
 	/*
-	 * register with the global instance
+	 * port i is interface i, on the device of the board port it was
+	 * configured with
 	 */
-	sr_set_subsystem(get_sr(), router);
-	
+	for (i = 0; i < router->if_list_index; ++i) {
+		int hw_port = router->if_list[i].hw_port >= 0 ? router->if_list[i].hw_port : i;
+		snprintf(dev, sizeof(dev), "%s%i", sr->io_prefix, hw_port);
+		router->sockfd[i] = router->io->open(router, i, dev, sr->rx_batch);
+	}
 	
+	if (strcmp(sr->io_prefix, CPU_IO_NETFPGA_PREFIX)) {
+		printf("\n ports %s0..%d, %s i/o, no NetFPGA", sr->io_prefix, NUM_INTERFACES - 1, router->io->name);
+		return 0;
+	}
 	
-	#ifdef _CPUMODE_
 // 	rs->is_netfpga = 1;
-	char* name = (char*)calloc(1, 32);
-	strncpy(name, "nf2c0", 5);
+	char* name = (char*)calloc(1, sizeof(dev));
+	snprintf(name, sizeof(dev), "%s0", sr->io_prefix);
 	router->netfpga.device_name = name;
 	router->netfpga.fd = 0;
 	router->netfpga.net_iface = 0;
@@ -191,53 +235,26 @@ int router_init(struct sr_instance* sr){
 	 * initialize the hardware 
 	 */
 	netfpga_init(router);
-	
-	#else
-	//rs->is_netfpga = 0;
-	#endif
-	
-	/*
-	 * creating threads
-	 */
-	if (pthread_create(&router->arp_thread, NULL, arp_thread, (void *)sr) != 0){
-		perror("ARP thread create error");
-	}
-
-	if (pthread_create(&router->dijkstra_thread, NULL, dijkstra_thread, (void *)router) != 0){
-		perror("dijkstra thread create error");
-	}
-	
-	if (pthread_create(&router->pwospf_lsu_thread, NULL, pwospf_lsuThread, (void *)sr) != 0){
-		perror("pwospf_lsu_thread create error");
-	}
-	
-	if (pthread_create(&router->pwospf_hello_thread, NULL, pwospf_helloThread, (void *)sr) != 0){
-		perror("pwospf_hello_thread create error");
-	}
-	
-	if (pthread_create(&router->pwospf_lsu_bcast_thread, NULL, pwospf_lsu_bcast_thread, (void *)sr) != 0){
-		perror("pwospf_lsu_bcast_thread create error");
+	for (i = 0; i < router->if_list_index; ++i) {
+		netfpga_initInterfaces(router, &router->if_list[i]);
 	}
 	
-	if (pthread_create(&router->pwospf_lsu_timeout_thread, NULL, pwospf_lsu_timeout_thread, (void *)sr) != 0){
-		perror("pwospf_lsu_timeout_thread create error");
-	}
-	
-	/*
-	 * save a pointer to global instance
-	 */
-	router->sr = sr;
-	
 	return 0;
 }
 
-int router_processPacket(struct sr_instance* sr, const uint8_t* packet, int len, const char* interface){
+/**
+ * the packet buffer is lent, take a reference to keep it after returning
+ */
+int router_processPacket(struct sr_instance* sr, pkt_buf_t* pkt, int port){
+	const uint8_t* packet = pkt->data;
+	unsigned int len = pkt->len;
 	
 	/*
 	 * check ethernet header type
 	 */
 	uint16_t eth_type = eth_getType(packet);
 	
+#ifdef _DEBUG_
 	eth_header_t* eth_hdr = (eth_header_t*) packet;
 	int i = 0;
 	printf("\n\n\tEthernet Header: ");
@@ -255,63 +272,147 @@ int router_processPacket(struct sr_instance* sr, const uint8_t* packet, int len,
 	}
 	printf("\n\t\tType: %04X", eth_hdr->type);
 	printf("\n\n");
+#endif
 	
 	switch(eth_type){
 		case ETH_TYPE_ARP:
-			printf("\n Packet Type: ARP, length: %d, Interface: %s", len, interface);				
-			arp_processPacket(sr, packet, len, interface);
+			Debug("\n Packet Type: ARP, length: %d, Port: %d", len, port);				
+			arp_processPacket(sr, packet, len, port);
 			break;
 		case ETH_TYPE_IP:
-			printf("\n Packet Type: IP,  length: %d, Interface: %s",len, interface);
-			ip_processPacket(sr, packet, len, interface);
+			Debug("\n Packet Type: IP,  length: %d, Port: %d",len, port);
+			ip_processPacket(sr, pkt, port);
 			break;
 		default:
-			printf("\n Packet Type: %X (UNKNOWN), length: %d, Interface: %s",eth_type, len, interface);
+			Debug("\n Packet Type: %X (UNKNOWN), length: %d, Port: %d",eth_type, len, port);
 	}
 	return 0;
 }
 
 
-int router_sendPacket(struct sr_instance* sr, uint8_t* packet, unsigned int len, const char* interface) {
-	router_t* router = sr_get_subsystem(sr);
-	if (pthread_mutex_lock(&router->lock_send) != 0) {
-		perror("Failure locking write lock\n");
-		exit(1);
+/**
+ * process a vector of received frames. The rcu read side section the IP path
+ * runs in is entered once for every run of consecutive forwarded frames
+ * instead of per frame; it is left around any other frame since ARP
+ * processing may grow the cache and PWOSPF locks the router list, both held
+ * by writers that wait for readers. Nothing is locked or shared between
+ * receive workers on the way through.
+ * The packet buffers are lent, as for router_processPacket
+ */
+void router_processBatch(struct sr_instance* sr, pkt_buf_t** pkts, const int* ports, int count){
+	int locked = 0;
+	int i = 0;
+	
+	/*
+	 * frames sent while processing the batch go out together at the end
+	 */
+	txq_beginBatch();
+	
+	for (i = 0; i < count; i++){
+		pkt_buf_t* pkt = pkts[i];
+		
+		if (eth_getType(pkt->data) == ETH_TYPE_IP) {
+			/*
+			 * invalid packets are dropped without touching any lock
+			 */
+			if (!ip_isValid(pkt->data, pkt->len)) {
+				continue;
+			}
+			
+			if (ip_isLocal(sr, pkt->data)) {
+				if (locked) {
+					rcu_readUnlock();
+					locked = 0;
+				}
+				ip_processLocal(sr, pkt, ports[i]);
+				continue;
+			}
+			
+			if (!locked) {
+				rcu_readLock();
+				locked = 1;
+			}
+			ip_processPacketLocked(sr, pkt, ports[i]);
+		} else {
+			if (locked) {
+				rcu_readUnlock();
+				locked = 0;
+			}
+			router_processPacket(sr, pkt, ports[i]);
+		}
+	}
+	
+	if (locked) {
+		rcu_readUnlock();
 	}
 	
-	int result = 0;
+	if (txq_endBatch()) {
+		router_flushTx(sr);
+	}
+}
+
+/*
+ * padding for short frames that have no room of their own
+ */
+static const uint8_t router_zero_pad[PKT_MIN_LEN];
+
+/**
+ * the packet buffer is lent, the transmit queue of the port takes its own
+ * reference. Inside a receive batch the frame leaves when the batch ends,
+ * otherwise before returning. Do not write the buffer after sending it.
+ *
+ * @param port index of the outgoing interface in if_list
+ * @return the length put on the wire, -1 on failure
+ */
+int router_sendPacket(struct sr_instance* sr, pkt_buf_t* pkt, int port) {
+	router_t* router = sr_get_subsystem(sr);
+	unsigned int len = pkt->len;
+	
+	if (port < 0 || port >= router->if_list_index) {
+		return -1;
+	}
 	
-	if (len < 60) {
-		int pad_len = 60 - len;
-		uint8_t* pad_packet = (uint8_t*) malloc (len + pad_len);
-		if (!pad_packet) {
-			perror("Failed to malloc in send_packet().\n");
-			exit(1);
+	Debug("\n Sending packet with size = %d, from interface %s ", len < PKT_MIN_LEN ? PKT_MIN_LEN : len, router->if_list[port].name);
+	
+	if (len < PKT_MIN_LEN) {
+		if (pkt_tailroom(pkt) < PKT_MIN_LEN - len) {
+			/*
+			 * a wrapped frame ends where the ring slot does, its padding
+			 * goes out as a second piece instead of a copy
+			 */
+			struct iovec iov[2];
+			iov[0].iov_base = pkt->data;
+			iov[0].iov_len = len;
+			iov[1].iov_base = (void*) router_zero_pad;
+			iov[1].iov_len = PKT_MIN_LEN - len;
+			return txq_sendv(sr, &router->txq[port], iov, 2, port);
 		}
 		
-		bzero(pad_packet, len + pad_len);
-		memmove(pad_packet, packet, len);
-		
-		printf("\n Sending packet with size = %d, from interface %s ", len+pad_len, interface);
-		
-		result = sr_integ_low_level_output(sr, pad_packet, len+pad_len, interface);
-		
-		free(pad_packet);
-	} else {
-		printf("\n Sending packet with size = %d, from interface %s ", len, interface);
-		result = sr_integ_low_level_output(sr, packet, len, interface);
+		/*
+		 * pad in place, pkt_alloc always leaves room for a minimum size frame
+		 */
+		bzero(pkt->data + len, PKT_MIN_LEN - len);
+		len = PKT_MIN_LEN;
 	}
 	
-	/*
-	 * print_packet(packet, len);
-	 */
+	router_tx_pending |= 1 << port;
+	return txq_push(sr, &router->txq[port], pkt, len, port);
+}
+
+/**
+ * send whatever the transmit queues the calling thread used hold, one vector
+ * per port. Queues only other receive workers used are left to them
+ */
+void router_flushTx(struct sr_instance* sr) {
+	router_t* router = sr_get_subsystem(sr);
+	int i = 0;
 	
-	if (pthread_mutex_unlock(&router->lock_send) != 0) {
-		perror("Failure unlocking write lock\n");
-		exit(1);
+	for (i = 0; i < NUM_INTERFACES; i++){
+		if (router_tx_pending & (1 << i)) {
+			txq_flush(sr, &router->txq[i], i);
+		}
 	}
-	
-	return result;
+	router_tx_pending = 0;
 }
 
 
@@ -359,30 +460,38 @@ int router_unlockMutex(pthread_mutex_t* mutex){
 
 
 /**
- * find ETH address of packet and send it, if not find add to queue
+ * find ETH address of packet and send it, if not find add to queue.
+ * The packet buffer is lent, the ARP queue takes its own reference when parking it.
+ * The cache lookup is lock free, the queue is locked here if needed
  */
-int router_ip2mac(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct in_addr* next_hop, const char* out_iface) {
+int router_ip2mac(struct sr_instance* sr, pkt_buf_t* pkt, struct in_addr* next_hop, int out_port) {
 	
 	router_t* router = (router_t*) sr_get_subsystem(sr);
-	eth_header_t* eth = (eth_header_t*) packet;
+	eth_header_t* eth = (eth_header_t*) pkt->data;
 	
 	
-	arp_item_t* arp_item = arp_searchCache(router, next_hop);
- 	if (arp_item) {
-		memcpy(eth->d_addr, arp_item->arp_ha, ETH_ADDR_LEN);
-		
-		if (router_sendPacket(sr, packet, len, out_iface) != 0) {
-			printf("Failure sending IP packet\n");
-			free(packet);
-			return 1;
-		}
-		
-		free(packet);
-	} else {
+	if (!arp_searchCache(router, next_hop, eth->d_addr)) {
 		/* 
-		 * add the packet to the queue, will free later 
+		 * park the packet in the queue until the next hop is resolved.
+		 * A reply drains the queue after updating the cache, both under
+		 * the queue lock, so look again once we hold it or the packet
+		 * could miss the reply that just went by
 		 */
-		arp_qAdd(sr, packet, len, out_iface, next_hop);
+		arp_lockQueue(router);
+		int resolved = arp_searchCache(router, next_hop, eth->d_addr);
+		if (!resolved) {
+			arp_qAdd(sr, pkt, out_port, next_hop);
+		}
+		arp_unlockQueue(router);
+		
+		if (!resolved) {
+			return 0;
+		}
+	}
+	
+	if (router_sendPacket(sr, pkt, out_port) < 0) {
+		printf("Failure sending IP packet\n");
+		return 1;
 	}
 	
 	return 0;
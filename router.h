@@ -11,6 +11,10 @@
 #include "nf2.h"
 #include "nf2util.h"
 #include "ll.h"
+#include "packet.h"
+#include "txq.h"
+#include "cpu_io.h"
+#include "timer.h"
 
 #include <stdint.h>
 #include <pthread.h>
@@ -31,16 +35,20 @@ typedef struct Interface{
 	uint32_t mask;
 	uint32_t speed;
 	char name[SR_NAMELEN];
+	int hw_port; /* ethN of the board (cpu mode and NetFPGA) behind it, -1 if none */
 	unsigned char addr[PHY_ADDR_LEN];
 	node_t* neighbors;
 	time_t last_sent_hello;
+	timer_entry_t hello_timer;
 } interface_t;
 
 
 typedef struct nbr_router {
 	uint32_t router_id;	/* net byte order */
 	struct in_addr ip;	/* net byte order */
+	int port;		/* if_list index it was heard on */
 	time_t last_rcvd_hello;
+	timer_entry_t dead_timer;	/* re-armed by every hello */
 } nbr_router_t;
 
 
@@ -48,8 +56,10 @@ typedef struct nbr_router {
 typedef struct Router{
 	struct sr_instance* sr;///>pointer to base system simple router
 	int32_t if_list_index; ///>index of active interface
-	interface_t if_list[NUM_INTERFACES]; ///>list of interfaces of router
-	int sockfd[NUM_INTERFACES]; ///>sockets to read from and write to nf devices
+	interface_t if_list[NUM_INTERFACES]; ///>list of interfaces of router, packets carry their index in it (port) from receive to transmit
+	int sockfd[NUM_INTERFACES]; ///>cpu mode: descriptor of each port that polls readable on receive
+	const struct Cpu_Io_Backend* io; ///>cpu mode: packet i/o backend driving the ports
+	void* io_port[NUM_INTERFACES]; ///>cpu mode: backend state of each port
 	struct nf2device netfpga; ///>NetFPGA device
 	
 	uint32_t router_id;
@@ -58,43 +68,47 @@ typedef struct Router{
 	uint16_t pwospf_hello_interval;
 	uint32_t pwospf_lsu_interval;
 	uint32_t pwospf_lsu_broadcast;
-	uint32_t dijkstra_dirty;
 	
-	node_t* arp_cache;///> a linked list showing ARP cache
-	node_t* arp_queue;///> a linked list for ARP queue
-	node_t* rtable;///>a linked list for routing table
+	struct Arp_Cache* arp_cache;///> hash table of resolved neighbors, read under rcu
+	struct Arp_Queue* arp_queue;///> packets parked per unresolved next hop, under lock_arp_queue
+	node_t* rtable;///>a linked list for routing table, configuration source of fib
+	struct Fib* fib;///>immutable lookup snapshot built from rtable, read under rcu
+	struct Adj_Table* adj;///>pre-resolved rewrites the fib routes through, written under lock_arp_cache
+	struct ICMP_Limiter* icmp_limit;///>token buckets of the ICMP messages we generate, lock free
 	node_t* pwospf_router_list;///> a linked list for PWOSPF router list
 	node_t* pwospf_lsu_queue;///> a linked list for PWOSFP LSU packets
+	txq_t txq[NUM_INTERFACES];///> transmit queue of each port, each with its own lock
+	timer_wheel_t* timers;///> every timed event of the router, run by timer_thread or a reactor
+	timer_entry_t lsu_timer;///> refresh of our LSU, re-armed by every flood
+	timer_entry_t dijkstra_timer;///> pending rtable rebuild
+	timer_entry_t lsu_bcast_timer;///> sends the queued LSU packets
 	
 	
-	pthread_rwlock_t lock_arp_cache; ///> access lock for ARP cache
+	pthread_rwlock_t lock_arp_cache; ///> serializes writers of the ARP cache and adjacencies, lookups take no lock
 	pthread_rwlock_t lock_arp_queue;///> access lock for ARP queue
-	pthread_rwlock_t lock_rtable;///> access lock for routing table
-	pthread_mutex_t lock_send;///> lock for sending packets
+	pthread_rwlock_t lock_rtable;///> access lock for routing table list, not needed for lookups
 	pthread_mutex_t lock_pwospf_list;///> access lock for pwospf_router_list
 	pthread_mutex_t lock_pwospf_queue;///> access lock for pwospf_lsu_queue
-	pthread_mutex_t lock_dijkstra;
-	pthread_mutex_t lock_pwospf_bcast;
 	
-	pthread_cond_t dijkstra_cond;
-	pthread_cond_t pwospf_lsu_bcast_cond;
-	
-	pthread_t arp_thread;///>ARP thread	
-	pthread_t dijkstra_thread;
-	pthread_t pwospf_lsu_thread;
-	pthread_t pwospf_hello_thread;
-	pthread_t pwospf_lsu_bcast_thread;
-	pthread_t pwospf_lsu_timeout_thread;
+	pthread_t timer_thread;///>runs the timers, unless a reactor does
 } router_t;
 
 
 int router_init(struct sr_instance* sr);
 
-int router_processPacket(struct sr_instance* sr, const uint8_t* packet, int len, const char* interface);
+void router_start(struct sr_instance* sr);
+
+int router_initIo(struct sr_instance* sr);
+
+int router_processPacket(struct sr_instance* sr, pkt_buf_t* pkt, int port);
+
+void router_processBatch(struct sr_instance* sr, pkt_buf_t** pkts, const int* ports, int count);
 
 void router_initInterfaces(router_t* router, interface_t* interface, struct sr_vns_if vns_if);
 
-int router_sendPacket(struct sr_instance* sr, uint8_t* packet, unsigned int len, const char* interface);
+int router_sendPacket(struct sr_instance* sr, pkt_buf_t* pkt, int port);
+
+void router_flushTx(struct sr_instance* sr);
 
 int router_lockRead(pthread_rwlock_t* lock);
 
@@ -102,7 +116,7 @@ int router_lockWrite(pthread_rwlock_t* lock);
 
 int router_unlock(pthread_rwlock_t* lock);
 
-int router_ip2mac(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct in_addr* next_hop, const char* out_iface);
+int router_ip2mac(struct sr_instance* sr, pkt_buf_t* pkt, struct in_addr* next_hop, int out_port);
 
 int router_getInterfaceIndex(router_t* router, const char* interface);
 
@@ -12,6 +12,9 @@
 #include "netfpga.h"
 #include "pwospf.h"
 #include "dijkstra.h"
+#include "fib.h"
+#include "adj.h"
+#include "rcu.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,7 +22,8 @@
 #include <unistd.h>
 
 /**
- * performs a linear longest prefix match
+ * performs a longest prefix match on the current FIB snapshot. Lock free, the
+ * snapshot is read under rcu so it cannot be freed while we use it
  * @param router pointer to #router_t struct
  * @param dest destination address to lookup
  * @param [out] next_hop result of lpm
@@ -27,57 +31,63 @@
  * @return: 1 if no match, 0 if there is a match
  */
 int rtable_nextHop(router_t* router, struct in_addr* dest, struct in_addr* next_hop, int* next_hop_ifIndex){
-	int i;
+	return rtable_nextHopAdj(router, dest, next_hop, next_hop_ifIndex, NULL);
+}
+
+/**
+ * rtable_nextHop that also returns the adjacency of the route, ADJ_NONE for
+ * directly connected ones. The adjacency stays valid as long as the caller
+ * stays inside its rcu read side section
+ */
+int rtable_nextHopAdj(router_t* router, struct in_addr* dest, struct in_addr* next_hop, int* next_hop_ifIndex, int* adj){
+	int retval = 1;
 	
-	node_t* n = router->rtable;
-	rtable_row_t* lpm = NULL;
+	rcu_readLock();
+	fib_t* fib = rcu_dereference(router->fib);
+	if (fib) {
+		retval = fib_lookupAdj(fib, dest, next_hop, next_hop_ifIndex, adj);
+	}
+	rcu_readUnlock();
 	
-	int most_bits_matched = -1;
-	while (n){
-		rtable_row_t* row = (rtable_row_t*) n->data;
-		
-		if (row->is_active){
-			uint32_t mask = ntohl(row->mask.s_addr);
-			uint32_t ip = ntohl(row->ip.s_addr) & mask;
-			uint32_t dest_ip = ntohl(dest->s_addr) & mask;
-			
-			if (ip == dest_ip) {
-				/*
-				 * count the number of bits in the mask 
-				 */
-				int bits_matched = 0;
-				for (i = 0; i < 32; ++i) {
-					if ((mask >> i) & 0x1) {
-						++bits_matched;
-					}
-				}
-				
-				if (bits_matched > most_bits_matched) {
-					lpm = row;
-					most_bits_matched = bits_matched;
-				}
-			}
+	return retval;
+}
+
+/*
+ * build a new FIB snapshot, attach every gateway route to its adjacency and
+ * publish it to the forwarding path
+ * NOT Threadsafe, ensure rtable locked for write
+ */
+void rtable_buildFib(router_t* router){
+	fib_t* fib = fib_create(router->rtable);
+	fib->version = router->fib ? router->fib->version + 1 : 1;
+	uint32_t i = 0;
+	
+	router_lockWrite(&router->lock_arp_cache);
+	for (i = 0; i < fib->nh_count; i++){
+		fib_nh_t* nh = &fib->nh[i];
+		if (nh->gw.s_addr && nh->ifIndex >= 0) {
+			nh->adj = adj_get(router, &nh->gw, nh->ifIndex);
 		}
-		n = n->next;
 	}
+	router_unlock(&router->lock_arp_cache);
 	
-	int retval = 1;
-	if (lpm) {
-		if (lpm->gw.s_addr == 0) {
-			/*
-			 * Support for next hop 0.0.0.0, meaning it is equivalent to the destination ip 
-			 */
-			next_hop->s_addr = dest->s_addr;
-		} else {
-			next_hop->s_addr = lpm->gw.s_addr;
-		}
+	fib_t* old_fib = rcu_assignPointer(router->fib, fib);
+	
+	/*
+	 * wait for readers still looking at the old snapshot before freeing it,
+	 * its adjacencies can be reused after that
+	 */
+	if (old_fib) {
+		rcu_synchronize();
 		
-		(*next_hop_ifIndex) = router_getInterfaceIndex(router, lpm->iface);
+		router_lockWrite(&router->lock_arp_cache);
+		for (i = 0; i < old_fib->nh_count; i++){
+			adj_put(router, old_fib->nh[i].adj);
+		}
+		router_unlock(&router->lock_arp_cache);
 		
-		retval = 0;
+		fib_destroy(old_fib);
 	}
-	
-	return retval;
 }
 
 void rtable_init(struct sr_instance* sr){
@@ -117,7 +127,7 @@ void rtable_init(struct sr_instance* sr){
 		char* gw = NULL;
 		char* mask = NULL;
 		char* iface = NULL;
-		if (sscanf(buf, "%as %as %as %as", &ip, &gw, &mask, &iface) != 4) {
+		if (sscanf(buf, "%ms %ms %ms %ms", &ip, &gw, &mask, &iface) != 4) {
 			printf("ignoring incorrect line in rtable file\n");
 			continue;
 		}
@@ -134,7 +144,16 @@ void rtable_init(struct sr_instance* sr){
 		if (inet_pton(AF_INET, mask, &(row->mask)) == 0) {
 			perror("Failure reading rtable");
 		}
-		strncpy(row->iface, iface, 32);
+		
+		/*
+		 * the file names the interface, the table keeps its port
+		 */
+		row->ifIndex = router_getInterfaceIndex(router, iface);
+		if (row->ifIndex < 0) {
+			printf("ignoring route through unknown interface %s\n", iface);
+			free(row);
+			continue;
+		}
 		
 		row->is_active = 1;
 		row->is_static = 1;
@@ -158,14 +177,15 @@ void rtable_init(struct sr_instance* sr){
 		printf("Read: %s ", inet_ntop(AF_INET, &(row->ip), ip_array, INET_ADDRSTRLEN));
 		printf("%s ", inet_ntop(AF_INET, &(row->gw), gw_array, INET_ADDRSTRLEN));
 		printf("%s ", inet_ntop(AF_INET, &(row->mask), mask_array, INET_ADDRSTRLEN));
-		printf("%s\n", row->iface);
+		printf("%s\n", router->if_list[row->ifIndex].name);
 	}
 	
 	
 	if (fclose(file) != 0) {
 		perror("Failure closing file");
 	}
-	netfpga_writeRTable(&router->netfpga, router->rtable);
+	netfpga_writeRTable(router, router->rtable);
+	rtable_buildFib(router);
 	
 	/* check if we have a default route entry, if so we need to add it to our pwospf router */
 	pwospf_iface_t* default_route = pwospf_hasDefaultRoute(router);
@@ -228,5 +248,10 @@ void rtable_updated(router_t* router){
 	/*
 	 * write to hardware
 	 */
-	netfpga_writeRTable(&router->netfpga, router->rtable);
+	netfpga_writeRTable(router, router->rtable);
+	
+	/*
+	 * and rebuild the software lookup structure
+	 */
+	rtable_buildFib(router);
 }
@@ -15,17 +15,21 @@ typedef struct RoutingTableRow {
 	struct in_addr ip;
 	struct in_addr gw;
 	struct in_addr mask;
-	char iface[32];
+	int ifIndex;	/* outgoing port: index in if_list */
 	unsigned int is_static:1;
 	unsigned int is_active:1;
 } rtable_row_t;
 
 int rtable_nextHop(router_t* router, struct in_addr* dest, struct in_addr* next_hop, int* next_hop_ifIndex);
 
+int rtable_nextHopAdj(router_t* router, struct in_addr* dest, struct in_addr* next_hop, int* next_hop_ifIndex, int* adj);
+
 void rtable_init(struct sr_instance* sr);
 
 void rtable_updated(router_t* router);
 
+void rtable_buildFib(router_t* router);
+
 #endif
 
 
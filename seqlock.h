@@ -0,0 +1,43 @@
+/**
+ * @file seqlock.h
+ * @author Mohammad Reza Hosseini
+ *
+ * sequence counters for small records read on the forwarding path.
+ *
+ * A writer makes the counter odd, changes the record and makes it even again.
+ * A reader copies the record out between seqlock_readBegin and
+ * seqlock_readRetry and starts over if the counter moved, so it never blocks
+ * and never sees a half written record.  Writers must be serialized by the
+ * caller.
+ */
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include <stdint.h>
+
+static inline uint32_t seqlock_readBegin(const uint32_t* seq){
+	uint32_t s;
+	while ((s = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1) {
+		/* -- writer in progress -- */
+	}
+	return s;
+}
+
+/**
+ * @return non zero if the copy made since seqlock_readBegin may be torn
+ */
+static inline int seqlock_readRetry(const uint32_t* seq, uint32_t start){
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+static inline void seqlock_writeBegin(uint32_t* seq){
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_writeEnd(uint32_t* seq){
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -53,6 +53,7 @@
 #include "sr_vns.h"
 #include "sr_base.h"
 #include "sr_base_internal.h"
+#include "sr_dumper.h"
 
 #ifdef _CPUMODE_
 #include "sr_cpu_extension_nf2.h"
@@ -131,6 +132,27 @@ int sr_init_low_level_subystem(int argc, char **argv)
 	uint16_t port =  3250;
 	uint16_t topo =  0;
 	int ospf = 0;
+	int rx_batch = SR_DEFAULT_RX_BATCH;
+	int busy_poll = 0;
+	char *io_backend = SR_DEFAULT_IO_BACKEND;
+	char *io_prefix = SR_DEFAULT_IO_PREFIX;
+	int rx_workers = SR_DEFAULT_RX_WORKERS;
+	char *rx_cpus = "";
+	int reactor = 0;
+	#ifdef _CPUMODE_
+	uint16_t cli_port = SR_DEFAULT_CLI_PORT;
+	#endif
+	int arp_queue_len = SR_DEFAULT_ARP_QUEUE_LEN;
+	int arp_drop_oldest = 1;
+	int icmp_rate = -1;
+	int icmp_source_rate = -1;
+	int icmp_prefix_len = SR_DEFAULT_ICMP_PREFIX_LEN;
+	int vns_tx_bytes = SR_DEFAULT_VNS_TX_BYTES;
+	int vns_tx_delay = SR_DEFAULT_VNS_TX_DELAY;
+	int log_snaplen = SR_PACKET_DUMP_SIZE;
+	int log_rotate_mb = 0;
+	int log_rotate_secs = 0;
+	int log_files = SR_DEFAULT_LOG_FILES;
 	
 	char  *logfile = 0;
 	int free_logfile = 0;
@@ -150,7 +172,7 @@ int sr_init_low_level_subystem(int argc, char **argv)
 	
 	sr = (struct sr_instance*) malloc(sizeof(struct sr_instance));
 	
-	while ((c = getopt(argc, argv, "hna:s:v:p:t:r:l:i:u:")) != EOF)
+	while ((c = getopt(argc, argv, "hnBEa:s:v:p:t:r:l:i:u:b:k:d:w:c:q:Q:C:L:W:S:R:")) != EOF)
 	{
 		switch (c)
 		{
@@ -194,6 +216,93 @@ int sr_init_low_level_subystem(int argc, char **argv)
 				Debug("\nOSPF disabled!\n\n");
 				ospf = 0;
 				break;
+			case 'b':
+				rx_batch = atoi((char *) optarg);
+				if (rx_batch < 1 || rx_batch > SR_MAX_RX_BATCH) {
+					fprintf(stderr, "rx batch must be between 1 and %d\n", SR_MAX_RX_BATCH);
+					exit(1);
+				}
+				break;
+			case 'B':
+				busy_poll = 1;
+				break;
+			case 'k':
+				io_backend = optarg;
+				break;
+			case 'd':
+				io_prefix = optarg;
+				break;
+			case 'w':
+				rx_workers = atoi((char *) optarg);
+				if (rx_workers < 1) {
+					fprintf(stderr, "need at least one rx worker\n");
+					exit(1);
+				}
+				break;
+			case 'c':
+				rx_cpus = optarg;
+				break;
+			case 'E':
+				reactor = 1;
+				break;
+			case 'C':
+				#ifdef _CPUMODE_
+				cli_port = atoi((char *) optarg);
+				#else
+				fprintf(stderr, "cli port is only supported in cpu mode, ignored\n");
+				#endif
+				break;
+			case 'L':
+				/* -- global[,per source[,source prefix length]] -- */
+				if (sscanf(optarg, "%d,%d,%d", &icmp_rate, &icmp_source_rate, &icmp_prefix_len) < 1 ||
+						icmp_rate < 0 || icmp_prefix_len < 0 || icmp_prefix_len > 32) {
+					fprintf(stderr, "icmp limit must be rate[,source rate[,prefix length]]\n");
+					exit(1);
+				}
+				break;
+			case 'W':
+				/* -- bytes[,delay] -- */
+				if (sscanf(optarg, "%d,%d", &vns_tx_bytes, &vns_tx_delay) < 1 ||
+						vns_tx_bytes < 0 || vns_tx_delay < 0 || vns_tx_delay > SR_MAX_VNS_TX_DELAY) {
+					fprintf(stderr, "vns output buffer must be bytes[,delay] with a delay up to %d us\n",
+						SR_MAX_VNS_TX_DELAY);
+					exit(1);
+				}
+				break;
+			case 'S':
+				log_snaplen = atoi((char *) optarg);
+				if (log_snaplen < 1 || log_snaplen > SR_PACKET_DUMP_SIZE) {
+					fprintf(stderr, "log snaplen must be between 1 and %d\n", SR_PACKET_DUMP_SIZE);
+					exit(1);
+				}
+				break;
+			case 'R':
+				/* -- MB[,seconds[,files]] -- */
+				if (sscanf(optarg, "%d,%d,%d", &log_rotate_mb, &log_rotate_secs, &log_files) < 1 ||
+						log_rotate_mb < 0 || log_rotate_secs < 0 ||
+						log_files < 1 || log_files > SR_MAX_LOG_FILES) {
+					fprintf(stderr, "log rotation must be MB[,seconds[,files]] with up to %d files\n",
+						SR_MAX_LOG_FILES);
+					exit(1);
+				}
+				break;
+			case 'q':
+				arp_queue_len = atoi((char *) optarg);
+				if (arp_queue_len < 1 || arp_queue_len > SR_MAX_ARP_QUEUE_LEN) {
+					fprintf(stderr, "arp queue length must be between 1 and %d\n", SR_MAX_ARP_QUEUE_LEN);
+					exit(1);
+				}
+				break;
+			case 'Q':
+				if (strcmp(optarg, "oldest") == 0) {
+					arp_drop_oldest = 1;
+				} else if (strcmp(optarg, "newest") == 0) {
+					arp_drop_oldest = 0;
+				} else {
+					fprintf(stderr, "arp queue drop policy must be oldest or newest\n");
+					exit(1);
+				}
+				break;
 		} /* switch */
 	} /* -- while -- */
 	
@@ -213,6 +322,31 @@ int sr_init_low_level_subystem(int argc, char **argv)
 	/* -- zero out sr instance and set default configurations -- */
 	sr_init_instance(sr);
 	sr->template[0] = '\0';
+	sr->rx_batch = rx_batch;
+	sr->busy_poll = busy_poll;
+	strncpy(sr->io_backend, io_backend, SR_NAMELEN - 1);
+	strncpy(sr->io_prefix, io_prefix, SR_NAMELEN - 1);
+	sr->rx_workers = rx_workers;
+	strncpy(sr->rx_cpus, rx_cpus, SR_NAMELEN - 1);
+	#ifdef _CPUMODE_
+	sr->reactor = reactor;
+	sr->cli_port = cli_port;
+	#else
+	if (reactor) {
+		fprintf(stderr, "reactor mode is only supported in cpu mode, ignored\n");
+	}
+	#endif
+	sr->arp_queue_len = arp_queue_len;
+	sr->arp_drop_oldest = arp_drop_oldest;
+	sr->icmp_rate = icmp_rate;
+	sr->icmp_source_rate = icmp_source_rate;
+	sr->icmp_prefix_len = icmp_prefix_len;
+	sr->vns_tx_bytes = vns_tx_bytes;
+	sr->vns_tx_delay = vns_tx_delay;
+	sr->log_snaplen = log_snaplen;
+	sr->log_rotate_mb = log_rotate_mb;
+	sr->log_rotate_secs = log_rotate_secs;
+	sr->log_files = log_files;
 	strncpy(sr->auth_key_fn,auth_key_file,64);
 	
 	strncpy(sr->rtable, rtable, SR_NAMELEN);
@@ -400,13 +534,41 @@ void sr_init_instance(struct sr_instance* sr)
 	sr->user[0]  = 0;
 	sr->vhost[0] = 0;
 	sr->topo_id  = 0;
-	sr->logfile  = 0;
+	sr->log      = 0;
+	sr->log_snaplen = SR_PACKET_DUMP_SIZE;
+	sr->log_rotate_mb = 0;
+	sr->log_rotate_secs = 0;
+	sr->log_files = SR_DEFAULT_LOG_FILES;
+	memset(sr->log_if, 0, sizeof(sr->log_if));
 	sr->hw_init  = 0;
+	sr->rx_batch = SR_DEFAULT_RX_BATCH;
+	sr->busy_poll = 0;
+	strncpy(sr->io_backend, SR_DEFAULT_IO_BACKEND, SR_NAMELEN);
+	strncpy(sr->io_prefix, SR_DEFAULT_IO_PREFIX, SR_NAMELEN);
+	sr->rx_workers = SR_DEFAULT_RX_WORKERS;
+	sr->rx_cpus[0] = '\0';
+	sr->reactor = 0;
+	sr->cli_port = SR_DEFAULT_CLI_PORT;
+	sr->arp_queue_len = SR_DEFAULT_ARP_QUEUE_LEN;
+	sr->arp_drop_oldest = 1;
+	sr->icmp_rate = -1;
+	sr->icmp_source_rate = -1;
+	sr->icmp_prefix_len = SR_DEFAULT_ICMP_PREFIX_LEN;
 	
 	sr->interface_subsystem = 0;
 	
 	pthread_mutex_init(&(sr->send_lock), 0);
 	
+	sr->vns_rx = 0;
+	sr->vns_rx_head = 0;
+	sr->vns_rx_tail = 0;
+	sr->vns_rx_reads = 0;
+	sr->vns_rx_cmds = 0;
+	sr->vns_rx_moves = 0;
+	sr->vns_tx = 0;
+	sr->vns_tx_bytes = SR_DEFAULT_VNS_TX_BYTES;
+	sr->vns_tx_delay = SR_DEFAULT_VNS_TX_DELAY;
+	
 	sr_integ_init(sr);
 } /* -- sr_init_instance -- */
 
@@ -418,6 +580,8 @@ void sr_init_instance(struct sr_instance* sr)
 
 static void sr_destroy_instance(struct sr_instance* sr) {
 	assert(sr);
+	/* -- whatever is still in the capture ring goes to the logfile -- */
+	sr_log_stop(sr);
 	sr_integ_destroy(sr);
 	free( sr );
 }
@@ -432,4 +596,13 @@ static void usage(char* argv0)
 	printf("Simple Router Client\n");
 	printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
 	printf("           [-t topo id] [-r rtable_file] [-l log_file] [-i interface_file]\n");
+	printf("           [-b rx_batch] [-B (busy poll)]\n");
+	printf("           [-k socket|mmap|xdp (cpu mode i/o)] [-d device prefix (default nf2c)]\n");
+	printf("           [-w rx workers] [-c cpu,cpu,.. (pin rx workers)]\n");
+	printf("           [-E (epoll reactor per rx worker)] [-C cli port (reactor mode)]\n");
+	printf("           [-q packets parked per unresolved next hop] [-Q oldest|newest (dropped when full)]\n");
+	printf("           [-L icmp/s[,icmp/s per source[,source prefix length]] (0: unlimited)]\n");
+	printf("           [-W bytes[,us] (VNS output coalesced up to bytes, held at most us; 0: off)]\n");
+	printf("           [-S snaplen (bytes of each logged frame)]\n");
+	printf("           [-R MB[,seconds[,files]] (rotate the log through log_file.0..files-1; 0: off)]\n");
 } /* -- usage -- */
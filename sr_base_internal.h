@@ -39,6 +39,35 @@
 
 #define CPU_HW_FILENAME "cpuhw"
 
+/* -- frames pulled per receive syscall in cpu mode -- */
+#define SR_DEFAULT_RX_BATCH 32
+#define SR_MAX_RX_BATCH     1024
+
+/* -- cpu mode packet i/o, see cpu_io.h -- */
+#define SR_DEFAULT_IO_BACKEND "socket"
+#define SR_DEFAULT_IO_PREFIX  "nf2c"
+#define SR_DEFAULT_RX_WORKERS 1
+
+/* -- cpu mode reactor, see reactor.h; CLI port 0: no CLI -- */
+#define SR_DEFAULT_CLI_PORT 0
+
+/* -- packets parked per unresolved next hop, see arp.h -- */
+#define SR_DEFAULT_ARP_QUEUE_LEN 8
+#define SR_MAX_ARP_QUEUE_LEN     64
+
+/* -- VNS output buffer, see sr_vns.c; 0 bytes: one write per frame -- */
+#define SR_DEFAULT_VNS_TX_BYTES (16 * 1024)
+#define SR_DEFAULT_VNS_TX_DELAY 200 /* us */
+#define SR_MAX_VNS_TX_DELAY     999
+
+/* -- packet log, see sr_dumper.h; rotation off: one file that keeps growing -- */
+#define SR_DEFAULT_LOG_FILES 10
+#define SR_MAX_LOG_FILES     1000
+#define SR_LOG_PORTS         32 /* ports the log has an interface block for */
+
+/* -- rate limits of generated ICMP, see ICMP.h; -1: the per type defaults -- */
+#define SR_DEFAULT_ICMP_PREFIX_LEN 24
+
 /* -- gcc specific vararg macro support ... but its so nice! -- */
 #ifdef _DEBUG_
 #define Debug(x, args...) printf(x, ## args)
@@ -89,10 +118,47 @@ struct sr_instance
     char server[32];
     unsigned short topo_id; /* topology id */
     struct sockaddr_in sr_addr; /* address to server */
-    FILE* logfile; /* file to log all received/sent packets to */
+    struct sr_log* log; /* capture ring the log writer drains to the logfile */
+    int log_snaplen;     /* bytes kept of each logged frame */
+    int log_rotate_mb;   /* next logfile once this one has this many MB, 0: never */
+    int log_rotate_secs; /* .. or is this old, 0: never */
+    int log_files;       /* logfiles rotated through, the oldest is overwritten */
+    struct sr_vns_if log_if[SR_LOG_PORTS]; /* interface of each port, named in the log */
     volatile uint8_t  hw_init; /* bool : hardware has been initialized */
     pthread_mutex_t   send_lock; /* experimental */
 
+    /* VNS receive ring, commands are parsed where recv put them */
+    uint8_t* vns_rx;            /* SR_VNS_RX_RING bytes, allocated on first read */
+    unsigned int vns_rx_head;   /* first byte not parsed yet */
+    unsigned int vns_rx_tail;   /* end of the bytes read */
+    unsigned long vns_rx_reads; /* recv calls */
+    unsigned long vns_rx_cmds;  /* commands parsed */
+    unsigned long vns_rx_moves; /* partial commands moved back to the front */
+
+    /* VNS output buffer, frames to the server are coalesced into one writev */
+    struct sr_vns_tx* vns_tx;   /* allocated on first send, guarded by send_lock */
+    int vns_tx_bytes;           /* flush once this much is held, 0: no coalescing */
+    int vns_tx_delay;           /* us the oldest frame may wait for company */
+
+    /* cpu mode receive loop */
+    int rx_batch;   /* frames per recvmmsg, 1 reads one frame at a time */
+    int busy_poll;  /* bool : spin on non-blocking sockets instead of select */
+    char io_backend[SR_NAMELEN]; /* packet i/o backend, see cpu_io.h */
+    char io_prefix[SR_NAMELEN];  /* ports are <io_prefix>0..3 */
+    int rx_workers; /* cpu mode receive threads, ports are dealt out round robin */
+    char rx_cpus[SR_NAMELEN];    /* cpus to pin receive workers to, "0,2,..", empty: not pinned */
+    int reactor;    /* bool : each rx worker runs an epoll reactor, the first one the timers and CLI */
+    uint16_t cli_port; /* reactor mode: real TCP port the CLI listens on, 0: none */
+
+    /* arp queue */
+    int arp_queue_len;   /* packets parked per unresolved next hop */
+    int arp_drop_oldest; /* bool : a full neighbor drops its oldest packet instead of the new one */
+
+    /* icmp rate limits */
+    int icmp_rate;        /* messages/s of each ICMP type/code, -1: per type defaults, 0: unlimited */
+    int icmp_source_rate; /* the same per source prefix */
+    int icmp_prefix_len;  /* sources sharing a prefix this long share a bucket */
+
     void* interface_subsystem; /* subsystem to send/recv packets from */
 };
 
@@ -115,10 +181,16 @@ struct sr_instance* sr_get_global_instance(struct sr_instance* sr);
 void sr_integ_init(struct sr_instance* );
 void sr_integ_hw_setup(struct sr_instance* ); /* called after hwinfo */
 void sr_integ_destroy(struct sr_instance* );
+struct Packet_Buffer;
 void sr_integ_input(struct sr_instance* sr,
-                   const uint8_t * packet/* borrowed */,
-                   unsigned int len,
-                   const char* interface/* borrowed */);
+                   struct Packet_Buffer* pkt/* borrowed */,
+                   int port);
+void sr_integ_input_batch(struct sr_instance* sr,
+                   struct Packet_Buffer** pkts/* borrowed */,
+                   const int* ports/* borrowed */,
+                   int count);
+int sr_integ_getPort(struct sr_instance* sr,
+                     const char* interface/* borrowed */);
 void sr_integ_add_interface(struct sr_instance*,
                             struct sr_vns_if* /* borrowed */);
 
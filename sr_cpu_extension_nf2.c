@@ -17,6 +17,11 @@
 
 #include "router.h"
 #include "functions.h"
+#include "reactor.h"
+
+#include "cli/cli.h"
+#include "cli/cli_main.h"
+#include "cli/cli_local.h"
 
 
 
@@ -26,9 +31,14 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
 struct sr_ethernet_hdr
@@ -124,6 +134,7 @@ int sr_cpu_init_hardware(struct sr_instance* sr, const char* hwfile)
 		asci_to_ether(buf, vns_if.addr);
 		
 		sr_integ_add_interface(sr, &vns_if);
+		sr_log_add_interface(sr, &vns_if);
 		
 	} /* -- while ( fgets ( .. ) ) -- */
 	Debug(" < --                         -- >\n");
@@ -133,80 +144,292 @@ int sr_cpu_init_hardware(struct sr_instance* sr, const char* hwfile)
 	
 } /* -- sr_cpu_init_hardware -- */
 
+/* -- a receive worker: the ports it owns and the cpu it is pinned to -- */
+typedef struct sr_cpu_worker
+{
+	struct sr_instance* sr;
+	int id;
+	int ports[NUM_INTERFACES];
+	int port_count;
+	int cpu; /* -1: not pinned */
+	pkt_buf_t** pkts; /* receive batch */
+	int* pkt_ports;   /* port of each frame of the batch */
+	
+	/* -- reactor mode: the reactor and a handler argument per port -- */
+	reactor_t* reactor;
+	struct sr_cpu_rx_port
+	{
+		struct sr_cpu_worker* worker;
+		int port;
+	} rx[NUM_INTERFACES];
+} sr_cpu_worker_t;
+
 /*-----------------------------------------------------------------------------
- * Method: sr_cpu_input(..)
+ * Method: sr_cpu_rx_port(..)
  * Scope: Local
  *
+ * Pulls up to sr->rx_batch frames from port through the packet i/o backend
+ * (router->io) and runs them through the router to completion, transmit
+ * included.
+ *
  *---------------------------------------------------------------------------*/
 
-int sr_cpu_input(struct sr_instance* sr)
+static void sr_cpu_rx_port(sr_cpu_worker_t* worker, int port)
 {
-	/* REQUIRES */
-	assert(sr);
+	struct sr_instance* sr = worker->sr;
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	const cpu_io_t* io = router->io;
+	int j;
 	
-	fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-	fprintf(stderr, "!!!  sr_cpu_input(..) (sr_cpu_extension_nf2.c) called while running in cpu mode     !!!\n");
-// 	fprintf(stderr, "!!!  you need to implement this function to read from the hardware                  !!!\n");
-	fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
+	int n = io->rx(router, port, worker->pkts, sr->rx_batch);
+	if (n <= 0) {
+		return;
+	}
 	
-	//while (1);
+	for (j = 0; j < n; ++j) {
+		worker->pkt_ports[j] = port;
 		
+		/* log packet */
+		sr_log_packet(sr, worker->pkts[j]->data, worker->pkts[j]->len, port, SR_LOG_IN);
+	}
+	
+	sr_integ_input_batch(sr, worker->pkts, worker->pkt_ports, n);
+	io->rxDone(router, port, worker->pkts, n);
+} /* -- sr_cpu_rx_port -- */
+
+/*-----------------------------------------------------------------------------
+ * Reactor handlers: a port that polls readable, a client connecting to the
+ * CLI and a request from a connected client.  All run on the reactor of
+ * their worker, one at a time.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_cpu_rx_ready(reactor_t* r, reactor_handler_t* h, uint32_t events)
+{
+	struct sr_cpu_rx_port* rx = (struct sr_cpu_rx_port*) h->arg;
+	
+	sr_cpu_rx_port(rx->worker, rx->port);
+} /* -- sr_cpu_rx_ready -- */
+
+static void sr_cpu_cli_ready(reactor_t* r, reactor_handler_t* h, uint32_t events)
+{
+	cli_client_t* client = (cli_client_t*) h->arg;
+	
+	int alive = cli_client_handle_request(client);
+	
+	/* if the client shutdown the router, bail now */
+	if (cli_is_time_to_shutdown()) {
+		exit(1);
+	}
+	
+	/* stop watching the client before its socket is closed */
+	if (!alive) {
+		reactor_remove(r, h);
+		cli_client_cleanup(client);
+		free(client);
+	}
+} /* -- sr_cpu_cli_ready -- */
+
+static void sr_cpu_cli_accept(reactor_t* r, reactor_handler_t* h, uint32_t events)
+{
+	cli_client_t* client = cli_local_accept(h->fd);
+	if (!client) {
+		return;
+	}
+	
+	cli_client_welcome(client);
+	
+	/* -- negative fd: a socket of the local stack -- */
+	reactor_add(r, -client->fd, EPOLLIN, sr_cpu_cli_ready, client);
+} /* -- sr_cpu_cli_accept -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_cpu_rx_reactor(..)
+ * Scope: Local
+ *
+ * Receive loop of a worker in reactor mode (sr->reactor): an epoll reactor
+ * owns the ports of the worker; the first worker's also runs the timer wheel
+ * of the router, in place of timer_thread, and with sr->cli_port set the CLI
+ * listening socket and its clients, in place of a thread per client.  With
+ * sr->busy_poll the reactor polls instead of sleeping.  Never returns.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_cpu_rx_reactor(sr_cpu_worker_t* worker)
+{
+	struct sr_instance* sr = worker->sr;
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	int i;
+	
+	worker->reactor = reactor_create(sr->busy_poll);
+	
+	for (i = 0; i < worker->port_count; ++i) {
+		worker->rx[i].worker = worker;
+		worker->rx[i].port = worker->ports[i];
+		reactor_add(worker->reactor, router->sockfd[worker->ports[i]], EPOLLIN, sr_cpu_rx_ready, &worker->rx[i]);
+	}
+	
+	if (worker->id == 0) {
+		reactor_setWheel(worker->reactor, router->timers);
+		
+		if (sr->cli_port) {
+			/* ignore the broken pipe signal */
+			signal(SIGPIPE, SIG_IGN);
+			
+			cli_setup();
+			int bindfd = cli_local_listen(sr->cli_port);
+			reactor_add(worker->reactor, bindfd, EPOLLIN, sr_cpu_cli_accept, NULL);
+			printf("\n CLI on port %u", sr->cli_port);
+		}
+	}
+	
+	reactor_run(worker->reactor);
+} /* -- sr_cpu_rx_reactor -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_cpu_rx_worker(..)
+ * Scope: Local
+ *
+ * Receive loop of one worker: takes a batch from each of its ports in turn
+ * (sr_cpu_rx_port) before touching the next port.  Waits in select(..) on
+ * its ports, or with sr->busy_poll polls them without blocking.  In reactor
+ * mode the loop is sr_cpu_rx_reactor(..) instead.  Never returns.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void* sr_cpu_rx_worker(void* arg)
+{
+	sr_cpu_worker_t* worker = (sr_cpu_worker_t*) arg;
+	struct sr_instance* sr = worker->sr;
 	router_t* router = (router_t*) sr_get_subsystem(sr);
+	int fds[NUM_INTERFACES];
 	int i;
-	char* internal_names[NUM_INTERFACES] = {"eth0", "eth1", "eth2", "eth3"};
+	
+	worker->pkts = (pkt_buf_t**) calloc(sr->rx_batch, sizeof(pkt_buf_t*));
+	worker->pkt_ports = (int*) calloc(sr->rx_batch, sizeof(int));
+	assert(router->io && worker->pkts && worker->pkt_ports);
+	
+	if (worker->cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(worker->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+			fprintf(stderr, "rx worker %d: cannot pin to cpu %d\n", worker->id, worker->cpu);
+		}
+	}
+	
+	for (i = 0; i < worker->port_count; ++i) {
+		fds[i] = router->sockfd[worker->ports[i]];
+	}
+	
+	#ifdef SO_BUSY_POLL
+	if (sr->busy_poll) {
+		/* -- let the driver spin for us as well, best effort -- */
+		int usecs = 50;
+		for (i = 0; i < worker->port_count; ++i) {
+			setsockopt(fds[i], SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+		}
+	}
+	#endif
+	
+	if (sr->reactor) {
+		sr_cpu_rx_reactor(worker);
+		return NULL;
+	}
 	
 	/* setup select */
 	fd_set read_set;
 	FD_ZERO(&read_set);
-	int READ_BUF_SIZE = 16384;
-	unsigned char readBuf[READ_BUF_SIZE];
 	
 	while (1) {
-		for (i = 0; i < NUM_INTERFACES; ++i) {
-			FD_SET(router->sockfd[i], &read_set);
-		}
-		
-// 		struct timeval t;
-// 		t.tv_usec = 500; // timeout every half a millisecond
-		
-		int nfd = array_max(router->sockfd, NUM_INTERFACES) + 1;
-		if (select(nfd, &read_set, NULL, NULL, NULL) < 0) {
-			perror("select");
-			exit(1);
+		if (!sr->busy_poll) {
+			for (i = 0; i < worker->port_count; ++i) {
+				FD_SET(fds[i], &read_set);
+			}
+			
+			int nfd = array_max(fds, worker->port_count) + 1;
+			if (select(nfd, &read_set, NULL, NULL, NULL) < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				perror("select");
+				exit(1);
+			}
 		}
 		
-		for (i = 0; i < NUM_INTERFACES; ++i) {
-			if (FD_ISSET(router->sockfd[i], &read_set)) {
-				printf("\n\n Something on %s \n", internal_names[i]);
-				// assume each read is a full packet
-				int read_bytes = read(router->sockfd[i], readBuf, READ_BUF_SIZE);
-				
-				/* log packet */
-//				pthread_mutex_lock(rs->log_dumper_mutex); //TODO: lock
-				sr_log_packet(sr, (unsigned char*)readBuf, read_bytes);
-//				pthread_mutex_unlock(rs->log_dumper_mutex);
-				
-				/* send packet */
-				sr_integ_input(sr, readBuf, read_bytes, internal_names[i]);
+		for (i = 0; i < worker->port_count; ++i) {
+			if (!sr->busy_poll && !FD_ISSET(fds[i], &read_set)) {
+				continue;
 			}
+			
+			sr_cpu_rx_port(worker, worker->ports[i]);
 		}
 	}
 	
-	//assert(0);
+	return NULL;
+} /* -- sr_cpu_rx_worker -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_cpu_input(..)
+ * Scope: Local
+ *
+ * Starts sr->rx_workers receive workers (at most one per port) and becomes
+ * the first of them.  Ports are dealt out round robin, worker k owns ports
+ * k, k + workers, ..; each port is only ever read by its worker.  With
+ * sr->rx_cpus set, worker k is pinned to the k-th cpu of the list (wrapping
+ * around).
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_cpu_input(struct sr_instance* sr)
+{
+	/* REQUIRES */
+	assert(sr);
 	
-	/*
-	 * TODO: Read packet from the hardware and pass to sr_integ_input(..)
-	 *       e.g.
-	 *
-	 *  sr_integ_input(sr,
-	 *          packet,   * lent *
-	 *          len,
-	 *          "eth2" ); * lent *
-	 */
+	fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
+	fprintf(stderr, "!!!  sr_cpu_input(..) (sr_cpu_extension_nf2.c) called while running in cpu mode     !!!\n");
+// 	fprintf(stderr, "!!!  you need to implement this function to read from the hardware                  !!!\n");
+	fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
 	
-	/*
-	 * Note: To log incoming packets, use sr_log_packet from sr_dumper.[c,h]
-	 */
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	int port_count = router->if_list_index;
+	int workers = sr->rx_workers < port_count ? sr->rx_workers : port_count;
+	static sr_cpu_worker_t worker[NUM_INTERFACES];
+	int cpus[NUM_INTERFACES];
+	int cpu_count = 0;
+	int i;
+	
+	/* -- cpu list -- */
+	char list[SR_NAMELEN];
+	char* save = NULL;
+	char* tok;
+	strncpy(list, sr->rx_cpus, SR_NAMELEN);
+	for (tok = strtok_r(list, ",", &save); tok && cpu_count < NUM_INTERFACES; tok = strtok_r(NULL, ",", &save)) {
+		cpus[cpu_count++] = atoi(tok);
+	}
+	
+	for (i = 0; i < workers; ++i) {
+		worker[i].sr = sr;
+		worker[i].id = i;
+		worker[i].port_count = 0;
+		worker[i].cpu = cpu_count ? cpus[i % cpu_count] : -1;
+	}
+	for (i = 0; i < port_count; ++i) {
+		sr_cpu_worker_t* w = &worker[i % workers];
+		w->ports[w->port_count++] = i;
+	}
+	
+	for (i = 1; i < workers; ++i) {
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, sr_cpu_rx_worker, &worker[i]) != 0) {
+			perror("rx worker create error");
+			exit(1);
+		}
+		pthread_detach(tid);
+	}
+	printf("\n %d rx worker(s)%s%s", workers, cpu_count ? ", pinned" : "", sr->reactor ? ", reactor" : "");
+	
+	sr_cpu_rx_worker(&worker[0]);
 	
 	/* RETURN 1 on success, 0 on failure.
 	 * Note: With a 0 result, the router will shut-down
@@ -224,63 +447,94 @@ int sr_cpu_input(struct sr_instance* sr)
 int sr_cpu_output(struct sr_instance* sr /* borrowed */,
 		  uint8_t* buf /* borrowed */ ,
 		  unsigned int len,
-		  const char* iface /* borrowed */)
+		  int port)
 {
 	/* REQUIRES */
 	assert(sr);
 	assert(buf);
-	assert(iface);
 	
-	fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-	fprintf(stderr, "!!! sr_cpu_output(..) (sr_cpu_extension_nf2.c) called while running in cpu mode !!!\n");
-	fprintf(stderr, "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
+	/* Return the length of the packet on success, -1 on failure */
+	if (sr_cpu_output_batch(sr, &buf, &len, 1, port) != 1) {
+		return -1;
+	}
+	return len;
+} /* -- sr_cpu_output -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_cpu_output_batch(..)
+ * Scope: Global
+ *
+ * Send a vector of frames out of one port through the packet i/o backend,
+ * without blocking.  Whatever the backend cannot take right now is left to
+ * the caller.
+ *
+ * Returns the number of frames sent, -1 on failure.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_cpu_output_batch(struct sr_instance* sr /* borrowed */,
+			uint8_t** bufs /* borrowed */,
+			unsigned int* lens /* borrowed */,
+			int count,
+			int port)
+{
+	/* REQUIRES */
+	assert(sr);
+	assert(bufs);
 	
 	router_t* router = sr_get_subsystem(sr);
-	int written_length = 0;
 	int i = 0;
 	
-	/* log the packet */
-// 	pthread_mutex_lock(rs->log_dumper_mutex);//TODO: lock
-	sr_log_packet(sr, buf, len);
-// 	pthread_mutex_unlock(rs->log_dumper_mutex);
-	
+	/* -- ports are opened after the router threads start -- */
+	if (port < 0 || port >= NUM_INTERFACES || !router->io || !router->io_port[port]) {
+		return -1;
+	}
 	
-	char* internal_names[4] = {"eth0", "eth1", "eth2", "eth3"};
-	for (i = 0; i < 4; ++i) {
-		if (strcmp(iface, internal_names[i]) == 0) {
-			break;
-		}
+	/* log the packets */
+	for (i = 0; i < count; ++i) {
+		sr_log_packet(sr, bufs[i], lens[i], port, SR_LOG_OUT);
 	}
 	
-	/* setup select */
-	fd_set write_set;
-	FD_ZERO(&write_set);
+	return router->io->tx(router, port, bufs, lens, count);
+} /* -- sr_cpu_output_batch -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_cpu_outputv(..)
+ * Scope: Global
+ *
+ * Send one frame gathered from iovcnt pieces out of port, without blocking.
+ *
+ * Returns the length of the frame on success, -1 on failure.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_cpu_outputv(struct sr_instance* sr /* borrowed */,
+		   const struct iovec* iov /* borrowed */,
+		   int iovcnt,
+		   int port)
+{
+	/* REQUIRES */
+	assert(sr);
+	assert(iov);
 	
-	while (written_length < len) {
-		FD_SET(router->sockfd[i], &write_set);
-		
-// 		struct timeval t;
-// 		t.tv_sec = 0;
-// 		t.tv_usec = 500; // timeout every half a millisecond
-		
-		if (select(router->sockfd[i]+1, NULL, &write_set, NULL, NULL) < 0) {
-			perror("select");
-			exit(1);
-		}
-		
-		if (FD_ISSET(router->sockfd[i], &write_set)) {
-			int w = 0;
-			if ((w = write(router->sockfd[i], &buf[written_length], len - written_length)) == -1) {
-				perror("write");
-				exit(1);
-			}
-			written_length += w;
-		}
+	router_t* router = sr_get_subsystem(sr);
+	int len = 0;
+	int i = 0;
+	
+	if (port < 0 || port >= NUM_INTERFACES || !router->io || !router->io_port[port]) {
+		return -1;
 	}
 	
-	/* Return the length of the packet on success, -1 on failure */
+	for (i = 0; i < iovcnt; ++i) {
+		len += iov[i].iov_len;
+	}
+	sr_log_packetv(sr, iov, iovcnt, port, SR_LOG_OUT);
+	
+	if (router->io->txv(router, port, iov, iovcnt) != 1) {
+		return -1;
+	}
 	return len;
-} /* -- sr_cpu_output -- */
+} /* -- sr_cpu_outputv -- */
 
 
 /*-----------------------------------------------------------------------------
@@ -26,6 +26,16 @@ int sr_cpu_input(struct sr_instance* sr);
 int sr_cpu_output(struct sr_instance* sr /* borrowed */,
                        uint8_t* buf /* borrowed */ ,
                        unsigned int len,
-                       const char* iface /* borrowed */);
+                       int port);
+int sr_cpu_output_batch(struct sr_instance* sr /* borrowed */,
+                        uint8_t** bufs /* borrowed */,
+                        unsigned int* lens /* borrowed */,
+                        int count,
+                        int port);
+struct iovec;
+int sr_cpu_outputv(struct sr_instance* sr /* borrowed */,
+                   const struct iovec* iov /* borrowed */,
+                   int iovcnt,
+                   int port);
 
 #endif  /* --  SR_CPU_EXTENSIONS_H -- */
@@ -1,13 +1,144 @@
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <fcntl.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <assert.h>
 
 #include "sr_dumper.h"
 
 #include "sr_base_internal.h"
 
+/*
+ * Packets are logged from the receive workers and every sender, so the hot
+ * path only copies them into a bounded multi producer ring (Vyukov's: each
+ * slot carries a sequence number telling whose turn it is) and never takes
+ * a lock or makes a system call.  One writer thread drains the ring with
+ * large writev calls.  A full ring drops the record and counts it.
+ *
+ * Records are pcapng Enhanced Packet Blocks built whole in their slot.  The
+ * writer puts a Section Header Block at the start of every file and the
+ * Interface Description Blocks of the ports in front of the first record
+ * that needs them, so interface id and port are the same number.
+ */
+
+/* bytes of an EPB behind the frame at most: padding, epb_flags, end, length */
+#define SR_LOG_EPB_TAIL (3 + 8 + 4 + 4)
+
+struct sr_log_slot
+{
+    unsigned long seq;          /* pos: free for pos, pos + 1: record of pos */
+    struct pcapng_epb hdr;      /* the record as it goes to the file .. */
+    uint8_t data[SR_PACKET_DUMP_SIZE + SR_LOG_EPB_TAIL]; /* .. right behind its header */
+} __attribute__((aligned(64)));
+
+struct sr_log
+{
+    unsigned long head __attribute__((aligned(64))); /* next slot to claim */
+    unsigned long dropped;
+    int snaplen;
+    unsigned long tail __attribute__((aligned(64))); /* writer only from here */
+    int stop;
+    pthread_t thread;
+    struct sr_log_stats stats;  /* dropped aside */
+    char name[256];             /* logfile, rotated ones get .<file> appended */
+    int fd;
+    int file;                   /* index of the current one when rotating */
+    int idbs;                   /* interface blocks in the current file */
+    unsigned long file_bytes;
+    time_t opened;              /* CLOCK_MONOTONIC s */
+    struct sr_log_slot slots[SR_LOG_RING_SLOTS];
+};
+
+struct pcapng_opt
+{
+    uint16_t code;
+    uint16_t len;
+};
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_claim(..)
+ * Scope:  local
+ *
+ * Slot for one record of a len byte frame on port, stamped now and complete
+ * but for the first caplen bytes of the frame, NULL if the ring is full.
+ * The record is seen by the writer once sr_log_publish gives the slot back.
+ *
+ *---------------------------------------------------------------------------*/
+
+static struct sr_log_slot* sr_log_claim(struct sr_log* log, int len, int port, int dir)
+{
+    struct sr_log_slot* slot;
+    struct pcapng_opt opt;
+    struct timespec ts;
+    unsigned long pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED);
+    uint32_t flags = dir;
+    uint32_t zero = 0;
+    uint64_t ns;
+    uint8_t* tail;
+    int caplen;
+
+    while (1)
+    {
+        slot = &log->slots[pos & (SR_LOG_RING_SLOTS - 1)];
+        long dif = (long)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (long)pos;
+
+        if ( dif == 0 )
+        {
+            /* -- on failure pos is reloaded with the head another producer moved -- */
+            if ( __atomic_compare_exchange_n(&log->head, &pos, pos + 1, 1,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+            { break; }
+        }
+        else if ( dif < 0 )
+        {
+            /* -- the writer has not freed the slot of pos - SR_LOG_RING_SLOTS yet -- */
+            __atomic_add_fetch(&log->dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        else
+        { pos = __atomic_load_n(&log->head, __ATOMIC_RELAXED); }
+    }
+
+    /* -- vdso, no system call -- */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    caplen = min(log->snaplen, len);
+
+    /* -- padding, epb_flags with the direction, end of options, length -- */
+    tail = slot->data + caplen;
+    memset(tail, 0, 3);
+    tail += (4 - caplen % 4) % 4;
+    opt.code = PCAPNG_OPT_EPB_FLAGS;
+    opt.len  = sizeof(flags);
+    memcpy(tail, &opt, sizeof(opt));
+    memcpy(tail + 4, &flags, sizeof(flags));
+    memcpy(tail + 8, &zero, sizeof(zero));
+    tail += 12;
+
+    slot->hdr.type    = PCAPNG_EPB_TYPE;
+    slot->hdr.len     = sizeof(slot->hdr) + (tail - slot->data) + 4;
+    slot->hdr.ifid    = port;
+    slot->hdr.ts_high = ns >> 32;
+    slot->hdr.ts_low  = (uint32_t)ns;
+    slot->hdr.caplen  = caplen;
+    slot->hdr.origlen = len;
+    memcpy(tail, &slot->hdr.len, sizeof(slot->hdr.len));
+
+    return slot;
+} /* -- sr_log_claim -- */
+
+static void sr_log_publish(struct sr_log_slot* slot, unsigned long seq)
+{
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+}
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
@@ -15,26 +146,480 @@
  *
  *---------------------------------------------------------------------------*/
 
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len, int port, int dir )
+{
+    struct sr_log* log;
+    struct sr_log_slot* slot;
+
+    /* REQUIRES */
+    assert(sr);
+
+    /* -- read once, sr_log_stop may clear it meanwhile -- */
+    log = __atomic_load_n(&sr->log, __ATOMIC_ACQUIRE);
+
+    /* -- frames on no port of ours are not passed to the router either -- */
+    if(!log || port < 0 || port >= SR_LOG_PORTS)
+    {return; }
+
+    slot = sr_log_claim(log, len, port, dir);
+    if(!slot)
+    {return; }
+
+    memcpy(slot->data, buf, slot->hdr.caplen);
+    sr_log_publish(slot, slot->seq + 1);
+} /* -- sr_log_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_packetv()
+ * Scope:  Global
+ *
+ * Log one packet whose bytes are spread over iovcnt pieces (e.g. a frame
+ * and its padding), as a single record.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_packetv(struct sr_instance* sr, const struct iovec* iov, int iovcnt,
+                    int port, int dir )
 {
-    struct pcap_pkthdr h;
+    struct sr_log* log;
+    struct sr_log_slot* slot;
+    int len = 0;
+    int copied = 0;
     int size;
+    int i;
 
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
+    log = __atomic_load_n(&sr->log, __ATOMIC_ACQUIRE);
+    if(!log || port < 0 || port >= SR_LOG_PORTS)
     {return; }
 
-    size = min(SR_PACKET_DUMP_SIZE, len);
+    for(i = 0; i < iovcnt; i++)
+    { len += iov[i].iov_len; }
 
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < SR_PACKET_DUMP_SIZE) ? size : SR_PACKET_DUMP_SIZE;
+    slot = sr_log_claim(log, len, port, dir);
+    if(!slot)
+    {return; }
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
-} /* -- sr_log_packet -- */
+    size = slot->hdr.caplen;
+    for(i = 0; i < iovcnt && copied < size; i++)
+    {
+        int piece = min(size - copied, (int)iov[i].iov_len);
+        memcpy(slot->data + copied, iov[i].iov_base, piece);
+        copied += piece;
+    }
+    sr_log_publish(slot, slot->seq + 1);
+} /* -- sr_log_packetv -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_add_interface(..)
+ * Scope:  Global
+ *
+ * Remember the interface of a port for the Interface Description Blocks.
+ * Called as the interfaces are added, before any frame is logged on them.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_add_interface(struct sr_instance* sr, const struct sr_vns_if* vns_if )
+{
+    int port = sr_integ_getPort(sr, vns_if->name);
+
+    if ( port >= 0 && port < SR_LOG_PORTS )
+    { sr->log_if[port] = *vns_if; }
+} /* -- sr_log_add_interface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_write(..)
+ * Scope:  local
+ *
+ * Write all of iov to fd, across short writes.
+ *
+ * RETURN VALUES:
+ *
+ *  bytes written, -1 on error
+ *
+ *---------------------------------------------------------------------------*/
+
+static long sr_log_write(int fd, struct iovec* iov, int iovcnt)
+{
+    long total = 0;
+
+    while ( iovcnt > 0 )
+    {
+        ssize_t w = writev(fd, iov, iovcnt);
+        if ( w < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            return -1;
+        }
+        total += w;
+
+        while ( iovcnt > 0 && (size_t)w >= iov->iov_len )
+        {
+            w -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if ( iovcnt > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+
+    return total;
+} /* -- sr_log_write -- */
+
+static long sr_log_write_buf(int fd, void* buf, int len)
+{
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len  = len;
+    return sr_log_write(fd, &iov, 1);
+}
+
+/*
+ * Append option code with len bytes of val, padded to 4 bytes
+ * @return bytes appended
+ */
+static int sr_log_opt(uint8_t* p, uint16_t code, const void* val, uint16_t len)
+{
+    struct pcapng_opt opt;
+    int padded = (len + 3) & ~3;
+
+    opt.code = code;
+    opt.len  = len;
+    memcpy(p, &opt, sizeof(opt));
+    memset(p + sizeof(opt), 0, padded);
+    memcpy(p + sizeof(opt), val, len);
+    return sizeof(opt) + padded;
+}
+
+static time_t sr_log_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_write_idbs(..)
+ * Scope:  local
+ *
+ * Describe ports log->idbs .. ports - 1 in the current file.  A port that
+ * was never named goes by its number.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_log_write_idbs(struct sr_instance* sr, struct sr_log* log, int ports)
+{
+    uint8_t block[128];
+
+    for ( ; log->idbs < ports; log->idbs++ )
+    {
+        const struct sr_vns_if* vns_if = &sr->log_if[log->idbs];
+        uint32_t type = PCAPNG_IDB_TYPE;
+        uint16_t linktype = LINKTYPE_ETHERNET;
+        uint16_t reserved = 0;
+        uint32_t snaplen = log->snaplen;
+        uint32_t ipv4[2];
+        uint8_t tsresol = 9; /* 10^-9 s */
+        char name[SR_NAMELEN + 1];
+        uint32_t len = 16;
+
+        if ( vns_if->name[0] )
+        {
+            memcpy(name, vns_if->name, SR_NAMELEN);
+            name[SR_NAMELEN] = 0;
+        }
+        else
+        { snprintf(name, sizeof(name), "port%d", log->idbs); }
+
+        memcpy(block, &type, 4);
+        memcpy(block + 8, &linktype, 2);
+        memcpy(block + 10, &reserved, 2);
+        memcpy(block + 12, &snaplen, 4);
+        len += sr_log_opt(block + len, PCAPNG_OPT_IF_NAME, name, strlen(name));
+        if ( vns_if->name[0] )
+        {
+            ipv4[0] = vns_if->ip;
+            ipv4[1] = vns_if->mask;
+            len += sr_log_opt(block + len, PCAPNG_OPT_IF_IPV4, ipv4, sizeof(ipv4));
+            len += sr_log_opt(block + len, PCAPNG_OPT_IF_MAC, vns_if->addr, 6);
+        }
+        len += sr_log_opt(block + len, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+        len += sr_log_opt(block + len, PCAPNG_OPT_END, 0, 0);
+        len += 4;
+        memcpy(block + 4, &len, 4);
+        memcpy(block + len - 4, &len, 4);
+
+        if ( sr_log_write_buf(log->fd, block, len) == len )
+        { log->file_bytes += len; }
+    }
+} /* -- sr_log_write_idbs -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_open(..)
+ * Scope:  local
+ *
+ * Open the next logfile and start its section.  The file before, if any,
+ * is closed once the new one is open.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success, -1 if the file cannot be opened
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_log_open(struct sr_instance* sr, struct sr_log* log)
+{
+    uint32_t shb[7];
+    uint16_t version[2] = { 1, 0 };
+    char path[sizeof(log->name) + 8];
+    int64_t section_len = -1; /* unknown */
+    int fd;
+
+    if ( strcmp(log->name, "-") == 0 )
+    { fd = STDOUT_FILENO; }
+    else
+    {
+        if ( sr->log_rotate_mb || sr->log_rotate_secs )
+        {
+            snprintf(path, sizeof(path), "%s.%d", log->name, log->file);
+            log->file = (log->file + 1) % sr->log_files;
+        }
+        else
+        { snprintf(path, sizeof(path), "%s", log->name); }
+
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if ( fd < 0 )
+        {
+            fprintf(stderr, "sr_log_open: can't open %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+
+    if ( log->fd >= 0 && log->fd != STDOUT_FILENO )
+    { close(log->fd); }
+    log->fd = fd;
+    log->idbs = 0;
+    log->opened = sr_log_now();
+
+    shb[0] = PCAPNG_SHB_TYPE;
+    shb[1] = sizeof(shb);
+    shb[2] = PCAPNG_BYTE_ORDER;
+    memcpy(&shb[3], version, sizeof(version));
+    memcpy(&shb[4], &section_len, 8);
+    shb[6] = sizeof(shb);
+    log->file_bytes = sr_log_write_buf(fd, shb, sizeof(shb)) > 0 ? sizeof(shb) : 0;
+
+    __atomic_add_fetch(&log->stats.files, 1, __ATOMIC_RELAXED);
+    return 0;
+} /* -- sr_log_open -- */
+
+/*
+ * time for the next file, with rotation on
+ */
+static int sr_log_full(struct sr_instance* sr, struct sr_log* log)
+{
+    if ( log->fd == STDOUT_FILENO )
+    { return 0; }
+
+    return (sr->log_rotate_mb &&
+            log->file_bytes >= (unsigned long)sr->log_rotate_mb << 20) ||
+           (sr->log_rotate_secs && sr_log_now() - log->opened >= sr->log_rotate_secs);
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_writer(..)
+ * Scope:  local
+ *
+ * Drain the ring in order, up to SR_LOG_WRITE_RECORDS records per writev,
+ * until stopped and empty.  A record not published yet holds up the ones
+ * behind it.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void* sr_log_writer(void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_log* log = sr->log;
+    struct iovec iov[SR_LOG_WRITE_RECORDS];
+    int failed = 0;
+
+    while (1)
+    {
+        int stop = __atomic_load_n(&log->stop, __ATOMIC_ACQUIRE);
+        int ports = 0;
+        int n = 0;
+
+        while ( n < SR_LOG_WRITE_RECORDS )
+        {
+            unsigned long pos = log->tail + n;
+            struct sr_log_slot* slot = &log->slots[pos & (SR_LOG_RING_SLOTS - 1)];
+
+            if ( __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1 )
+            { break; }
+            iov[n].iov_base = &slot->hdr;
+            iov[n].iov_len  = slot->hdr.len;
+            if ( (int)slot->hdr.ifid >= ports )
+            { ports = slot->hdr.ifid + 1; }
+            n++;
+        }
+
+        if ( n == 0 )
+        {
+            /* -- stop is read before the scan, nothing published before it is missed -- */
+            if ( stop )
+            { break; }
+            usleep(SR_LOG_IDLE_US);
+            continue;
+        }
+
+        /* -- a file only describes the ports it has frames of -- */
+        if ( sr_log_full(sr, log) && sr_log_open(sr, log) < 0 )
+        {
+            /* -- stay with the current file and try again a period later -- */
+            log->opened = sr_log_now();
+            log->file_bytes = 0;
+        }
+        sr_log_write_idbs(sr, log, ports);
+
+        long w = sr_log_write(log->fd, iov, n);
+        if ( w < 0 && !failed )
+        {
+            perror("sr_log_writer: write");
+            failed = 1;
+        }
+        if ( w > 0 )
+        {
+            log->file_bytes += w;
+            __atomic_add_fetch(&log->stats.bytes, w, __ATOMIC_RELAXED);
+        }
+        __atomic_add_fetch(&log->stats.writes, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&log->stats.logged, n, __ATOMIC_RELAXED);
+
+        /* -- hand the slots back for the next lap of the ring -- */
+        while ( n-- > 0 )
+        {
+            sr_log_publish(&log->slots[log->tail & (SR_LOG_RING_SLOTS - 1)],
+                           log->tail + SR_LOG_RING_SLOTS);
+            log->tail++;
+        }
+    }
+
+    return 0;
+} /* -- sr_log_writer -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_start(..)
+ * Scope:  Global
+ *
+ * Open the first logfile and set up the ring and its writer, with the
+ * snaplen and rotation of sr.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_log_start(struct sr_instance* sr, const char* logfile)
+{
+    struct sr_log* log;
+    unsigned long i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(logfile);
+    assert(!sr->log);
+
+    log = (struct sr_log*)aligned_alloc(64, sizeof(struct sr_log));
+    assert(log);
+    memset(log, 0, sizeof(struct sr_log));
+    for(i = 0; i < SR_LOG_RING_SLOTS; i++)
+    { log->slots[i].seq = i; }
+
+    log->snaplen = sr->log_snaplen;
+    log->fd = -1;
+    if ( strlen(logfile) >= sizeof(log->name) )
+    {
+        fprintf(stderr, "sr_log_start: name too long: %s\n", logfile);
+        free(log);
+        return -1;
+    }
+    strcpy(log->name, logfile);
+    if ( sr_log_open(sr, log) < 0 )
+    {
+        free(log);
+        return -1;
+    }
+
+    __atomic_store_n(&sr->log, log, __ATOMIC_RELEASE);
+    if ( pthread_create(&log->thread, 0, sr_log_writer, sr) )
+    {
+        perror("Log writer thread");
+        exit(1);
+    }
+
+    return 0;
+} /* -- sr_log_start -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_stop(..)
+ * Scope:  Global
+ *
+ * Let the writer drain the ring, wait for it and close the logfile.
+ * Packets logged after this are ignored.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_stop(struct sr_instance* sr)
+{
+    struct sr_log* log = sr->log;
+    struct sr_log_stats stats;
+
+    if(!log)
+    {return; }
+
+    __atomic_store_n(&log->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(log->thread, 0);
+    if ( log->fd != STDOUT_FILENO )
+    { close(log->fd); }
+
+    sr_log_get_stats(sr, &stats);
+    if ( stats.dropped )
+    {
+        fprintf(stderr, "packet log: %lu records written, %lu dropped on a full ring\n",
+                stats.logged, stats.dropped);
+    }
+
+    /* -- senders still running may hold the pointer, the ring stays -- */
+    __atomic_store_n(&sr->log, 0, __ATOMIC_RELEASE);
+} /* -- sr_log_stop -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_get_stats(..)
+ * Scope:  Global
+ *
+ * Counters of the writer, read without stopping it.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_get_stats(struct sr_instance* sr, struct sr_log_stats* stats)
+{
+    struct sr_log* log = __atomic_load_n(&sr->log, __ATOMIC_ACQUIRE);
+
+    memset(stats, 0, sizeof(*stats));
+    if(!log)
+    {return; }
+
+    stats->logged  = __atomic_load_n(&log->stats.logged, __ATOMIC_RELAXED);
+    stats->writes  = __atomic_load_n(&log->stats.writes, __ATOMIC_RELAXED);
+    stats->bytes   = __atomic_load_n(&log->stats.bytes, __ATOMIC_RELAXED);
+    stats->files   = __atomic_load_n(&log->stats.files, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&log->dropped, __ATOMIC_RELAXED);
+} /* -- sr_log_get_stats -- */
 
 static void
 sf_write_header(FILE *fp, int linktype, int thiszone, int snaplen)
@@ -1,6 +1,11 @@
 /**
  * This header file defines data structures for logging packets in tcpdump
  * format as well as a set of operations for logging.
+ *
+ * The packet log itself is pcapng: one Interface Description Block per
+ * router port, so every frame keeps the port and the direction it was seen
+ * in, and nanosecond timestamps.  Classic pcap is still written by
+ * sr_dump_open and sr_dump.
  */
 
 
@@ -27,6 +32,41 @@
 
 #define SR_PACKET_DUMP_SIZE 1514
 
+/* records the capture ring holds for the log writer, a power of 2 */
+#define SR_LOG_RING_SLOTS 4096
+/* most records the log writer puts in one writev */
+#define SR_LOG_WRITE_RECORDS 128
+/* us the log writer sleeps when the ring is empty */
+#define SR_LOG_IDLE_US 1000
+
+/* direction of a logged frame, as the pcapng epb_flags have it */
+#define SR_LOG_IN  1 /* received on the port */
+#define SR_LOG_OUT 2 /* sent out of the port */
+
+/* pcapng block types and options */
+#define PCAPNG_SHB_TYPE   0x0A0D0D0A
+#define PCAPNG_IDB_TYPE   0x00000001
+#define PCAPNG_EPB_TYPE   0x00000006
+#define PCAPNG_BYTE_ORDER 0x1A2B3C4D
+#define PCAPNG_OPT_END        0
+#define PCAPNG_OPT_IF_NAME    2
+#define PCAPNG_OPT_IF_IPV4    4
+#define PCAPNG_OPT_IF_MAC     6
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS  2
+
+/* Enhanced Packet Block up to the frame, which is followed by its padding
+ * to 4 bytes, the epb_flags option, the end of options and the length again */
+struct pcapng_epb {
+  uint32_t type;
+  uint32_t len;       /* of the whole block */
+  uint32_t ifid;      /* index of the Interface Description Block, the port */
+  uint32_t ts_high;   /* ns since the epoch */
+  uint32_t ts_low;
+  uint32_t caplen;
+  uint32_t origlen;
+};
+
 /* file header */
 struct pcap_file_header {
   uint32_t   magic;         /* magic number */
@@ -65,9 +105,38 @@ struct pcap_sf_pkthdr {
     uint32_t len;            /* length this packet (off wire) */
 };
 
-/* Given sr instance, log packet to logfile */
+/* What the log writer has done so far */
+struct sr_log_stats {
+    unsigned long logged;  /* records written to the logfile */
+    unsigned long dropped; /* records lost to a full ring */
+    unsigned long writes;  /* writev calls */
+    unsigned long bytes;   /* bytes written */
+    unsigned long files;   /* logfiles opened, rotation included */
+};
+
+/* Given sr instance, log packet seen on port going in direction dir
+ * (SR_LOG_IN or SR_LOG_OUT) to logfile */
 struct sr_instance; /* forward declare */
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len );
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len, int port, int dir );
+
+/* Same as sr_log_packet for a packet gathered from several pieces */
+struct iovec; /* forward declare */
+void sr_log_packetv(struct sr_instance* sr, const struct iovec* iov, int iovcnt,
+                    int port, int dir );
+
+/* Name the port of an interface in the logfiles, before or after the start */
+struct sr_vns_if; /* forward declare */
+void sr_log_add_interface(struct sr_instance* sr, const struct sr_vns_if* vns_if );
+
+/* Open the logfile (rotated through logfile.0, logfile.1, .. if sr asks
+ * for rotation) and start the thread draining logged packets to it.
+ * Returns -1 if it cannot be opened. */
+int sr_log_start(struct sr_instance* sr, const char* logfile);
+
+/* Write out what is still in the ring, stop the thread, close the file */
+void sr_log_stop(struct sr_instance* sr);
+
+void sr_log_get_stats(struct sr_instance* sr, struct sr_log_stats* stats);
 
 /**
  * Open a dump file and initialize the file.
@@ -15,11 +15,13 @@
 #include <stdlib.h>
 
 #include <assert.h>
+#include <sys/uio.h>
 
 #include "sr_vns.h"
 #include "sr_base_internal.h"
 #include "router.h"
 #include "rtable.h"
+#include "pwospf.h"
 
 #ifdef _CPUMODE_
 #include "sr_cpu_extension_nf2.h"
@@ -55,46 +57,88 @@ void sr_integ_init(struct sr_instance* sr)
 void sr_integ_hw_setup(struct sr_instance* sr)
 {
 	printf(" ** sr_integ_hw(..) called \n");
+	#ifdef _CPUMODE_
+	router_initIo(sr);
+	#endif /* _CPUMODE_ */
 	rtable_init(sr);
+	pwospf_startTimers(sr);
+	router_start(sr);
 } /* -- sr_integ_hw_setup -- */
 
 /*---------------------------------------------------------------------
  * Method: sr_integ_input(struct sr_instance*,
- *                        uint8_t* packet,
- *                        char* interface)
+ *                        pkt_buf_t* pkt,
+ *                        int port)
  * Scope:  Global
  *
  * This method is called each time the router receives a packet on the
- * interface.  The packet buffer, the packet length and the receiving
- * interface are passed in as parameters. The packet is complete with
- * ethernet headers.
+ * interface.  The packet buffer and the receiving port (index of the
+ * interface in the router's interface list, see sr_integ_getPort) are
+ * passed in as parameters. The packet is complete with ethernet headers.
  *
- * Note: Both the packet buffer and the character's memory are handled
- * by sr_vns_comm.c that means do NOT delete either.  Make a copy of the
- * packet instead if you intend to keep it around beyond the scope of
- * the method call.
+ * Note: The packet buffer is handled by the receive loop that means do
+ * NOT delete it.  Take it with pkt_keep if you intend to keep the packet
+ * around beyond the scope of the method call; that is a reference unless
+ * the frame sits in a receive ring, then it is a copy.
  *
  *---------------------------------------------------------------------*/
 
 void sr_integ_input(struct sr_instance* sr,
-		    const uint8_t * packet/* borrowed */,
-		    unsigned int len,
-		    const char* interface/* borrowed */)
+		    pkt_buf_t* pkt/* borrowed */,
+		    int port)
 {
 	/* -- INTEGRATION PACKET ENTRY POINT!-- */
 	
-	printf(" ** sr_integ_input(..) called \n");
-	
+	Debug(" ** sr_integ_input(..) called \n");
 	
-	router_processPacket(sr, packet, len, interface);
+	if (port < 0) {
+		/* -- not one of ours -- */
+		return;
+	}
 	
-// 	sr_integ_low_level_output(sr /* borrowed */,
-// 				  packet /* borrowed */ ,
-// 			   len,
-// 			   interface /* borrowed */);
+	router_processPacket(sr, pkt, port);
 	
 } /* -- sr_integ_input -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_integ_input_batch(struct sr_instance*,
+ *                              pkt_buf_t** pkts,
+ *                              const int* ports,
+ *                              int count)
+ * Scope:  Global
+ *
+ * Same as sr_integ_input for a vector of frames pulled in one receive
+ * call, ports[i] is the receiving port of pkts[i].  Same ownership rules
+ * apply to every buffer.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_integ_input_batch(struct sr_instance* sr,
+			  pkt_buf_t** pkts/* borrowed */,
+			  const int* ports/* borrowed */,
+			  int count)
+{
+	router_processBatch(sr, pkts, ports, count);
+} /* -- sr_integ_input_batch -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_integ_getPort(struct sr_instance*,
+ *                          const char* interface)
+ * Scope:  Global
+ *
+ * Port of the interface named interface, -1 if there is none.  Names
+ * only live at the edges (VNS framing, configuration files, the CLI),
+ * everything past sr_integ_input works on ports.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_integ_getPort(struct sr_instance* sr,
+		     const char* interface/* borrowed */)
+{
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	return router_getInterfaceIndex(router, interface);
+} /* -- sr_integ_getPort -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_integ_add_interface(..)
  * Scope: global
@@ -143,15 +187,87 @@ struct sr_instance* get_sr() {
 int sr_integ_low_level_output(struct sr_instance* sr /* borrowed */,
 			      uint8_t* buf /* borrowed */ ,
 			      unsigned int len,
-			      const char* iface /* borrowed */)
+			      int port)
 {
 	#ifdef _CPUMODE_
-	return sr_cpu_output(sr, buf /*lent*/, len, iface);
+	return sr_cpu_output(sr, buf /*lent*/, len, port);
 	#else
-	return sr_vns_send_packet(sr, buf /*lent*/, len, iface);
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	return sr_vns_send_packet(sr, buf /*lent*/, len, router->if_list[port].name);
 	#endif /* _CPUMODE_ */
 } /* -- sr_vns_integ_output -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_integ_low_level_outputv(..)
+ * Scope: global
+ *
+ * Send one frame gathered from iovcnt pieces (e.g. a frame and its padding,
+ * or headers and a payload kept apart) out of port, without copying them
+ * together first.
+ *
+ * Returns the length of the frame on success, -1 on failure.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_integ_low_level_outputv(struct sr_instance* sr /* borrowed */,
+			       const struct iovec* iov /* borrowed */,
+			       int iovcnt,
+			       int port)
+{
+	#ifdef _CPUMODE_
+	return sr_cpu_outputv(sr, iov /*lent*/, iovcnt, port);
+	#else
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	int len = 0;
+	int i;
+	if (sr_vns_send_packetv(sr, iov /*lent*/, iovcnt, router->if_list[port].name) < 0) {
+		return -1;
+	}
+	for (i = 0; i < iovcnt; ++i) {
+		len += iov[i].iov_len;
+	}
+	return len;
+	#endif /* _CPUMODE_ */
+} /* -- sr_integ_low_level_outputv -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_integ_low_level_output_batch(..)
+ * Scope: global
+ *
+ * Send a vector of frames out of one port.  Never blocks for long, frames
+ * the backend cannot take right now are not retried.  The frames stay in
+ * their packet buffers, so VNS can put its header in their headroom.
+ *
+ * Returns the number of frames sent (from the front of the vector).
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_integ_low_level_output_batch(struct sr_instance* sr /* borrowed */,
+				    pkt_buf_t** pkts /* borrowed */,
+				    unsigned int* lens /* borrowed */,
+				    int count,
+				    int port)
+{
+	#ifdef _CPUMODE_
+	uint8_t* bufs[TXQ_SIZE];
+	int i;
+	assert(count <= TXQ_SIZE);
+	for (i = 0; i < count; ++i) {
+		bufs[i] = pkts[i]->data;
+	}
+	return sr_cpu_output_batch(sr, bufs /*lent*/, lens, count, port);
+	#else
+	router_t* router = (router_t*) sr_get_subsystem(sr);
+	int i;
+	for (i = 0; i < count; ++i) {
+		if (sr_vns_send_pkt(sr, pkts[i] /*lent*/, lens[i], router->if_list[port].name) < 0) {
+			break;
+		}
+	}
+	return i;
+	#endif /* _CPUMODE_ */
+} /* -- sr_integ_low_level_output_batch -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_integ_destroy(..)
  * Scope: global
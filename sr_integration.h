@@ -6,13 +6,30 @@
 #ifndef SR_INTEGRATION_H
 #define SR_INTEGRATION_H
 
+struct Packet_Buffer;
+struct iovec;
+
 /** returns a pointer to the global sr (only valid after it is initialized) */
 struct sr_instance* get_sr();
 
 int sr_integ_low_level_output( struct sr_instance* sr /* borrowed */,
                                uint8_t* buf /* borrowed */ ,
                                unsigned int len,
-                               const char* iface );
+                               int port );
+
+/** sends one frame gathered from iovcnt pieces out of port, returns its
+ *  length or -1 */
+int sr_integ_low_level_outputv( struct sr_instance* sr /* borrowed */,
+                                const struct iovec* iov /* borrowed */,
+                                int iovcnt,
+                                int port );
+
+/** sends count frames out of port, returns how many were taken */
+int sr_integ_low_level_output_batch( struct sr_instance* sr /* borrowed */,
+                                     struct Packet_Buffer** pkts /* borrowed */,
+                                     unsigned int* lens /* borrowed */,
+                                     int count,
+                                     int port );
 
 /** returns the ip of the interface this will be sent via */
 uint32_t sr_integ_findsrcip(uint32_t dest /* nbo */);
@@ -22,12 +22,15 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
 
 #include "sha1.h"
 #include "sr_vns.h"
 #include "sr_dumper.h"
 
 #include "sr_base_internal.h"
+#include "packet.h"
 
 #include "vnscommand.h"
 
@@ -41,8 +44,7 @@ void sr_vns_init_log(struct sr_instance* sr, char* logfile)
     if (!logfile)
     { return; }
 
-    sr->logfile = sr_dump_open(logfile, 0, SR_PACKET_DUMP_SIZE);
-    if(!sr->logfile)
+    if ( sr_log_start(sr, logfile) < 0 )
     {
         fprintf(stderr,"Error opening up dump file %s\n",
                 logfile);
@@ -59,10 +61,10 @@ void sr_vns_init_log(struct sr_instance* sr, char* logfile)
  *----------------------------------------------------------------------------*/
 void sr_close_instance(struct sr_instance* sr)
 {
+    sr_vns_flush(sr, SR_VNS_FLUSH_BATCH);
     close(sr->sockfd);
 
-    if(sr->logfile)
-    { sr_dump_close(sr->logfile); }
+    sr_log_stop(sr);
 
     sr->hw_init = 0;
 } /* -- sr_close_instance -- */
@@ -228,7 +230,11 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
             case HWINTERFACE:
                 fprintf(stderr,"Interface: %s\n",hwinfo->mHWInfo[i].value);
                 if (vns_if.name[0])
-                { sr_integ_add_interface(sr, &vns_if); vns_if.name[0] = 0; }
+                {
+                    sr_integ_add_interface(sr, &vns_if);
+                    sr_log_add_interface(sr, &vns_if);
+                    vns_if.name[0] = 0;
+                }
                 strncpy(vns_if.name, hwinfo->mHWInfo[i].value, SR_NAMELEN);
                 break;
             case HWSPEED:
@@ -264,7 +270,11 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
     } /* -- for -- */
 
     if (vns_if.name[0])
-    { sr_integ_add_interface(sr, &vns_if); vns_if.name[0] = 0; }
+    {
+        sr_integ_add_interface(sr, &vns_if);
+        sr_log_add_interface(sr, &vns_if);
+        vns_if.name[0] = 0;
+    }
 
     /* flag that hardware has been initialized */
     sr->hw_init = 1;
@@ -356,122 +366,141 @@ int sr_vns_read_from_server(struct sr_instance* sr /* borrowed */)
     return sr_read_from_server_expect(sr, 0);
 }/* -- sr_vns_read_from_server -- */
 
-int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
-{
-    int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
-
-    /* REQUIRES */
-    assert(sr);
-
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_fill(..)
+ * Scope: local
+ *
+ * One recv into the receive ring, blocking until the server sends something.
+ * A partial command left at the end of the ring is first moved to its front
+ * when the room behind it could not hold a whole command.
+ *
+ * Returns the bytes read, 0 if the server closed the connection, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
 
-    bytes_read = 0;
+static int sr_vns_fill(struct sr_instance* sr)
+{
+    int ret;
 
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
+    if ( ! sr->vns_rx )
     {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
-
+        sr->vns_rx = (uint8_t*)malloc(SR_VNS_RX_RING);
+        if ( ! sr->vns_rx )
+        {
+            perror("malloc failed");
+            exit(1);
+        }
+        sr->vns_rx_head = sr->vns_rx_tail = 0;
     }
 
-    len = ntohl(len);
-
-    if ( len > 10000 || len < 0 )
+    if ( sr->vns_rx_head == sr->vns_rx_tail )
+    { sr->vns_rx_head = sr->vns_rx_tail = 0; }
+    else if ( SR_VNS_RX_RING - sr->vns_rx_tail < SR_VNS_CMD_MAX )
     {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
+        memmove(sr->vns_rx, sr->vns_rx + sr->vns_rx_head,
+                sr->vns_rx_tail - sr->vns_rx_head);
+        sr->vns_rx_tail -= sr->vns_rx_head;
+        sr->vns_rx_head = 0;
+        sr->vns_rx_moves++;
     }
 
-    if((buf = malloc(len)) == 0)
+    do
+    { /* -- just in case SIGALRM breaks recv -- */
+        ret = recv(sr->sockfd, sr->vns_rx + sr->vns_rx_tail,
+                   SR_VNS_RX_RING - sr->vns_rx_tail, 0);
+    } while ( ret == -1 && errno == EINTR ); /* be mindful of signals */
+
+    if ( ret == -1 )
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+        perror("recv(..):sr_client.c::sr_read_from_server");
         return -1;
     }
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
+    sr->vns_rx_tail += ret;
+    sr->vns_rx_reads++;
+    return ret;
+} /* -- sr_vns_fill -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_peek(..)
+ * Scope: local
+ *
+ * Returns the length of the command at the head of the ring if all of it
+ * has been read, 0 if not, -1 if its length is bogus.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_peek(struct sr_instance* sr)
+{
+    unsigned int avail = sr->vns_rx_tail - sr->vns_rx_head;
+    uint32_t len;
 
-    bytes_read = 0;
+    if ( avail < sizeof(c_base) )
+    { return 0; }
+
+    memcpy(&len, sr->vns_rx + sr->vns_rx_head, sizeof(len));
+    len = ntohl(len);
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
+    if ( len > SR_VNS_CMD_MAX || len < sizeof(c_base) )
     {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
+        fprintf(stderr,"Error: command length to large %u\n",len);
+        return -1;
     }
 
-    /* My entry for most unreadable line of code - guido */
-    /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+    return len <= avail ? (int)len : 0;
+} /* -- sr_vns_peek -- */
 
-    /* make sure the command is what we expected if we were expecting something */
-    if(expected_cmd && command!=expected_cmd) {
-        if(command != VNSCLOSE) { /* VNSCLOSE is always ok */
-            fprintf(stderr, "Error: expected command %d but got %d\n", expected_cmd, command);
-            return -1;
-        }
-    }
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_input_batch(..)
+ * Scope: local
+ *
+ * Hand the frames collected from the ring to the router.  They are lent
+ * straight out of the ring: the router copies what it keeps (pkt_keep) and
+ * the frames it sent are written out before the ring is reused.
+ *
+ *---------------------------------------------------------------------------*/
 
-    ret = 1;
-    switch (command)
-    {
-        /* -------------        VNSPACKET     -------------------- */
+static void sr_vns_input_batch(struct sr_instance* sr, pkt_buf_t** pkts,
+                               int* ports, int* count)
+{
+    int i;
+
+    if ( *count == 0 )
+    { return; }
 
-        case VNSPACKET:
-            sr_pkt = (c_packet_ethernet_header *)buf;
+    sr_integ_input_batch(sr, pkts /* lent */, ports, *count);
 
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
+    /* -- whatever the batch sent leaves together, the output buffer may
+     *    point into the ring -- */
+    sr_vns_flush(sr, SR_VNS_FLUSH_BATCH);
 
-            /* -- pass to router, student's code should take over here -- */
-            sr_integ_input(sr,
-                    (buf+sizeof(c_packet_header)), /* lent */
-                    len - sizeof(c_packet_header),
-                    (const char*)buf + sizeof(c_base)); /* lent */
+    for ( i = 0; i < *count; i++ )
+    { pkt_unref(pkts[i]); }
+    *count = 0;
+} /* -- sr_vns_input_batch -- */
 
-            break;
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_handle_command(..)
+ * Scope: local
+ *
+ * Handle one command other than VNSPACKET, buf is where it sits in the ring.
+ *
+ * Returns 1 to go on reading, 0 if the session ended, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_handle_command(struct sr_instance* sr, uint8_t* buf, int command)
+{
+    int ret = 1;
 
+    switch (command)
+    {
             /* -------------        VNSCLOSE      -------------------- */
 
         case VNSCLOSE:
             fprintf(stderr,"VNS server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_close_instance(sr); /* closes the VNS socket and logfile */
-
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -491,7 +520,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         case VNS_RTABLE:
             fprintf(stderr, "not yet setup to handle VNS_RTABLE message\n");
             sr_close_instance(sr);
-            if(buf) { free(buf); }
             return 0;
             break;
 
@@ -513,8 +541,118 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
+    return ret;
+} /* -- sr_vns_handle_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_expect(..)
+ * Scope: global
+ *
+ * Read from the server until at least one whole command is buffered, then
+ * handle every whole command in the ring.  Runs of VNSPACKETs are handed to
+ * the router as one batch, in place.  While expected_cmd is set (setup) only
+ * the next command is handled and it has to be that one (or VNSCLOSE).
+ *
+ * Returns 1 to go on reading, 0 if the session ended, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+{
+    pkt_buf_t* pkts[SR_VNS_RX_BATCH];
+    int ports[SR_VNS_RX_BATCH];
+    int count = 0;
+    int command, len;
+    uint8_t* buf;
+    int ret = 1;
+
+    /* REQUIRES */
+    assert(sr);
+
+    /*---------------------------------------------------------------------------
+      Read until a whole command is in the ring
+      -------------------------------------------------------------------------*/
+
+    while ( (len = sr_vns_peek(sr)) == 0 )
+    {
+        int got = sr_vns_fill(sr);
+        if ( got <= 0 )
+        {
+            if ( got == 0 )
+            { fprintf(stderr,"Error: VNS server closed the connection\n"); }
+            close(sr->sockfd);
+            return -1;
+        }
+    }
+
+    /*---------------------------------------------------------------------------
+      Handle what is there
+      -------------------------------------------------------------------------*/
+
+    while ( ret == 1 && len > 0 )
+    {
+        buf = sr->vns_rx + sr->vns_rx_head;
+
+        /* My entry for most unreadable line of code - guido */
+        /* ... you win - mc                                  */
+        command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+        sr->vns_rx_head += len;
+        sr->vns_rx_cmds++;
+
+        /* make sure the command is what we expected if we were expecting something */
+        if(expected_cmd && command!=expected_cmd) {
+            if(command != VNSCLOSE) { /* VNSCLOSE is always ok */
+                fprintf(stderr, "Error: expected command %d but got %d\n", expected_cmd, command);
+                return -1;
+            }
+        }
+
+        if ( command == VNSPACKET )
+        {
+            unsigned int frame_len = len - sizeof(c_packet_header);
+            uint8_t* frame = buf + sizeof(c_packet_header);
+            int port = sr_integ_getPort(sr, (const char*)buf + sizeof(c_base));
+
+            /* -- log packet -- */
+            sr_log_packet(sr, frame, frame_len, port, SR_LOG_IN);
+
+            /* -- pass to router, student's code should take over here.
+             *    The frame is lent where it sits in the ring -- */
+            if ( port >= 0 )
+            {
+                if ( frame_len <= PKT_BUF_SIZE - PKT_HEADROOM )
+                { pkts[count] = pkt_wrap(frame, frame_len); }
+                else
+                {
+                    pkts[count] = pkt_alloc(frame_len);
+                    memcpy(pkts[count]->data, frame, frame_len);
+                }
+                ports[count++] = port;
+                if ( count == SR_VNS_RX_BATCH )
+                { sr_vns_input_batch(sr, pkts, ports, &count); }
+            }
+        }
+        else
+        {
+            /* -- commands are handled in arrival order -- */
+            sr_vns_input_batch(sr, pkts, ports, &count);
+            ret = sr_vns_handle_command(sr, buf, command);
+        }
+
+        if ( expected_cmd )
+        { break; }
+
+        len = sr_vns_peek(sr);
+    }
+
+    sr_vns_input_batch(sr, pkts, ports, &count);
+
+    if ( len < 0 )
+    {
+        close(sr->sockfd);
+        return -1;
+    }
+
     return ret;
 }/* -- sr_read_from_server -- */
 
@@ -534,13 +672,390 @@ int sr_vns_send_packet(struct sr_instance* sr /* borrowed */,
                        unsigned int len,
                        const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct iovec iov;
 
     /* REQUIRES */
-    assert(sr);
     assert(buf);
+
+    iov.iov_base = buf;
+    iov.iov_len  = len;
+    return sr_vns_send_packetv(sr, &iov, 1, iface);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Output buffer
+ *
+ * Frames to the server are not written one by one but collected under
+ * send_lock and written out with one writev: at the end of each receive
+ * batch, once sr->vns_tx_bytes are held, when the buffer is full, or by the
+ * flusher thread once the oldest frame waited sr->vns_tx_delay us.  Frames
+ * in a packet buffer are referenced with the VNS header in their headroom,
+ * everything else is copied into the staging area with its header in front.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_vns_tx
+{
+    pthread_cond_t cond;                /* wakes the flusher, with send_lock */
+    struct iovec iov[SR_VNS_TX_FRAMES]; /* one per frame at most */
+    int iovcnt;
+    pkt_buf_t* pkts[SR_VNS_TX_FRAMES];  /* referenced until written */
+    int npkts;
+    uint64_t queued[SR_VNS_TX_FRAMES];  /* ns each frame was queued */
+    int frames;
+    unsigned int bytes;                 /* VNS headers included */
+    unsigned int staged;                /* bytes used in stage */
+    struct sr_vns_tx_stats stats;
+    uint8_t stage[SR_VNS_TX_STAGE];
+};
+
+static uint64_t sr_vns_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- sr_vns_now -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_flush_locked(..)
+ * Scope: local
+ *
+ * Write out every frame held, NOT Threadsafe, caller holds send_lock.
+ * Frames a failed write could not take are dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_flush_locked(struct sr_instance* sr, int cause)
+{
+    struct sr_vns_tx* tx = sr->vns_tx;
+    struct iovec* iov;
+    int iovcnt;
+    uint64_t now;
+    int ret = 0;
+    int b;
+    int i;
+
+    if ( !tx || tx->frames == 0 )
+    { return 0; }
+
+    /* -- a blocking socket may still take less on a signal -- */
+    iov = tx->iov;
+    iovcnt = tx->iovcnt;
+    while ( iovcnt > 0 )
+    {
+        ssize_t n = writev(sr->sockfd, iov, iovcnt);
+        if ( n < 0 )
+        {
+            if ( errno == EINTR )
+            { continue; }
+            perror("writev");
+            fprintf(stderr, "Error writing packet\n");
+            ret = -1;
+            break;
+        }
+        while ( iovcnt > 0 && (size_t)n >= iov->iov_len )
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if ( iovcnt > 0 )
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    now = sr_vns_now();
+    tx->stats.flushes++;
+    tx->stats.frames += tx->frames;
+    tx->stats.bytes += tx->bytes;
+    tx->stats.cause[cause]++;
+    for ( b = 0; b < SR_VNS_TX_HIST - 1 && (tx->frames >> (b + 1)); b++ );
+    tx->stats.size[b]++;
+    for ( i = 0; i < tx->frames; i++ )
+    {
+        uint64_t us = (now - tx->queued[i]) / 1000;
+        for ( b = 0; b < SR_VNS_TX_LAT_HIST - 1 && us >= (1ULL << b); b++ );
+        tx->stats.latency[b]++;
+    }
+
+    for ( i = 0; i < tx->npkts; i++ )
+    { pkt_unref(tx->pkts[i]); }
+    tx->npkts = 0;
+    tx->iovcnt = 0;
+    tx->frames = 0;
+    tx->bytes = 0;
+    tx->staged = 0;
+
+    return ret;
+} /* -- sr_vns_flush_locked -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_flusher(..)
+ * Scope: local
+ *
+ * Thread writing out frames that waited sr->vns_tx_delay us without the
+ * buffer being flushed otherwise.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void* sr_vns_flusher(void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_vns_tx* tx = sr->vns_tx;
+    struct timespec ts;
+    uint64_t deadline;
+
+    pthread_mutex_lock(&(sr->send_lock));
+    while ( 1 )
+    {
+        if ( tx->frames == 0 )
+        {
+            pthread_cond_wait(&tx->cond, &(sr->send_lock));
+            continue;
+        }
+
+        deadline = tx->queued[0] + (uint64_t)sr->vns_tx_delay * 1000;
+        if ( sr_vns_now() >= deadline )
+        {
+            sr_vns_flush_locked(sr, SR_VNS_FLUSH_TIMER);
+            continue;
+        }
+
+        ts.tv_sec  = deadline / 1000000000ULL;
+        ts.tv_nsec = deadline % 1000000000ULL;
+        pthread_cond_timedwait(&tx->cond, &(sr->send_lock), &ts);
+    }
+    pthread_mutex_unlock(&(sr->send_lock));
+
+    return 0;
+} /* -- sr_vns_flusher -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_tx_get(..)
+ * Scope: local
+ *
+ * The output buffer, set up on the first send.  NOT Threadsafe, caller
+ * holds send_lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+static struct sr_vns_tx* sr_vns_tx_get(struct sr_instance* sr)
+{
+    struct sr_vns_tx* tx = sr->vns_tx;
+    pthread_condattr_t attr;
+    pthread_t thread;
+
+    if ( tx )
+    { return tx; }
+
+    tx = (struct sr_vns_tx*)calloc(1, sizeof(struct sr_vns_tx));
+    assert(tx);
+
+    /* -- the flusher sleeps until a deadline on sr_vns_now -- */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if ( pthread_cond_init(&tx->cond, &attr) )
+    {
+        perror("VNS flusher cond init error");
+        exit(1);
+    }
+    pthread_condattr_destroy(&attr);
+    sr->vns_tx = tx;
+
+    /* -- without a threshold or a delay every frame is written right away -- */
+    if ( sr->vns_tx_bytes > 0 && sr->vns_tx_delay > 0 )
+    {
+        if ( pthread_create(&thread, 0, sr_vns_flusher, sr) )
+        {
+            perror("VNS flusher thread");
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+
+    return tx;
+} /* -- sr_vns_tx_get -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_tx_room(..)
+ * Scope: local
+ *
+ * Make room for one more frame, staging len bytes of it.  NOT Threadsafe,
+ * caller holds send_lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_tx_room(struct sr_instance* sr, struct sr_vns_tx* tx,
+                          unsigned int len)
+{
+    if ( tx->frames < SR_VNS_TX_FRAMES &&
+         tx->staged + len <= SR_VNS_TX_STAGE )
+    { return 0; }
+
+    return sr_vns_flush_locked(sr, SR_VNS_FLUSH_BYTES);
+} /* -- sr_vns_tx_room -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_tx_queued(..)
+ * Scope: local
+ *
+ * Account for a frame of len bytes just put in iov, writing the buffer out
+ * if the threshold is hit.  NOT Threadsafe, caller holds send_lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_tx_queued(struct sr_instance* sr, struct sr_vns_tx* tx,
+                            unsigned int len)
+{
+    tx->queued[tx->frames++] = sr_vns_now();
+    tx->bytes += len;
+
+    /* -- without a delay nothing may be held past the call -- */
+    if ( tx->bytes >= (unsigned int)sr->vns_tx_bytes || sr->vns_tx_delay == 0 )
+    { return sr_vns_flush_locked(sr, SR_VNS_FLUSH_BYTES); }
+
+    /* -- the flusher sleeps while the buffer is empty -- */
+    if ( tx->frames == 1 )
+    { pthread_cond_signal(&tx->cond); }
+
+    return 0;
+} /* -- sr_vns_tx_queued -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_tx_stage(..)
+ * Scope: local
+ *
+ * Copy a frame gathered from iovcnt pieces into the output buffer behind
+ * its VNS header, total_len counts both.  NOT Threadsafe, caller holds
+ * send_lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_tx_stage(struct sr_instance* sr, struct sr_vns_tx* tx,
+                           const struct iovec* iov, int iovcnt,
+                           unsigned int total_len, const char* iface)
+{
+    c_packet_header sr_pkt;
+    uint8_t* dst;
+    int ret = 0;
+    int i;
+
+    if ( sr_vns_tx_room(sr, tx, total_len) < 0 )
+    { ret = -1; }
+
+    memset(&sr_pkt, 0, sizeof(sr_pkt));
+    sr_pkt.mLen  = htonl(total_len);
+    sr_pkt.mType = htonl(VNSPACKET);
+    strncpy(sr_pkt.mInterfaceName,iface,16);
+
+    dst = tx->stage + tx->staged;
+    memcpy(dst, &sr_pkt, sizeof(sr_pkt));
+    dst += sizeof(sr_pkt);
+    for ( i = 0; i < iovcnt; i++ )
+    {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+
+    /* -- frames staged back to back go out as one piece -- */
+    if ( tx->iovcnt > 0 &&
+         (uint8_t*)tx->iov[tx->iovcnt - 1].iov_base +
+         tx->iov[tx->iovcnt - 1].iov_len == tx->stage + tx->staged )
+    { tx->iov[tx->iovcnt - 1].iov_len += total_len; }
+    else
+    {
+        tx->iov[tx->iovcnt].iov_base = tx->stage + tx->staged;
+        tx->iov[tx->iovcnt++].iov_len = total_len;
+    }
+    tx->staged += total_len;
+
+    if ( sr_vns_tx_queued(sr, tx, total_len) < 0 )
+    { ret = -1; }
+
+    return ret;
+} /* -- sr_vns_tx_stage -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_flush(..)
+ * Scope: Global
+ *
+ * Write out the frames held in the output buffer.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_flush(struct sr_instance* sr /* borrowed */, int cause)
+{
+    int ret;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(cause >= 0 && cause < SR_VNS_FLUSH_CAUSES);
+
+    if ( pthread_mutex_lock(&(sr->send_lock)) )
+    { assert (0); }
+    ret = sr_vns_flush_locked(sr, cause);
+    if ( pthread_mutex_unlock(&(sr->send_lock)) )
+    { assert (0); }
+
+    return ret;
+} /* -- sr_vns_flush -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_get_tx_stats(..)
+ * Scope: Global
+ *
+ * Copy out the counters of the output buffer, zeroes before the first send.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_vns_get_tx_stats(struct sr_instance* sr /* borrowed */,
+                         struct sr_vns_tx_stats* stats /* borrowed */)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(stats);
+
+    if ( pthread_mutex_lock(&(sr->send_lock)) )
+    { assert (0); }
+    if ( sr->vns_tx )
+    { *stats = sr->vns_tx->stats; }
+    else
+    { memset(stats, 0, sizeof(*stats)); }
+    if ( pthread_mutex_unlock(&(sr->send_lock)) )
+    { assert (0); }
+} /* -- sr_vns_get_tx_stats -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_send_packetv(..)
+ * Scope: Global
+ *
+ * Send a packet gathered from iovcnt pieces (e.g. a frame and its padding)
+ * to the server.  The pieces are copied into the output buffer behind
+ * their VNS header, the caller may reuse them right away.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_send_packetv(struct sr_instance* sr /* borrowed */,
+                        const struct iovec* iov /* borrowed */,
+                        int iovcnt,
+                        const char* iface /* borrowed */)
+{
+    unsigned int total_len = sizeof(c_packet_header);
+    unsigned int len = 0;
+    int ret;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(iov);
     assert(iface);
+    assert(iovcnt <= SR_VNS_IOV_MAX);
+
+    for ( i = 0; i < iovcnt; i++ )
+    { len += iov[i].iov_len; }
+    total_len += len;
 
     /* don't waste my time ... */
     if ( len < 14 /* sizeof ethernet header */ )
@@ -548,36 +1063,103 @@ int sr_vns_send_packet(struct sr_instance* sr /* borrowed */,
         fprintf(stderr , "** Error: packet is wayy to short \n");
         return -1;
     }
+    if ( total_len > SR_VNS_TX_STAGE )
+    {
+        fprintf(stderr , "** Error: packet is too long \n");
+        return -1;
+    }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(total_len);
+    /* -- log packet, the port is only looked up when logging -- */
+    if ( sr->log )
+    { sr_log_packetv(sr, iov, iovcnt, sr_integ_getPort(sr, iface), SR_LOG_OUT); }
 
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    if ( pthread_mutex_lock(&(sr->send_lock)) )
+    { assert (0); }
+    ret = sr_vns_tx_stage(sr, sr_vns_tx_get(sr), iov, iovcnt, total_len, iface);
+    if ( pthread_mutex_unlock(&(sr->send_lock)) )
+    { assert (0); }
+
+    return ret;
+} /* -- sr_vns_send_packetv -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_send_pkt(..)
+ * Scope: Global
+ *
+ * Send the first 'len' bytes of the frame in pkt (padding included) to the
+ * server.  The header is written into the headroom of the buffer right in
+ * front of the frame and the buffer is referenced by the output buffer
+ * until it is written, so frame and header leave with no copy.  Frames
+ * without headroom (wrapped ones) go through sr_vns_send_packet.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_send_pkt(struct sr_instance* sr /* borrowed */,
+                    pkt_buf_t* pkt /* borrowed */,
+                    unsigned int len,
+                    const char* iface /* borrowed */)
+{
+    c_packet_header *sr_pkt;
+    struct sr_vns_tx* tx;
+    struct iovec iov;
+    unsigned int total_len =  len + (sizeof(c_packet_header));
+    int ret = 0;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(pkt);
+    assert(iface);
+
+    if ( pkt_headroom(pkt) < sizeof(c_packet_header) )
+    { return sr_vns_send_packet(sr, pkt->data, len, iface); }
+
+    /* don't waste my time ... */
+    if ( len < 14 /* sizeof ethernet header */ )
+    {
+        fprintf(stderr , "** Error: packet is wayy to short \n");
+        return -1;
+    }
 
     /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+    if ( sr->log )
+    { sr_log_packet(sr, pkt->data, len, sr_integ_getPort(sr, iface), SR_LOG_OUT); }
 
     if ( pthread_mutex_lock(&(sr->send_lock)) )
     { assert (0); }
-    if( write(sr->sockfd, sr_pkt, total_len) < (signed int)total_len )
+
+    /* -- the headroom holds one header, a buffer sent to several ports
+     *    while it is still held goes out as a copy -- */
+    tx = sr_vns_tx_get(sr);
+    for ( i = 0; i < tx->npkts && tx->pkts[i] != pkt; i++ );
+    if ( i < tx->npkts )
     {
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        if ( pthread_mutex_unlock(&(sr->send_lock)) )
-        { assert (0); }
-        return -1;
+        iov.iov_base = pkt->data;
+        iov.iov_len  = len;
+        ret = sr_vns_tx_stage(sr, tx, &iov, 1, total_len, iface);
     }
+    else
+    {
+        if ( sr_vns_tx_room(sr, tx, 0) < 0 )
+        { ret = -1; }
+
+        sr_pkt = (c_packet_header *)(pkt->data - sizeof(c_packet_header));
+        sr_pkt->mLen  = htonl(total_len);
+        sr_pkt->mType = htonl(VNSPACKET);
+        strncpy(sr_pkt->mInterfaceName,iface,16);
+
+        tx->pkts[tx->npkts++] = pkt_ref(pkt);
+        tx->iov[tx->iovcnt].iov_base = sr_pkt;
+        tx->iov[tx->iovcnt++].iov_len = total_len;
+
+        if ( sr_vns_tx_queued(sr, tx, total_len) < 0 )
+        { ret = -1; }
+    }
+
     if ( pthread_mutex_unlock(&(sr->send_lock)) )
     { assert (0); }
 
-    free(sr_pkt);
-
-    return 0;
-} /* -- sr_send_packet -- */
+    return ret;
+} /* -- sr_vns_send_pkt -- */
 
 #endif /* _CPUMODE_ */
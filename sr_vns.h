@@ -28,6 +28,43 @@
 #endif /* _SOLARIS_ */
 
 struct sr_instance* sr; /* -- forward declare -- */
+struct Packet_Buffer;
+struct iovec;
+
+/* -- pieces a packet may be gathered from, see sr_vns_send_packetv -- */
+#define SR_VNS_IOV_MAX 8
+
+/* -- longest command accepted from the server -- */
+#define SR_VNS_CMD_MAX 10000
+
+/* -- receive ring, one recv takes whatever fits behind the last command -- */
+#define SR_VNS_RX_RING (256 * 1024)
+
+/* -- frames handed to the router at once -- */
+#define SR_VNS_RX_BATCH 64
+
+/* -- output buffer: frames one writev may carry, bytes staged for copied
+ *    frames and headers, histogram buckets (powers of two) -- */
+#define SR_VNS_TX_FRAMES 64
+#define SR_VNS_TX_STAGE  (64 * 1024)
+#define SR_VNS_TX_HIST   8
+#define SR_VNS_TX_LAT_HIST 12
+
+/* -- why the output buffer was written out -- */
+#define SR_VNS_FLUSH_BATCH 0 /* end of a receive batch */
+#define SR_VNS_FLUSH_BYTES 1 /* byte threshold or a full buffer */
+#define SR_VNS_FLUSH_TIMER 2 /* the oldest frame waited the whole delay */
+#define SR_VNS_FLUSH_CAUSES 3
+
+struct sr_vns_tx_stats
+{
+    unsigned long flushes;  /* writev calls */
+    unsigned long frames;
+    unsigned long bytes;
+    unsigned long cause[SR_VNS_FLUSH_CAUSES];     /* flushes by SR_VNS_FLUSH_* */
+    unsigned long size[SR_VNS_TX_HIST];           /* flushes of 2^i up to 2^(i+1) - 1 frames */
+    unsigned long latency[SR_VNS_TX_LAT_HIST];    /* frames held < 2^i us, last: the rest */
+};
 
 void sr_vns_init_log(struct sr_instance* sr, char* logfile);
 
@@ -46,6 +83,26 @@ int  sr_vns_connect_to_server(struct sr_instance* ,unsigned short , char* );
  */
 int  sr_vns_send_packet(struct sr_instance* ,uint8_t* , unsigned int , const char*);
 
+/**
+ * Same as sr_vns_send_packet for a packet gathered from at most
+ * SR_VNS_IOV_MAX pieces, nothing is copied.
+ */
+int  sr_vns_send_packetv(struct sr_instance* ,const struct iovec* , int , const char*);
+
+/**
+ * Same as sr_vns_send_packet for a frame in a packet buffer, the VNS header
+ * goes into the headroom of the buffer instead of a copy.
+ */
+int  sr_vns_send_pkt(struct sr_instance* ,struct Packet_Buffer* , unsigned int , const char*);
+
+/**
+ * Write out the frames held in the output buffer, cause is one of
+ * SR_VNS_FLUSH_*.  Returns 0 on success or -1 on error.
+ */
+int  sr_vns_flush(struct sr_instance* ,int);
+
+void sr_vns_get_tx_stats(struct sr_instance* ,struct sr_vns_tx_stats*);
+
 #endif /* _CPUMODE */
 
 #endif  /* -- SR_VNS_H -- */
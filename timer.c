@@ -0,0 +1,338 @@
+/**
+ * @file timer.c
+ * @author Mohammad Reza Hosseini
+ *
+ * The slot of level L covering tick T is (T >> 6L) & 63, and it is cascaded
+ * at the ticks where T is a multiple of 2^6L. A timer goes to the lowest
+ * level whose 64 slots reach its expiry from the clock, so when its slot is
+ * cascaded it lands in a level below, at the latest in level 0 where it
+ * fires on its exact tick.
+ */
+
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+
+/**
+ * ms on a clock that does not jump with the time of day
+ */
+uint64_t timer_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+timer_wheel_t* timer_createWheel(void){
+	timer_wheel_t* w = (timer_wheel_t*) calloc(1, sizeof(timer_wheel_t));
+	pthread_condattr_t attr;
+
+	assert(w);
+	if (pthread_mutex_init(&w->lock, NULL) != 0){
+		perror("Lock init error");
+		exit(1);
+	}
+
+	/*
+	 * the thread sleeps until a tick of timer_now
+	 */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (pthread_cond_init(&w->cond, &attr) != 0){
+		perror("Timer cond init error");
+		exit(1);
+	}
+	pthread_condattr_destroy(&attr);
+
+	w->clock = timer_now();
+	w->wake = TIMER_NEVER;
+
+	return w;
+}
+
+void timer_init(timer_entry_t* t, timer_fn_t fn, void* arg, uintptr_t data){
+	memset(t, 0, sizeof(timer_entry_t));
+	t->fn = fn;
+	t->arg = arg;
+	t->data = data;
+}
+
+/**
+ * NOT Threadsafe, caller holds w->lock
+ */
+static void timer_unlink(timer_entry_t* t){
+	*t->pprev = t->next;
+	if (t->next) {
+		t->next->pprev = t->pprev;
+	}
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+/**
+ * put t in the slot covering its expiry. An expiry already behind the clock
+ * fires on the next tick.
+ * NOT Threadsafe, caller holds w->lock
+ */
+static void timer_add(timer_wheel_t* w, timer_entry_t* t){
+	uint64_t delta = t->expires > w->clock ? t->expires - w->clock : 0;
+	uint64_t expires = w->clock + delta;
+	int level = 0;
+
+	while (level < TIMER_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TIMER_SLOT_BITS))) {
+		level++;
+	}
+
+	timer_entry_t** head = &w->slot[level][(expires >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1)];
+	t->next = *head;
+	if (t->next) {
+		t->next->pprev = &t->next;
+	}
+	*head = t;
+	t->pprev = head;
+}
+
+/**
+ * first tick at or after the clock with work to do: a level 0 slot to run or
+ * a slot above to cascade. Every level is looked at, a slot far up may come
+ * up before a late one below.
+ * NOT Threadsafe, caller holds w->lock
+ */
+static uint64_t timer_next(timer_wheel_t* w){
+	uint64_t next = TIMER_NEVER;
+	int level = 0;
+
+	if (w->stats.pending == 0) {
+		return TIMER_NEVER;
+	}
+
+	for (level = 0; level < TIMER_LEVELS; level++){
+		int shift = level * TIMER_SLOT_BITS;
+		uint64_t step = 1ULL << shift;
+		uint64_t tick = (w->clock + step - 1) & ~(step - 1);
+		int i = 0;
+
+		for (i = 0; i < TIMER_SLOTS && tick < next; i++, tick += step){
+			if (w->slot[level][(tick >> shift) & (TIMER_SLOTS - 1)]) {
+				next = tick;
+				break;
+			}
+		}
+	}
+
+	return next;
+}
+
+/**
+ * run one tick: cascade the slots coming up above, then move the level 0
+ * slot of the tick to the expired list and advance the clock.
+ * NOT Threadsafe, caller holds w->lock, the expired list is empty
+ */
+static void timer_tick(timer_wheel_t* w){
+	uint64_t tick = w->clock;
+	int level = 0;
+
+	for (level = 1; level < TIMER_LEVELS; level++){
+		int shift = level * TIMER_SLOT_BITS;
+		if (tick & ((1ULL << shift) - 1)) {
+			break;
+		}
+
+		timer_entry_t** head = &w->slot[level][(tick >> shift) & (TIMER_SLOTS - 1)];
+		timer_entry_t* t = *head;
+		*head = NULL;
+		while (t) {
+			timer_entry_t* next = t->next;
+			timer_add(w, t);
+			w->stats.cascaded++;
+			t = next;
+		}
+	}
+
+	timer_entry_t** head = &w->slot[0][tick & (TIMER_SLOTS - 1)];
+	w->expired = *head;
+	if (w->expired) {
+		w->expired->pprev = &w->expired;
+	}
+	*head = NULL;
+	w->clock = tick + 1;
+}
+
+/**
+ * run every timer due by now, one at a time with the lock dropped around the
+ * callback: the timer may be re-armed, cancelled or freed meanwhile, so it
+ * is not looked at again once its callback is picked.
+ * NOT Threadsafe, caller holds w->lock
+ * @return tick of the next work, TIMER_NEVER if nothing is pending
+ */
+static uint64_t timer_runLocked(timer_wheel_t* w, uint64_t now){
+	while (1) {
+		timer_entry_t* t = w->expired;
+		if (t) {
+			timer_fn_t fn = t->fn;
+			void* arg = t->arg;
+			uintptr_t data = t->data;
+
+			timer_unlink(t);
+			w->stats.pending--;
+			w->stats.fired++;
+
+			pthread_mutex_unlock(&w->lock);
+			fn(arg, data);
+			pthread_mutex_lock(&w->lock);
+			continue;
+		}
+
+		/*
+		 * the ticks before the next work have nothing to do, skip them
+		 */
+		uint64_t next = timer_next(w);
+		if (next > now) {
+			if (w->clock <= now) {
+				w->clock = now + 1;
+			}
+			return next;
+		}
+		w->clock = next;
+		timer_tick(w);
+	}
+}
+
+/**
+ * arm t to fire delay ms from now, re-arming it if it is pending
+ */
+void timer_schedule(timer_wheel_t* w, timer_entry_t* t, uint64_t delay){
+	if (delay > TIMER_MAX_DELAY) {
+		delay = TIMER_MAX_DELAY;
+	}
+	timer_scheduleAt(w, t, timer_now() + delay);
+}
+
+/**
+ * arm t to fire at tick expires of timer_now, re-arming it if it is pending
+ */
+void timer_scheduleAt(timer_wheel_t* w, timer_entry_t* t, uint64_t expires){
+	pthread_mutex_lock(&w->lock);
+
+	if (t->pprev) {
+		timer_unlink(t);
+	} else {
+		w->stats.pending++;
+	}
+	if (expires > w->clock + TIMER_MAX_DELAY) {
+		expires = w->clock + TIMER_MAX_DELAY;
+	}
+	t->expires = expires;
+	timer_add(w, t);
+	w->stats.scheduled++;
+
+	/*
+	 * wake whoever runs the wheel if it sleeps past the new expiry
+	 */
+	if (expires < w->wake) {
+		if (w->notify) {
+			w->wake = expires;
+			w->notify(w->notify_arg, expires);
+		} else {
+			pthread_cond_signal(&w->cond);
+		}
+	}
+
+	pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * take t off the wheel. Its callback may still run if it was already picked
+ * @return 1 if t was pending
+ */
+int timer_cancel(timer_wheel_t* w, timer_entry_t* t){
+	int pending = 0;
+
+	pthread_mutex_lock(&w->lock);
+	if (t->pprev) {
+		timer_unlink(t);
+		w->stats.pending--;
+		w->stats.cancelled++;
+		pending = 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return pending;
+}
+
+/**
+ * @return 1 if t is armed and its callback has not been picked yet
+ */
+int timer_isPending(timer_wheel_t* w, timer_entry_t* t){
+	pthread_mutex_lock(&w->lock);
+	int pending = t->pprev != NULL;
+	pthread_mutex_unlock(&w->lock);
+
+	return pending;
+}
+
+/**
+ * run every timer due at tick now, for callers driving the wheel themselves.
+ * With a notify hook the next tick is handed to it before the lock is
+ * dropped, so an earlier expiry armed meanwhile is never overwritten.
+ * @return tick of the next work, TIMER_NEVER if nothing is pending
+ */
+uint64_t timer_run(timer_wheel_t* w, uint64_t now){
+	pthread_mutex_lock(&w->lock);
+	uint64_t next = timer_runLocked(w, now);
+	if (w->notify) {
+		w->wake = next;
+		w->notify(w->notify_arg, next);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return next;
+}
+
+/**
+ * hand the wheel to an event loop instead of timer_thread: fn is told the
+ * tick to run it next whenever that moves, the loop then calls timer_run
+ */
+void timer_setNotify(timer_wheel_t* w, timer_notify_fn_t fn, void* arg){
+	pthread_mutex_lock(&w->lock);
+	w->notify = fn;
+	w->notify_arg = arg;
+	w->wake = TIMER_NEVER;
+	pthread_mutex_unlock(&w->lock);
+}
+
+/**
+ * copy out the counters of the wheel
+ */
+void timer_getStats(timer_wheel_t* w, timer_stats_t* stats){
+	pthread_mutex_lock(&w->lock);
+	*stats = w->stats;
+	pthread_mutex_unlock(&w->lock);
+}
+
+void* timer_thread(void* param){
+	assert(param);
+	timer_wheel_t* w = (timer_wheel_t*) param;
+
+	pthread_mutex_lock(&w->lock);
+	while (1) {
+		w->wake = timer_runLocked(w, timer_now());
+
+		if (w->wake == TIMER_NEVER) {
+			pthread_cond_wait(&w->cond, &w->lock);
+		} else {
+			struct timespec ts;
+			ts.tv_sec = w->wake / 1000;
+			ts.tv_nsec = (w->wake % 1000) * 1000000;
+			pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+		}
+		w->wake = TIMER_NEVER;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file timer.h
+ * @author Mohammad Reza Hosseini
+ *
+ * hierarchical timer wheel with millisecond ticks. Every timed event of the
+ * router (ARP retries and expiry, hellos, neighbor dead intervals, LSU
+ * refresh, LSDB aging, dijkstra runs) is a timer embedded in the object it
+ * belongs to, and one thread runs them all: timer_thread, or an event loop
+ * that sleeps on its own descriptors and is told through timer_setNotify
+ * when the next tick with work moves.
+ *
+ * Level 0 has a slot per tick for the next 64 ms, each level above a slot per
+ * 64 slots of the level below; a timer sits in the finest level that covers
+ * its delay and is cascaded down as its slot comes up. Arming, re-arming and
+ * cancelling cost O(1) and the thread sleeps until the next slot with work.
+ *
+ * A callback runs without the wheel lock and the timer is no longer pending
+ * by then, so it may re-arm itself. It may also run after the timer was
+ * re-armed or cancelled (it was already taken off the wheel): callbacks
+ * revalidate under the lock of their object, timer_isPending tells them
+ * whether a newer deadline replaced the one they fire for.
+ */
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define TIMER_LEVELS		4
+#define TIMER_SLOT_BITS		6
+#define TIMER_SLOTS		(1 << TIMER_SLOT_BITS)
+
+///longest delay in ms (about 4.6 hours), longer ones are clamped to it
+#define TIMER_MAX_DELAY		((1ULL << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+///returned by timer_run when nothing is pending
+#define TIMER_NEVER		UINT64_MAX
+
+typedef void (*timer_fn_t)(void* arg, uintptr_t data);
+
+///called under the wheel lock with the tick the wheel wants to run next
+typedef void (*timer_notify_fn_t)(void* arg, uint64_t wake);
+
+typedef struct Timer {
+	struct Timer* next;
+	struct Timer** pprev;			/* link pointing at us, NULL unless pending */
+	uint64_t expires;			/* ms, on the timer_now clock */
+	timer_fn_t fn;
+	void* arg;
+	uintptr_t data;
+} timer_entry_t;
+
+typedef struct Timer_Stats {
+	unsigned long scheduled;		/* arms and re-arms */
+	unsigned long cancelled;		/* pending timers taken off */
+	unsigned long fired;			/* callbacks run */
+	unsigned long cascaded;			/* timers moved down a level */
+	unsigned int pending;			/* armed now */
+} timer_stats_t;
+
+typedef struct Timer_Wheel {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;			/* a timer was armed before wake */
+	uint64_t clock;				/* next tick to run */
+	uint64_t wake;				/* tick the thread sleeps until */
+	timer_entry_t* expired;			/* due timers of the tick being run */
+	timer_entry_t* slot[TIMER_LEVELS][TIMER_SLOTS];
+	timer_stats_t stats;
+	timer_notify_fn_t notify;		/* set when an event loop runs the wheel */
+	void* notify_arg;
+} timer_wheel_t;
+
+uint64_t timer_now(void);
+
+timer_wheel_t* timer_createWheel(void);
+
+void timer_init(timer_entry_t* t, timer_fn_t fn, void* arg, uintptr_t data);
+
+void timer_schedule(timer_wheel_t* w, timer_entry_t* t, uint64_t delay);
+
+void timer_scheduleAt(timer_wheel_t* w, timer_entry_t* t, uint64_t expires);
+
+int timer_cancel(timer_wheel_t* w, timer_entry_t* t);
+
+int timer_isPending(timer_wheel_t* w, timer_entry_t* t);
+
+uint64_t timer_run(timer_wheel_t* w, uint64_t now);
+
+void timer_setNotify(timer_wheel_t* w, timer_notify_fn_t fn, void* arg);
+
+void timer_getStats(timer_wheel_t* w, timer_stats_t* stats);
+
+void* timer_thread(void* param);
+
+#endif
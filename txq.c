@@ -0,0 +1,149 @@
+/**
+ * @file txq.c
+ * @author Mohammad Reza Hosseini
+ *
+ * A queue is flushed with its lock held, so frames of one port leave in the
+ * order they were pushed no matter which thread flushes them.
+ */
+
+#include "txq.h"
+#include "sr_integration.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * receive batches the calling thread is inside of, frames are only held back
+ * while it is non zero
+ */
+static __thread int txq_batch_depth = 0;
+
+
+void txq_init(txq_t* q){
+	memset(q, 0, sizeof(txq_t));
+	if (pthread_mutex_init(&q->lock, NULL) != 0){
+		perror("Lock init error");
+		exit(1);
+	}
+}
+
+/**
+ * hand everything queued to the backend.
+ * NOT Threadsafe, caller holds q->lock
+ */
+static void txq_flushLocked(struct sr_instance* sr, txq_t* q, int port){
+	unsigned int count = q->count;
+	unsigned int i = 0;
+
+	if (count == 0) {
+		return;
+	}
+
+	int sent = sr_integ_low_level_output_batch(sr, q->pkts, q->lens, count, port);
+	if (sent < 0) {
+		sent = 0;
+	}
+
+	int bucket = 0;
+	while ((count >> (bucket + 1)) && bucket < TXQ_HIST_BUCKETS - 1) {
+		bucket++;
+	}
+
+	q->stats.flushes++;
+	q->stats.frames += sent;
+	q->stats.drops += count - sent;
+	q->stats.hist[bucket]++;
+
+	for (i = 0; i < count; i++){
+		pkt_unref(q->pkts[i]);
+		q->pkts[i] = NULL;
+	}
+	q->count = 0;
+}
+
+/**
+ * queue a frame for transmission on port, taking a reference to the buffer.
+ * The buffer must not be written after this call. Outside of a receive batch
+ * the queue is flushed before returning.
+ *
+ * @return len
+ */
+int txq_push(struct sr_instance* sr, txq_t* q, pkt_buf_t* pkt, unsigned int len, int port){
+	pthread_mutex_lock(&q->lock);
+
+	if (q->count == TXQ_SIZE) {
+		/*
+		 * the batch produced more than the queue holds for this port, send
+		 * what we have instead of dropping
+		 */
+		q->stats.overruns++;
+		txq_flushLocked(sr, q, port);
+	}
+
+	q->pkts[q->count] = pkt_ref(pkt);
+	q->lens[q->count] = len;
+	q->count++;
+
+	if (txq_batch_depth == 0) {
+		txq_flushLocked(sr, q, port);
+	}
+
+	pthread_mutex_unlock(&q->lock);
+	return len;
+}
+
+void txq_flush(struct sr_instance* sr, txq_t* q, int port){
+	pthread_mutex_lock(&q->lock);
+	txq_flushLocked(sr, q, port);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * send one frame gathered from iovcnt pieces right away, after whatever is
+ * queued so the port keeps its order. For frames that cannot be queued as
+ * one buffer, e.g. a wrapped frame that needs padding.
+ *
+ * @return the length put on the wire, -1 on failure
+ */
+int txq_sendv(struct sr_instance* sr, txq_t* q, const struct iovec* iov, int iovcnt, int port){
+	pthread_mutex_lock(&q->lock);
+	txq_flushLocked(sr, q, port);
+
+	int len = sr_integ_low_level_outputv(sr, iov, iovcnt, port);
+	q->stats.flushes++;
+	q->stats.hist[0]++;
+	if (len < 0) {
+		q->stats.drops++;
+	} else {
+		q->stats.frames++;
+	}
+
+	pthread_mutex_unlock(&q->lock);
+	return len;
+}
+
+/**
+ * start holding back frames sent by this thread, batches may nest
+ */
+void txq_beginBatch(void){
+	txq_batch_depth++;
+}
+
+/**
+ * @return 1 if the outermost batch of this thread ended and the caller has to
+ * flush the queues, 0 otherwise
+ */
+int txq_endBatch(void){
+	return --txq_batch_depth == 0;
+}
+
+/**
+ * copy the counters of a queue, consistent with each other
+ */
+void txq_getStats(txq_t* q, txq_stats_t* stats){
+	pthread_mutex_lock(&q->lock);
+	*stats = q->stats;
+	pthread_mutex_unlock(&q->lock);
+}
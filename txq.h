@@ -0,0 +1,58 @@
+/**
+ * @file txq.h
+ * @author Mohammad Reza Hosseini
+ *
+ * per interface transmit queues. Frames sent while a receive batch is being
+ * processed are parked on the queue of their output port (by reference, no
+ * copy) and handed to the backend as one vector when the batch ends, so a
+ * burst costs one sendmmsg per port instead of one write per frame. Frames
+ * sent from anywhere else (timers, ARP and PWOSPF threads) are flushed right
+ * away. Each queue has its own lock, ports never contend with each other.
+ */
+#ifndef TXQ_H_
+#define TXQ_H_
+
+#include "sr_base_internal.h"
+#include "packet.h"
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+///frames a port can hold between flushes
+#define TXQ_SIZE		256
+
+///flush size histogram buckets, bucket i counts flushes of 2^i to 2^(i+1)-1 frames
+#define TXQ_HIST_BUCKETS	9
+
+typedef struct Tx_Queue_Stats {
+	unsigned long frames;			/* frames taken by the backend */
+	unsigned long flushes;			/* vectors handed to the backend */
+	unsigned long overruns;			/* pushes that found the queue full */
+	unsigned long drops;			/* frames the backend refused */
+	unsigned long hist[TXQ_HIST_BUCKETS];	/* flushes by number of frames */
+} txq_stats_t;
+
+typedef struct Tx_Queue {
+	pthread_mutex_t lock;
+	unsigned int count;
+	pkt_buf_t* pkts[TXQ_SIZE];
+	unsigned int lens[TXQ_SIZE];		/* wire length, may include padding */
+	txq_stats_t stats;
+} txq_t;
+
+void txq_init(txq_t* q);
+
+int txq_push(struct sr_instance* sr, txq_t* q, pkt_buf_t* pkt, unsigned int len, int port);
+
+void txq_flush(struct sr_instance* sr, txq_t* q, int port);
+
+int txq_sendv(struct sr_instance* sr, txq_t* q, const struct iovec* iov, int iovcnt, int port);
+
+void txq_beginBatch(void);
+
+int txq_endBatch(void);
+
+void txq_getStats(txq_t* q, txq_stats_t* stats);
+
+#endif